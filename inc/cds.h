@@ -23,6 +23,10 @@
 #ifndef __CDS_H
 #define __CDS_H
 
+#include <stdint.h>
+
+#include "arena.h"
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -47,7 +51,9 @@ enum
    CDS_402_ERROR = -402, /* (Invalid Args) */
    CDS_501_ERROR = -501, /* (Action Failed) */
    CDS_701_ERROR = -701, /* (No Such Object) */
+   CDS_708_ERROR = -708, /* (Unsupported or invalid search criteria) */
    CDS_709_ERROR = -709, /* (Unsupported or invalid sort criteria) */
+   CDS_710_ERROR = -710, /* (No such container) */
    CDS_720_ERROR = -720  /* (Cannot process the request) */
 };
 
@@ -66,6 +72,49 @@ int cds_init();
  */
 int cds_reinit();
 
+/*
+ * Set the shortest part of a word that Search looks up in the
+ * trigram indexes, for contains criteria. Shorter parts are
+ * only checked against the items the other words match: a
+ * contains criteria made of shorter parts only fails with 708.
+ *
+ * @param len The length, in bytes. Values below 3 mean 3.
+ * @return CDS_SUCCESS.
+ */
+int cds_set_search_min_length( int len );
+
+/**
+ * What streaming needs to know about a shared file. It is
+ * copied out of the item, so it stays valid even if the item
+ * is removed meanwhile.
+ */
+typedef struct cds_stream_info
+{
+   /* AV_TIME_BASE units, 0 if the item cannot be seeked by time */
+   int64_t duration;
+   int bitrate;
+
+   /* Retained, NULL until the time index has been built */
+   struct timeindex *time_index;
+} cds_stream_info;
+
+/**
+ * Gets the streaming information of the item shared from a 
+ * certain file. It must be given back with cds_release_stream_info.
+ *
+ * @param filename The item file name.
+ * @param info Will receive the streaming information.
+ * @return CDS_SUCCESS, or CDS_701_ERROR if the file is not shared.
+ */
+int cds_get_stream_info( const char *filename, cds_stream_info *info );
+
+/**
+ * Gives back the time index retained by cds_get_stream_info.
+ *
+ * @param info The streaming information.
+ */
+void cds_release_stream_info( cds_stream_info *info );
+
 /**
  * Returns the SCPD description of the CDS service as per
  * the UPnP specifications.
@@ -82,52 +131,106 @@ char *cds_get_scpd();
  * implementation to be aligned to the UPnP formatting
  * style.
  */
+#define CDS_SERVICE_TYPE "urn:schemas-upnp-org:service:ContentDirectory:1"
 #define CDS_GET_SEARCH_CAPS_ACTION "GetSearchCapabilities"
 #define CDS_GET_SORT_CAPS_ACTION "GetSortCapabilities"
 #define CDS_GET_SYSTEM_UPDATE_ID_ACTION "GetSystemUpdateID"
 #define CDS_BROWSE_ACTION "Browse"
+#define CDS_SEARCH_ACTION "Search"
 
 /* Samsung specific actions. */
 #define CDS_SEC_GET_OBJECT_ID_FROM_ID_ACTION "X_GetObjectIDfromIndex"
 
+/**
+ * A piece of a response body. The owner, if not NULL, is the
+ * reference counted buffer of a CDS cache the data lives in.
+ */
+typedef struct cds_response_part
+{
+   const char *data;
+   long length;
+   void *owner;
+} cds_response_part;
+
+/**
+ * An action response, including the envelope, in XML format.
+ * The body is either a static buffer or allocated from the 
+ * request arena: it is never freed by the caller.
+ * When parts is not NULL, the body is made of num_parts pieces
+ * instead, to be sent in order, and length is their total. 
+ * Each response must be given back with cds_release_response
+ * once it has been sent.
+ */
+typedef struct cds_response
+{
+   const char *body;
+   long length;
+
+   cds_response_part *parts;
+   int num_parts;
+} cds_response;
+
+/**
+ * Gives back the cache buffers a response is made of.
+ *
+ * @param response The response, once it has been sent.
+ */
+void cds_release_response( cds_response *response );
+
+/**
+ * Action handler.
+ *
+ * @param soap_action_body The soap action body, including the envelope,
+ *    in XML format. It is parsed in place, so its content is modified.
+ * @param a The arena to allocate from.
+ * @param response The action response.
+ * @return CDS_SUCCESS if successful, or the UPnP error code.
+ */
+typedef int (*cds_action_handler)( char *soap_action_body, arena *a, cds_response *response );
+
 /**
  * GetSearchCapabilities Action.
  *
+ * @param soap_action_body The request body, unused.
+ * @param a The request arena, unused.
  * @param GetSearchCapsResponse The GetSearchCapabilitiesResponse
- *    in XML format. This is a newly allocated buffer
- *    so memory must be freed after calling this function.
+ *    in XML format. It is a static buffer,
+ *    not to be freed.
  * @return CDS_SUCCESS is successful, or the UPnP defined error codes
  *    for the Browse action: 
  *    402 (Invalid Args)
  *    501 (Action Failed)
  */
-int cds_GetSearchCapabilities( char **GetSearchCapabilitiesResponse );
+int cds_GetSearchCapabilities( char *soap_action_body, arena *a, cds_response *GetSearchCapabilitiesResponse );
 
 /**
  * GetSortCapabilities Action.
  *
+ * @param soap_action_body The request body, unused.
+ * @param a The request arena, unused.
  * @param GetSortCapabilitiesResponse The GetSortCapabilitiesResponse
- *    in XML format. This is a newly allocated buffer
- *    so memory must be freed after calling this function.
+ *    in XML format. It is a static buffer,
+ *    not to be freed.
  * @return CDS_SUCCESS is successful, or the UPnP defined error codes
  *    for the Browse action: 
  *    402 (Invalid Args)
  *    501 (Action Failed)
  */
-int cds_GetSortCapabilities( char **GetSearchCapabilitiesResponse );
+int cds_GetSortCapabilities( char *soap_action_body, arena *a, cds_response *GetSortCapabilitiesResponse );
 
 /**
  * GetSystemUpdateID Action.
  *
+ * @param soap_action_body The request body, unused.
+ * @param a The arena the response is allocated from.
  * @param GetSystemUpdateIDResponse The GetSystemUpdateIDResponse
- *    in XML format. This is a newly allocated buffer
- *    so memory must be freed after calling this function.
+ *    in XML format.
  * @return CDS_SUCCESS is successful, or the UPnP defined error codes
  *    for the Browse action: 
  *    402 (Invalid Args)
  *    501 (Action Failed)
  */
-int cds_GetSystemUpdateID( char **GetSystemUpdateIDResponse );
+int cds_GetSystemUpdateID( char *soap_action_body, arena *a, cds_response *GetSystemUpdateIDResponse );
 
 /**
  * Browse Action.
@@ -141,6 +244,8 @@ int cds_GetSystemUpdateID( char **GetSystemUpdateIDResponse );
             </u:Browse>
          </s:Body>
       </s:Envelope>
+ * @param a The arena the request arguments and the response
+ *    are allocated from.
  * @param browse_result The BrowseResponse result body, including the envelope, in 
  *    XML format. E.g.
       <s:Envelope xmlns:s="http://schemas.xmlsoap.org/soap/envelope/" s:encodingStyle="http://schemas.xmlsoap.org/soap/encoding/">
@@ -163,7 +268,31 @@ int cds_GetSystemUpdateID( char **GetSystemUpdateIDResponse );
  *    709 (Unsupported or invalid sort criteria)
  *    720 (Cannot process the request)
  */
-int cds_Browse( char *soap_action_body, char **BrowseResponse );
+int cds_Browse( char *soap_action_body, arena *a, cds_response *BrowseResponse );
+
+/**
+ * Search Action. Only items are searched for, among the
+ * descendants of the container.
+ *
+ * @param soap_action_body The Search request body soap action, including 
+ *    the envelope, in XML format. The arguments are ContainerID, 
+ *    SearchCriteria, Filter, StartingIndex, RequestedCount and 
+ *    SortCriteria.
+ * @param a The arena the request arguments and the response
+ *    are allocated from.
+ * @param SearchResponse The SearchResponse result body, including the 
+ *    envelope, in XML format. It carries the same arguments as the 
+ *    BrowseResponse: Result, NumberReturned, TotalMatches and UpdateID.
+ * @return CDS_SUCCESS is successful, or the UPnP defined error codes
+ *    for the Search action: 
+ *    402 (Invalid Args)
+ *    501 (Action Failed)
+ *    708 (Unsupported or invalid search criteria)
+ *    709 (Unsupported or invalid sort criteria)
+ *    710 (No such container)
+ *    720 (Cannot process the request)
+ */
+int cds_Search( char *soap_action_body, arena *a, cds_response *SearchResponse );
 
 /**
  * X_GetObjectIDfromIndex Action. This I suppose is used by Samsung
@@ -184,6 +313,7 @@ int cds_Browse( char *soap_action_body, char **BrowseResponse );
             </u:X_GetObjectIDfromIndex>
          </s:Body>
       </s:Envelope>
+ * @param a The arena the response is allocated from.
  * @param X_GetObjectIDfromIndexResponse The X_GetObjectIDfromIndexResponse
  *    result body in XML format. This is defined as, eg.
       <s:Envelope xmlns:s="http://schemas.xmlsoap.org/soap/envelope/" s:encodingStyle="http://schemas.xmlsoap.org/soap/encoding/">
@@ -196,18 +326,21 @@ int cds_Browse( char *soap_action_body, char **BrowseResponse );
  * @return CDS_SUCCESS is successful, or 402 otherwise. (Note this is
  *    not documented so we are just guessing a meaningful value).
  */
-int cds_X_GetObjectIDfromIndex( char *soap_action_body, char **X_GetObjectIDfromIndexResponse );
+int cds_X_GetObjectIDfromIndex( char *soap_action_body, arena *a, cds_response *X_GetObjectIDfromIndexResponse );
 
 /**
  * CDS Action dispatcher.
  *
  * @param soap_action The soap action string (the one in the HTTP header)
  * @param soap_action_body The soap action body, including the envelope, in XML format.
+ *    It is parsed in place, so its content is modified.
+ * @param a The arena to allocate from. It is reset by the caller
+ *    once the response has been sent.
  * @action_response The action response, including the envelope, in XML format.
  * @return CDS_SUCCESS if successful, or another value otherwise, depending on the
  *    UPnP error derived during the action processing.
  */
-int cds_dispatch_action( char *soap_action, char *soap_action_body, char **action_response );
+int cds_dispatch_action( char *soap_action, char *soap_action_body, arena *a, cds_response *action_response );
 
 
 DLLEXPORT void cds_test();
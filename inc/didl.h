@@ -24,30 +24,224 @@
 #ifndef __DIDL_H
 #define __DIDL_H
 
+#include <stdint.h>
+#include <time.h>
+
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifdef WIN32
 #define DLLEXPORT __declspec(dllexport)
 #else
 #define DLLEXPORT
 #endif
 
-#define DIDL_NAME = "DIDL-Lite";
-#define DIDL_XMLNS = "xmlns";
-#define DIDL_XMLNS_URL = "urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/";
-#define DIDL_XMLNS_DC = "xmlns:dc";
-#define DIDL_XMLNS_DC_URL = "http://purl.org/dc/elements/1.1/";
-#define DIDL_XMLNS_UPNP = "xmlns:upnp";
-#define DIDL_XMLNS_UPNP_URL = "urn:schemas-upnp-org:metadata-1-0/upnp/";
+/*
+ * DIDL-Lite writer. Browse results carry the DIDL-Lite document
+ * as the text of the <Result> element, so the document is XML
+ * escaped once as a document and once more as element text. The
+ * writer produces that form directly, in a single pass over the
+ * objects and into one buffer that grows as needed: no tree is
+ * built and no intermediate copy of the document is made.
+ *
+ * Markup is written as literals that are already escaped for
+ * <Result> (the DIDL_* strings below), values are escaped twice
+ * on the fly.
+ */
+
+/* Error codes */
+enum
+{
+   DIDL_SUCCESS = 0,
+   DIDL_ERROR = -1
+};
+
+/*
+ * DIDL-Lite document start and end, escaped for <Result>.
+ */
+#define DIDL_HEADER \
+   "&lt;DIDL-Lite xmlns=&quot;urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/&quot; " \
+   "xmlns:dc=&quot;http://purl.org/dc/elements/1.1/&quot; " \
+   "xmlns:upnp=&quot;urn:schemas-upnp-org:metadata-1-0/upnp/&quot; " \
+   "xmlns:dlna=&quot;urn:schemas-dlna-org:metadata-1-0/&quot;&gt;"
+#define DIDL_FOOTER "&lt;/DIDL-Lite&gt;"
+
+/* ID of the root container, and parent ID of the root. */
+#define DIDL_ROOT_ID "0"
+#define DIDL_ROOT_PARENT_ID "-1"
+
+#define DIDL_OBJECT_CONTAINER "object.container"
+#define DIDL_OBJECT_ITEM "object.item"
+
+/*
+ * Optional properties, as selected by the Browse Filter
+ * argument. The id, parentID and restricted attributes,
+ * dc:title and upnp:class are always written.
+ */
+enum
+{
+   DIDL_PROP_CHILD_COUNT       = 1<<0,   /* @childCount */
+   DIDL_PROP_SEARCHABLE        = 1<<1,   /* @searchable */
+   DIDL_PROP_ARTIST            = 1<<2,   /* upnp:artist */
+   DIDL_PROP_CREATOR           = 1<<3,   /* dc:creator */
+   DIDL_PROP_ALBUM             = 1<<4,   /* upnp:album */
+   DIDL_PROP_GENRE             = 1<<5,   /* upnp:genre */
+   DIDL_PROP_DESCRIPTION       = 1<<6,   /* dc:description */
+   DIDL_PROP_TRACK_NUMBER      = 1<<7,   /* upnp:originalTrackNumber */
+   DIDL_PROP_RES               = 1<<8,   /* res, with its protocolInfo */
+   DIDL_PROP_RES_SIZE          = 1<<9,   /* res@size */
+   DIDL_PROP_RES_DURATION      = 1<<10,  /* res@duration */
+   DIDL_PROP_RES_BITRATE       = 1<<11,  /* res@bitrate */
+   DIDL_PROP_RES_SAMPLE_FREQ   = 1<<12,  /* res@sampleFrequency */
+   DIDL_PROP_RES_CHANNELS      = 1<<13,  /* res@nrAudioChannels */
+   DIDL_PROP_RES_RESOLUTION    = 1<<14,  /* res@resolution */
+   DIDL_PROP_DATE              = 1<<15,  /* dc:date */
+
+   DIDL_PROP_ALL               = 0xffff  /* Filter "*" */
+};
+
+/**
+ * The output buffer. It is allocated from an arena,
+ * and is not zero terminated.
+ */
+typedef struct didl_writer
+{
+   arena *a;
+   char *buf;
+   long length;
+   long size;
+
+   /* The DIDL_PROP_* properties to write. */
+   unsigned int filter;
+
+   /* Set when running out of memory, nothing is written from then on. */
+   int error;
+} didl_writer;
+
+/**
+ * Parses a Browse Filter argument: a comma separated list of
+ * property names, or "*" for all of them. Properties that
+ * are never written are ignored.
+ *
+ * @param filter The Filter argument.
+ * @return The DIDL_PROP_* properties to write.
+ */
+unsigned int didl_parse_filter( const char *filter );
+
+/**
+ * Initializes a writer. All of the properties are
+ * written until the filter is set.
+ *
+ * @param w The writer.
+ * @param a The arena the output is allocated from.
+ * @param size_hint The expected size of the output. The
+ *    buffer grows past it if needed.
+ * @return DIDL_SUCCESS or DIDL_ERROR if out of memory.
+ */
+int didl_writer_init( didl_writer *w, arena *a, long size_hint );
+
+/**
+ * Appends bytes as they are, they must be already 
+ * escaped.
+ *
+ * @param w The writer.
+ * @param s The bytes to append.
+ * @param len The number of bytes.
+ */
+void didl_write( didl_writer *w, const char *s, long len );
+
+/**
+ * Appends a string literal as it is.
+ */
+#define didl_write_literal( w, lit ) didl_write( (w), (lit), (long)sizeof(lit)-1 )
 
-#define DIDL_CONTAINER = "container";
-#define DIDL_ID = "id";
-#define DIDL_SEARCHABLE = "searchable";
-#define DIDL_PARENTID = "parentID";
-#define DIDL_RESTICTED = "restricted";
-	
-#define DIDL_OBJECT_CONTAINER = "object.container";
+/**
+ * Appends a value, escaping it twice: as DIDL-Lite 
+ * content and then as <Result> content. Control 
+ * characters not allowed in XML are dropped.
+ *
+ * @param w The writer.
+ * @param s The value.
+ * @param len The length of the value.
+ */
+void didl_write_escaped( didl_writer *w, const char *s, long len );
 
-#define DIDL_RES = "res";
-#define DIDL_RES_PROTOCOLINFO = "protocolInfo";
+/**
+ * Appends a zero terminated value, escaping it twice.
+ *
+ * @param w The writer.
+ * @param s The value.
+ */
+void didl_write_text( didl_writer *w, const char *s );
 
+/**
+ * Appends an integer in decimal notation.
+ *
+ * @param w The writer.
+ * @param n The integer.
+ */
+void didl_write_int( didl_writer *w, int64_t n );
+
+/**
+ * Appends a container element.
+ *
+ * @param w The writer.
+ * @param id The container ID.
+ * @param parent_id The parent container ID.
+ * @param child_count The number of direct children.
+ * @param title The display name.
+ */
+void didl_write_container( didl_writer *w, const char *id, const char *parent_id,
+                           int child_count, const char *title );
+
+/**
+ * Gets the title of an item: the track title if known,
+ * or else the file name without path and extension.
+ *
+ * @param item The item.
+ * @param len Receives the title length.
+ * @return The title, not zero terminated.
+ */
+const char *didl_item_title( struct item_info *item, long *len );
 
-#endif __DIDL_H
\ No newline at end of file
+/* Buffer sizes for didl_format_date and didl_item_protocol_info. */
+#define DIDL_DATE_SIZE 16
+#define DIDL_PROTOCOL_INFO_SIZE 256
+
+/**
+ * Formats a dc:date value: an ISO 8601 date in UTC.
+ *
+ * @param date The time.
+ * @param buf Receives the date, DIDL_DATE_SIZE bytes at most.
+ * @return The date length.
+ */
+long didl_format_date( time_t date, char *buf );
+
+/**
+ * Formats the protocolInfo of the resource of an item.
+ *
+ * @param item The item.
+ * @param buf Receives the protocolInfo, DIDL_PROTOCOL_INFO_SIZE 
+ *    bytes at most.
+ * @return The protocolInfo length.
+ */
+long didl_item_protocol_info( struct item_info *item, char *buf );
+
+/**
+ * Appends an item element, with its resource.
+ *
+ * @param w The writer.
+ * @param item The item.
+ * @param parent_id The parent container ID.
+ */
+void didl_write_item( didl_writer *w, struct item_info *item, const char *parent_id );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -39,6 +39,7 @@ enum
    HTTPD_400_ERROR = -400,
    HTTPD_402_ERROR = -402,
    HTTPD_404_ERROR = -404,
+   HTTPD_406_ERROR = -406,
    HTTPD_416_ERROR = -416,
    HTTPD_500_ERROR = -500,
    HTTPD_501_ERROR = -501,
@@ -73,6 +74,14 @@ typedef struct httpd_init_param
    /* The "/" location. */
    char *doc_root;
 
+   /* 
+    * Size of the worker pool running the requests, and
+    * maximum number of requests queued or running. 
+    * Zero means default.
+    */
+   int num_workers;
+   int queue_depth;
+
    /* Callbacks */
    connection_manager_cb conn_mgr_cb;
    content_directory_cb cont_dir_cb;
@@ -118,6 +127,19 @@ char *httpd_get_version();
  */
 char *httpd_get_root_name();
 
+/**
+ * @return The path of the "/" location, terminated with a '/'.
+ */
+char *httpd_get_doc_root();
+
+/**
+ * Guesses the MIME type of a file from its extension.
+ *
+ * @param filename The file name.
+ * @return The MIME type string.
+ */
+char *httpd_guess_mime_type( const char *filename );
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,186 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef __HTTPPARSER_H
+#define __HTTPPARSER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * DLNA Requirement [7.4.47.1]: HTTP Client and 
+ * Server Endpoints must use a total HTTP 
+ * header size that is less than or equal to 
+ * 8192 bytes (8 KB) when sending an HTTP 
+ * request or HTTP response.
+ */
+#define HTTP_HEADERS_MAX_SIZE 8192
+
+/**
+ * Upper limit to the size of a request body.
+ * SOAP actions are a few hundred bytes long,
+ * anything bigger than this is rejected.
+ */
+#define HTTP_BODY_MAX_SIZE 65536
+
+/* http_parser_execute return codes */
+enum
+{
+   HTTP_PARSER_DONE = 1,
+   HTTP_PARSER_AGAIN = 0,
+   HTTP_PARSER_ERROR = -1
+};
+
+/**
+ * Headers the parser keeps track of. Any other 
+ * header is skipped.
+ */
+typedef enum
+{
+   HTTP_HEADER_CONNECTION,
+   HTTP_HEADER_CONTENT_LENGTH,
+   HTTP_HEADER_TRANSFER_ENCODING,
+   HTTP_HEADER_USER_AGENT,
+   HTTP_HEADER_SOAPACTION,
+   HTTP_HEADER_RANGE,
+
+   /* DLNA headers */
+   HTTP_HEADER_GETCONTENTFEATURES,
+   HTTP_HEADER_TIMESEEKRANGE,
+   HTTP_HEADER_FRIENDLYNAME,
+   HTTP_HEADER_TRANSFERMODE,
+
+   /* Samsung headers */
+   HTTP_HEADER_GETMEDIAINFO_SEC,
+   HTTP_HEADER_GETCAPTIONINFO_SEC,
+
+   HTTP_HEADER_MAX
+} HTTP_HEADER;
+
+/**
+ * A piece of the request buffer. Offsets are used rather
+ * than pointers, as the buffer may move while it grows.
+ * A slice with a negative offset is empty - e.g. a header
+ * that was not received.
+ */
+typedef struct http_slice
+{
+   long offset;
+   long len;
+} http_slice;
+
+/**
+ * Returns a pointer to the first character of a slice.
+ * Once a request has been parsed, slices are zero 
+ * terminated in the buffer and can be used as strings.
+ */
+#define http_slice_ptr( buf, slice ) ((char *)(buf) + (slice).offset)
+
+/* Whether a slice is set. */
+#define http_slice_empty( slice ) ((slice).offset < 0)
+
+/**
+ * A resumable request parser.
+ *
+ * The parser works on a buffer the caller fills up as data 
+ * arrives, and only looks at the bytes received since the 
+ * previous call. It never allocates memory nor copies
+ * anything out of the buffer: the request line, the headers
+ * and the body are all described as slices of the buffer. 
+ * Chunked bodies are decoded in place, as the chunks arrive.
+ *
+ * Requests start at the beginning of the buffer. Once a request 
+ * has been dealt with, http_parser_consume removes it from the 
+ * buffer, and whatever follows - e.g. a pipelined request - 
+ * is parsed next.
+ */
+typedef struct http_parser
+{
+   int state;
+
+   /* Bytes of the buffer used up so far. */
+   long pos;
+
+   /* 
+    * How far the current line has been searched for its end,
+    * and where its first ':' is (-1 if not found yet).
+    */
+   long scan;
+   long colon;
+
+   /* Request line */
+   http_slice method;
+   http_slice uri;
+   http_slice version;
+
+   /* Known headers values, with surrounding whitespace trimmed. */
+   http_slice headers[HTTP_HEADER_MAX];
+
+   /* Body, either delimited by Content-Length or chunked. */
+   int chunked;
+   long content_length;
+   long chunk_left;
+   http_slice body;
+
+   /* The byte after the body, overwritten by its terminating zero. */
+   unsigned char saved;
+} http_parser;
+
+/**
+ * Gets a parser ready for a new request.
+ *
+ * @param p The parser.
+ */
+void http_parser_init( http_parser *p );
+
+/**
+ * Parses the bytes added to the buffer since the last call.
+ * Once the request is complete, the request line, headers 
+ * and body slices are zero terminated in the buffer.
+ *
+ * @param p The parser.
+ * @param buf The buffer, with the request at its beginning.
+ * @param len The number of bytes in the buffer.
+ * @return HTTP_PARSER_DONE if the request is complete,
+ *    HTTP_PARSER_AGAIN if more data is needed, or 
+ *    HTTP_PARSER_ERROR if the request is malformed or
+ *    too large.
+ */
+int http_parser_execute( http_parser *p, unsigned char *buf, long len );
+
+/**
+ * Removes a complete request from the beginning of the buffer
+ * and gets the parser ready for the next one.
+ *
+ * @param p The parser.
+ * @param buf The buffer.
+ * @param len The number of bytes in the buffer, updated
+ *    to what is left after the request.
+ */
+void http_parser_consume( http_parser *p, unsigned char *buf, long *len );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __REACTOR_H
+#define __REACTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WIN32
+#  include <winsock2.h>
+#  define reactor_fd SOCKET
+#else
+#  define reactor_fd int
+#endif
+
+/* Error codes */
+enum
+{
+   REACTOR_SUCCESS = 0,
+   REACTOR_ERROR = -1
+};
+
+/* Events a descriptor can be watched for. */
+enum
+{
+   REACTOR_READ = 1<<0,
+   REACTOR_WRITE = 1<<1,
+
+   /*
+    * Only reported, never requested: the peer hung
+    * up or the descriptor is in an error state.
+    */
+   REACTOR_HANGUP = 1<<2
+};
+
+/**
+ * An event returned by reactor_wait.
+ */
+typedef struct reactor_event
+{
+   int events;    /* REACTOR_READ | REACTOR_WRITE | REACTOR_HANGUP */
+   void *data;    /* The pointer given to reactor_add */
+} reactor_event;
+
+/**
+ * Opaque reactor handle.
+ * Under Linux this is backed by epoll, elsewhere
+ * by select().
+ */
+typedef struct reactor reactor;
+
+/**
+ * Creates a new reactor.
+ *
+ * @return The new reactor, or NULL if it could not be created.
+ */
+reactor *reactor_create();
+
+/**
+ * Destroys a reactor. Descriptors that are still being
+ * watched are NOT closed.
+ *
+ * @param r The reactor to destroy.
+ */
+void reactor_destroy( reactor *r );
+
+/**
+ * Starts watching a descriptor.
+ *
+ * @param r The reactor.
+ * @param fd The descriptor to watch. It should be non-blocking.
+ * @param events A combination of REACTOR_READ and REACTOR_WRITE.
+ * @param data A pointer that will be returned with each event.
+ * @return REACTOR_SUCCESS or REACTOR_ERROR.
+ */
+int reactor_add( reactor *r, reactor_fd fd, int events, void *data );
+
+/**
+ * Changes the set of events a descriptor is watched for.
+ * Passing 0 as events keeps the descriptor registered
+ * but no events will be reported for it.
+ *
+ * @param r The reactor.
+ * @param fd A descriptor previously passed to reactor_add.
+ * @param events A combination of REACTOR_READ and REACTOR_WRITE.
+ * @param data A pointer that will be returned with each event.
+ * @return REACTOR_SUCCESS or REACTOR_ERROR.
+ */
+int reactor_modify( reactor *r, reactor_fd fd, int events, void *data );
+
+/**
+ * Stops watching a descriptor.
+ * Must be called before the descriptor is closed.
+ *
+ * @param r The reactor.
+ * @param fd A descriptor previously passed to reactor_add.
+ * @return REACTOR_SUCCESS or REACTOR_ERROR.
+ */
+int reactor_remove( reactor *r, reactor_fd fd );
+
+/**
+ * Waits for events on the watched descriptors.
+ *
+ * @param r The reactor.
+ * @param events An array that will receive the events.
+ * @param max_events The size of the events array.
+ * @param timeout_ms The maximum time to wait, in milliseconds.
+ *    -1 waits forever.
+ * @return The number of events stored in the array (0 on timeout),
+ *    or REACTOR_ERROR.
+ */
+int reactor_wait( reactor *r, reactor_event *events, int max_events, int timeout_ms );
+
+/**
+ * Makes a thread blocked in reactor_wait return as soon
+ * as possible. Can be called from any thread.
+ *
+ * @param r The reactor.
+ * @return REACTOR_SUCCESS or REACTOR_ERROR.
+ */
+int reactor_wakeup( reactor *r );
+
+/**
+ * Puts a socket in non-blocking mode.
+ *
+ * @param fd The socket.
+ * @return REACTOR_SUCCESS or REACTOR_ERROR.
+ */
+int reactor_set_nonblocking( reactor_fd fd );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
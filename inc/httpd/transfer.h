@@ -0,0 +1,126 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __TRANSFER_H
+#define __TRANSFER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#ifdef WIN32
+#  include <winsock2.h>
+#  define transfer_socket SOCKET
+#else
+#  define transfer_socket int
+#endif
+
+/* transfer_send return codes */
+enum
+{
+   TRANSFER_DONE = 0,
+   TRANSFER_AGAIN = 1,
+   TRANSFER_ERROR = -1
+};
+
+/**
+ * A file transfer to a non-blocking socket: the response
+ * headers followed by a range of the file.
+ *
+ * Under Linux the file data is moved with sendfile(), so it never
+ * goes through user space. Elsewhere, or when the file system does
+ * not support it, the file is read with pread() and the headers
+ * and the data are sent together with a single gathering write.
+ */
+typedef struct transfer
+{
+   /* Response headers, sent before the file data. */
+   char *head;
+   long head_len;
+   long head_sent;
+
+   /* The file and the range still to be sent. */
+   int fd;
+   int64_t offset;
+   int64_t remaining;
+   int use_sendfile;
+
+   /* Bounce buffer, only used by the fallback path. */
+   char *buf;
+   long buf_len;
+   long buf_sent;
+} transfer;
+
+/**
+ * Opens a file for transfer. The whole file is selected
+ * for sending until transfer_set_range is called.
+ *
+ * @param filename The file to send.
+ * @param size Will receive the file size.
+ * @return The new transfer, or NULL if the file cannot be
+ *    opened or is not a regular file.
+ */
+transfer *transfer_open( const char *filename, int64_t *size );
+
+/**
+ * Selects the part of the file to send.
+ *
+ * @param t The transfer.
+ * @param offset The first byte to send.
+ * @param length The number of bytes to send.
+ */
+void transfer_set_range( transfer *t, int64_t offset, int64_t length );
+
+/**
+ * Sets the response headers sent before the file data.
+ *
+ * @param t The transfer.
+ * @param head The headers, zero terminated. They are copied.
+ * @return TRANSFER_DONE, or TRANSFER_ERROR if out of memory.
+ */
+int transfer_set_head( transfer *t, const char *head );
+
+/**
+ * Sends as much as possible without blocking. To be called
+ * again each time the socket becomes writable, until it
+ * returns TRANSFER_DONE or TRANSFER_ERROR.
+ *
+ * @param t The transfer.
+ * @param sock The non-blocking client socket.
+ * @return TRANSFER_DONE when everything has been sent,
+ *    TRANSFER_AGAIN if the socket is full, or TRANSFER_ERROR.
+ */
+int transfer_send( transfer *t, transfer_socket sock );
+
+/**
+ * Closes the file and frees up the transfer.
+ *
+ * @param t The transfer.
+ */
+void transfer_free( transfer *t );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef __INDEXER_H
+#define __INDEXER_H
+
+#include "item.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Error codes */
+enum
+{
+   INDEXER_SUCCESS = 0,
+   INDEXER_ERROR = -1
+};
+
+/**
+ * Starts the background indexer. The indexer scans MPEG-1/2
+ * program and transport streams for their keyframes, and builds
+ * the time index used to answer TimeSeekRange.dlna.org requests.
+ *
+ * @param metadata_path The directory where index files are kept.
+ * @return INDEXER_SUCCESS or INDEXER_ERROR.
+ */
+int indexer_start( const char *metadata_path );
+
+/**
+ * Stops the background indexer. Items being indexed are left
+ * with a partial index, and will be scanned again next time.
+ */
+void indexer_stop();
+
+/**
+ * Queues an item for indexing. This never blocks: the item gets
+ * an empty time index right away, which fills up while the item
+ * is scanned, or is loaded from the metadata directory if the
+ * item was indexed before. Items that already have a time index,
+ * and items that are not video, are ignored.
+ *
+ * @param item The item to index.
+ * @return INDEXER_SUCCESS, or INDEXER_ERROR if the indexer
+ *    is not running or out of memory.
+ */
+int indexer_submit( item_info *item );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -37,10 +37,13 @@ extern "C" {
 #define inline _inline
 #endif
 
+#include <time.h>
+
 #include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
 
 #include "profiles.h"
+#include "timeindex.h"
 
 /** UPnP item type */
 typedef enum 
@@ -123,6 +126,9 @@ typedef struct item_info {
 	char *filename;
    char *filepath;
 
+   /* Last modification time of the file (dc:date), 0 if unknown */
+   time_t date;
+
    /* Resource encoding ("res@") properties */
    int64_t size;
    int64_t duration;
@@ -141,6 +147,9 @@ typedef struct item_info {
    int audio_stream_idx;
    int video_stream_idx;
 
+   /* Time to byte index, NULL until it has been built. */
+   timeindex *time_index;
+
    /** Validation function */
    item_validation_func validate;
 
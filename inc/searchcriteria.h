@@ -0,0 +1,114 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef __SEARCHCRITERIA_H
+#define __SEARCHCRITERIA_H
+
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+   ContentDirectory:1 [2.5.5]: search criteria syntax.
+   - searchCrit = searchExp | asterisk
+   - searchExp = relExp | searchExp wChar+ logOp wChar+ searchExp
+               | "(" wChar* searchExp wChar* ")"
+   - logOp = "and" | "or"
+   - relExp = property wChar+ binOp wChar+ quotedVal
+            | property wChar+ existsOp wChar+ boolVal
+   - binOp = relOp | stringOp
+   - relOp = "=" | "!=" | "<" | "<=" | ">" | ">="
+   - stringOp = "contains" | "doesNotContain" | "derivedfrom"
+   - existsOp = "exists"
+   - boolVal = "true" | "false"
+   - quotedVal = dQuote escapedQuote dQuote, with '"' and '\'
+     escaped by a '\'
+
+   "and" binds tighter than "or".
+
+   Examples:
+   - upnp:class derivedfrom "object.item.audioItem" and dc:title contains "love"
+   - (upnp:artist = "Miles Davis" or upnp:genre = "Jazz") and dc:date exists true
+*/
+
+/* Error codes */
+enum
+{
+   SEARCH_SUCCESS = 0,
+   SEARCH_ERROR = -1
+};
+
+typedef enum
+{
+   SEARCH_ALL,                /* "*" */
+   SEARCH_AND,
+   SEARCH_OR,
+   SEARCH_EQUAL,              /* = */
+   SEARCH_NOT_EQUAL,          /* != */
+   SEARCH_LESS,               /* < */
+   SEARCH_LESS_EQUAL,         /* <= */
+   SEARCH_GREATER,            /* > */
+   SEARCH_GREATER_EQUAL,      /* >= */
+   SEARCH_CONTAINS,
+   SEARCH_DOES_NOT_CONTAIN,
+   SEARCH_DERIVED_FROM,
+   SEARCH_EXISTS
+} SEARCH_OP;
+
+/**
+ * A node of a parsed search criteria.
+ */
+typedef struct search_expr search_expr;
+struct search_expr
+{
+   SEARCH_OP op;
+
+   /* op == SEARCH_AND or SEARCH_OR */
+   search_expr *left;
+   search_expr *right;
+
+   /* Relational expressions */
+   char *property;   /* E.g. "dc:title" */
+   char *value;      /* Unquoted and unescaped. "true" or "false" for SEARCH_EXISTS */
+};
+
+/**
+ * Parses a search criteria. Property names and values are
+ * zero terminated and unescaped in place, so the criteria
+ * is modified and must outlive the expression.
+ *
+ * @param criteria The SearchCriteria argument. An empty 
+ *    criteria is the same as "*".
+ * @param a The arena the expression nodes are allocated from.
+ * @param expr Receives the expression.
+ * @return SEARCH_SUCCESS, or SEARCH_ERROR if the criteria is 
+ *    invalid or if out of memory.
+ */
+int search_parse( char *criteria, arena *a, search_expr **expr );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef __TEXTINDEX_H
+#define __TEXTINDEX_H
+
+#include <stdint.h>
+
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Inverted word index. Texts are split into words, runs of 
+ * ASCII letters and digits and of non-ASCII bytes, so that 
+ * UTF-8 words stay whole. Words are case folded (ASCII only).
+ * Each word maps onto the sorted list of the ids of the texts
+ * holding it. So does each trigram, three bytes in a row of
+ * a word, for substring lookups. The trigram lists are bounded:
+ * past a number of ids, the longest lists are dropped, and their
+ * trigrams no longer narrow lookups down.
+ *
+ * The index answers which texts may match a query: lookups 
+ * return candidates, that the caller verifies against the 
+ * texts themselves.
+ *
+ * An index is not thread safe: callers serialize its use.
+ */
+
+/* Error codes */
+enum
+{
+   TEXTINDEX_SUCCESS = 0,
+   TEXTINDEX_ERROR = -1,
+
+   /* No word of the query narrows anything down. */
+   TEXTINDEX_NO_WORDS = 1,
+
+   /* Every word of a substring query is too short to be looked up. */
+   TEXTINDEX_TOO_SHORT = 2
+};
+
+/* Lookup modes */
+enum
+{
+   TEXTINDEX_WORDS,        /* Every query word is a word of the text */
+   TEXTINDEX_SUBSTRING     /* Every query word is part of a word of the text.
+                              Shorter words than the minimum substring 
+                              length are ignored, and a query made of 
+                              them only is refused. */
+};
+
+typedef struct textindex textindex;
+
+/**
+ * A set of ids, in increasing order.
+ */
+typedef struct textindex_set
+{
+   uint32_t *ids;
+   int count;
+} textindex_set;
+
+/**
+ * Creates a new, empty, index.
+ *
+ * @return The index, or NULL if out of memory.
+ */
+textindex *textindex_create();
+
+/**
+ * Frees up an index.
+ *
+ * @param index The index. Can be NULL.
+ */
+void textindex_free( textindex *index );
+
+/**
+ * Sets the limits of the substring lookups.
+ *
+ * @param index The index.
+ * @param min_substring The shortest query word that narrows 
+ *    substring lookups down. It is 3 at least, and by default.
+ * @param max_postings How many ids the trigram lists can hold in
+ *    all, 4M (16MB) by default. Unchanged if not positive.
+ */
+void textindex_set_limits( textindex *index, int min_substring, long max_postings );
+
+/**
+ * Adds the words of a text to the index. Adding texts in 
+ * increasing id order is the cheapest.
+ *
+ * @param index The index.
+ * @param text The text.
+ * @param len The text length.
+ * @param id The text id.
+ * @return TEXTINDEX_SUCCESS, or TEXTINDEX_ERROR if out of memory.
+ *    The text may then be partially indexed.
+ */
+int textindex_add( textindex *index, const char *text, long len, uint32_t id );
+
+/**
+ * Removes the words of a text from the index.
+ *
+ * @param index The index.
+ * @param text The text, as it was added.
+ * @param len The text length.
+ * @param id The text id.
+ */
+void textindex_remove( textindex *index, const char *text, long len, uint32_t id );
+
+/**
+ * Finds the texts that may match a query.
+ *
+ * @param index The index.
+ * @param query The query.
+ * @param mode TEXTINDEX_WORDS or TEXTINDEX_SUBSTRING.
+ * @param a The arena the set is allocated from.
+ * @param set Receives the ids of the candidate texts.
+ * @return TEXTINDEX_SUCCESS, TEXTINDEX_NO_WORDS if no word of
+ *    the query narrows the lookup down, in which case any text 
+ *    is a candidate, TEXTINDEX_TOO_SHORT if every word of a
+ *    substring query is shorter than the minimum substring 
+ *    length, in which case nothing was looked up, or 
+ *    TEXTINDEX_ERROR if out of memory.
+ */
+int textindex_find( textindex *index, const char *query, int mode, arena *a, textindex_set *set );
+
+/**
+ * Intersects two sets.
+ *
+ * @param x A set.
+ * @param y Another set.
+ * @param a The arena the result is allocated from.
+ * @param result Receives the ids in both sets.
+ * @return TEXTINDEX_SUCCESS, or TEXTINDEX_ERROR if out of memory.
+ */
+int textindex_and( const textindex_set *x, const textindex_set *y, arena *a, textindex_set *result );
+
+/**
+ * Merges two sets.
+ *
+ * @param x A set.
+ * @param y Another set.
+ * @param a The arena the result is allocated from.
+ * @param result Receives the ids in either set.
+ * @return TEXTINDEX_SUCCESS, or TEXTINDEX_ERROR if out of memory.
+ */
+int textindex_or( const textindex_set *x, const textindex_set *y, arena *a, textindex_set *result );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef __TIMEINDEX_H
+#define __TIMEINDEX_H
+
+#include <stdint.h>
+
+#include "pthread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Error codes */
+enum
+{
+   TIMEINDEX_SUCCESS = 0,
+   TIMEINDEX_ERROR = -1
+};
+
+/**
+ * A point where playback can start from: the presentation 
+ * time and the byte offset of the packet carrying it.
+ * Only keyframes (GOP starts) are entry points, so there
+ * is no need to store a keyframe flag with each entry.
+ */
+typedef struct timeindex_entry
+{
+   int64_t time;     /* Milliseconds from the start of the item */
+   int64_t offset;   /* Byte offset in the file */
+} timeindex_entry;
+
+/**
+ * Time to byte index of an item, used to answer 
+ * TimeSeekRange.dlna.org requests. Entries are kept 
+ * sorted by time, and offsets never go backwards.
+ *
+ * An index can be looked up while it is still being built
+ * by the indexer: the part not indexed yet is interpolated.
+ * It is reference counted, as the indexer may still be 
+ * working on it when the item it belongs to is freed.
+ */
+typedef struct timeindex
+{
+   pthread_mutex_t lock;
+   volatile long refs;
+
+   /* Set once the whole item has been indexed. */
+   int complete;
+
+   int num_entries;
+   int max_entries;
+   timeindex_entry *entries;
+} timeindex;
+
+/**
+ * Creates a new, empty, time index with a reference count of 1.
+ *
+ * @return The new index, or NULL if out of memory.
+ */
+timeindex *timeindex_create();
+
+/**
+ * Takes a reference to a time index.
+ *
+ * @param idx The index.
+ * @return idx.
+ */
+timeindex *timeindex_retain( timeindex *idx );
+
+/**
+ * Drops a reference to a time index, and frees 
+ * it up when that was the last one.
+ *
+ * @param idx The index to free. Can be NULL.
+ */
+void timeindex_free( timeindex *idx );
+
+/**
+ * Appends an entry to the index. Entries must be added in 
+ * increasing time order, the others are silently dropped.
+ *
+ * @param idx The index.
+ * @param time The entry time, in milliseconds.
+ * @param offset The entry byte offset.
+ * @return TIMEINDEX_SUCCESS, or TIMEINDEX_ERROR if out of memory.
+ */
+int timeindex_add( timeindex *idx, int64_t time, int64_t offset );
+
+/**
+ * Marks the index as complete: from now on entries
+ * are trusted up to the end of the item.
+ *
+ * @param idx The index.
+ */
+void timeindex_set_complete( timeindex *idx );
+
+/**
+ * Finds the last entry at or before a certain time.
+ *
+ * @param idx The index.
+ * @param time The time to look for, in milliseconds.
+ * @param entry Will receive the entry found.
+ * @return 1 if an entry was found, 0 otherwise.
+ */
+int timeindex_lookup( timeindex *idx, int64_t time, timeindex_entry *entry );
+
+/**
+ * Maps a time onto a byte offset. The index is used when 
+ * there is one, otherwise the offset is interpolated from 
+ * the bitrate, or from the size and duration of the item.
+ *
+ * @param idx The item index. Can be NULL.
+ * @param time The time to seek to, in milliseconds.
+ * @param duration The item duration, in milliseconds.
+ * @param size The item size, in bytes.
+ * @param bitrate The item bitrate, in bits per second. Can be 0.
+ * @param end 0 to find where playback starts from, which may be 
+ *    slightly before time. 1 to find where it stops, which may be
+ *    slightly after time.
+ * @param entry Will receive the position found. The offset is the
+ *    item size when an end position falls after the last entry.
+ * @return 1 if successful, 0 if time is past the end of the
+ *    item or nothing is known about its duration.
+ */
+int timeindex_seek( timeindex *idx, int64_t time, 
+                    int64_t duration, int64_t size, int bitrate,
+                    int end, timeindex_entry *entry );
+
+/**
+ * Saves a complete index to a file.
+ *
+ * @param idx The index.
+ * @param filename The index file.
+ * @param size The size of the indexed item, stored
+ *    to detect stale index files.
+ * @return TIMEINDEX_SUCCESS or TIMEINDEX_ERROR.
+ */
+int timeindex_save( timeindex *idx, const char *filename, int64_t size );
+
+/**
+ * Loads an index saved with timeindex_save into an empty 
+ * index, and marks it as complete.
+ *
+ * @param idx The index.
+ * @param filename The index file.
+ * @param size The current size of the item. Files saved 
+ *    for a different size are ignored.
+ * @return TIMEINDEX_SUCCESS, or TIMEINDEX_ERROR if the file is
+ *    missing, stale or corrupted.
+ */
+int timeindex_load( timeindex *idx, const char *filename, int64_t size );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
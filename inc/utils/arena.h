@@ -0,0 +1,114 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bump pointer allocator. Memory is carved out of a chain of
+ * fixed size blocks and is never freed piecemeal: the whole
+ * arena is reset at once, keeping its blocks for the next
+ * round. Once the blocks needed by the largest request seen
+ * so far are in place, allocating from the arena costs no
+ * more than a pointer increment.
+ *
+ * An arena is not thread safe; it is meant to be owned by
+ * a single request at a time.
+ */
+
+typedef struct arena_block arena_block;
+
+typedef struct arena
+{
+   arena_block *first;    /* Chain of standard blocks */
+   arena_block *current;  /* Block allocations come from */
+   arena_block *large;    /* Oversized allocations, freed on reset */
+   size_t block_size;
+} arena;
+
+/**
+ * Initializes an empty arena. No memory is allocated
+ * until the first call to arena_alloc.
+ *
+ * @param a The arena.
+ * @param block_size The size of each standard block.
+ */
+void arena_init( arena *a, size_t block_size );
+
+/**
+ * Allocates memory from the arena. The memory is suitably
+ * aligned for any type and stays valid until the arena is
+ * reset or destroyed.
+ *
+ * @param a The arena.
+ * @param size The number of bytes.
+ * @return The memory, or NULL if out of memory.
+ */
+void *arena_alloc( arena *a, size_t size );
+
+/**
+ * Copies a string into the arena.
+ *
+ * @param a The arena.
+ * @param s The string.
+ * @return The copy, or NULL if out of memory.
+ */
+char *arena_strdup( arena *a, const char *s );
+
+/**
+ * Copies at most len characters of a string into the 
+ * arena. The copy is always zero terminated.
+ *
+ * @param a The arena.
+ * @param s The string.
+ * @param len The maximum number of characters to copy.
+ * @return The copy, or NULL if out of memory.
+ */
+char *arena_strndup( arena *a, const char *s, size_t len );
+
+/**
+ * Releases everything allocated from the arena at once.
+ * Standard blocks are kept for reuse, oversized ones 
+ * are given back to the system.
+ *
+ * @param a The arena.
+ */
+void arena_reset( arena *a );
+
+/**
+ * Frees all the memory held by the arena.
+ *
+ * @param a The arena.
+ */
+void arena_destroy( arena *a );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __ATOMIC_H
+#define __ATOMIC_H
+
+/*
+ * Minimal set of atomic operations, all of them implying
+ * a full memory barrier. Operands must be naturally aligned.
+ */
+
+#ifdef WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+
+#  define atomic_inc(p)              InterlockedIncrement( (volatile LONG *)(p) )
+#  define atomic_dec(p)              InterlockedDecrement( (volatile LONG *)(p) )
+#  define atomic_add(p, v)           (InterlockedExchangeAdd( (volatile LONG *)(p), (LONG)(v) ) + (LONG)(v))
+#  define atomic_xchg(p, v)          InterlockedExchange( (volatile LONG *)(p), (LONG)(v) )
+#  define atomic_cas(p, o, n)        (InterlockedCompareExchange( (volatile LONG *)(p), (LONG)(n), (LONG)(o) ) == (LONG)(o))
+#  define atomic_xchg_ptr(p, v)      InterlockedExchangePointer( (PVOID volatile *)(p), (PVOID)(v) )
+#  define atomic_cas_ptr(p, o, n)    (InterlockedCompareExchangePointer( (PVOID volatile *)(p), (PVOID)(n), (PVOID)(o) ) == (PVOID)(o))
+#  define atomic_barrier()           MemoryBarrier()
+#else
+#  define atomic_inc(p)              __sync_add_and_fetch( (p), 1 )
+#  define atomic_dec(p)              __sync_sub_and_fetch( (p), 1 )
+#  define atomic_add(p, v)           __sync_add_and_fetch( (p), (v) )
+#  define atomic_xchg(p, v)          __atomic_exchange_n( (p), (v), __ATOMIC_SEQ_CST )
+#  define atomic_cas(p, o, n)        __sync_bool_compare_and_swap( (p), (o), (n) )
+#  define atomic_xchg_ptr(p, v)      __atomic_exchange_n( (p), (v), __ATOMIC_SEQ_CST )
+#  define atomic_cas_ptr(p, o, n)    __sync_bool_compare_and_swap( (p), (o), (n) )
+#  define atomic_barrier()           __sync_synchronize()
+#endif
+
+/* Reads a value with a full barrier before and after. */
+#define atomic_read(p)               atomic_add( (p), 0 )
+
+#endif
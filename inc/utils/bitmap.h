@@ -0,0 +1,175 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __BITMAP_H
+#define __BITMAP_H
+
+#include <stdint.h>
+
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compressed bitmaps of 32 bit integers, in the manner of
+ * Roaring bitmaps. Integers are split in chunks of 65536 by
+ * their high 16 bits. A chunk is stored as a sorted array of
+ * its low 16 bits while it is sparse, and as a plain 65536 bit
+ * set once it has more than 4096 members.
+ *
+ * Bitmaps built with bitmap_add are allocated from the heap and
+ * freed with bitmap_free. The results of the set operations are
+ * allocated from an arena and read only. They may share chunks
+ * with their operands, so they are only valid as long as the
+ * operands are not modified.
+ */
+
+enum
+{
+   BITMAP_SUCCESS = 0,
+   BITMAP_ERROR = -1
+};
+
+typedef struct bitmap_container bitmap_container;
+
+typedef struct bitmap
+{
+   bitmap_container *containers;    /* By increasing high bits */
+   int num_containers;
+   int max_containers;
+} bitmap;
+
+/**
+ * Initializes an empty bitmap.
+ *
+ * @param b The bitmap.
+ */
+void bitmap_init( bitmap *b );
+
+/**
+ * Frees the memory of a bitmap built with bitmap_add. 
+ * The bitmap is left empty.
+ *
+ * @param b The bitmap.
+ */
+void bitmap_free( bitmap *b );
+
+/**
+ * Adds an integer to a bitmap. Adding integers in increasing 
+ * order is the fastest.
+ *
+ * @param b The bitmap.
+ * @param x The integer.
+ * @return BITMAP_SUCCESS, or BITMAP_ERROR if out of memory.
+ */
+int bitmap_add( bitmap *b, uint32_t x );
+
+/**
+ * Removes an integer from a bitmap.
+ *
+ * @param b The bitmap.
+ * @param x The integer.
+ */
+void bitmap_remove( bitmap *b, uint32_t x );
+
+/**
+ * Counts the integers in a bitmap.
+ *
+ * @param b The bitmap.
+ * @return The number of integers.
+ */
+uint32_t bitmap_count( const bitmap *b );
+
+/**
+ * Intersects two bitmaps.
+ *
+ * @param x The first bitmap.
+ * @param y The second bitmap.
+ * @param a The arena the result is allocated from.
+ * @param result Receives the integers in both bitmaps.
+ * @return BITMAP_SUCCESS, or BITMAP_ERROR if out of memory.
+ */
+int bitmap_and( const bitmap *x, const bitmap *y, arena *a, bitmap *result );
+
+/**
+ * Unites two bitmaps.
+ *
+ * @param x The first bitmap.
+ * @param y The second bitmap.
+ * @param a The arena the result is allocated from.
+ * @param result Receives the integers in either bitmap.
+ * @return BITMAP_SUCCESS, or BITMAP_ERROR if out of memory.
+ */
+int bitmap_or( const bitmap *x, const bitmap *y, arena *a, bitmap *result );
+
+/**
+ * Takes a bitmap away from another.
+ *
+ * @param x The first bitmap.
+ * @param y The bitmap to take away.
+ * @param a The arena the result is allocated from.
+ * @param result Receives the integers in x which are not in y.
+ * @return BITMAP_SUCCESS, or BITMAP_ERROR if out of memory.
+ */
+int bitmap_andnot( const bitmap *x, const bitmap *y, arena *a, bitmap *result );
+
+/**
+ * Unites any number of bitmaps at once, which is much faster 
+ * than uniting them two by two.
+ *
+ * @param maps The bitmaps.
+ * @param count The number of bitmaps.
+ * @param a The arena the result is allocated from.
+ * @param result Receives the integers in any of the bitmaps.
+ * @return BITMAP_SUCCESS, or BITMAP_ERROR if out of memory.
+ */
+int bitmap_or_many( const bitmap **maps, int count, arena *a, bitmap *result );
+
+/**
+ * Builds a bitmap from sorted integers.
+ *
+ * @param ids The integers, in increasing order.
+ * @param count The number of integers.
+ * @param a The arena the result is allocated from.
+ * @param result Receives the bitmap.
+ * @return BITMAP_SUCCESS, or BITMAP_ERROR if out of memory.
+ */
+int bitmap_from_array( const uint32_t *ids, int count, arena *a, bitmap *result );
+
+/**
+ * Lists a range of the integers in a bitmap, in increasing
+ * order.
+ *
+ * @param b The bitmap.
+ * @param start The position of the first integer to list.
+ * @param count The maximum number of integers to list.
+ * @param ids Receives the integers, count at most.
+ * @return The number of integers listed.
+ */
+uint32_t bitmap_select( const bitmap *b, uint32_t start, uint32_t count, uint32_t *ids );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
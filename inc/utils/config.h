@@ -41,8 +41,14 @@ char *config_get_announce_as();
 char *config_get_ip_address();
 int config_get_port();
 char *config_get_doc_root_path();
+int config_get_workers();
+int config_get_queue_depth();
 
 /* UPnP configuration parameters. */
 char **config_get_allowed_ips();
 
+/* CDS configuration parameters. */
+char *config_get_metadata_path();
+int config_get_search_min_length();
+
 #endif
@@ -0,0 +1,82 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __MPSCQ_H
+#define __MPSCQ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lock-free, intrusive, multiple producers single consumer queue
+ * (after Dmitry Vyukov's design). Producers never block nor spin:
+ * a push is a single atomic exchange. Only one thread at a time
+ * may pop from a queue.
+ *
+ * Queued structures embed an mpsc_node, usually as their first
+ * member so that the node pointer can be cast back to them.
+ */
+
+typedef struct mpsc_node mpsc_node;
+struct mpsc_node
+{
+   mpsc_node * volatile next;
+};
+
+typedef struct mpsc_queue
+{
+   mpsc_node * volatile head;  /* Producers side */
+   mpsc_node *tail;            /* Consumer side */
+   mpsc_node stub;
+} mpsc_queue;
+
+/**
+ * Initializes an empty queue.
+ *
+ * @param q The queue.
+ */
+void mpsc_queue_init( mpsc_queue *q );
+
+/**
+ * Appends a node to the queue. Can be called by any thread.
+ *
+ * @param q The queue.
+ * @param node The node to append.
+ */
+void mpsc_queue_push( mpsc_queue *q, mpsc_node *node );
+
+/**
+ * Removes the oldest node from the queue. Must only be
+ * called by the consumer thread.
+ *
+ * @param q The queue.
+ * @return The node, or NULL if the queue is empty or a
+ *    producer is half way through a push. In the latter
+ *    case the node will be available shortly.
+ */
+mpsc_node *mpsc_queue_pop( mpsc_queue *q );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
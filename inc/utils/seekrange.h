@@ -22,6 +22,7 @@
 #ifndef __SEEKRANGE_H
 #define __SEEKRANGE_H
 
+#include <stdint.h>
 
 
 /*----------------------------------------------------------------------------
@@ -59,7 +60,7 @@ typedef enum
 typedef struct npt_time_sec
 {
    unsigned long sec_hi; /* 1*DIGIT */
-   unsigned int sec_lo;  /* [ "." 1*3DIGIT ] */
+   unsigned int sec_lo;  /* [ "." 1*3DIGIT ], in milliseconds */
 } npt_time_sec;
 
 /*
@@ -70,7 +71,7 @@ typedef struct npt_time_hhmmss
    unsigned long hh;    /* npt hh - 1*DIGIT ; any positive number */
    unsigned char mm;    /* npt mm - 1*2DIGIT ; 0-59 */
    unsigned char ss;    /* npt ss - 1*2DIGIT ; 0-59 */
-   unsigned int low;    /* [ "." 1*3DIGIT ] */
+   unsigned int low;    /* [ "." 1*3DIGIT ], in milliseconds */
 } npt_time_hhmmss;
 
 /**
@@ -126,6 +127,17 @@ int npt_parse( const char *npt_string, npt_time *npt );
 __declspec(dllexport)
 char *npt_tostring( const npt_time *npt, char *buf, unsigned int buf_len );
 
+/**
+ * Converts an npt-time into milliseconds.
+ *
+ * @param npt The npt time structure to convert.
+ * @param msec Will receive the time in milliseconds.
+ * @return 1 if successful, 0 if npt is not an actual
+ *    time (NPT_INVALID, NPT_NOW or NPT_UNKNOWN).
+ */
+__declspec(dllexport)
+int npt_to_msec( const npt_time *npt, int64_t *msec );
+
 
 /*----------------------------------------------------------------------------
  *
@@ -149,6 +161,9 @@ char *npt_tostring( const npt_time *npt, char *buf, unsigned int buf_len );
    Examples:
     Range: bytes=1539686400-
     Range: bytes=1539686400-1540210688
+
+   Positions are 64 bit wide, as recordings easily
+   exceed the 4GB limit.
 */
 
 typedef enum
@@ -163,8 +178,8 @@ typedef struct bytes_range
 {
    BR_TYPE type;
 
-   unsigned long first;
-   unsigned long last;
+   int64_t first;
+   int64_t last;    /* Undefined for BR_OPEN ranges */
 } bytes_range;
 
 /**
@@ -174,7 +189,8 @@ typedef struct bytes_range
  *    in the form of a bytes range specifier
  * @param br A pointer to a structure that will receive 
  *    the timeseek_range details.
- * @return 1 if successful, 0 otherwise.
+ * @return 1 if successful, 0 otherwise. Closed ranges whose
+ *    last byte pos is lower than the first are invalid.
  */
 __declspec(dllexport)
 int bytesrange_parse( const char *bytesrange_string, bytes_range *br );
@@ -249,8 +265,8 @@ typedef struct timeseek_range
    npt_time npt_end;
    npt_time instance_duration;
    
-   unsigned long range_start;
-   unsigned long range_end;
+   int64_t range_start;
+   int64_t range_end;
    npt_time instance_length;  /* Can only get the types NPT_SEC or NPT_UNKNOWN */
 } timeseek_range;
 
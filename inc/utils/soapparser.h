@@ -0,0 +1,101 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef __SOAPPARSER_H
+#define __SOAPPARSER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pull parser for SOAP action requests. The envelope is read in 
+ * a single pass, picking the action element out of the Body and
+ * the text of each of its argument elements. No tree is built 
+ * and nothing is allocated: names and values are zero terminated
+ * in place, and entities and CDATA sections are decoded in place
+ * too (decoding never makes a value longer). Values without any
+ * of them are not touched at all.
+ *
+ * Namespace prefixes are dropped, names are local names.
+ */
+
+/* Error codes */
+enum
+{
+   SOAP_SUCCESS = 0,
+   SOAP_ERROR = -1
+};
+
+/**
+ * Most arguments kept for an action. Further 
+ * arguments are parsed but ignored.
+ */
+#define SOAP_MAX_ARGUMENTS 16
+
+/**
+ * An action argument. Both strings point
+ * into the parsed buffer.
+ */
+typedef struct soap_argument
+{
+   char *name;
+   char *value;
+} soap_argument;
+
+/**
+ * A parsed action request.
+ */
+typedef struct soap_request
+{
+   char *action;   /* E.g. "Browse" */
+   int num_arguments;
+   soap_argument arguments[SOAP_MAX_ARGUMENTS];
+} soap_request;
+
+/**
+ * Parses a SOAP envelope. The buffer is modified, and 
+ * must outlive the request structure.
+ *
+ * @param buf The envelope.
+ * @param len The envelope length.
+ * @param request The structure receiving the action name
+ *    and its arguments.
+ * @return SOAP_SUCCESS, or SOAP_ERROR if the envelope 
+ *    is malformed or does not carry an action.
+ */
+int soap_parse_request( char *buf, long len, soap_request *request );
+
+/**
+ * Returns the value of an action argument.
+ *
+ * @param request A request parsed by soap_parse_request.
+ * @param name The argument name.
+ * @return The value, or NULL if the argument is missing.
+ */
+char *soap_get_argument( soap_request *request, const char *name );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
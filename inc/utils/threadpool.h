@@ -0,0 +1,102 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+#include "mpscq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Error codes */
+enum
+{
+   THREADPOOL_SUCCESS = 0,
+   THREADPOOL_ERROR = -1,
+   THREADPOOL_QUEUE_FULL = -2
+};
+
+/**
+ * A job run by the pool workers.
+ *
+ * @param arg The pointer given to threadpool_submit.
+ */
+typedef void (*threadpool_job_fn)( void *arg );
+
+/**
+ * A queued job. Jobs are provided by the callers, usually 
+ * embedded in the structure they work on, so that nothing
+ * is allocated per submit.
+ */
+typedef struct threadpool_job
+{
+   mpsc_node node; /* Must be first */
+   threadpool_job_fn fn;
+   void *arg;
+} threadpool_job;
+
+/**
+ * Opaque thread pool handle.
+ */
+typedef struct threadpool threadpool;
+
+/**
+ * Creates a pool and starts its workers.
+ *
+ * @param num_workers The number of worker threads.
+ * @param queue_depth The maximum number of jobs queued
+ *    or running at any time.
+ * @return The new pool, or NULL on error.
+ */
+threadpool *threadpool_create( int num_workers, int queue_depth );
+
+/**
+ * Queues a job. Can be called from any thread, and never
+ * blocks: each worker has its own lock-free queue, and the
+ * job is given to an idle worker if there is one.
+ *
+ * @param pool The pool.
+ * @param job The job storage. It must not be submitted again
+ *    before fn is called, and is not touched once fn is called,
+ *    so fn can free it up.
+ * @param fn The job function.
+ * @param arg The job argument.
+ * @return THREADPOOL_SUCCESS, or THREADPOOL_QUEUE_FULL if the
+ *    queue depth has been reached.
+ */
+int threadpool_submit( threadpool *pool, threadpool_job *job, threadpool_job_fn fn, void *arg );
+
+/**
+ * Stops the workers once all the queued jobs have been
+ * run, and frees up the pool. No job must be submitted
+ * after this function is called.
+ *
+ * @param pool The pool.
+ */
+void threadpool_destroy( threadpool *pool );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,14 +30,5 @@ xmlNode *xml_first_node_by_name( xmlNode *root_node, const char *name );
 xmlNode *xml_next_sibling_by_name( xmlNode *node, const char *node_name );
 unsigned int xml_num_children( xmlNode *node );
 
-/**
- * Given a soap action, inclusive of the soap envelope,
- * returns the Body node content as an XML node.
- *
- * @param soap_action The entire soap action
- * @return An XML node with the SOAP body, or NULL
- */
-xmlNode *xml_get_soap_body( char *soap_action );
-
 
 #endif
\ No newline at end of file
@@ -29,16 +29,22 @@
 #include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
 
-#include "libxml/parser.h"
-#include "libxml/tree.h"
+#include "pthread.h"
 
+#include "atomic.h"
 #include "logger.h"
 #include "md5utils.h"
-#include "xmlutils.h"
+#include "soapparser.h"
 
 //#include "upnp-types.h"
 
 #include "item.h"
+#include "musicTrack.h"
+#include "indexer.h"
+#include "didl.h"
+#include "bitmap.h"
+#include "textindex.h"
+#include "searchcriteria.h"
 
 #include "cds.h"
 
@@ -51,17 +57,101 @@ typedef enum
 
 typedef ITEM_ID OBJECT_ID;
 
+/*
+ * Item types folders keep counts of, one per ITEM_TYPE
+ * bit from ITEM_VIDEO to ITEM_PLAYLIST.
+ */
+#define CDS_NUM_ITEM_TYPES 5
+
+/*
+ * A reference counted, immutable buffer. The caches hand them
+ * out to responses, which keep them alive while being sent.
+ */
+typedef struct cds_blob
+{
+   volatile long refs;
+   long length;
+   char data[1];
+} cds_blob;
+
+/*
+ * Rendered DIDL-Lite fragments each object keeps: one for 
+ * the full property set, one for the last narrower Filter.
+ */
+#define CDS_FRAGMENT_SLOTS 2
+
+/*
+ * A DIDL-Lite fragment, with the Filter and the version 
+ * of the object it was rendered for.
+ */
+typedef struct cds_fragment
+{
+   cds_blob *blob;
+   unsigned int filter;
+   unsigned long version;
+} cds_fragment;
+
+/*
+ * Properties children can be sorted on. The text properties
+ * come first: their collation keys are computed once and kept
+ * with the object.
+ */
+typedef enum
+{
+   CDS_SORT_TITLE = 0,
+   CDS_SORT_ARTIST,
+   CDS_SORT_ALBUM,
+   CDS_SORT_CREATOR,
+   CDS_SORT_DATE,
+   CDS_SORT_TRACK_NUMBER,
+   CDS_SORT_NUM_PROPS
+} CDS_SORT_PROP;
+
+#define CDS_SORT_NUM_TEXT_PROPS (CDS_SORT_CREATOR+1)
+
+/*
+ * Collation keys of the text properties of an object, 
+ * stored right after the structure.
+ */
+typedef struct cds_sort_keys
+{
+   const char *text[CDS_SORT_NUM_TEXT_PROPS];
+} cds_sort_keys;
+
+/*
+ * A parsed SortCriteria: the properties to sort on,
+ * most significant first, and their directions.
+ */
+typedef struct cds_sort_criteria
+{
+   int num_keys;
+   unsigned char props[CDS_SORT_NUM_PROPS];
+   unsigned char descending[CDS_SORT_NUM_PROPS];
+} cds_sort_criteria;
+
+/*
+ * The children of a folder in the order of a SortCriteria,
+ * as many as the folder has.
+ */
+typedef struct cds_sort_order cds_sort_order;
+struct cds_sort_order
+{
+   cds_sort_criteria criteria;
+   struct cds_object **children;
+   int max_children;
+
+   /* Next order of the folder, from the most recently used. */
+   cds_sort_order *next;
+};
+
 typedef struct cds_object cds_object;
 struct cds_object {
 
    CDS_OBJ_TYPE type;
 
-   /* Parent object. */
+   /* Parent object, and position among its children. */
    cds_object *parent;
-
-   /* Next and previous siblings */
-   cds_object *next;
-   cds_object *previous;
+   int index;
 
    union
    {
@@ -70,14 +160,60 @@ struct cds_object {
       {
          char *name;
          OBJECT_ID id;
+
+         /* 
+          * Children, in insertion order. They are kept in a
+          * contiguous array so that a Browse page is a slice
+          * of it and a child is reached by its index.
+          */
          int num_children;
-         cds_object *first_child;
-         cds_object *last_child;
+         int max_children;
+         cds_object **children;
+
+         /* 
+          * Item counts per type, among the direct children and
+          * in the whole subtree, plus the number of objects in
+          * the subtree. Kept up to date as objects are added 
+          * and deleted, so they never need to be computed.
+          */
+         int direct_counts[CDS_NUM_ITEM_TYPES];
+         int total_counts[CDS_NUM_ITEM_TYPES];
+         int total_children;
+
+         /* 
+          * ContainerUpdateID: the SystemUpdateID of the last
+          * change to the container, or to the childCount of
+          * one of its children.
+          */
+         unsigned long update_id;
+
+         /* 
+          * Children orders for the SortCriteria used so far,
+          * built when first asked for and kept up to date as 
+          * children are added and deleted.
+          * Protected by cds_sort_mutex.
+          */
+         cds_sort_order *sort_orders;
       };
 
       /* type == CDS_OBJ_ITEM */
-      item_info *item;
+      struct
+      {
+         item_info *item;
+
+         /* Number of the item in the search index. */
+         uint32_t ordinal;
+
+         /* Next item in its file index bucket. */
+         cds_object *file_chain;
+      };
    };
+
+   /* Protected by cds_fragment_mutex. */
+   cds_fragment fragments[CDS_FRAGMENT_SLOTS];
+
+   /* NULL until first sorted. Protected by cds_sort_mutex. */
+   cds_sort_keys *sort_keys;
 };
 
 
@@ -93,54 +229,1920 @@ struct cds_object {
  * that items of different kinds do not get mixed up.
  * More initializations are carried out during cds_init().
  */
-static cds_object root_tree = { CDS_OBJ_FOLDER, NULL, NULL, NULL, {"Root", CDS_ROOT_TREE_ID, 0, NULL, NULL} };
-static cds_object audio_tree = { CDS_OBJ_FOLDER, NULL, NULL, NULL, {"Music", CDS_PHOTO_TREE_ID, 0, NULL, NULL} };
-static cds_object photo_tree = { CDS_OBJ_FOLDER, NULL, NULL, NULL, {"Photo", CDS_MUSIC_TREE_ID, 0, NULL, NULL} };
-static cds_object video_tree = { CDS_OBJ_FOLDER, NULL, NULL, NULL, {"Video", CDS_VIDEO_TREE_ID, 0, NULL, NULL} };
+#define CDS_TREE_ROOT(name, id) \
+   { CDS_OBJ_FOLDER, NULL, 0, \
+     { { name, id, 0, 0, NULL, { 0 }, { 0 }, 0, 0, NULL } }, \
+     { { NULL, 0, 0 } }, NULL }
+
+static cds_object root_tree = CDS_TREE_ROOT( "Root", CDS_ROOT_TREE_ID );
+static cds_object audio_tree = CDS_TREE_ROOT( "Music", CDS_PHOTO_TREE_ID );
+static cds_object photo_tree = CDS_TREE_ROOT( "Photo", CDS_MUSIC_TREE_ID );
+static cds_object video_tree = CDS_TREE_ROOT( "Video", CDS_VIDEO_TREE_ID );
+static cds_object *root_tree_children[] = { &audio_tree, &photo_tree, &video_tree };
+
+/**
+ * A structure with the Browse action
+ * request information.
+ */
+typedef struct browse_request
+{
+   char *ObjectID;
+   enum {
+      BrowseMetadata,
+      BrowseDirectChildren
+   } BrowseFlag;
+   unsigned int Filter;    /* DIDL_PROP_* properties */
+   int StartingIndex;
+   int RequestedCount;
+   char *SortCriteria;
+   cds_sort_criteria Sort;    /* SortCriteria, parsed */
+} browse_request;
+
+/**
+ * A structure with the Search action
+ * request information.
+ */
+typedef struct search_request
+{
+   char *ContainerID;
+   char *SearchCriteria;
+   unsigned int Filter;    /* DIDL_PROP_* properties */
+   int StartingIndex;
+   int RequestedCount;
+   char *SortCriteria;
+   cds_sort_criteria Sort;    /* SortCriteria, parsed */
+} search_request;
+
+
+/*
+ * State Variables definitions
+ */
+
+/* Properties items can be searched on, see cds_search_names. */
+#define CDS_SEARCH_CAPABILITIES "dc:title,dc:creator,upnp:artist,upnp:album,upnp:genre,upnp:class,dc:date,res@protocolInfo"
+
+/* Properties children can be sorted on, see cds_sort_names. */
+#define CDS_SORT_CAPABILITIES "dc:title,dc:date,upnp:artist,upnp:album,upnp:originalTrackNumber,dc:creator"
+
+/* 
+ * SystemUpdateID, moves on whenever anything in the tree changes.
+ * Containers take their update ID from it.
+ */
+static unsigned long cds_system_update_id = 1;
+
+/*---------------------------------------------------------------------------
+ *
+ * Object ID index
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * The virtual trees. Folders are duplicated in each of 
+ * them under the same ID, items belong to one only.
+ */
+enum
+{
+   CDS_TREE_AUDIO = 0,
+   CDS_TREE_PHOTO,
+   CDS_TREE_VIDEO,
+   CDS_NUM_TREES
+};
+
+/*
+ * An index entry: the objects carrying an ID, one per
+ * virtual tree. The key points to the ID of one of them.
+ */
+typedef struct cds_id_entry
+{
+   const char *id;
+   unsigned long hash;
+   cds_object *objects[CDS_NUM_TREES];
+} cds_id_entry;
+
+/*
+ * Open addressing (linear probing) hash table over all the 
+ * objects in the trees, so that IDs are resolved in constant
+ * time. Deletions shift entries back, no tombstones are left.
+ */
+static struct
+{
+   cds_id_entry *entries;
+   unsigned long capacity;  /* A power of two */
+   unsigned long count;
+} cds_id_index = { NULL, 0, 0 };
+
+#define CDS_INDEX_INITIAL_CAPACITY 1024
+
+#define cds_object_id(obj) \
+   (((obj)->type == CDS_OBJ_FOLDER) ? (obj)->id : (obj)->item->id)
+
+/*
+ * FNV-1a hash of an object ID.
+ */
+static
+unsigned long cds_id_hash( const char *id )
+{
+   unsigned long hash = 2166136261UL;
+
+   while( *id )
+   {
+      hash ^= (unsigned char)*id++;
+      hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+   }
+   return hash;
+} /* cds_id_hash */
+
+/*
+ * Returns the virtual tree a tree root stands for,
+ * or -1 for the root tree.
+ */
+static
+int cds_tree_slot( cds_object *tree )
+{
+   if( tree == &audio_tree ) return CDS_TREE_AUDIO;
+   if( tree == &photo_tree ) return CDS_TREE_PHOTO;
+   if( tree == &video_tree ) return CDS_TREE_VIDEO;
+   return -1;
+} /* cds_tree_slot */
+
+/*
+ * Finds the index entry for an ID.
+ *
+ * @param id The object ID.
+ * @return The entry, or NULL if no object carries the ID.
+ */
+static
+cds_id_entry *cds_index_lookup( const char *id )
+{
+   unsigned long hash;
+   unsigned long i;
+   cds_id_entry *entry;
+
+   if( cds_id_index.count == 0 )
+   {
+      return NULL;
+   }
+
+   hash = cds_id_hash( id );
+   for( i = hash & (cds_id_index.capacity-1); ; i = (i+1) & (cds_id_index.capacity-1) )
+   {
+      entry = &cds_id_index.entries[i];
+      if( entry->id == NULL )
+      {
+         return NULL;
+      }
+      if( (entry->hash == hash) && (strcmp(entry->id, id) == 0) )
+      {
+         return entry;
+      }
+   }
+} /* cds_index_lookup */
+
+/*
+ * Doubles the index capacity (or allocates it the 
+ * first time) and rehashes all of its entries.
+ */
+static
+int cds_index_grow()
+{
+   cds_id_entry *old_entries = cds_id_index.entries;
+   unsigned long old_capacity = cds_id_index.capacity;
+   unsigned long capacity;
+   unsigned long i, j;
+
+   capacity = (old_capacity == 0) ? CDS_INDEX_INITIAL_CAPACITY : old_capacity * 2;
+   cds_id_index.entries = (cds_id_entry *)calloc( capacity, sizeof(cds_id_entry) );
+   if( cds_id_index.entries == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Out of memory growing the object index") );
+      cds_id_index.entries = old_entries;
+      return CDS_501_ERROR;
+   }
+   cds_id_index.capacity = capacity;
+
+   for( i = 0; i < old_capacity; i++ )
+   {
+      if( old_entries[i].id == NULL ) continue;
+
+      for( j = old_entries[i].hash & (capacity-1); cds_id_index.entries[j].id != NULL; j = (j+1) & (capacity-1) )
+         ;
+      cds_id_index.entries[j] = old_entries[i];
+   }
+   free( old_entries );
+
+   return CDS_SUCCESS;
+} /* cds_index_grow */
+
+/*
+ * Adds an object to the index.
+ *
+ * @param obj The object.
+ * @param slot The virtual tree the object is in.
+ * @return CDS_SUCCESS, or an error if out of memory.
+ */
+static
+int cds_index_add( cds_object *obj, int slot )
+{
+   const char *id = cds_object_id( obj );
+   cds_id_entry *entry;
+   unsigned long hash;
+   unsigned long i;
+
+   entry = cds_index_lookup( id );
+   if( entry == NULL )
+   {
+      /* Keep the table at most three quarters full. */
+      if( (cds_id_index.count+1) * 4 > cds_id_index.capacity * 3 )
+      {
+         if( cds_index_grow() != CDS_SUCCESS )
+         {
+            return CDS_501_ERROR;
+         }
+      }
+
+      hash = cds_id_hash( id );
+      for( i = hash & (cds_id_index.capacity-1); cds_id_index.entries[i].id != NULL; i = (i+1) & (cds_id_index.capacity-1) )
+         ;
+      entry = &cds_id_index.entries[i];
+      entry->id = id;
+      entry->hash = hash;
+      cds_id_index.count++;
+   }
+
+   entry->objects[slot] = obj;
+
+   return CDS_SUCCESS;
+} /* cds_index_add */
+
+/*
+ * Removes an object from the index.
+ *
+ * @param obj The object.
+ */
+static
+void cds_index_remove( cds_object *obj )
+{
+   cds_id_entry *entry;
+   unsigned long i, j, home;
+   int slot, in_use = 0;
+
+   entry = cds_index_lookup( cds_object_id(obj) );
+   if( entry == NULL )
+   {
+      return;
+   }
+
+   for( slot = 0; slot < CDS_NUM_TREES; slot++ )
+   {
+      if( entry->objects[slot] == obj )
+      {
+         entry->objects[slot] = NULL;
+      }
+      else
+      if( entry->objects[slot] != NULL )
+      {
+         /* The key must not point into the object going away. */
+         entry->id = cds_object_id( entry->objects[slot] );
+         in_use = 1;
+      }
+   }
+   if( in_use )
+   {
+      return;
+   }
+
+   /* 
+    * Free the entry, moving back any entry of the
+    * probe sequence that would not be found anymore.
+    */
+   i = entry - cds_id_index.entries;
+   for( j = (i+1) & (cds_id_index.capacity-1); cds_id_index.entries[j].id != NULL; j = (j+1) & (cds_id_index.capacity-1) )
+   {
+      home = cds_id_index.entries[j].hash & (cds_id_index.capacity-1);
+      if( ((j > i) && ((home <= i) || (home > j))) ||
+          ((j < i) && ((home <= i) && (home > j))) )
+      {
+         cds_id_index.entries[i] = cds_id_index.entries[j];
+         i = j;
+      }
+   }
+   memset( &cds_id_index.entries[i], 0, sizeof(cds_id_entry) );
+   cds_id_index.count--;
+} /* cds_index_remove */
+
+/*
+ * Finds the object carrying an ID.
+ *
+ * @param id The object ID.
+ * @param slot The virtual tree to look into, or -1 
+ *    for any of them.
+ * @return The object, or NULL.
+ */
+static
+cds_object *cds_find_object( const char *id, int slot )
+{
+   cds_id_entry *entry;
+
+   entry = cds_index_lookup( id );
+   if( entry == NULL )
+   {
+      return NULL;
+   }
+
+   if( slot >= 0 )
+   {
+      return entry->objects[slot];
+   }
+
+   for( slot = 0; slot < CDS_NUM_TREES; slot++ )
+   {
+      if( entry->objects[slot] != NULL ) return entry->objects[slot];
+   }
+   return NULL;
+} /* cds_find_object */
+
+/*
+ * Items by file name, for the HTTP server to find the item it
+ * streams: almost every GET asks for the DLNA headers, which
+ * depend on the item. Items are chained in the buckets through
+ * file_chain.
+ */
+static struct
+{
+   pthread_mutex_t mutex;
+   cds_object **buckets;
+   unsigned long num_buckets;  /* A power of two */
+   unsigned long count;
+} cds_file_index;
+
+/*
+ * Add an item to the file index. An item the index has no room
+ * for can still be streamed, only not time seeked.
+ *
+ * @param obj The item.
+ */
+static
+void cds_file_index_add( cds_object *obj )
+{
+   unsigned long hash;
+   unsigned long i;
+
+   if( obj->item->filename == NULL )
+   {
+      return;
+   }
+
+   pthread_mutex_lock( &cds_file_index.mutex );
+
+   /* At most one item per bucket on average. */
+   if( cds_file_index.count >= cds_file_index.num_buckets )
+   {
+      unsigned long num_buckets;
+      cds_object **buckets;
+      cds_object *item, *next;
+
+      num_buckets = (cds_file_index.num_buckets == 0) ? CDS_INDEX_INITIAL_CAPACITY : cds_file_index.num_buckets * 2;
+      buckets = (cds_object **)calloc( num_buckets, sizeof(cds_object *) );
+      if( buckets == NULL )
+      {
+         pthread_mutex_unlock( &cds_file_index.mutex );
+         logger_log( LOG_ERROR, LOG_MSG("Out of memory growing the file index") );
+         return;
+      }
+
+      for( i = 0; i < cds_file_index.num_buckets; i++ )
+      {
+         for( item = cds_file_index.buckets[i]; item != NULL; item = next )
+         {
+            next = item->file_chain;
+            hash = cds_id_hash( item->item->filename ) & (num_buckets-1);
+            item->file_chain = buckets[hash];
+            buckets[hash] = item;
+         }
+      }
+      free( cds_file_index.buckets );
+      cds_file_index.buckets = buckets;
+      cds_file_index.num_buckets = num_buckets;
+   }
+
+   hash = cds_id_hash( obj->item->filename ) & (cds_file_index.num_buckets-1);
+   obj->file_chain = cds_file_index.buckets[hash];
+   cds_file_index.buckets[hash] = obj;
+   cds_file_index.count++;
+
+   pthread_mutex_unlock( &cds_file_index.mutex );
+} /* cds_file_index_add */
+
+/*
+ * Take an item out of the file index.
+ *
+ * @param obj The item.
+ */
+static
+void cds_file_index_remove( cds_object *obj )
+{
+   cds_object **link;
+
+   if( obj->item->filename == NULL )
+   {
+      return;
+   }
+
+   pthread_mutex_lock( &cds_file_index.mutex );
+
+   if( cds_file_index.num_buckets > 0 )
+   {
+      link = &cds_file_index.buckets[cds_id_hash(obj->item->filename) & (cds_file_index.num_buckets-1)];
+      while( (*link != NULL) && (*link != obj) )
+      {
+         link = &(*link)->file_chain;
+      }
+      if( *link != NULL )
+      {
+         *link = obj->file_chain;
+         cds_file_index.count--;
+      }
+   }
+
+   pthread_mutex_unlock( &cds_file_index.mutex );
+} /* cds_file_index_remove */
+
+
+/*---------------------------------------------------------------------------
+ *
+ * Shared buffers
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Create a buffer holding one reference.
+ *
+ * @param data The data to copy in, or NULL to leave it uninitialized.
+ * @param length The data length.
+ * @return The buffer, or NULL if out of memory.
+ */
+static
+cds_blob *cds_blob_new( const char *data, long length )
+{
+   cds_blob *blob;
+
+   blob = (cds_blob *)malloc( sizeof(cds_blob) + length );
+   if( blob != NULL )
+   {
+      blob->refs = 1;
+      blob->length = length;
+      if( data != NULL )
+      {
+         memcpy( blob->data, data, length );
+      }
+   }
+
+   return blob;
+} /* cds_blob_new */
+
+#define cds_blob_ref(blob) atomic_inc( &(blob)->refs )
+
+/*
+ * Drop a reference to a buffer, freeing it with the last one.
+ *
+ * @param blob The buffer, or NULL.
+ */
+static
+void cds_blob_release( cds_blob *blob )
+{
+   if( (blob != NULL) && (atomic_dec( &blob->refs ) == 0) )
+   {
+      free( blob );
+   }
+} /* cds_blob_release */
+
+/* Protects the DIDL-Lite fragments of all objects. */
+static pthread_mutex_t cds_fragment_mutex;
+
+
+/*---------------------------------------------------------------------------
+ *
+ * Sorting
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Control points sort large folders page by page, so sorting
+ * them on every request is out of the question. Each folder 
+ * keeps the orders of its children for the few SortCriteria 
+ * clients use, and a sorted page is a slice of one of them.
+ * An order is built the first time it is asked for, and then
+ * maintained with a binary search as children come and go.
+ */
+
+/* Most SortCriteria orders a folder keeps. */
+#define CDS_SORT_MAX_ORDERS 4
+
+/* Protects the sort orders of all folders and the collation keys. */
+static pthread_mutex_t cds_sort_mutex;
+
+/* The criteria qsort compares with. Protected by cds_sort_mutex. */
+static const cds_sort_criteria *cds_sort_current;
+
+static const struct
+{
+   const char *name;
+   CDS_SORT_PROP prop;
+} cds_sort_names[] =
+{
+   { "dc:title",                 CDS_SORT_TITLE },
+   { "dc:date",                  CDS_SORT_DATE },
+   { "upnp:artist",              CDS_SORT_ARTIST },
+   { "upnp:album",               CDS_SORT_ALBUM },
+   { "upnp:originalTrackNumber", CDS_SORT_TRACK_NUMBER },
+   { "dc:creator",               CDS_SORT_CREATOR },
+   { NULL, 0 }
+};
+
+/*
+ * Parse a SortCriteria argument: a comma separated list of
+ * properties, each one preceded by '+' for ascending or '-' 
+ * for descending order. A property without sign is sorted in
+ * ascending order.
+ *
+ * @param s The SortCriteria argument.
+ * @param criteria Receives the parsed criteria, with no keys
+ *    if the argument is empty.
+ * @return CDS_SUCCESS, or CDS_709_ERROR for an unsupported property.
+ */
+static
+int cds_parse_sort_criteria( const char *s, cds_sort_criteria *criteria )
+{
+   const char *end;
+   int descending;
+   int len;
+   int i, k;
+
+   criteria->num_keys = 0;
+   for( ; ; )
+   {
+      while( (*s == ',') || (*s == ' ') || (*s == '\t') || (*s == '\r') || (*s == '\n') )
+      {
+         s++;
+      }
+      if( *s == 0 )
+      {
+         return CDS_SUCCESS;
+      }
+
+      descending = 0;
+      if( *s == '+' )
+      {
+         s++;
+      }
+      else if( *s == '-' )
+      {
+         descending = 1;
+         s++;
+      }
+
+      for( end = s; (*end != 0) && (*end != ',') && (*end != ' ') && (*end != '\t'); end++ );
+      len = (int)(end - s);
+
+      for( i = 0; cds_sort_names[i].name != NULL; i++ )
+      {
+         if( (strncmp(cds_sort_names[i].name, s, len) == 0) && (cds_sort_names[i].name[len] == 0) )
+         {
+            break;
+         }
+      }
+      if( cds_sort_names[i].name == NULL )
+      {
+         logger_log( LOG_ERROR, LOG_MSG("Unsupported sort property %.*s"), len, s );
+         return CDS_709_ERROR;
+      }
+
+      /* Only the first occurrence of a property matters. */
+      for( k = 0; k < criteria->num_keys; k++ )
+      {
+         if( criteria->props[k] == cds_sort_names[i].prop ) break;
+      }
+      if( k == criteria->num_keys )
+      {
+         criteria->props[k] = (unsigned char)cds_sort_names[i].prop;
+         criteria->descending[k] = (unsigned char)descending;
+         criteria->num_keys++;
+      }
+
+      s = end;
+   }
+} /* cds_parse_sort_criteria */
+
+/*
+ * Get a text property of an object, as written to DIDL-Lite.
+ *
+ * @param obj The object.
+ * @param prop The CDS_SORT_* text property.
+ * @param len Receives the text length.
+ * @return The text, not zero terminated, or NULL if none.
+ */
+static
+const char *cds_sort_text( cds_object *obj, int prop, long *len )
+{
+   musicTrack_info *track = NULL;
+   const char *text = NULL;
+
+   if( obj->type == CDS_OBJ_FOLDER )
+   {
+      if( prop == CDS_SORT_TITLE )
+      {
+         text = obj->name;
+      }
+   }
+   else if( prop == CDS_SORT_TITLE )
+   {
+      return didl_item_title( obj->item, len );
+   }
+   else if( obj->item->type == ITEM_AUDIO )
+   {
+      track = (musicTrack_info *)obj->item->specific_info;
+   }
+
+   if( track != NULL )
+   {
+      text = (prop == CDS_SORT_ALBUM) ? track->album : track->artist;
+   }
+
+   *len = (text != NULL) ? (long)strlen(text) : 0;
+   return text;
+} /* cds_sort_text */
+
+/*
+ * Write the collation key of a text: case folded, with runs of
+ * digits prefixed by their length so that numbers compare by 
+ * value, "Track 9" before "Track 10". Keys are compared with 
+ * strcmp. A run of n digits takes n+2 bytes, so the key can take
+ * up to twice the text length plus one, a lone digit being 3
+ * bytes, plus the terminating zero.
+ *
+ * @param text The text.
+ * @param len The text length.
+ * @param key Receives the key.
+ * @return The end of the key, past the terminating zero.
+ */
+static
+char *cds_collation_key( const char *text, long len, char *key )
+{
+   const char *end = text + len;
+   const char *digits;
+   long n;
+
+   while( text < end )
+   {
+      if( (*text >= '0') && (*text <= '9') )
+      {
+         /* Leading zeros do not count. */
+         while( (text < end-1) && (text[0] == '0') && (text[1] >= '0') && (text[1] <= '9') )
+         {
+            text++;
+         }
+         for( digits = text; (text < end) && (*text >= '0') && (*text <= '9'); text++ );
+         n = (long)(text - digits);
+
+         *key++ = '0';
+         *key++ = (char)((n < 255) ? n : 255);
+         memcpy( key, digits, n );
+         key += n;
+      }
+      else
+      {
+         *key++ = ((*text >= 'A') && (*text <= 'Z')) ? (char)(*text - 'A' + 'a') : *text;
+         text++;
+      }
+   }
+   *key++ = 0;
+
+   return key;
+} /* cds_collation_key */
+
+/*
+ * Get the collation key of a text property of an object, 
+ * computing the keys of the object on first use.
+ * Must be called with the sort mutex locked.
+ *
+ * @param obj The object.
+ * @param prop The CDS_SORT_* text property.
+ * @return The key, empty if the object has no such property
+ *    or if out of memory.
+ */
+static
+const char *cds_sort_key( cds_object *obj, int prop )
+{
+   const char *text[CDS_SORT_NUM_TEXT_PROPS];
+   long len[CDS_SORT_NUM_TEXT_PROPS];
+   long size = sizeof(cds_sort_keys);
+   char *key;
+   int i;
+
+   if( obj->sort_keys == NULL )
+   {
+      for( i = 0; i < CDS_SORT_NUM_TEXT_PROPS; i++ )
+      {
+         text[i] = cds_sort_text( obj, i, &len[i] );
+         size += 2*len[i] + 2;
+      }
+
+      obj->sort_keys = (cds_sort_keys *)malloc( size );
+      if( obj->sort_keys == NULL )
+      {
+         return "";
+      }
+
+      key = (char *)(obj->sort_keys + 1);
+      for( i = 0; i < CDS_SORT_NUM_TEXT_PROPS; i++ )
+      {
+         obj->sort_keys->text[i] = key;
+         key = cds_collation_key( (text[i] != NULL) ? text[i] : "", len[i], key );
+      }
+   }
+
+   return obj->sort_keys->text[prop];
+} /* cds_sort_key */
+
+/*
+ * Get a numeric property of an object, 0 if it has none.
+ *
+ * @param obj The object.
+ * @param prop The CDS_SORT_* numeric property.
+ * @return The value.
+ */
+static
+int64_t cds_sort_number( cds_object *obj, int prop )
+{
+   if( obj->type == CDS_OBJ_FOLDER )
+   {
+      return 0;
+   }
+
+   if( prop == CDS_SORT_DATE )
+   {
+      return (int64_t)obj->item->date;
+   }
+
+   if( (obj->item->type == ITEM_AUDIO) && (obj->item->specific_info != NULL) )
+   {
+      return ((musicTrack_info *)obj->item->specific_info)->originalTrackNumber;
+   }
+   return 0;
+} /* cds_sort_number */
+
+/*
+ * Compare two children of a folder for a SortCriteria. Ties are
+ * broken by the position among the children, so that no two
+ * children ever compare equal. Must be called with the sort 
+ * mutex locked.
+ *
+ * @return A negative value, zero or a positive value if a
+ *    comes before, is or comes after b.
+ */
+static
+int cds_sort_compare( cds_object *a, cds_object *b, const cds_sort_criteria *criteria )
+{
+   int64_t value_a, value_b;
+   int prop;
+   int res;
+   int i;
+
+   for( i = 0; i < criteria->num_keys; i++ )
+   {
+      prop = criteria->props[i];
+      if( prop < CDS_SORT_NUM_TEXT_PROPS )
+      {
+         res = strcmp( cds_sort_key(a, prop), cds_sort_key(b, prop) );
+      }
+      else
+      {
+         value_a = cds_sort_number( a, prop );
+         value_b = cds_sort_number( b, prop );
+         res = (value_a > value_b) - (value_a < value_b);
+      }
+
+      if( res != 0 )
+      {
+         return criteria->descending[i] ? -res : res;
+      }
+   }
+
+   return (a->index > b->index) - (a->index < b->index);
+} /* cds_sort_compare */
+
+/* cds_sort_compare for qsort, with cds_sort_current. */
+static
+int cds_sort_qsort_compare( const void *a, const void *b )
+{
+   return cds_sort_compare( *(cds_object **)a, *(cds_object **)b, cds_sort_current );
+} /* cds_sort_qsort_compare */
+
+/*
+ * Find where an object goes in an order: the position of 
+ * the first child not coming before it.
+ * Must be called with the sort mutex locked.
+ *
+ * @param order The order.
+ * @param count The number of children in the order.
+ * @param obj The object.
+ * @return The position.
+ */
+static
+int cds_sort_position( cds_sort_order *order, int count, cds_object *obj )
+{
+   int low = 0;
+   int high = count;
+   int mid;
+
+   while( low < high )
+   {
+      mid = low + (high - low) / 2;
+      if( cds_sort_compare(order->children[mid], obj, &order->criteria) < 0 )
+      {
+         low = mid + 1;
+      }
+      else
+      {
+         high = mid;
+      }
+   }
+
+   return low;
+} /* cds_sort_position */
+
+/* Free an order unlinked from its folder. */
+static
+void cds_sort_free_order( cds_sort_order *order )
+{
+   free( order->children );
+   free( order );
+} /* cds_sort_free_order */
+
+/*
+ * Drop all of the orders of a folder.
+ *
+ * @param folder The folder.
+ */
+static
+void cds_sort_drop_orders( cds_object *folder )
+{
+   cds_sort_order *order;
+
+   pthread_mutex_lock( &cds_sort_mutex );
+   while( (order = folder->sort_orders) != NULL )
+   {
+      folder->sort_orders = order->next;
+      cds_sort_free_order( order );
+   }
+   pthread_mutex_unlock( &cds_sort_mutex );
+} /* cds_sort_drop_orders */
+
+/*
+ * Find the order of the children of a folder for a SortCriteria,
+ * building it the first time. Must be called with the sort 
+ * mutex locked.
+ *
+ * @param folder The folder.
+ * @param criteria The criteria, with at least one key.
+ * @return The order, or NULL if out of memory.
+ */
+static
+cds_sort_order *cds_sort_get_order( cds_object *folder, const cds_sort_criteria *criteria )
+{
+   cds_sort_order **link;
+   cds_sort_order *order;
+   int num_orders = 0;
+
+   for( link = &folder->sort_orders; (order = *link) != NULL; link = &order->next )
+   {
+      if( (order->criteria.num_keys == criteria->num_keys) &&
+          (memcmp(order->criteria.props, criteria->props, criteria->num_keys) == 0) &&
+          (memcmp(order->criteria.descending, criteria->descending, criteria->num_keys) == 0) )
+      {
+         /* Most recently used first. */
+         *link = order->next;
+         order->next = folder->sort_orders;
+         folder->sort_orders = order;
+         return order;
+      }
+      num_orders++;
+   }
+
+   /* Make room, dropping the least recently used. */
+   if( num_orders >= CDS_SORT_MAX_ORDERS )
+   {
+      for( link = &folder->sort_orders; (*link)->next != NULL; link = &(*link)->next );
+      cds_sort_free_order( *link );
+      *link = NULL;
+   }
+
+   order = (cds_sort_order *)malloc( sizeof(cds_sort_order) );
+   if( order == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Out of memory sorting children") );
+      return NULL;
+   }
+   order->criteria = *criteria;
+   order->max_children = (folder->num_children > 0) ? folder->num_children : 1;
+   order->children = (cds_object **)malloc( order->max_children * sizeof(cds_object *) );
+   if( order->children == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Out of memory sorting children") );
+      free( order );
+      return NULL;
+   }
+
+   memcpy( order->children, folder->children, folder->num_children * sizeof(cds_object *) );
+   cds_sort_current = &order->criteria;
+   qsort( order->children, folder->num_children, sizeof(cds_object *), cds_sort_qsort_compare );
+
+   order->next = folder->sort_orders;
+   folder->sort_orders = order;
+
+   return order;
+} /* cds_sort_get_order */
+
+/*
+ * Insert a child just added to a folder in the folder orders.
+ * Orders that cannot grow are dropped, to be built again later.
+ *
+ * @param folder The folder, already holding the child.
+ * @param obj The child.
+ */
+static
+void cds_sort_insert( cds_object *folder, cds_object *obj )
+{
+   cds_sort_order **link;
+   cds_sort_order *order;
+   cds_object **children;
+   int count = folder->num_children - 1;
+   int pos;
+
+   pthread_mutex_lock( &cds_sort_mutex );
+
+   link = &folder->sort_orders;
+   while( (order = *link) != NULL )
+   {
+      if( folder->num_children > order->max_children )
+      {
+         children = (cds_object **)realloc( order->children, 2 * order->max_children * sizeof(cds_object *) );
+         if( children == NULL )
+         {
+            *link = order->next;
+            cds_sort_free_order( order );
+            continue;
+         }
+         order->children = children;
+         order->max_children *= 2;
+      }
+
+      pos = cds_sort_position( order, count, obj );
+      memmove( order->children + pos + 1, order->children + pos, (count - pos) * sizeof(cds_object *) );
+      order->children[pos] = obj;
+
+      link = &order->next;
+   }
+
+   pthread_mutex_unlock( &cds_sort_mutex );
+} /* cds_sort_insert */
+
+/*
+ * Remove a child about to be deleted from the folder orders.
+ *
+ * @param folder The folder, still holding the child.
+ * @param obj The child.
+ */
+static
+void cds_sort_remove( cds_object *folder, cds_object *obj )
+{
+   cds_sort_order *order;
+   int count = folder->num_children;
+   int pos;
+
+   pthread_mutex_lock( &cds_sort_mutex );
+
+   for( order = folder->sort_orders; order != NULL; order = order->next )
+   {
+      pos = cds_sort_position( order, count, obj );
+      if( (pos < count) && (order->children[pos] == obj) )
+      {
+         memmove( order->children + pos, order->children + pos + 1, (count - pos - 1) * sizeof(cds_object *) );
+      }
+   }
+
+   pthread_mutex_unlock( &cds_sort_mutex );
+} /* cds_sort_remove */
+
+
+/*---------------------------------------------------------------------------
+ *
+ * Search index
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Control points which do not browse folders find everything
+ * with Search: all of the music tracks, the albums of an artist,
+ * the titles containing a word. Items are numbered with dense
+ * ordinals, reused once freed, and everything is indexed by 
+ * ordinal.
+ *
+ * Properties with few distinct values, the facets, keep a bitmap
+ * of the items per value: criteria on them are evaluated on the 
+ * values and with bitmap operations alone, without looking at any
+ * item, and the number of matches is a bitmap count.
+ * Titles are mostly unique instead: their words are indexed, and
+ * the items the index returns are checked against the criteria.
+ * Type-ahead searches look for parts of words: these are found 
+ * through the trigrams of the titles, and of the names of the 
+ * artists, albums and genres, before being checked as well.
+ */
+
+/* Properties items can be searched on. */
+typedef enum
+{
+   CDS_SEARCH_TITLE = 0,
+   CDS_SEARCH_CLASS,
+   CDS_SEARCH_ARTIST,
+   CDS_SEARCH_ALBUM,
+   CDS_SEARCH_GENRE,
+   CDS_SEARCH_DATE,
+   CDS_SEARCH_PROTOCOL_INFO,
+   CDS_SEARCH_NUM_PROPS
+} CDS_SEARCH_PROP;
+
+/* The properties from CDS_SEARCH_CLASS on are facets. */
+#define CDS_SEARCH_FIRST_FACET CDS_SEARCH_CLASS
+#define CDS_SEARCH_NUM_FACETS (CDS_SEARCH_NUM_PROPS - CDS_SEARCH_FIRST_FACET)
+
+/* Size of the buffer for the text of a property. */
+#define CDS_SEARCH_TEXT_SIZE DIDL_PROTOCOL_INFO_SIZE
+
+/* 
+ * Trigram list ids kept per index, 16MB each. Beyond that the
+ * commonest trigrams are dropped, and searches on them check
+ * more items.
+ */
+#define CDS_SEARCH_MAX_POSTINGS (4L * 1024 * 1024)
+
+/* SearchCriteria property names, see CDS_SEARCH_CAPABILITIES. */
+static const struct
+{
+   const char *name;
+   int prop;
+} cds_search_names[] = 
+{
+   { "dc:title", CDS_SEARCH_TITLE },
+   { "dc:creator", CDS_SEARCH_ARTIST },
+   { "upnp:artist", CDS_SEARCH_ARTIST },
+   { "upnp:album", CDS_SEARCH_ALBUM },
+   { "upnp:genre", CDS_SEARCH_GENRE },
+   { "upnp:class", CDS_SEARCH_CLASS },
+   { "dc:date", CDS_SEARCH_DATE },
+   { "res@protocolInfo", CDS_SEARCH_PROTOCOL_INFO },
+   { NULL, 0 }
+};
+
+/*
+ * A value of a facet, and the items having it. Values are the 
+ * same if they only differ in case, the first spelling seen is
+ * kept. Items without the property have the empty value.
+ */
+typedef struct cds_facet_value
+{
+   char *text;
+   long len;
+   unsigned long hash;
+   int chain;           /* Next value in the bucket, or -1 */
+   bitmap items;
+} cds_facet_value;
+
+/*
+ * The values of a facet, hashed. Values are never deleted, 
+ * they are few, and they are skipped once they have no items.
+ */
+typedef struct cds_facet
+{
+   cds_facet_value *values;
+   int num_values;
+   int max_values;
+
+   int *buckets;        /* First value of each bucket, or -1 */
+   int num_buckets;     /* A power of two */
+
+   /* The words of the values, by position, NULL for no index. */
+   textindex *names;
+} cds_facet;
+
+static struct
+{
+   pthread_mutex_t mutex;
+
+   textindex *titles;
+   cds_facet facets[CDS_SEARCH_NUM_FACETS];
+
+   /* Items by ordinal, NULL for free ordinals. */
+   cds_object **items;
+   uint32_t num_items;
+   uint32_t max_items;
+
+   /* The ordinals in use, and those free for reuse. */
+   bitmap live;
+   uint32_t *free;
+   uint32_t num_free;
+} cds_search;
+
+#define cds_search_fold(c) \
+   ((((c) >= 'A') && ((c) <= 'Z')) ? (c) + ('a' - 'A') : (c))
+
+/*
+ * Get a searchable property of an item, as written to DIDL-Lite.
+ *
+ * @param obj The item.
+ * @param prop The CDS_SEARCH_* property.
+ * @param buf A CDS_SEARCH_TEXT_SIZE bytes buffer for the 
+ *    properties that have to be formatted.
+ * @param len Receives the text length.
+ * @return The text, not zero terminated, or NULL if none.
+ */
+static
+const char *cds_search_text( cds_object *obj, int prop, char *buf, long *len )
+{
+   musicTrack_info *track;
+   const char *text = NULL;
+
+   switch( prop )
+   {
+      case CDS_SEARCH_TITLE:
+         return cds_sort_text( obj, CDS_SORT_TITLE, len );
+
+      case CDS_SEARCH_ARTIST:
+         return cds_sort_text( obj, CDS_SORT_ARTIST, len );
+
+      case CDS_SEARCH_ALBUM:
+         return cds_sort_text( obj, CDS_SORT_ALBUM, len );
+
+      case CDS_SEARCH_GENRE:
+         if( obj->item->type == ITEM_AUDIO )
+         {
+            track = (musicTrack_info *)obj->item->specific_info;
+            text = (track != NULL) ? track->genre : NULL;
+         }
+         break;
+
+      case CDS_SEARCH_CLASS:
+         text = (obj->item->class != NULL) ? obj->item->class : DIDL_OBJECT_ITEM;
+         break;
+
+      case CDS_SEARCH_DATE:
+         if( obj->item->date == 0 )
+         {
+            break;
+         }
+         *len = didl_format_date( obj->item->date, buf );
+         return buf;
+
+      case CDS_SEARCH_PROTOCOL_INFO:
+         *len = didl_item_protocol_info( obj->item, buf );
+         return buf;
+   }
+
+   *len = (text != NULL) ? (long)strlen(text) : 0;
+   return text;
+} /* cds_search_text */
+
+/*
+ * FNV-1a hash of a text, ignoring case.
+ */
+static
+unsigned long cds_search_hash( const char *text, long len )
+{
+   unsigned long hash = 2166136261UL;
+   long i;
+
+   for( i = 0; i < len; i++ )
+   {
+      hash ^= (unsigned char)cds_search_fold( text[i] );
+      hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+   }
+   return hash;
+} /* cds_search_hash */
+
+/*
+ * Compare a text with a zero terminated value, ignoring case.
+ *
+ * @param text The text, not zero terminated.
+ * @param len The text length.
+ * @param value The value.
+ * @param prefix Non zero to compare with the start of the text only.
+ * @return A negative value, zero or a positive value if the
+ *    text comes before, is or comes after the value.
+ */
+static
+int cds_search_compare( const char *text, long len, const char *value, int prefix )
+{
+   int c1, c2;
+   long i;
+
+   for( i = 0; value[i] != '\0'; i++ )
+   {
+      if( i == len )
+      {
+         return -1;
+      }
+      c1 = cds_search_fold( (unsigned char)text[i] );
+      c2 = cds_search_fold( (unsigned char)value[i] );
+      if( c1 != c2 )
+      {
+         return c1 - c2;
+      }
+   }
+
+   return (prefix || (i == len)) ? 0 : 1;
+} /* cds_search_compare */
+
+/*
+ * Find a value of a facet.
+ *
+ * @return The value position, or -1 if the facet does not have it.
+ */
+static
+int cds_facet_find( cds_facet *facet, const char *text, long len, unsigned long hash )
+{
+   cds_facet_value *value;
+   int i;
+
+   if( facet->num_buckets == 0 )
+   {
+      return -1;
+   }
+
+   for( i = facet->buckets[hash & (facet->num_buckets - 1)]; i >= 0; i = value->chain )
+   {
+      value = &facet->values[i];
+      if( (value->hash == hash) && (value->len == len) && 
+          (cds_search_compare( value->text, value->len, text, 0 ) == 0) )
+      {
+         return i;
+      }
+   }
+   return -1;
+} /* cds_facet_find */
+
+/*
+ * Find a value of a facet, adding it if new.
+ *
+ * @return The value position, or -1 if out of memory.
+ */
+static
+int cds_facet_get( cds_facet *facet, const char *text, long len )
+{
+   unsigned long hash = cds_search_hash( text, len );
+   cds_facet_value *value;
+   int i;
+
+   i = cds_facet_find( facet, text, len, hash );
+   if( i >= 0 )
+   {
+      return i;
+   }
+
+   if( facet->num_values == facet->max_values )
+   {
+      int max = (facet->max_values == 0) ? 16 : facet->max_values * 2;
+
+      value = (cds_facet_value *)realloc( facet->values, max * sizeof(cds_facet_value) );
+      if( value == NULL )
+      {
+         return -1;
+      }
+      facet->values = value;
+      facet->max_values = max;
+   }
+
+   if( facet->num_values == facet->num_buckets )
+   {
+      /* As many buckets as values, at most. */
+      int num_buckets = (facet->num_buckets == 0) ? 16 : facet->num_buckets * 2;
+      int *buckets;
+
+      buckets = (int *)malloc( num_buckets * sizeof(int) );
+      if( buckets == NULL )
+      {
+         return -1;
+      }
+      for( i = 0; i < num_buckets; i++ )
+      {
+         buckets[i] = -1;
+      }
+      for( i = 0; i < facet->num_values; i++ )
+      {
+         value = &facet->values[i];
+         value->chain = buckets[value->hash & (num_buckets - 1)];
+         buckets[value->hash & (num_buckets - 1)] = i;
+      }
+      free( facet->buckets );
+      facet->buckets = buckets;
+      facet->num_buckets = num_buckets;
+   }
+
+   value = &facet->values[facet->num_values];
+   value->text = (char *)malloc( len + 1 );
+   if( value->text == NULL )
+   {
+      return -1;
+   }
+   memcpy( value->text, text, len );
+   value->text[len] = '\0';
+   value->len = len;
+   value->hash = hash;
+   bitmap_init( &value->items );
+
+   if( (facet->names != NULL) && 
+       (textindex_add( facet->names, text, len, facet->num_values ) != TEXTINDEX_SUCCESS) )
+   {
+      textindex_remove( facet->names, text, len, facet->num_values );
+      free( value->text );
+      return -1;
+   }
+
+   value->chain = facet->buckets[hash & (facet->num_buckets - 1)];
+   facet->buckets[hash & (facet->num_buckets - 1)] = facet->num_values;
+
+   return facet->num_values++;
+} /* cds_facet_get */
+
+/*
+ * Give an item just added to the tree an ordinal, and index
+ * its properties.
+ *
+ * @param obj The item.
+ * @return CDS_SUCCESS, or an error if out of memory.
+ */
+static
+int cds_search_add( cds_object *obj )
+{
+   char buf[CDS_SEARCH_TEXT_SIZE];
+   cds_facet *facet;
+   const char *text;
+   uint32_t ordinal;
+   long len;
+   int prop;
+   int i;
+   int res = CDS_SUCCESS;
+
+   pthread_mutex_lock( &cds_search.mutex );
+
+   if( (cds_search.num_free == 0) && (cds_search.num_items == cds_search.max_items) )
+   {
+      uint32_t max_items = (cds_search.max_items == 0) ? 1024 : cds_search.max_items * 2;
+      cds_object **items;
+      uint32_t *free_ordinals;
+
+      items = (cds_object **)realloc( cds_search.items, max_items * sizeof(cds_object *) );
+      if( items != NULL )
+      {
+         cds_search.items = items;
+      }
+      free_ordinals = (uint32_t *)realloc( cds_search.free, max_items * sizeof(uint32_t) );
+      if( free_ordinals != NULL )
+      {
+         cds_search.free = free_ordinals;
+      }
+      if( (items == NULL) || (free_ordinals == NULL) )
+      {
+         pthread_mutex_unlock( &cds_search.mutex );
+         logger_log( LOG_ERROR, LOG_MSG("Out of memory indexing an item") );
+         return CDS_501_ERROR;
+      }
+      cds_search.max_items = max_items;
+   }
+
+   /* Reusing ordinals keeps the bitmaps dense. */
+   if( cds_search.num_free > 0 )
+   {
+      ordinal = cds_search.free[--cds_search.num_free];
+   }
+   else
+   {
+      ordinal = cds_search.num_items++;
+   }
+   obj->ordinal = ordinal;
+   cds_search.items[ordinal] = obj;
+
+   if( bitmap_add( &cds_search.live, ordinal ) != BITMAP_SUCCESS )
+   {
+      res = CDS_501_ERROR;
+   }
+
+   for( prop = CDS_SEARCH_FIRST_FACET; prop < CDS_SEARCH_NUM_PROPS; prop++ )
+   {
+      facet = &cds_search.facets[prop - CDS_SEARCH_FIRST_FACET];
+      text = cds_search_text( obj, prop, buf, &len );
+      i = cds_facet_get( facet, (text != NULL) ? text : "", len );
+      if( (i < 0) || (bitmap_add( &facet->values[i].items, ordinal ) != BITMAP_SUCCESS) )
+      {
+         res = CDS_501_ERROR;
+      }
+   }
+
+   text = cds_search_text( obj, CDS_SEARCH_TITLE, buf, &len );
+   if( textindex_add( cds_search.titles, text, len, ordinal ) != TEXTINDEX_SUCCESS )
+   {
+      res = CDS_501_ERROR;
+   }
+
+   pthread_mutex_unlock( &cds_search.mutex );
+
+   if( res != CDS_SUCCESS )
+   {
+      /* Searches may miss it. */
+      logger_log( LOG_ERROR, LOG_MSG("Out of memory indexing an item") );
+   }
+   return res;
+} /* cds_search_add */
+
+/*
+ * Take an item about to be deleted out of the index.
+ *
+ * @param obj The item.
+ */
+static
+void cds_search_remove( cds_object *obj )
+{
+   char buf[CDS_SEARCH_TEXT_SIZE];
+   cds_facet *facet;
+   const char *text;
+   long len;
+   int prop;
+   int i;
+
+   pthread_mutex_lock( &cds_search.mutex );
+
+   if( (obj->ordinal < cds_search.num_items) && (cds_search.items[obj->ordinal] == obj) )
+   {
+      bitmap_remove( &cds_search.live, obj->ordinal );
+
+      for( prop = CDS_SEARCH_FIRST_FACET; prop < CDS_SEARCH_NUM_PROPS; prop++ )
+      {
+         facet = &cds_search.facets[prop - CDS_SEARCH_FIRST_FACET];
+         text = cds_search_text( obj, prop, buf, &len );
+         if( text == NULL )
+         {
+            text = "";
+         }
+         i = cds_facet_find( facet, text, len, cds_search_hash(text, len) );
+         if( i >= 0 )
+         {
+            bitmap_remove( &facet->values[i].items, obj->ordinal );
+         }
+      }
+
+      text = cds_search_text( obj, CDS_SEARCH_TITLE, buf, &len );
+      textindex_remove( cds_search.titles, text, len, obj->ordinal );
+
+      cds_search.items[obj->ordinal] = NULL;
+      cds_search.free[cds_search.num_free++] = obj->ordinal;
+   }
+
+   pthread_mutex_unlock( &cds_search.mutex );
+} /* cds_search_remove */
+
+/*
+ * Check whether a text contains a value, ignoring case.
+ */
+static
+int cds_search_contains( const char *text, long len, const char *value )
+{
+   long value_len = (long)strlen( value );
+   long i;
+
+   for( i = 0; i + value_len <= len; i++ )
+   {
+      if( cds_search_compare( text + i, len - i, value, 1 ) == 0 )
+      {
+         return 1;
+      }
+   }
+   return 0;
+} /* cds_search_contains */
+
+/*
+ * Check a property text against a relational operator.
+ *
+ * @param text The text, empty if the property is missing.
+ * @param len The text length.
+ * @param op The SEARCH_* relational operator.
+ * @param value The value to compare the text with.
+ * @return Non zero if the text matches.
+ */
+static
+int cds_search_match( const char *text, long len, int op, const char *value )
+{
+   int res;
+
+   switch( op )
+   {
+      case SEARCH_EXISTS:
+         return (len > 0) == (cds_search_compare( value, (long)strlen(value), "true", 0 ) == 0);
+
+      case SEARCH_CONTAINS:
+         return cds_search_contains( text, len, value );
+
+      case SEARCH_DOES_NOT_CONTAIN:
+         return !cds_search_contains( text, len, value );
+
+      case SEARCH_DERIVED_FROM:
+         /* "object.item" is derived from by "object.item.audioItem" only. */
+         res = (long)strlen( value );
+         return (cds_search_compare( text, len, value, 1 ) == 0) && 
+                ((len == res) || (text[res] == '.'));
+
+      default:
+         break;
+   }
+
+   res = cds_search_compare( text, len, value, 0 );
+   switch( op )
+   {
+      case SEARCH_EQUAL:         return res == 0;
+      case SEARCH_NOT_EQUAL:     return res != 0;
+      case SEARCH_LESS:          return res < 0;
+      case SEARCH_LESS_EQUAL:    return res <= 0;
+      case SEARCH_GREATER:       return res > 0;
+      case SEARCH_GREATER_EQUAL: return res >= 0;
+      default:                   return 0;
+   }
+} /* cds_search_match */
+
+/*
+ * Get the items matching a relational expression on a facet:
+ * the union of the bitmaps of the values that match it. With a
+ * name index, only the values it returns are checked for contains.
+ * Must be called with the search mutex locked.
+ */
+static
+int cds_search_facet( cds_facet *facet, int op, const char *value, arena *a, bitmap *set )
+{
+   const bitmap **maps;
+   textindex_set candidates;
+   int count;
+   int i, j;
+
+   bitmap_init( set );
+
+   if( op == SEARCH_EQUAL )
+   {
+      i = cds_facet_find( facet, value, (long)strlen(value), cds_search_hash(value, (long)strlen(value)) );
+      if( i >= 0 )
+      {
+         *set = facet->values[i].items;
+      }
+      return CDS_SUCCESS;
+   }
+
+   maps = (const bitmap **)arena_alloc( a, (facet->num_values + 1) * sizeof(bitmap *) );
+   if( maps == NULL )
+   {
+      return CDS_501_ERROR;
+   }
+
+   /* Every value is a candidate, unless the index has fewer. */
+   candidates.ids = NULL;
+   candidates.count = facet->num_values;
+   if( (op == SEARCH_CONTAINS) && (facet->names != NULL) )
+   {
+      switch( textindex_find( facet->names, value, TEXTINDEX_SUBSTRING, a, &candidates ) )
+      {
+         case TEXTINDEX_SUCCESS:
+            break;
+
+         case TEXTINDEX_NO_WORDS:
+            candidates.ids = NULL;
+            candidates.count = facet->num_values;
+            break;
+
+         case TEXTINDEX_TOO_SHORT:
+            logger_log( LOG_ERROR, LOG_MSG("Search value %s is too short"), value );
+            return CDS_708_ERROR;
+
+         default:
+            return CDS_501_ERROR;
+      }
+   }
+
+   count = 0;
+   for( j = 0; j < candidates.count; j++ )
+   {
+      i = (candidates.ids != NULL) ? (int)candidates.ids[j] : j;
+      if( (facet->values[i].items.num_containers > 0) && 
+          cds_search_match( facet->values[i].text, facet->values[i].len, op, value ) )
+      {
+         maps[count++] = &facet->values[i].items;
+      }
+   }
+
+   return (bitmap_or_many( maps, count, a, set ) == BITMAP_SUCCESS) ? CDS_SUCCESS : CDS_501_ERROR;
+} /* cds_search_facet */
+
+/*
+ * Get the items whose title matches a relational expression. 
+ * The words of contains, = and derivedfrom values narrow the
+ * candidates down, then each candidate is checked.
+ * Must be called with the search mutex locked.
+ */
+static
+int cds_search_titles( int op, const char *value, arena *a, bitmap *set )
+{
+   char buf[CDS_SEARCH_TEXT_SIZE];
+   textindex_set candidates;
+   const char *text;
+   long len;
+   int res;
+   int i, n;
+
+   res = TEXTINDEX_NO_WORDS;
+   if( op == SEARCH_CONTAINS )
+   {
+      res = textindex_find( cds_search.titles, value, TEXTINDEX_SUBSTRING, a, &candidates );
+   }
+   else if( (op == SEARCH_EQUAL) || (op == SEARCH_DERIVED_FROM) )
+   {
+      res = textindex_find( cds_search.titles, value, TEXTINDEX_WORDS, a, &candidates );
+   }
+
+   if( res == TEXTINDEX_TOO_SHORT )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Search value %s is too short"), value );
+      return CDS_708_ERROR;
+   }
+   if( res == TEXTINDEX_NO_WORDS )
+   {
+      /* Every item is a candidate. */
+      candidates.count = (int)bitmap_count( &cds_search.live );
+      candidates.ids = (uint32_t *)arena_alloc( a, (candidates.count + 1) * sizeof(uint32_t) );
+      if( candidates.ids == NULL )
+      {
+         return CDS_501_ERROR;
+      }
+      bitmap_select( &cds_search.live, 0, candidates.count, candidates.ids );
+      res = TEXTINDEX_SUCCESS;
+   }
+   if( res != TEXTINDEX_SUCCESS )
+   {
+      return CDS_501_ERROR;
+   }
+
+   for( i = 0, n = 0; i < candidates.count; i++ )
+   {
+      text = cds_search_text( cds_search.items[candidates.ids[i]], CDS_SEARCH_TITLE, buf, &len );
+      if( cds_search_match( text, len, op, value ) )
+      {
+         candidates.ids[n++] = candidates.ids[i];
+      }
+   }
+
+   return (bitmap_from_array( candidates.ids, n, a, set ) == BITMAP_SUCCESS) ? CDS_SUCCESS : CDS_501_ERROR;
+} /* cds_search_titles */
+
+/*
+ * Evaluate a SearchCriteria expression. Boolean operators are 
+ * bitmap operations, and negations are the items not matching 
+ * the positive expression.
+ * Must be called with the search mutex locked.
+ *
+ * @param expr The expression.
+ * @param a The arena the result is allocated from.
+ * @param set Receives the ordinals of the matching items. It
+ *    may share memory with the index, and is only valid until
+ *    the search mutex is released.
+ * @return CDS_SUCCESS, CDS_708_ERROR for an unsupported property
+ *    or a contains value too short to be looked up, or 
+ *    CDS_501_ERROR if out of memory.
+ */
+static
+int cds_search_eval( search_expr *expr, arena *a, bitmap *set )
+{
+   bitmap left, right;
+   int prop;
+   SEARCH_OP op;
+   int res;
+   int i;
+
+   switch( expr->op )
+   {
+      case SEARCH_ALL:
+         *set = cds_search.live;
+         return CDS_SUCCESS;
+
+      case SEARCH_AND:
+      case SEARCH_OR:
+         if( ((res = cds_search_eval( expr->left, a, &left )) != CDS_SUCCESS) ||
+             ((res = cds_search_eval( expr->right, a, &right )) != CDS_SUCCESS) )
+         {
+            return res;
+         }
+         res = (expr->op == SEARCH_AND) ? bitmap_and( &left, &right, a, set ) : 
+                                          bitmap_or( &left, &right, a, set );
+         return (res == BITMAP_SUCCESS) ? CDS_SUCCESS : CDS_501_ERROR;
+
+      default:
+         break;
+   }
+
+   for( i = 0; cds_search_names[i].name != NULL; i++ )
+   {
+      if( strcmp( cds_search_names[i].name, expr->property ) == 0 )
+      {
+         break;
+      }
+   }
+   if( cds_search_names[i].name == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Unsupported search property %s"), expr->property );
+      return CDS_708_ERROR;
+   }
+   prop = cds_search_names[i].prop;
+
+   op = expr->op;
+   if( op == SEARCH_NOT_EQUAL ) op = SEARCH_EQUAL;
+   if( op == SEARCH_DOES_NOT_CONTAIN ) op = SEARCH_CONTAINS;
+
+   if( prop >= CDS_SEARCH_FIRST_FACET )
+   {
+      res = cds_search_facet( &cds_search.facets[prop - CDS_SEARCH_FIRST_FACET], op, expr->value, a, &left );
+   }
+   else
+   {
+      res = cds_search_titles( op, expr->value, a, &left );
+   }
+   if( res != CDS_SUCCESS )
+   {
+      return res;
+   }
+
+   if( op == expr->op )
+   {
+      *set = left;
+      return CDS_SUCCESS;
+   }
+   return (bitmap_andnot( &cds_search.live, &left, a, set ) == BITMAP_SUCCESS) ? CDS_SUCCESS : CDS_501_ERROR;
+} /* cds_search_eval */
+
+/* cds_sort_compare for qsort, search results from any folder. */
+static
+int cds_search_qsort_compare( const void *a, const void *b )
+{
+   cds_object *obj_a = *(cds_object **)a;
+   cds_object *obj_b = *(cds_object **)b;
+   int res;
+
+   res = cds_sort_compare( obj_a, obj_b, cds_sort_current );
+   if( res == 0 )
+   {
+      res = (obj_a->ordinal > obj_b->ordinal) - (obj_a->ordinal < obj_b->ordinal);
+   }
+   return res;
+} /* cds_search_qsort_compare */
+
+
+/*---------------------------------------------------------------------------
+ *
+ * cds_object operations
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Return the slot of an item type in the folder counts,
+ * or -1 if the type is not counted.
+ */
+static
+int cds_item_type_slot( ITEM_TYPE item_type )
+{
+   int slot;
+
+   for( slot = 0; slot < CDS_NUM_ITEM_TYPES; slot++ )
+   {
+      if( item_type == (ITEM_TYPE)(1 << slot) ) return slot;
+   }
+   return -1;
+} /* cds_item_type_slot */
+
+/*
+ * Add (or take away) the contribution of an object to
+ * the counts of its parent and of all of its ancestors.
+ *
+ * @param obj The object being added or deleted. It must
+ *    already be linked to its parent.
+ * @param sign 1 when adding the object, -1 when deleting it.
+ */
+static
+void cds_update_counts( cds_object *obj, int sign )
+{
+   cds_object *folder;
+   int objects;
+   int slot;
+
+   if( obj->type == CDS_OBJ_ITEM )
+   {
+      objects = 1;
+      slot = cds_item_type_slot( obj->item->type );
+      if( slot >= 0 )
+      {
+         obj->parent->direct_counts[slot] += sign;
+         for( folder = obj->parent; folder != NULL; folder = folder->parent )
+         {
+            folder->total_counts[slot] += sign;
+         }
+      }
+   }
+   else
+   {
+      /* A folder brings in its whole subtree. */
+      objects = 1 + obj->total_children;
+      for( folder = obj->parent; folder != NULL; folder = folder->parent )
+      {
+         for( slot = 0; slot < CDS_NUM_ITEM_TYPES; slot++ )
+         {
+            folder->total_counts[slot] += sign * obj->total_counts[slot];
+         }
+      }
+   }
+
+   for( folder = obj->parent; folder != NULL; folder = folder->parent )
+   {
+      folder->total_children += sign * objects;
+   }
+} /* cds_update_counts */
 
-/**
- * A structure with the Browse action
- * request information.
+/*
+ * Move the update IDs on after the children of a folder changed.
+ * The parent of the folder shows its childCount, so it changes too.
+ *
+ * @param folder The folder.
  */
-typedef struct browse_request
+static
+void cds_container_changed( cds_object *folder )
 {
-   char *ObjectID;
-   enum {
-      BrowseMetadata,
-      BrowseDirectChildren
-   } BrowseFlag;
-   char *Filter;
-   int StartingIndex;
-   int RequestedCount;
-   char *SortCriteria;
-} browse_request;
+   cds_system_update_id++;
 
+   folder->update_id = cds_system_update_id;
+   if( folder->parent != NULL )
+   {
+      folder->parent->update_id = cds_system_update_id;
+   }
+} /* cds_container_changed */
 
 /*
- * State Variables definitions
+ * Append an object to the children of a folder.
+ *
+ * @param parent The folder.
+ * @param obj The object to be added.
+ * @return CDS_SUCCESS, or an error if out of memory.
  */
+static
+int cds_add_child( cds_object *parent, cds_object *obj )
+{
+   if( parent->num_children == parent->max_children )
+   {
+      int max_children = (parent->max_children == 0) ? 4 : parent->max_children * 2;
+      cds_object **children;
 
-/* No support of search strings for the time being. */
-#define CDS_SEARCH_CAPABILITIES ""
+      children = (cds_object **)realloc( parent->children, max_children * sizeof(cds_object *) );
+      if( children == NULL )
+      {
+         logger_log( LOG_ERROR, LOG_MSG("Out of memory adding a child object") );
+         return CDS_501_ERROR;
+      }
+      parent->children = children;
+      parent->max_children = max_children;
+   }
 
-/* No support of sort strings for the time being. */
-#define CDS_SORT_CAPABILITIES ""
+   obj->parent = parent;
+   obj->index = parent->num_children;
+   parent->children[parent->num_children++] = obj;
+   cds_sort_insert( parent, obj );
 
-/* Static system update ID. */
-#define CDS_SYSTEM_UPDATE_ID "1"
+   cds_update_counts( obj, 1 );
 
-/*---------------------------------------------------------------------------
- *
- * cds_object operations
- *
- *--------------------------------------------------------------------------*/
+   cds_container_changed( parent );
+   if( obj->type == CDS_OBJ_FOLDER )
+   {
+      obj->update_id = cds_system_update_id;
+   }
+
+   return CDS_SUCCESS;
+} /* cds_add_child */
 
 /*
  * Delete an object from the tree.
  * Deletion does not free memory associated with
  * cds_object being deleted. It is up to the application
  * to free the memory, as in 
- *    free( cds_del_object(obj) );
+ *    cds_free_object( cds_del_object(obj) );
+ * Deleting the last child of a folder is the cheapest,
+ * the others are shifted down one position.
  *
  * @param obj A pointer to the cds_object to be deleted.
  * @return A pointer to the cds_object deleted.
@@ -150,37 +2152,151 @@ cds_object *cds_del_object( cds_object *obj )
 {
    if( obj != NULL )
    {
-      if( obj->previous != NULL )
-      {
-         obj->previous->next = obj->next;
-      }
+      cds_object *parent = obj->parent;
+      int i;
 
-      if( obj->next != NULL )
+      cds_update_counts( obj, -1 );
+      cds_sort_remove( parent, obj );
+      if( obj->type == CDS_OBJ_ITEM )
       {
-         obj->next->previous = obj->previous;
+         cds_search_remove( obj );
+         cds_file_index_remove( obj );
       }
 
-      if( obj->parent->first_child == obj )
-      {
-         obj->parent->first_child = NULL;
-      }
-      if( obj->parent->last_child == obj )
+      for( i = obj->index; i < parent->num_children-1; i++ )
       {
-         obj->parent->last_child = obj->previous;
+         parent->children[i] = parent->children[i+1];
+         parent->children[i]->index = i;
       }
+      parent->num_children -= 1;
+
+      cds_container_changed( parent );
 
-      obj->parent->num_children -= 1;
+      cds_index_remove( obj );
    }
 
    return obj;
 } /* cds_del_object */
 
+/*
+ * Free an object deleted from the tree.
+ *
+ * @param obj The object, or NULL.
+ */
+static
+void cds_free_object( cds_object *obj )
+{
+   int i;
+
+   if( obj == NULL )
+   {
+      return;
+   }
+
+   if( obj->type == CDS_OBJ_FOLDER )
+   {
+      cds_sort_drop_orders( obj );
+      free( obj->children );
+   }
+   free( obj->sort_keys );
+   for( i = 0; i < CDS_FRAGMENT_SLOTS; i++ )
+   {
+      cds_blob_release( obj->fragments[i].blob );
+   }
+   free( obj );
+} /* cds_free_object */
+
+/*
+ * Get a page of the children of a folder, as for the
+ * StartingIndex and RequestedCount Browse arguments.
+ *
+ * @param folder The folder.
+ * @param start The index of the first child in the page.
+ * @param count The maximum number of children in the page,
+ *    0 for all of the children from start on.
+ * @param page Receives the address of the first child in 
+ *    the page. Valid until the folder is modified.
+ * @return The number of children in the page.
+ */
+static
+int cds_get_children( cds_object *folder, int start, int count, cds_object ***page )
+{
+   int available;
+
+   *page = NULL;
+   if( (start < 0) || (start >= folder->num_children) )
+   {
+      return 0;
+   }
+
+   available = folder->num_children - start;
+   if( (count <= 0) || (count > available) )
+   {
+      count = available;
+   }
+   *page = folder->children + start;
+
+   return count;
+} /* cds_get_children */
+
+/*
+ * Get a page of the children of a folder in the order of a
+ * SortCriteria. The page is copied to the arena, as the order
+ * may change once the sort mutex is released.
+ *
+ * @param folder The folder.
+ * @param criteria The criteria, with at least one key.
+ * @param start The index of the first child in the page.
+ * @param count The maximum number of children in the page,
+ *    0 for all of the children from start on.
+ * @param a The arena to copy the page to.
+ * @param page Receives the address of the first child in the page.
+ * @return The number of children in the page, or -1 if out of memory.
+ */
+static
+int cds_get_sorted_children( cds_object *folder, const cds_sort_criteria *criteria, 
+                             int start, int count, arena *a, cds_object ***page )
+{
+   cds_sort_order *order;
+   cds_object **copy;
+
+   count = cds_get_children( folder, start, count, page );
+   if( count == 0 )
+   {
+      return 0;
+   }
+
+   copy = (cds_object **)arena_alloc( a, count * sizeof(cds_object *) );
+   if( copy == NULL )
+   {
+      return -1;
+   }
+
+   pthread_mutex_lock( &cds_sort_mutex );
+   order = cds_sort_get_order( folder, criteria );
+   if( order != NULL )
+   {
+      memcpy( copy, order->children + start, count * sizeof(cds_object *) );
+   }
+   pthread_mutex_unlock( &cds_sort_mutex );
+
+   if( order == NULL )
+   {
+      return -1;
+   }
+
+   *page = copy;
+   return count;
+} /* cds_get_sorted_children */
+
 /*
  * Count the number of item_type items underneath a certain
- * root node. 
+ * root node. Counts are maintained as the tree changes, 
+ * so this does not visit the tree.
  *
  * @param root The root node to start the search from.
- * @param item_type The item type to search for
+ * @param item_type The item types to search for, or 
+ *    ITEM_UNDEFINED to count all objects, folders included.
  * @param recurse If true, function will count in the 
  *    entire tree underneath the root node.
  * @return The number of children found.
@@ -188,35 +2304,22 @@ cds_object *cds_del_object( cds_object *obj )
 static
 int cds_count_children( cds_object *root, ITEM_TYPE item_type, int recurse )
 {
-   cds_object *child;
+   int *counts;
    int count = 0;
+   int slot;
 
-   child = root->first_child;
-   while( child != NULL )
+   if( item_type == ITEM_UNDEFINED )
    {
-      if( item_type == ITEM_UNDEFINED )
-      {
-         count++;
-      }
+      return recurse ? root->total_children : root->num_children;
+   }
 
-      switch(child->type)
+   counts = recurse ? root->total_counts : root->direct_counts;
+   for( slot = 0; slot < CDS_NUM_ITEM_TYPES; slot++ )
+   {
+      if( item_type & (1 << slot) )
       {
-         case CDS_OBJ_FOLDER:
-            if( recurse ) 
-            {
-               count += cds_count_children( child, item_type, recurse );
-            }
-            break;
-
-         case CDS_OBJ_ITEM:
-            if( child->item->type & item_type )
-            {
-               count++;
-            }
-            break;
+         count += counts[slot];
       }
-
-      child = child->next;
    }
 
    return count;
@@ -272,43 +2375,25 @@ cds_object *cds_find_item_tree( item_info *item )
 } /* find_item_tree */
 
 /*
- * Search a folder object ID via a depth-first visit of the tree. 
- * To be changed into a breadth-first maybe?
+ * Find a folder object by ID.
  *
- * @param id A pointer tp The cds_object ID. The cds_object to be found must
+ * @param id A pointer to the cds_object ID. The cds_object to be found must
  *    be a CDS_OBJ_FOLDER or the search will not succeed.
- * @param The root node to start the search from.
+ * @param tree The virtual tree to look into, or NULL for any tree.
  * @return The cds_object corresponding to that ID.
  */
 static
-cds_object *cds_find_folder_id( OBJECT_ID *id, cds_object *root )
+cds_object *cds_find_folder_id( OBJECT_ID *id, cds_object *tree )
 {
-   if( root == NULL )
-   {
-      root = &root_tree;
-   }
-   if( strcmp(root->id, *id) == 0 )
-   {
-      return root;
-   }
-   else
-   {
-      cds_object *child;
+   cds_object *obj;
 
-      child = root->first_child;
-      while( child != NULL )
-      {
-         /* Just search underneath a folder. */
-         if( (child->type == CDS_OBJ_FOLDER) && cds_find_folder_id(id, child) )
-         {
-            return child;
-         }
-
-         child = child->next;
-      }
+   obj = cds_find_object( *id, (tree != NULL) ? cds_tree_slot(tree) : -1 );
+   if( (obj == NULL) || (obj->type != CDS_OBJ_FOLDER) )
+   {
+      return NULL;
    }
 
-   return NULL;
+   return obj;
 } /* cds_find_folder_id */
 
 /*
@@ -384,24 +2469,36 @@ cds_object *cds_add_item( item_info *item, OBJECT_ID *parent_id )
     * Create the new node. 
     */
    new_object = (cds_object *)calloc( 1, sizeof(cds_object) );
-   new_object->parent = real_parent;
-   new_object->previous = real_parent->last_child; /* Add it to the end of the parent's children list. */
+   if( new_object == NULL )
+   {
+      return NULL;
+   }
    new_object->item = item;
 
-   /* Update pointers to first and last child. */
-   if( real_parent->first_child == NULL )
+   if( cds_index_add( new_object, cds_tree_slot(real_tree) ) != CDS_SUCCESS )
    {
-      real_parent->first_child = new_object;
-      real_parent->last_child = real_parent->first_child;
+      free( new_object );
+      return NULL;
    }
-   else
+
+   /* Add it to the end of the parent's children. */
+   if( cds_add_child( real_parent, new_object ) != CDS_SUCCESS )
    {
-      real_parent->last_child->next = new_object;
-      real_parent->last_child = new_object;
+      cds_index_remove( new_object );
+      free( new_object );
+      return NULL;
    }
 
-   /* Update the number of direct children for this node. */
-   real_parent->num_children += 1;
+   /* An item the index has no room for can still be browsed. */
+   cds_search_add( new_object );
+   cds_file_index_add( new_object );
+
+   /* 
+    * Video items get their time index built in the
+    * background: adding items, and the first Browse, 
+    * never wait for a file to be scanned.
+    */
+   indexer_submit( item );
 
    return new_object;
 } /* cds_add_item */
@@ -432,6 +2529,7 @@ OBJECT_ID *cds_add_folder( char *path, char *name, OBJECT_ID *parent_id )
    cds_object *curr_tree = NULL;
    cds_object *real_parent = NULL;
    ITEM_ID digest;
+   int i;
 
    /* No point in adding if the path/name are invalid! */
    if( (path == NULL) || (path[0] == 0) || 
@@ -456,8 +2554,9 @@ OBJECT_ID *cds_add_folder( char *path, char *name, OBJECT_ID *parent_id )
     * make sure the folder exists in each of the three
     * directories - or cds_add_item will fail!
     */
-   for( curr_tree = root_tree.first_child; curr_tree != NULL; curr_tree = curr_tree->next )
+   for( i = 0; i < root_tree.num_children; i++ )
    {
+      curr_tree = root_tree.children[i];
       if( strcmp(*parent_id, root_tree.id) == 0 )
       {
          real_parent = curr_tree;
@@ -482,26 +2581,27 @@ OBJECT_ID *cds_add_folder( char *path, char *name, OBJECT_ID *parent_id )
        * of the found real parent in the current tree.
        */
       new_folder = (cds_object *)calloc( 1, sizeof(cds_object) );
+      if( new_folder == NULL )
+      {
+         return NULL;
+      }
       new_folder->type = CDS_OBJ_FOLDER;
       new_folder->name = name;
       strcpy( new_folder->id, digest );
-      new_folder->parent = real_parent;
-      new_folder->previous = real_parent->last_child; /* Add it to the end of the parent's children list. */
 
-      /* Update pointers to first and last child. */
-      if( real_parent->first_child == NULL )
+      if( cds_index_add( new_folder, cds_tree_slot(curr_tree) ) != CDS_SUCCESS )
       {
-         real_parent->first_child = new_folder;
-         real_parent->last_child = real_parent->first_child;
+         free( new_folder );
+         return NULL;
       }
-      else
+
+      /* Add it to the end of the parent's children. */
+      if( cds_add_child( real_parent, new_folder ) != CDS_SUCCESS )
       {
-         real_parent->last_child->next = new_folder;
-         real_parent->last_child = new_folder;
+         cds_index_remove( new_folder );
+         free( new_folder );
+         return NULL;
       }
-
-      /* Update number of children for this node. */
-      real_parent->num_children += 1;
    }
 
    return &new_folder->id;
@@ -516,17 +2616,21 @@ OBJECT_ID *cds_add_folder( char *path, char *name, OBJECT_ID *parent_id )
 static
 void cds_reset_tree( cds_object *root )
 {
-   cds_object *obj = root->first_child;
-   while( obj != NULL )
+   cds_object *obj;
+
+   /* Nothing to keep sorted any more. */
+   cds_sort_drop_orders( root );
+
+   /* Last to first, so that no child is ever shifted. */
+   while( root->num_children > 0 )
    {
+      obj = root->children[root->num_children-1];
       if( obj->type == CDS_OBJ_FOLDER )
       {
          cds_reset_tree( obj );
       }
 
-      free( cds_del_object( obj ) );
-
-      obj = root->first_child;
+      cds_free_object( cds_del_object( obj ) );
    }
 } /* cds_reset_tree */
 
@@ -548,18 +2652,337 @@ void cds_print_tree( cds_object *node, int indent )
    }
    else
    {
-      cds_object *child;
       printf( "%s (%s)\n", node->name, node->id );
 
-      child = node->first_child;
-      while( child != NULL )
+      for( i = 0; i < node->num_children; i++ )
+      {
+         cds_print_tree(node->children[i], indent+1);
+      }
+   }
+}
+
+
+
+/*---------------------------------------------------------------------------
+ *
+ * Browse response cache
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Control points browse the same pages over and over, every time
+ * a screen is visited again. Rendered BrowseResponse bodies are 
+ * kept in a bounded LRU cache keyed by the request arguments, so
+ * that a repeated Browse costs a hash lookup: the response is 
+ * sent straight from the cached buffer, which it holds a 
+ * reference to until then.
+ *
+ * Each entry remembers the update ID its response was rendered 
+ * at: the ContainerUpdateID of the browsed container, or the 
+ * SystemUpdateID for an item. Any change to the tree moves the 
+ * IDs on, and entries rendered before it never match again.
+ */
+
+#define CDS_CACHE_MAX_ENTRIES 256
+#define CDS_CACHE_MAX_BYTES (4*1024*1024)
+#define CDS_CACHE_BUCKETS 512   /* A power of two */
+
+typedef struct cds_cache_entry cds_cache_entry;
+struct cds_cache_entry
+{
+   unsigned long hash;
+   char *key;              /* Stored right after the entry */
+   unsigned long update_id;
+   cds_blob *response;
+
+   /* Bucket chain, and LRU list from the most recently used. */
+   cds_cache_entry *chain;
+   cds_cache_entry *prev;
+   cds_cache_entry *next;
+};
+
+static struct
+{
+   pthread_mutex_t mutex;
+   cds_cache_entry *buckets[CDS_CACHE_BUCKETS];
+   cds_cache_entry *first;
+   cds_cache_entry *last;
+   int count;
+   long bytes;
+} cds_cache;
+
+/*
+ * The update ID a Browse response depends on, which is also 
+ * the UpdateID it returns: the ContainerUpdateID for a 
+ * container, the SystemUpdateID for an item.
+ */
+#define cds_browse_update_id(obj) \
+   (((obj)->type == CDS_OBJ_FOLDER) ? (obj)->update_id : cds_system_update_id)
+
+/*
+ * Build the cache key of a Browse request. The ObjectID
+ * length is part of it, so that the key is unambiguous.
+ * There is no client dialect in it: actions are not told who
+ * the client is, and the DIDL-Lite only depends on the request
+ * arguments and on the server address, so every client gets
+ * the same response. Anything added to the DIDL-Lite on a per
+ * client basis (protocolInfo, resource filtering) must be 
+ * added to the key too.
+ *
+ * @param browse_req The browse request.
+ * @param a The arena to allocate the key from.
+ * @return The key, or NULL if out of memory.
+ */
+static
+char *cds_cache_key( browse_request *browse_req, arena *a )
+{
+   char *key;
+
+   key = (char *)arena_alloc( a, strlen(browse_req->ObjectID) + strlen(browse_req->SortCriteria) + 64 );
+   if( key != NULL )
+   {
+      sprintf( key, "%d/%x/%d/%d/%d:%s%s", 
+               (int)browse_req->BrowseFlag, browse_req->Filter, 
+               browse_req->StartingIndex, browse_req->RequestedCount, 
+               (int)strlen(browse_req->ObjectID), browse_req->ObjectID, 
+               browse_req->SortCriteria );
+   }
+
+   return key;
+} /* cds_cache_key */
+
+/*
+ * Build the cache key of a Search request. It cannot be
+ * mistaken for a Browse key, which starts with a digit.
+ *
+ * @param search_req The search request.
+ * @param a The arena to allocate the key from.
+ * @return The key, or NULL if out of memory.
+ */
+static
+char *cds_search_cache_key( search_request *search_req, arena *a )
+{
+   char *key;
+
+   key = (char *)arena_alloc( a, strlen(search_req->ContainerID) + strlen(search_req->SearchCriteria) + 
+                                 strlen(search_req->SortCriteria) + 64 );
+   if( key != NULL )
+   {
+      sprintf( key, "S/%x/%d/%d/%d:%s%d:%s%s", 
+               search_req->Filter, search_req->StartingIndex, search_req->RequestedCount, 
+               (int)strlen(search_req->ContainerID), search_req->ContainerID, 
+               (int)strlen(search_req->SearchCriteria), search_req->SearchCriteria, 
+               search_req->SortCriteria );
+   }
+
+   return key;
+} /* cds_search_cache_key */
+
+/*
+ * Take an entry out of its bucket and of the LRU list.
+ * Must be called with the cache locked.
+ */
+static
+void cds_cache_unlink( cds_cache_entry *entry )
+{
+   cds_cache_entry **link;
+
+   link = &cds_cache.buckets[entry->hash & (CDS_CACHE_BUCKETS-1)];
+   while( *link != entry )
+   {
+      link = &(*link)->chain;
+   }
+   *link = entry->chain;
+
+   if( entry->prev != NULL ) entry->prev->next = entry->next;
+   else cds_cache.first = entry->next;
+   if( entry->next != NULL ) entry->next->prev = entry->prev;
+   else cds_cache.last = entry->prev;
+
+   cds_cache.count--;
+   cds_cache.bytes -= entry->response->length;
+} /* cds_cache_unlink */
+
+/*
+ * Free an entry once unlinked. Responses still being sent
+ * keep the buffer alive.
+ */
+static
+void cds_cache_free_entry( cds_cache_entry *entry )
+{
+   cds_blob_release( entry->response );
+   free( entry );
+} /* cds_cache_free_entry */
+
+/*
+ * Find the entry for a key. Must be called with the cache locked.
+ */
+static
+cds_cache_entry *cds_cache_find( const char *key, unsigned long hash )
+{
+   cds_cache_entry *entry;
+
+   for( entry = cds_cache.buckets[hash & (CDS_CACHE_BUCKETS-1)]; entry != NULL; entry = entry->chain )
+   {
+      if( (entry->hash == hash) && (strcmp(entry->key, key) == 0) )
+      {
+         return entry;
+      }
+   }
+
+   return NULL;
+} /* cds_cache_find */
+
+/*
+ * Look a Browse response up in the cache. The response is made
+ * of the cached buffer itself, referenced until it is released.
+ *
+ * @param key The request key.
+ * @param update_id The current update ID of the browsed object.
+ * @param a The arena to allocate the response part from.
+ * @param response Receives the response.
+ * @return 1 if found, 0 otherwise.
+ */
+static
+int cds_cache_get( const char *key, unsigned long update_id, arena *a, cds_response *response )
+{
+   cds_cache_entry *entry;
+   cds_response_part *part;
+   unsigned long hash = cds_id_hash( key );
+
+   part = (cds_response_part *)arena_alloc( a, sizeof(cds_response_part) );
+   if( part == NULL )
+   {
+      return 0;
+   }
+
+   pthread_mutex_lock( &cds_cache.mutex );
+
+   entry = cds_cache_find( key, hash );
+   if( (entry != NULL) && (entry->update_id != update_id) )
+   {
+      /* Rendered before the last change, drop it. */
+      cds_cache_unlink( entry );
+      cds_cache_free_entry( entry );
+      entry = NULL;
+   }
+
+   if( entry != NULL )
+   {
+      cds_blob_ref( entry->response );
+      part->data = entry->response->data;
+      part->length = entry->response->length;
+      part->owner = entry->response;
+
+      /* Most recently used. */
+      if( entry != cds_cache.first )
+      {
+         entry->prev->next = entry->next;
+         if( entry->next != NULL ) entry->next->prev = entry->prev;
+         else cds_cache.last = entry->prev;
+
+         entry->prev = NULL;
+         entry->next = cds_cache.first;
+         cds_cache.first->prev = entry;
+         cds_cache.first = entry;
+      }
+   }
+
+   pthread_mutex_unlock( &cds_cache.mutex );
+
+   if( entry == NULL )
+   {
+      return 0;
+   }
+
+   response->body = NULL;
+   response->length = part->length;
+   response->parts = part;
+   response->num_parts = 1;
+
+   return 1;
+} /* cds_cache_get */
+
+/*
+ * Store a Browse response in the cache, evicting the least
+ * recently used entries if needed.
+ *
+ * @param key The request key.
+ * @param update_id The update ID the response was rendered at.
+ * @param response The response.
+ */
+static
+void cds_cache_put( const char *key, unsigned long update_id, cds_response *response )
+{
+   cds_cache_entry *entry;
+   cds_cache_entry *old;
+   size_t key_len = strlen( key );
+   char *p;
+   int i;
+
+   /* Do not let a single huge page flush everything else. */
+   if( response->length > CDS_CACHE_MAX_BYTES / 16 )
+   {
+      return;
+   }
+
+   entry = (cds_cache_entry *)malloc( sizeof(cds_cache_entry) + key_len + 1 );
+   if( entry == NULL )
+   {
+      return;
+   }
+   entry->hash = cds_id_hash( key );
+   entry->key = (char *)(entry + 1);
+   memcpy( entry->key, key, key_len + 1 );
+   entry->update_id = update_id;
+
+   /* Gather the response parts in a single buffer. */
+   entry->response = cds_blob_new( response->body, response->length );
+   if( entry->response == NULL )
+   {
+      free( entry );
+      return;
+   }
+   if( response->parts != NULL )
+   {
+      p = entry->response->data;
+      for( i = 0; i < response->num_parts; i++ )
       {
-         cds_print_tree(child, indent+1);
-         child = child->next;
+         memcpy( p, response->parts[i].data, response->parts[i].length );
+         p += response->parts[i].length;
       }
    }
-}
 
+   pthread_mutex_lock( &cds_cache.mutex );
+
+   old = cds_cache_find( key, entry->hash );
+   if( old != NULL )
+   {
+      cds_cache_unlink( old );
+      cds_cache_free_entry( old );
+   }
+
+   entry->chain = cds_cache.buckets[entry->hash & (CDS_CACHE_BUCKETS-1)];
+   cds_cache.buckets[entry->hash & (CDS_CACHE_BUCKETS-1)] = entry;
+
+   entry->prev = NULL;
+   entry->next = cds_cache.first;
+   if( cds_cache.first != NULL ) cds_cache.first->prev = entry;
+   else cds_cache.last = entry;
+   cds_cache.first = entry;
+
+   cds_cache.count++;
+   cds_cache.bytes += entry->response->length;
+
+   while( (cds_cache.count > CDS_CACHE_MAX_ENTRIES) || (cds_cache.bytes > CDS_CACHE_MAX_BYTES) )
+   {
+      old = cds_cache.last;
+      cds_cache_unlink( old );
+      cds_cache_free_entry( old );
+   }
+
+   pthread_mutex_unlock( &cds_cache.mutex );
+} /* cds_cache_put */
 
 
 /*-------------------------------------------------------------------------
@@ -568,6 +2991,8 @@ void cds_print_tree( cds_object *node, int indent )
  *
  *------------------------------------------------------------------------*/
 
+static
+void cds_build_action_index();
 
 /*
  * Initialize the CDS.
@@ -584,23 +3009,73 @@ int cds_init()
     * Build the tree structure with the three virtual
     * trees for audio, photo and video.
     */
-   root_tree.first_child = &audio_tree;
-   root_tree.last_child = &video_tree;
+   root_tree.children = root_tree_children;
    root_tree.num_children = 3;
+   root_tree.max_children = 3;
+   root_tree.total_children = 3;
 
    audio_tree.parent = &root_tree;
-   audio_tree.next = &photo_tree;
+   audio_tree.index = 0;
    
    photo_tree.parent = &root_tree;
-   photo_tree.previous = &audio_tree;
-   photo_tree.next = &video_tree;
+   photo_tree.index = 1;
 
    video_tree.parent = &root_tree;
-   video_tree.previous = &photo_tree;
+   video_tree.index = 2;
+
+   /* The tree roots can be looked up by ID too. */
+   cds_index_add( &root_tree, CDS_TREE_AUDIO );
+   cds_index_add( &root_tree, CDS_TREE_PHOTO );
+   cds_index_add( &root_tree, CDS_TREE_VIDEO );
+   cds_index_add( &audio_tree, CDS_TREE_AUDIO );
+   cds_index_add( &photo_tree, CDS_TREE_PHOTO );
+   cds_index_add( &video_tree, CDS_TREE_VIDEO );
+
+   cds_build_action_index();
+
+   pthread_mutex_init( &cds_cache.mutex, NULL );
+   pthread_mutex_init( &cds_fragment_mutex, NULL );
+   pthread_mutex_init( &cds_sort_mutex, NULL );
+   pthread_mutex_init( &cds_search.mutex, NULL );
+   pthread_mutex_init( &cds_file_index.mutex, NULL );
+
+   cds_search.titles = textindex_create();
+   cds_search.facets[CDS_SEARCH_ARTIST - CDS_SEARCH_FIRST_FACET].names = textindex_create();
+   cds_search.facets[CDS_SEARCH_ALBUM - CDS_SEARCH_FIRST_FACET].names = textindex_create();
+   cds_search.facets[CDS_SEARCH_GENRE - CDS_SEARCH_FIRST_FACET].names = textindex_create();
+   if( (cds_search.titles == NULL) || 
+       (cds_search.facets[CDS_SEARCH_ARTIST - CDS_SEARCH_FIRST_FACET].names == NULL) ||
+       (cds_search.facets[CDS_SEARCH_ALBUM - CDS_SEARCH_FIRST_FACET].names == NULL) ||
+       (cds_search.facets[CDS_SEARCH_GENRE - CDS_SEARCH_FIRST_FACET].names == NULL) )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Out of memory creating the search index") );
+      return CDS_501_ERROR;
+   }
+   cds_set_search_min_length( 0 );
 
    return CDS_SUCCESS;
 } /* cds_init */
 
+int cds_set_search_min_length( int len )
+{
+   int i;
+
+   pthread_mutex_lock( &cds_search.mutex );
+
+   textindex_set_limits( cds_search.titles, len, CDS_SEARCH_MAX_POSTINGS );
+   for( i = 0; i < CDS_SEARCH_NUM_FACETS; i++ )
+   {
+      if( cds_search.facets[i].names != NULL )
+      {
+         textindex_set_limits( cds_search.facets[i].names, len, CDS_SEARCH_MAX_POSTINGS );
+      }
+   }
+
+   pthread_mutex_unlock( &cds_search.mutex );
+
+   return CDS_SUCCESS;
+} /* cds_set_search_min_length */
+
 /*
  * Re-initialize the CDS.
  *
@@ -615,6 +3090,53 @@ int cds_reinit()
    return CDS_SUCCESS;
 } /* cds_reinit */
 
+/**
+ * Gets the streaming information of the item shared from a 
+ * certain file. The item is only looked at under the file index
+ * mutex, since a rescan can free it as soon as it is released.
+ *
+ * @param filename The item file name.
+ * @param info Will receive the streaming information.
+ * @return CDS_SUCCESS, or CDS_701_ERROR if the file is not shared.
+ */
+int cds_get_stream_info( const char *filename, cds_stream_info *info )
+{
+   cds_object *obj = NULL;
+
+   pthread_mutex_lock( &cds_file_index.mutex );
+
+   if( cds_file_index.num_buckets > 0 )
+   {
+      obj = cds_file_index.buckets[cds_id_hash(filename) & (cds_file_index.num_buckets-1)];
+      while( (obj != NULL) && (strcmp(obj->item->filename, filename) != 0) )
+      {
+         obj = obj->file_chain;
+      }
+   }
+
+   if( obj != NULL )
+   {
+      info->duration = item_is_photo( obj->item ) ? 0 : obj->item->duration;
+      info->bitrate = obj->item->bitrate;
+      info->time_index = (obj->item->time_index != NULL) ? timeindex_retain( obj->item->time_index ) : NULL;
+   }
+
+   pthread_mutex_unlock( &cds_file_index.mutex );
+
+   return (obj != NULL) ? CDS_SUCCESS : CDS_701_ERROR;
+} /* cds_get_stream_info */
+
+/**
+ * Gives back the time index retained by cds_get_stream_info.
+ *
+ * @param info The streaming information.
+ */
+void cds_release_stream_info( cds_stream_info *info )
+{
+   timeindex_free( info->time_index );
+   info->time_index = NULL;
+} /* cds_release_stream_info */
+
 /**
  * Returns the SCPD description of the CDS as per
  * the UPnP specifications.
@@ -689,6 +3211,61 @@ char *cds_get_scpd()
       "      </argumentList>"
       "    </action>"
       "    <action>"
+      "      <name>Search</name>"
+      "      <argumentList>"
+      "        <argument>"
+      "          <name>ContainerID</name>"
+      "          <direction>in</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_ObjectID</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>SearchCriteria</name>"
+      "          <direction>in</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_SearchCriteria</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>Filter</name>"
+      "          <direction>in</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_Filter</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>StartingIndex</name>"
+      "          <direction>in</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_Index</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>RequestedCount</name>"
+      "          <direction>in</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_Count</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>SortCriteria</name>"
+      "          <direction>in</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_SortCriteria</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>Result</name>"
+      "          <direction>out</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_Result</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>NumberReturned</name>"
+      "          <direction>out</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_Count</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>TotalMatches</name>"
+      "          <direction>out</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_Count</relatedStateVariable>"
+      "        </argument>"
+      "        <argument>"
+      "          <name>UpdateID</name>"
+      "          <direction>out</direction>"
+      "          <relatedStateVariable>A_ARG_TYPE_UpdateID</relatedStateVariable>"
+      "        </argument>"
+      "      </argumentList>"
+      "    </action>"
+      "    <action>"
       "      <name>GetSystemUpdateID</name>"
       "      <argumentList>"
       "        <argument>"
@@ -741,6 +3318,10 @@ char *cds_get_scpd()
       "      <dataType>string</dataType>"
       "    </stateVariable>"
       "    <stateVariable sendEvents=\"no\">"
+      "      <name>A_ARG_TYPE_SearchCriteria</name>"
+      "      <dataType>string</dataType>"
+      "    </stateVariable>"
+      "    <stateVariable sendEvents=\"no\">"
       "      <name>SortCapabilities</name>"
       "      <dataType>string</dataType>"
       "    </stateVariable>"
@@ -891,94 +3472,449 @@ SERVER: MS-Windows/XP UPnP/1.0 PROTOTYPE/1.0
 */
 
 /*
- * Parse the browse request XML into a browse request
- * structure.
- * Returns either CDS_SUCCESS or the UPnP error codes
- * for the Browse Action.
+ * Points an action response to a static buffer: 
+ * no copy, no length computation at run time.
+ */
+#define cds_static_response( response, buf ) \
+   ((response)->body = (buf), (response)->length = sizeof(buf)-1)
+
+/*
+ * Parse the browse request XML into a browse request
+ * structure. Arguments point into the request body, which
+ * is modified in the process.
+ * Returns either CDS_SUCCESS or the UPnP error codes
+ * for the Browse Action.
+ */
+static
+int cds_parse_browse_request( char *soap_action_body, browse_request *browse_req )
+{
+   soap_request soap_req;
+   char *value;
+
+   if( soap_parse_request( soap_action_body, (long)strlen(soap_action_body), &soap_req ) != SOAP_SUCCESS )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+
+   /* Check this is a Browse action. */
+   if( strcmp( soap_req.action, CDS_BROWSE_ACTION ) != 0 )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+
+   /* Get the ObjectID value. */
+   browse_req->ObjectID = soap_get_argument( &soap_req, "ObjectID" );
+   if( browse_req->ObjectID == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+
+   /* Get the BrowseFlag value. */
+   value = soap_get_argument( &soap_req, "BrowseFlag" );
+   if( value == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+   browse_req->BrowseFlag = (strcmp(value, "BrowseMetadata") == 0) ? BrowseMetadata : BrowseDirectChildren;
+
+   /* Get the Filter value, once and for all of the objects. */
+   value = soap_get_argument( &soap_req, "Filter" );
+   if( value == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+   browse_req->Filter = didl_parse_filter( value );
+
+   /* Get the StartingIndex value. */
+   value = soap_get_argument( &soap_req, "StartingIndex" );
+   if( value == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+   browse_req->StartingIndex = atoi( value );
+
+   /* Get the RequestedCount value. */
+   value = soap_get_argument( &soap_req, "RequestedCount" );
+   if( value == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+   browse_req->RequestedCount = atoi( value );
+
+   /* Get the SortCriteria value. */
+   browse_req->SortCriteria = soap_get_argument( &soap_req, "SortCriteria" );
+   if( browse_req->SortCriteria == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+
+   /* Unsupported sort properties make the request fail. */
+   return cds_parse_sort_criteria( browse_req->SortCriteria, &browse_req->Sort );
+} /* cds_parse_browse_request */
+
+/*
+ * Start of a BrowseResponse or a SearchResponse, up to the 
+ * DIDL-Lite result objects.
+ */
+#define CDS_RESULT_RESPONSE_HEADER(action) \
+   "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">" \
+      "<s:Body>" \
+         "<u:" action "Response xmlns:u=\"" CDS_SERVICE_TYPE "\">" \
+            "<Result>" \
+               DIDL_HEADER
+
+#define CDS_BROWSE_RESPONSE_HEADER CDS_RESULT_RESPONSE_HEADER( CDS_BROWSE_ACTION )
+#define CDS_SEARCH_RESPONSE_HEADER CDS_RESULT_RESPONSE_HEADER( CDS_SEARCH_ACTION )
+
+/* Expected size of a DIDL-Lite object, to size the fragment buffers. */
+#define CDS_DIDL_OBJECT_SIZE 768
+
+/*
+ * Folders are in each virtual tree under the same ID, so control
+ * points see them as "<tree>:<ID>": a folder reached from the 
+ * Video root is then browsed in the video tree. Items are in one
+ * tree only, and keep their ID.
+ */
+#define CDS_DIDL_ID_SIZE (sizeof(OBJECT_ID) + 2)
+
+/*
+ * Returns the virtual tree an object is in, or -1 for the
+ * root tree.
+ */
+static
+int cds_object_slot( cds_object *obj )
+{
+   while( (obj->parent != NULL) && (obj->parent != &root_tree) )
+   {
+      obj = obj->parent;
+   }
+   return cds_tree_slot( obj );
+} /* cds_object_slot */
+
+/*
+ * Find the object a Browse or Search request is about. Control
+ * points start browsing from object "0", which is the root.
+ *
+ * @param id The ObjectID or ContainerID argument.
+ * @return The object, or NULL.
+ */
+static
+cds_object *cds_browse_object( const char *id )
+{
+   cds_object *obj;
+
+   if( strcmp(id, DIDL_ROOT_ID) == 0 )
+   {
+      return &root_tree;
+   }
+
+   if( (id[0] >= '0') && (id[0] < '0' + CDS_NUM_TREES) && (id[1] == ':') )
+   {
+      obj = cds_find_object( id + 2, id[0] - '0' );
+      return ((obj != NULL) && (obj->type == CDS_OBJ_FOLDER)) ? obj : NULL;
+   }
+
+   obj = cds_find_object( id, -1 );
+   return ((obj != NULL) && (obj->type == CDS_OBJ_ITEM)) ? obj : NULL;
+} /* cds_browse_object */
+
+/*
+ * Get the ID of an object as shown to control points.
+ *
+ * @param obj The object.
+ * @param buf A CDS_DIDL_ID_SIZE bytes buffer, for folder IDs.
+ * @return The ID.
+ */
+static
+const char *cds_didl_id( cds_object *obj, char *buf )
+{
+   int slot;
+
+   if( obj == &root_tree )
+   {
+      return DIDL_ROOT_ID;
+   }
+   if( obj->type != CDS_OBJ_FOLDER )
+   {
+      return obj->item->id;
+   }
+
+   slot = cds_object_slot( obj );
+   if( slot < 0 )
+   {
+      return obj->id;
+   }
+   sprintf( buf, "%d:%s", slot, obj->id );
+   return buf;
+} /* cds_didl_id */
+
+/*
+ * Write the DIDL-Lite element for an object.
+ *
+ * @param w The DIDL-Lite writer.
+ * @param obj The object.
+ */
+static
+void cds_write_didl_object( didl_writer *w, cds_object *obj )
+{
+   char id[CDS_DIDL_ID_SIZE];
+   char parent_buf[CDS_DIDL_ID_SIZE];
+   const char *parent_id;
+
+   parent_id = (obj->parent != NULL) ? cds_didl_id(obj->parent, parent_buf) : DIDL_ROOT_PARENT_ID;
+   if( obj->type == CDS_OBJ_FOLDER )
+   {
+      didl_write_container( w, cds_didl_id(obj, id), parent_id, obj->num_children, obj->name );
+   }
+   else
+   {
+      didl_write_item( w, obj->item, parent_id );
+   }
+} /* cds_write_didl_object */
+
+/*
+ * The version of an object its DIDL-Lite fragments are rendered
+ * at. A container changes with its children, which moves its
+ * ContainerUpdateID on; items do not change once added.
+ */
+#define cds_fragment_version(obj) \
+   (((obj)->type == CDS_OBJ_FOLDER) ? (obj)->update_id : 0)
+
+/*
+ * Drop the buffer references of response parts.
+ *
+ * @param parts The parts.
+ * @param num_parts The number of parts.
+ */
+static
+void cds_release_parts( cds_response_part *parts, int num_parts )
+{
+   int i;
+
+   for( i = 0; i < num_parts; i++ )
+   {
+      cds_blob_release( (cds_blob *)parts[i].owner );
+      parts[i].owner = NULL;
+   }
+} /* cds_release_parts */
+
+/*
+ * Get the DIDL-Lite fragments of a page of objects. Cached 
+ * fragments are shared, and the missing or outdated ones are
+ * rendered and cached for the next requests.
+ *
+ * @param objects The objects.
+ * @param count The number of objects.
+ * @param filter The DIDL_PROP_* properties to render.
+ * @param a The arena to render to.
+ * @param parts Receives one part per object, each holding a
+ *    reference to the fragment buffer.
+ * @return CDS_SUCCESS, or CDS_501_ERROR if out of memory.
+ */
+static
+int cds_get_fragments( cds_object **objects, int count, unsigned int filter, arena *a, cds_response_part *parts )
+{
+   int slot = (filter == DIDL_PROP_ALL) ? 0 : 1;
+   cds_fragment *fragment;
+   cds_fragment *rendered;
+   int *missing;
+   int num_missing = 0;
+   didl_writer w;
+   int i, k;
+
+   pthread_mutex_lock( &cds_fragment_mutex );
+   for( i = 0; i < count; i++ )
+   {
+      fragment = &objects[i]->fragments[slot];
+      if( (fragment->blob != NULL) && (fragment->filter == filter) && 
+          (fragment->version == cds_fragment_version(objects[i])) )
+      {
+         cds_blob_ref( fragment->blob );
+         parts[i].data = fragment->blob->data;
+         parts[i].length = fragment->blob->length;
+         parts[i].owner = fragment->blob;
+      }
+      else
+      {
+         parts[i].data = NULL;
+         parts[i].length = 0;
+         parts[i].owner = NULL;
+         num_missing++;
+      }
+   }
+   pthread_mutex_unlock( &cds_fragment_mutex );
+
+   if( num_missing == 0 )
+   {
+      return CDS_SUCCESS;
+   }
+
+   missing = (int *)arena_alloc( a, num_missing * sizeof(int) );
+   rendered = (cds_fragment *)arena_alloc( a, num_missing * sizeof(cds_fragment) );
+   if( (missing == NULL) || (rendered == NULL) )
+   {
+      cds_release_parts( parts, count );
+      return CDS_501_ERROR;
+   }
+
+   /* 
+    * Render outside of the lock. The versions are taken first, 
+    * so that a fragment racing with a change is not kept.
+    */
+   for( i = 0, k = 0; i < count; i++ )
+   {
+      if( parts[i].data == NULL )
+      {
+         missing[k] = i;
+         rendered[k].filter = filter;
+         rendered[k].version = cds_fragment_version( objects[i] );
+         k++;
+      }
+   }
+
+   for( k = 0; k < num_missing; k++ )
+   {
+      i = missing[k];
+
+      didl_writer_init( &w, a, CDS_DIDL_OBJECT_SIZE );
+      w.filter = filter;
+      cds_write_didl_object( &w, objects[i] );
+      if( w.error )
+      {
+         logger_log( LOG_ERROR, LOG_MSG("Out of memory writing the Browse response") );
+         cds_release_parts( parts, count );
+         return CDS_501_ERROR;
+      }
+
+      /* Without a buffer to cache, send it from the arena anyway. */
+      rendered[k].blob = cds_blob_new( w.buf, w.length );
+      parts[i].data = (rendered[k].blob != NULL) ? rendered[k].blob->data : w.buf;
+      parts[i].length = w.length;
+      parts[i].owner = rendered[k].blob;
+   }
+
+   pthread_mutex_lock( &cds_fragment_mutex );
+   for( k = 0; k < num_missing; k++ )
+   {
+      i = missing[k];
+      fragment = &objects[i]->fragments[slot];
+      if( (rendered[k].blob != NULL) && 
+          (rendered[k].version == cds_fragment_version(objects[i])) &&
+          ((fragment->blob == NULL) || (fragment->filter != filter) || (fragment->version != rendered[k].version)) )
+      {
+         cds_blob_release( fragment->blob );
+         cds_blob_ref( rendered[k].blob );
+         *fragment = rendered[k];
+      }
+   }
+   pthread_mutex_unlock( &cds_fragment_mutex );
+
+   return CDS_SUCCESS;
+} /* cds_get_fragments */
+
+/*
+ * Put a BrowseResponse or a SearchResponse together from the 
+ * start of the envelope, the DIDL-Lite fragments of the result 
+ * objects and the end of the envelope, and point the action
+ * response to its parts.
+ *
+ * @param search Non zero for a SearchResponse.
+ * @param objects The result objects.
+ * @param number_returned The number of result objects.
+ * @param total_matches The number of objects matching the request.
+ * @param update_id The UpdateID to return.
+ * @param filter The DIDL_PROP_* properties to render.
+ * @param a The arena the response is allocated from.
+ * @param BrowseResult The browse or search result.
+ * @return CDS_SUCCESS, or CDS_501_ERROR if out of memory.
  */
 static
-int cds_parse_browse_request( char *soap_action_body, browse_request *browse_req )
+int cds_result_response( int search, cds_object **objects, int number_returned, int total_matches, 
+                         unsigned long update_id, unsigned int filter, arena *a, 
+                         cds_response *BrowseResult )
 {
-   xmlNode *body_node = NULL,
-           *browse_node = NULL,
-           *node = NULL;
+   cds_response_part *parts;
+   didl_writer w;
+   int num_parts = number_returned + 2;
+   int i;
 
-   body_node = xml_get_soap_body( soap_action_body );
-   if( body_node == NULL )
+   parts = (cds_response_part *)arena_alloc( a, num_parts * sizeof(cds_response_part) );
+   if( parts == NULL )
    {
-      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
-      return CDS_402_ERROR;
+      logger_log( LOG_ERROR, LOG_MSG("Out of memory writing the Browse response") );
+      return CDS_501_ERROR;
    }
 
-   /* Get the Browse node. */
-   browse_node = xml_first_node_by_name( body_node, "Browse" );
-   if( browse_node == NULL )
+   if( search )
    {
-      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
-      return CDS_402_ERROR;
+      parts[0].data = CDS_SEARCH_RESPONSE_HEADER;
+      parts[0].length = sizeof(CDS_SEARCH_RESPONSE_HEADER) - 1;
    }
-
-   /* Get the ObjectID value. */
-   node = xml_first_node_by_name( browse_node, "ObjectID" );
-   if( node == NULL )
+   else
    {
-      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
-      return CDS_402_ERROR;
+      parts[0].data = CDS_BROWSE_RESPONSE_HEADER;
+      parts[0].length = sizeof(CDS_BROWSE_RESPONSE_HEADER) - 1;
    }
-   browse_req->ObjectID = xmlNodeGetContent( node );
+   parts[0].owner = NULL;
 
-   /* Get the BrowseFlag value. */
-   node = xml_first_node_by_name( browse_node, "BrowseFlag" );
-   if( node == NULL )
+   if( cds_get_fragments( objects, number_returned, filter, a, parts + 1 ) != CDS_SUCCESS )
    {
-      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
-      return CDS_402_ERROR;
+      return CDS_501_ERROR;
    }
-   browse_req->BrowseFlag = (strcmp(xmlNodeGetContent(node), "BrowseMetadata") == 0) ? BrowseMetadata : BrowseDirectChildren;
 
-   /* Get the Filter value. */
-   node = xml_first_node_by_name( browse_node, "Filter" );
-   if( node == NULL )
+   didl_writer_init( &w, a, 256 );
+   didl_write_literal( &w, DIDL_FOOTER "</Result><NumberReturned>" );
+   didl_write_int( &w, number_returned );
+   didl_write_literal( &w, "</NumberReturned><TotalMatches>" );
+   didl_write_int( &w, total_matches );
+   didl_write_literal( &w, "</TotalMatches><UpdateID>" );
+   didl_write_int( &w, update_id );
+   if( search )
    {
-      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
-      return CDS_402_ERROR;
+      didl_write_literal( &w, "</UpdateID></u:SearchResponse></s:Body></s:Envelope>" );
    }
-   browse_req->Filter = xmlNodeGetContent( node );
-
-   /* Get the StartingIndex value. */
-   node = xml_first_node_by_name( browse_node, "StartingIndex" );
-   if( node == NULL )
+   else
    {
-      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
-      return CDS_402_ERROR;
+      didl_write_literal( &w, "</UpdateID></u:BrowseResponse></s:Body></s:Envelope>" );
    }
-   browse_req->StartingIndex = atoi( xmlNodeGetContent( node ) );
 
-   /* Get the RequestedCount value. */
-   node = xml_first_node_by_name( browse_node, "RequestedCount" );
-   if( node == NULL )
+   if( w.error )
    {
-      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
-      return CDS_402_ERROR;
+      logger_log( LOG_ERROR, LOG_MSG("Out of memory writing the Browse response") );
+      cds_release_parts( parts, num_parts );
+      return CDS_501_ERROR;
    }
-   browse_req->RequestedCount = atoi( xmlNodeGetContent( node ) );
 
-   /* Get the SortCriteria value. */
-   node = xml_first_node_by_name( browse_node, "SortCriteria" );
-   if( node == NULL )
+   parts[num_parts-1].data = w.buf;
+   parts[num_parts-1].length = w.length;
+   parts[num_parts-1].owner = NULL;
+
+   BrowseResult->body = NULL;
+   BrowseResult->length = 0;
+   for( i = 0; i < num_parts; i++ )
    {
-      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
-      return CDS_402_ERROR;
+      BrowseResult->length += parts[i].length;
    }
-   browse_req->SortCriteria = xmlNodeGetContent( node );
+   BrowseResult->parts = parts;
+   BrowseResult->num_parts = num_parts;
 
    return CDS_SUCCESS;
-} /* cds_parse_browse_request */
+} /* cds_result_response */
 
 /*
  * Browse action - BrowseMetadata flag processing.
  *
  * @param browse_req The browse request structure.
+ * @param obj The object to browse.
+ * @param a The arena the response is allocated from.
  * @BrowseResult The browse result, including the envelope, in XML 
  *    format.
  * @return CDS_SUCCESS is successful, or the UPnP defined error codes
@@ -990,42 +3926,17 @@ int cds_parse_browse_request( char *soap_action_body, browse_request *browse_req
  *    720 (Cannot process the request)
  */
 static
-int cds_browse_metadata( browse_request *browse_req, char **BrowseResult )
-{
-   /* Canned response for the time being. */
-   static char *canned_response = 
-      "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
-         "<s:Body>"
-            "<u:BrowseResponse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
-            "<Result>"
-               "&lt;DIDL-Lite xmlns=&quot;urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/&quot; xmlns:dc=&quot;http://purl.org/dc/elements/1.1/&quot; xmlns:upnp=&apos;urn:schemas-upnp-org:metadata-1-0/upnp/&apos; xmlns:dlna=&quot;urn:schemas-dlna-org:metadata-1-0/&quot; xmlns:sec=&quot;http://www.sec.co.kr/&quot;&gt;"
-                  "&lt;item id=&quot;A_F_0000_217&quot; parentID=&quot;A_F_0000&quot; restricted=&quot;1&quot;&gt;"
-                     "&lt;dc:title&gt;Zecchino d&amp;apos;oro - Un poco di zucchero&lt;/dc:title&gt;"
-                     "&lt;upnp:class&gt;object.item.audioItem&lt;/upnp:class&gt;"
-                     "&lt;upnp:album&gt;Nessun album&lt;/upnp:album&gt;"
-                     "&lt;sec:dcmInfo&gt;MOODSCORE=30322,MOODID=1,CREATIONDATE=1239615310,YEAR=2009&lt;/sec:dcmInfo&gt;"
-                     "&lt;dc:date&gt;2009-04-13&lt;/dc:date&gt;"
-                     "&lt;dc:creator&gt;Nessun cantante&lt;/dc:creator&gt;"
-                     "&lt;upnp:genre&gt;Other&lt;/upnp:genre&gt;"
-                     "&lt;res protocolInfo=&quot;http-get:*:audio/mpeg:DLNA.ORG_PN=MP3;DLNA.ORG_OP=01;DLNA.ORG_CI=0;DLNA.ORG_FLAGS=01500000000000000000000000000000&quot; size=&quot;3673383&quot; duration=&quot;0:03:03&quot;&gt;http://192.168.1.102:53235/A_F_0000_217.MP3&lt;/res&gt;"
-                  "&lt;/item&gt;"
-               "&lt;/DIDL-Lite&gt;"
-            "</Result>"
-            "<NumberReturned>1</NumberReturned>"
-            "<TotalMatches>1</TotalMatches>"
-            "<UpdateID>0</UpdateID>"
-            "</u:BrowseResponse>"
-         "</s:Body>"
-      "</s:Envelope>";
-
-   *BrowseResult = strdup( canned_response );
-   return CDS_SUCCESS;
+int cds_browse_metadata( browse_request *browse_req, cds_object *obj, arena *a, cds_response *BrowseResult )
+{
+   return cds_result_response( 0, &obj, 1, 1, cds_browse_update_id(obj), browse_req->Filter, a, BrowseResult );
 } /* cds_browse_metadata */
 
 /*
  * Browse action - BrowseDirectChildren flag processing.
  *
  * @param browse_req The browse request structure.
+ * @param folder The object to browse the children of.
+ * @param a The arena the response is allocated from.
  * @BrowseResult The browse result, including the envelope, in XML 
  *    format.
  * @return CDS_SUCCESS is successful, or the UPnP defined error codes
@@ -1037,32 +3948,193 @@ int cds_browse_metadata( browse_request *browse_req, char **BrowseResult )
  *    720 (Cannot process the request)
  */
 static
-int cds_browse_direct_children( browse_request *browse_req, char **BrowseResult )
-{
-   /* Canned response for the time being. */
-   static char *canned_response = 
-      "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
-         "<s:Body>"
-            "<u:BrowseResponse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
-               "<Result>"
-                  "&lt;DIDL-Lite xmlns=&quot;urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/&quot; xmlns:dc=&quot;http://purl.org/dc/elements/1.1/&quot; xmlns:upnp=&apos;urn:schemas-upnp-org:metadata-1-0/upnp/&apos; xmlns:dlna=&quot;urn:schemas-dlna-org:metadata-1-0/&quot; xmlns:sec=&quot;http://www.sec.co.kr/&quot;&gt;"
-                     "&lt;container id=&quot;A_F_0000&quot; parentID=&quot;A_F&quot; childCount=&quot;218&quot; restricted=&quot;1&quot;&gt;"
-                        "&lt;dc:title&gt;Canzoni Bimbi&lt;/dc:title&gt;"
-                        "&lt;upnp:class&gt;object.container&lt;/upnp:class&gt;"
-                     "&lt;/container&gt;"
-                  "&lt;/DIDL-Lite&gt;"
-               "</Result>"
-               "<NumberReturned>1</NumberReturned>"
-               "<TotalMatches>1</TotalMatches>"
-               "<UpdateID>0</UpdateID>"
-            "</u:BrowseResponse>"
-         "</s:Body>"
-      "</s:Envelope>";
-
-   *BrowseResult = strdup( canned_response );
-   return CDS_SUCCESS;
+int cds_browse_direct_children( browse_request *browse_req, cds_object *folder, arena *a, cds_response *BrowseResult )
+{
+   cds_object **page = NULL;
+   int count;
+   int total;
+
+   /* Items have no children. */
+   count = 0;
+   total = 0;
+   if( (folder->type == CDS_OBJ_FOLDER) && (browse_req->Sort.num_keys > 0) )
+   {
+      count = cds_get_sorted_children( folder, &browse_req->Sort, browse_req->StartingIndex, 
+                                       browse_req->RequestedCount, a, &page );
+      if( count < 0 )
+      {
+         return CDS_501_ERROR;
+      }
+      total = folder->num_children;
+   }
+   else if( folder->type == CDS_OBJ_FOLDER )
+   {
+      count = cds_get_children( folder, browse_req->StartingIndex, browse_req->RequestedCount, &page );
+      total = folder->num_children;
+   }
+
+   return cds_result_response( 0, page, count, total, cds_browse_update_id(folder), browse_req->Filter, a, BrowseResult );
 } /* cds_browse_direct_children */
 
+/*
+ * Parse the search request XML into a search request
+ * structure. Arguments point into the request body, which
+ * is modified in the process; the SearchCriteria is left 
+ * to cds_Search.
+ * Returns either CDS_SUCCESS or the UPnP error codes
+ * for the Search Action.
+ */
+static
+int cds_parse_search_request( char *soap_action_body, search_request *search_req )
+{
+   soap_request soap_req;
+   char *filter;
+   char *start;
+   char *count;
+
+   if( soap_parse_request( soap_action_body, (long)strlen(soap_action_body), &soap_req ) != SOAP_SUCCESS )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+
+   /* Check this is a Search action. */
+   if( strcmp( soap_req.action, CDS_SEARCH_ACTION ) != 0 )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+
+   search_req->ContainerID = soap_get_argument( &soap_req, "ContainerID" );
+   search_req->SearchCriteria = soap_get_argument( &soap_req, "SearchCriteria" );
+   filter = soap_get_argument( &soap_req, "Filter" );
+   start = soap_get_argument( &soap_req, "StartingIndex" );
+   count = soap_get_argument( &soap_req, "RequestedCount" );
+   search_req->SortCriteria = soap_get_argument( &soap_req, "SortCriteria" );
+   if( (search_req->ContainerID == NULL) || (search_req->SearchCriteria == NULL) || 
+       (filter == NULL) || (start == NULL) || (count == NULL) || 
+       (search_req->SortCriteria == NULL) )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
+      return CDS_402_ERROR;
+   }
+
+   search_req->Filter = didl_parse_filter( filter );
+   search_req->StartingIndex = atoi( start );
+   search_req->RequestedCount = atoi( count );
+
+   /* Unsupported sort properties make the request fail. */
+   return cds_parse_sort_criteria( search_req->SortCriteria, &search_req->Sort );
+} /* cds_parse_search_request */
+
+/*
+ * The number of results in a page, as for the StartingIndex
+ * and RequestedCount arguments.
+ */
+static
+int cds_page_size( int total, int start, int requested )
+{
+   if( (start < 0) || (start >= total) )
+   {
+      return 0;
+   }
+   if( (requested <= 0) || (requested > total - start) )
+   {
+      return total - start;
+   }
+   return requested;
+} /* cds_page_size */
+
+/*
+ * Get a page of the items matching a search, among the 
+ * descendants of a container, in the order of the SortCriteria.
+ * Searching the whole tree in index order only takes the items
+ * of the page: the matches are counted in the index.
+ *
+ * @param search_req The search request.
+ * @param expr The parsed SearchCriteria.
+ * @param container The container to search.
+ * @param a The arena the result is allocated from.
+ * @param page Receives the items in the page.
+ * @param total Receives the number of matching items.
+ * @return The number of items in the page, or the UPnP error code.
+ */
+static
+int cds_search_items( search_request *search_req, search_expr *expr, cds_object *container, 
+                      arena *a, cds_object ***page, int *total )
+{
+   bitmap set;
+   uint32_t *ids;
+   cds_object **items = NULL;
+   cds_object *parent;
+   int whole_tree;
+   int start = 0;
+   int count = 0;
+   int res;
+   int i, n = 0;
+
+   whole_tree = (container == &root_tree) && (search_req->Sort.num_keys == 0);
+
+   pthread_mutex_lock( &cds_search.mutex );
+
+   res = cds_search_eval( expr, a, &set );
+   if( res == CDS_SUCCESS )
+   {
+      *total = count = (int)bitmap_count( &set );
+      if( whole_tree )
+      {
+         start = search_req->StartingIndex;
+         count = cds_page_size( count, start, search_req->RequestedCount );
+      }
+
+      ids = (uint32_t *)arena_alloc( a, (count + 1) * sizeof(uint32_t) );
+      items = (cds_object **)arena_alloc( a, (count + 1) * sizeof(cds_object *) );
+      res = ((ids != NULL) && (items != NULL)) ? CDS_SUCCESS : CDS_501_ERROR;
+   }
+
+   if( res == CDS_SUCCESS )
+   {
+      count = (int)bitmap_select( &set, (start > 0) ? start : 0, count, ids );
+      for( i = 0; i < count; i++ )
+      {
+         /* Everything is underneath the root. */
+         parent = cds_search.items[ids[i]]->parent;
+         while( (container != &root_tree) && (parent != NULL) && (parent != container) )
+         {
+            parent = parent->parent;
+         }
+         if( parent != NULL )
+         {
+            items[n++] = cds_search.items[ids[i]];
+         }
+      }
+   }
+
+   pthread_mutex_unlock( &cds_search.mutex );
+
+   if( res != CDS_SUCCESS )
+   {
+      return res;
+   }
+   if( whole_tree )
+   {
+      *page = items;
+      return n;
+   }
+
+   if( (search_req->Sort.num_keys > 0) && (n > 1) )
+   {
+      pthread_mutex_lock( &cds_sort_mutex );
+      cds_sort_current = &search_req->Sort;
+      qsort( items, n, sizeof(cds_object *), cds_search_qsort_compare );
+      pthread_mutex_unlock( &cds_sort_mutex );
+   }
+
+   *total = n;
+   *page = items + search_req->StartingIndex;
+   return cds_page_size( n, search_req->StartingIndex, search_req->RequestedCount );
+} /* cds_search_items */
+
 /**
  * Browse Action.
  *
@@ -1075,6 +4147,8 @@ int cds_browse_direct_children( browse_request *browse_req, char **BrowseResult
             </u:Browse>
          </s:Body>
       </s:Envelope>
+ * @param a The arena the request arguments and the response
+ *    are allocated from.
  * @param browse_result The BrowseResponse result body, including the envelope, in 
  *    XML format. E.g.
       <s:Envelope xmlns:s="http://schemas.xmlsoap.org/soap/envelope/" s:encodingStyle="http://schemas.xmlsoap.org/soap/encoding/">
@@ -1097,50 +4171,146 @@ int cds_browse_direct_children( browse_request *browse_req, char **BrowseResult
  *    709 (Unsupported or invalid sort criteria)
  *    720 (Cannot process the request)
  */
-int cds_Browse( char *soap_action_body, char **BrowseResponse )
+int cds_Browse( char *soap_action_body, arena *a, cds_response *BrowseResponse )
 {
    browse_request browse_req;
+   cds_object *obj;
+   unsigned long update_id;
+   char *key;
    int res;
 
-   if( (res = cds_parse_browse_request( soap_action_body, &browse_req )) == CDS_SUCCESS )
+   if( (res = cds_parse_browse_request( soap_action_body, &browse_req )) != CDS_SUCCESS )
    {
-      switch( browse_req.BrowseFlag )
-      {
-         case BrowseMetadata:
-            res = cds_browse_metadata( &browse_req, BrowseResponse );
-            break;
+      /* Build the error message in the browse response. */
+      return res;
+   }
 
-         case BrowseDirectChildren:
-            res = cds_browse_direct_children( &browse_req, BrowseResponse );
-            break;
+   obj = cds_browse_object( browse_req.ObjectID );
+   if( obj == NULL )
+   {
+      return CDS_701_ERROR;
+   }
+   update_id = cds_browse_update_id( obj );
 
-         default:
-            res = CDS_720_ERROR;
-            break;
-      }
-      return res;
+   /* Nothing changed since the same request was answered. */
+   key = cds_cache_key( &browse_req, a );
+   if( (key != NULL) && cds_cache_get( key, update_id, a, BrowseResponse ) )
+   {
+      return CDS_SUCCESS;
    }
-   else
+
+   switch( browse_req.BrowseFlag )
    {
-      /* Build the error message in the browse response. */
-      return res;
+      case BrowseMetadata:
+         res = cds_browse_metadata( &browse_req, obj, a, BrowseResponse );
+         break;
+
+      case BrowseDirectChildren:
+         res = cds_browse_direct_children( &browse_req, obj, a, BrowseResponse );
+         break;
+
+      default:
+         res = CDS_720_ERROR;
+         break;
+   }
+
+   if( (res == CDS_SUCCESS) && (key != NULL) )
+   {
+      cds_cache_put( key, update_id, BrowseResponse );
    }
+
+   return res;
 } /* cds_Browse */
 
+/**
+ * Search Action.
+ *
+ * @param soap_action_body The Search request body soap action, including 
+ *    the envelope, in XML format.
+ * @param a The arena the request arguments and the response
+ *    are allocated from.
+ * @param SearchResponse The SearchResponse result body, including the 
+ *    envelope, in XML format.
+ * @return CDS_SUCCESS is successful, or the UPnP defined error codes
+ *    for the Search action: 
+ *    402 (Invalid Args)
+ *    501 (Action Failed)
+ *    708 (Unsupported or invalid search criteria)
+ *    709 (Unsupported or invalid sort criteria)
+ *    710 (No such container)
+ *    720 (Cannot process the request)
+ */
+int cds_Search( char *soap_action_body, arena *a, cds_response *SearchResponse )
+{
+   search_request search_req;
+   search_expr *expr;
+   cds_object *container;
+   cds_object **items;
+   unsigned long update_id;
+   char *key;
+   int count;
+   int total;
+   int res;
+
+   if( (res = cds_parse_search_request( soap_action_body, &search_req )) != CDS_SUCCESS )
+   {
+      return res;
+   }
+
+   container = cds_browse_object( search_req.ContainerID );
+   if( (container == NULL) || (container->type != CDS_OBJ_FOLDER) )
+   {
+      return CDS_710_ERROR;
+   }
+
+   /* 
+    * Any change to the tree may change the result. The key
+    * is built before the SearchCriteria is parsed in place.
+    */
+   update_id = cds_system_update_id;
+   key = cds_search_cache_key( &search_req, a );
+   if( (key != NULL) && cds_cache_get( key, update_id, a, SearchResponse ) )
+   {
+      return CDS_SUCCESS;
+   }
+
+   if( search_parse( search_req.SearchCriteria, a, &expr ) != SEARCH_SUCCESS )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Invalid search criteria") );
+      return CDS_708_ERROR;
+   }
+
+   count = cds_search_items( &search_req, expr, container, a, &items, &total );
+   if( count < 0 )
+   {
+      return count;
+   }
+
+   res = cds_result_response( 1, items, count, total, container->update_id, search_req.Filter, a, SearchResponse );
+   if( (res == CDS_SUCCESS) && (key != NULL) )
+   {
+      cds_cache_put( key, update_id, SearchResponse );
+   }
+
+   return res;
+} /* cds_Search */
+
 /**
  * GetSearchCapabilities Action.
  *
+ * @param soap_action_body The request body, unused.
+ * @param a The request arena, unused.
  * @param GetSearchCapsResponse The GetSearchCapabilitiesResponse
- *    result body in XML format. This is a newly allocated buffer
- *    so memory must be freed after calling this function.
+ *    result body in XML format. It is a static buffer,
+ *    not to be freed.
  * @return CDS_SUCCESS is successful, or the UPnP defined error codes
  *    for the Browse action: 
  *    402 (Invalid Args)
  *    501 (Action Failed)
  */
-int cds_GetSearchCapabilities( char **GetSearchCapabilitiesResponse )
+int cds_GetSearchCapabilities( char *soap_action_body, arena *a, cds_response *GetSearchCapabilitiesResponse )
 {
-   static char *search_caps_response =  
+   static const char search_caps_response[] =  
        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
        "  <s:Body>"
        "    <u:GetSearchCapabilitiesResponse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
@@ -1149,7 +4319,10 @@ int cds_GetSearchCapabilities( char **GetSearchCapabilitiesResponse )
        "  </s:Body>"
        "</s:Envelope>";
 
-   *GetSearchCapabilitiesResponse = strdup( search_caps_response );
+   (void)soap_action_body;
+   (void)a;
+
+   cds_static_response( GetSearchCapabilitiesResponse, search_caps_response );
 
    return CDS_SUCCESS;
 } /* cds_GetSearchCapabilities */
@@ -1157,17 +4330,19 @@ int cds_GetSearchCapabilities( char **GetSearchCapabilitiesResponse )
 /**
  * GetSortCapabilities Action.
  *
+ * @param soap_action_body The request body, unused.
+ * @param a The request arena, unused.
  * @param GetSortCapabilitiesResponse The GetSortCapabilitiesResponse
- *    result body in XML format. This is a newly allocated buffer
- *    so memory must be freed after calling this function.
+ *    result body in XML format. It is a static buffer,
+ *    not to be freed.
  * @return CDS_SUCCESS is successful, or the UPnP defined error codes
  *    for the Browse action: 
  *    402 (Invalid Args)
  *    501 (Action Failed)
  */
-int cds_GetSortCapabilities( char **GetSearchCapabilitiesResponse )
+int cds_GetSortCapabilities( char *soap_action_body, arena *a, cds_response *GetSortCapabilitiesResponse )
 {
-   static char *sort_caps_response = 
+   static const char sort_caps_response[] = 
        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
        "  <s:Body>"
        "    <u:GetSortCapabilitiesResponse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
@@ -1176,7 +4351,10 @@ int cds_GetSortCapabilities( char **GetSearchCapabilitiesResponse )
        "  </s:Body>"
        "</s:Envelope>";
 
-   *GetSearchCapabilitiesResponse = strdup( sort_caps_response );
+   (void)soap_action_body;
+   (void)a;
+
+   cds_static_response( GetSortCapabilitiesResponse, sort_caps_response );
 
    return CDS_SUCCESS;
 } /* cds_GetSortCapabilities */
@@ -1184,26 +4362,36 @@ int cds_GetSortCapabilities( char **GetSearchCapabilitiesResponse )
 /**
  * GetSystemUpdateID Action.
  *
+ * @param soap_action_body The request body, unused.
+ * @param a The arena the response is allocated from.
  * @param GetSystemUpdateIDResponse The GetSystemUpdateIDResponse
- *    result body in XML format. This is a newly allocated buffer
- *    so memory must be freed after calling this function.
+ *    result body in XML format.
  * @return CDS_SUCCESS is successful, or the UPnP defined error codes
  *    for the Browse action: 
  *    402 (Invalid Args)
  *    501 (Action Failed)
  */
-int cds_GetSystemUpdateID( char **GetSystemUpdateIDResponse )
+int cds_GetSystemUpdateID( char *soap_action_body, arena *a, cds_response *GetSystemUpdateIDResponse )
 {
-   static char *sys_update_id_response = 
+   static const char sys_update_id_response[] = 
        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
        "  <s:Body>"
        "    <u:GetSystemUpdateIDResponse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
-       "      <Id>"CDS_SYSTEM_UPDATE_ID"</Id>"
+       "      <Id>%lu</Id>"
        "    </u:GetSystemUpdateIDResponse>"
        "  </s:Body>"
        "</s:Envelope>";            
+   char *body;
 
-   *GetSystemUpdateIDResponse = strdup( sys_update_id_response );
+   (void)soap_action_body;
+
+   body = (char *)arena_alloc( a, sizeof(sys_update_id_response) + 16 );
+   if( body == NULL )
+   {
+      return CDS_501_ERROR;
+   }
+   GetSystemUpdateIDResponse->body = body;
+   GetSystemUpdateIDResponse->length = sprintf( body, sys_update_id_response, cds_system_update_id );
 
    return CDS_SUCCESS;
 }
@@ -1241,6 +4429,9 @@ SERVER: MS-Windows/XP UPnP/1.0 PROTOTYPE/1.0
 </s:Envelope>
 */
 
+/* Samsung category types. */
+#define CDS_SEC_CATEGORY_MUSIC 22
+
 /**
  * X_GetObjectIDfromIndex Action. This I suppose is used by Samsung
  * MediaRenderer to map child number X to the internal ID used by
@@ -1260,6 +4451,7 @@ SERVER: MS-Windows/XP UPnP/1.0 PROTOTYPE/1.0
             </u:X_GetObjectIDfromIndex>
          </s:Body>
       </s:Envelope>
+ * @param a The arena the response is allocated from.
  * @param X_GetObjectIDfromIndexResponse The X_GetObjectIDfromIndexResponse
  *    result body in XML format. This is defined as, eg.
       <s:Envelope xmlns:s="http://schemas.xmlsoap.org/soap/envelope/" s:encodingStyle="http://schemas.xmlsoap.org/soap/encoding/">
@@ -1272,89 +4464,261 @@ SERVER: MS-Windows/XP UPnP/1.0 PROTOTYPE/1.0
  * @return CDS_SUCCESS is successful, or 402 otherwise. (Note this is
  *    not documented so we are just guessing a meaningful value).
  */
-int cds_X_GetObjectIDfromIndex( char *soap_action, char **X_GetObjectIDfromIndexResponse )
+
+int cds_X_GetObjectIDfromIndex( char *soap_action, arena *a, cds_response *X_GetObjectIDfromIndexResponse )
 {
-   xmlNode *body_node, *node;
+   static const char response_format[] = 
+       "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+       "<s:Body>"
+       "<u:X_GetObjectIDfromIndexResponse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
+       "<ObjectID>%s</ObjectID>"
+       "</u:X_GetObjectIDfromIndexResponse>"
+       "</s:Body>"
+       "</s:Envelope>";
+
+   /* Category types seen so far. */
+   static const struct
+   {
+      int type;
+      cds_object *tree;
+   } categories[] =
+   {
+      { CDS_SEC_CATEGORY_MUSIC, &audio_tree }
+   };
+
+   soap_request soap_req;
+   cds_object **page;
+   char id[CDS_DIDL_ID_SIZE];
+   char *response;
+   char *value;
+   unsigned int i;
    int cat_type;
    int index;
 
-   body_node = xml_get_soap_body( soap_action );
-   if( body_node == NULL )
+   X_GetObjectIDfromIndexResponse->body = NULL;
+   X_GetObjectIDfromIndexResponse->length = 0;
+
+   if( soap_parse_request( soap_action, (long)strlen(soap_action), &soap_req ) != SOAP_SUCCESS )
    {
       logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
       return CDS_402_ERROR;
    }
 
-   /* Get the X_GetObjectIDfromIndex node. */
-   node = xml_first_node_by_name( body_node, "X_GetObjectIDfromIndex" );
-   if( node == NULL )
+   /* Check this is a X_GetObjectIDfromIndex action. */
+   if( strcmp( soap_req.action, CDS_SEC_GET_OBJECT_ID_FROM_ID_ACTION ) != 0 )
    {
       logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
       return CDS_402_ERROR;
    }
 
-   /* Get the CategoryType and Index nodes. */
-   node = xml_first_node_by_name( node, "CategoryType" );
-   if( node == NULL )
+   /* Get the CategoryType and Index values. */
+   value = soap_get_argument( &soap_req, "CategoryType" );
+   if( value == NULL )
    {
       logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
       return CDS_402_ERROR;
    }
-   cat_type = atoi( xmlNodeGetContent(node) );
-   node = xml_next_sibling_by_name( node, "Index" );
-   if( node == NULL )
+   cat_type = atoi( value );
+   value = soap_get_argument( &soap_req, "Index" );
+   if( value == NULL )
    {
       logger_log( LOG_ERROR, LOG_MSG("Error while parsing XML message") );
       return CDS_402_ERROR;
    }
-   index = atoi( xmlNodeGetContent(node) );
+   index = atoi( value );
 
-   /*
-    * TBD: Figure out how to associate the category type/index to the object ID. 
+   /* 
+    * The category tells the virtual tree, the index is the 
+    * position of the child there: with the children kept in 
+    * an array this is a plain lookup.
     */
+   for( i = 0; i < sizeof(categories)/sizeof(categories[0]); i++ )
+   {
+      if( categories[i].type == cat_type ) break;
+   }
+   if( i == sizeof(categories)/sizeof(categories[0]) )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Unknown category type %d"), cat_type );
+      return CDS_402_ERROR;
+   }
+
+   if( cds_get_children( categories[i].tree, index, 1, &page ) != 1 )
+   {
+      return CDS_402_ERROR;
+   }
+
+   response = (char *)arena_alloc( a, sizeof(response_format) + CDS_DIDL_ID_SIZE );
+   if( response == NULL )
+   {
+      return CDS_501_ERROR;
+   }
+   X_GetObjectIDfromIndexResponse->body = response;
+   X_GetObjectIDfromIndexResponse->length = sprintf( response, response_format, cds_didl_id(page[0], id) );
 
    return CDS_SUCCESS;
 } /* cds_X_GetObjectIDfromIndex */
 
+/*----------------------------------------------------------------------------
+ *
+ * Action dispatch
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * An action handled by the CDS, keyed by the value of the 
+ * SOAPACTION header without its quotes: "<service type>#<name>".
+ */
+typedef struct cds_action
+{
+   const char *key;
+   cds_action_handler handler;
+   size_t key_len;
+   unsigned long hash;
+} cds_action;
+
+/* key_len and hash are filled in by cds_build_action_index(). */
+static cds_action cds_actions[] =
+{
+   { CDS_SERVICE_TYPE "#" CDS_BROWSE_ACTION, cds_Browse, 0, 0 },
+   { CDS_SERVICE_TYPE "#" CDS_SEARCH_ACTION, cds_Search, 0, 0 },
+   { CDS_SERVICE_TYPE "#" CDS_GET_SEARCH_CAPS_ACTION, cds_GetSearchCapabilities, 0, 0 },
+   { CDS_SERVICE_TYPE "#" CDS_GET_SORT_CAPS_ACTION, cds_GetSortCapabilities, 0, 0 },
+   { CDS_SERVICE_TYPE "#" CDS_GET_SYSTEM_UPDATE_ID_ACTION, cds_GetSystemUpdateID, 0, 0 },
+   { CDS_SERVICE_TYPE "#" CDS_SEC_GET_OBJECT_ID_FROM_ID_ACTION, cds_X_GetObjectIDfromIndex, 0, 0 }
+};
+#define CDS_NUM_ACTIONS (sizeof(cds_actions) / sizeof(cds_actions[0]))
+
+/*
+ * Open addressing hash index over cds_actions. The size is 
+ * a power of two and keeps the table at most half full.
+ */
+#define CDS_ACTION_INDEX_SIZE 16
+static cds_action *cds_action_index[CDS_ACTION_INDEX_SIZE];
+
+/*
+ * FNV-1a hash of the action key.
+ */
+static
+unsigned long cds_action_hash( const char *key, size_t len )
+{
+   unsigned long hash = 2166136261UL;
+
+   while( len-- > 0 )
+   {
+      hash ^= (unsigned char)*key++;
+      hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+   }
+   return hash;
+} /* cds_action_hash */
+
+/*
+ * Fills in the action index. Called once by cds_init,
+ * before any request can be dispatched.
+ */
+static
+void cds_build_action_index()
+{
+   unsigned int i;
+   unsigned long slot;
+
+   memset( cds_action_index, 0, sizeof(cds_action_index) );
+   for( i = 0; i < CDS_NUM_ACTIONS; i++ )
+   {
+      cds_actions[i].key_len = strlen( cds_actions[i].key );
+      cds_actions[i].hash = cds_action_hash( cds_actions[i].key, cds_actions[i].key_len );
+
+      slot = cds_actions[i].hash & (CDS_ACTION_INDEX_SIZE-1);
+      while( cds_action_index[slot] != NULL )
+      {
+         slot = (slot+1) & (CDS_ACTION_INDEX_SIZE-1);
+      }
+      cds_action_index[slot] = &cds_actions[i];
+   }
+} /* cds_build_action_index */
+
+/*
+ * Looks up the action named by a SOAPACTION header value.
+ * Returns NULL if the action is not supported.
+ */
+static
+cds_action *cds_find_action( const char *soap_action )
+{
+   const char *end;
+   cds_action *action;
+   unsigned long hash;
+   unsigned long slot;
+   size_t len;
+
+   /* The header value is a quoted string. */
+   while( (*soap_action == ' ') || (*soap_action == '"') ) soap_action++;
+   end = soap_action + strlen( soap_action );
+   while( (end > soap_action) && ((end[-1] == ' ') || (end[-1] == '"')) ) end--;
+   len = end - soap_action;
+
+   hash = cds_action_hash( soap_action, len );
+   slot = hash & (CDS_ACTION_INDEX_SIZE-1);
+   while( (action = cds_action_index[slot]) != NULL )
+   {
+      if( (action->hash == hash) && (action->key_len == len) && (memcmp(action->key, soap_action, len) == 0) )
+      {
+         return action;
+      }
+      slot = (slot+1) & (CDS_ACTION_INDEX_SIZE-1);
+   }
+   return NULL;
+} /* cds_find_action */
+
 /**
  * CDS Action dispatcher.
  *
  * @param soap_action The soap action string (the one in the HTTP header)
  * @param soap_action_body The soap action body, including the envelope, in XML format.
+ *    It is parsed in place, so its content is modified.
+ * @param a The arena to allocate from. It is reset by the caller
+ *    once the response has been sent.
  * @action_response The action response, including the envelope, in XML format.
  * @return CDS_SUCCESS if successful, or another value otherwise, depending on the
  *    UPnP error derived during the action processing.
  */
-int cds_dispatch_action( char *soap_action, char *soap_action_body, char **action_response )
+int cds_dispatch_action( char *soap_action, char *soap_action_body, arena *a, cds_response *action_response )
 {
-   if( strstr(soap_action, "#Browse") )
-   {
-      return cds_Browse( soap_action_body, action_response );
-   }
-   
-   if( strstr(soap_action, "#GetSortCapabilities") )
-   {
-      return cds_GetSortCapabilities( action_response );
-   }
+   cds_action *action;
 
-   if( strstr(soap_action, "#GetSearchCapabilities") )
+   action_response->body = NULL;
+   action_response->length = 0;
+   action_response->parts = NULL;
+   action_response->num_parts = 0;
+
+   if( (soap_action == NULL) || (soap_action_body == NULL) )
    {
-      return cds_GetSearchCapabilities( action_response );
+      return CDS_402_ERROR;
    }
 
-   if( strstr(soap_action, "#GetSystemUpdateID") )
+   action = cds_find_action( soap_action );
+   if( action == NULL )
    {
-      return cds_GetSystemUpdateID( action_response );
+      /* "Cannot process the request" error */
+      logger_log( LOG_ERROR, LOG_MSG("unsupported action %s"), soap_action );
+      return CDS_720_ERROR;
    }
 
-   if( strstr(soap_action, "#X_GetObjectIDfromIndex") )
+   return action->handler( soap_action_body, a, action_response );
+} /* cds_dispatch_action */
+
+/**
+ * Gives back the cache buffers a response is made of.
+ *
+ * @param response The response, once it has been sent.
+ */
+void cds_release_response( cds_response *response )
+{
+   if( response->parts != NULL )
    {
-      return cds_X_GetObjectIDfromIndex( soap_action_body, action_response );
+      cds_release_parts( response->parts, response->num_parts );
+      response->parts = NULL;
+      response->num_parts = 0;
    }
-
-   /* "Cannot process the request" error */
-   return CDS_720_ERROR;
-} /* cds_action */
+} /* cds_release_response */
 
 
 #include "yada.h"
@@ -1362,9 +4726,12 @@ void cds_test()
 {
    item_info *ii1, *ii2, *ii3;
    OBJECT_ID *obj_id;
-   char *soap_res;
+   cds_response soap_res;
+   char soap_req[1024];
+   arena a;
 
    cds_init();
+   arena_init( &a, 4096 );
 
    if( item_getinfo( "D:\\MPEG-1.mpg", &ii1 ) == DLNA_SUCCESS )
    {
@@ -1428,9 +4795,10 @@ void cds_test()
    "</s:Envelope>"
 
    printf( "Request:\n\n%s\n\n", TEST_BROWSE_METADATA );
-   cds_Browse( TEST_BROWSE_METADATA, &soap_res );
-   printf( "Response:\n\n%s\n\n", soap_res );
-   free( soap_res );
+   strcpy( soap_req, TEST_BROWSE_METADATA );
+   cds_Browse( soap_req, &a, &soap_res );
+   printf( "Response:\n\n%s\n\n", soap_res.body );
+   arena_reset( &a );
 
    printf( "\n\n------------------ Browse - BrowseDirectChildren ----------------------- \n\n" );
 
@@ -1449,9 +4817,10 @@ void cds_test()
    "</s:Envelope>"\
 
    printf( "Request:\n\n%s\n\n", TEST_BROWSE_DIRECT_CHILDREN );
-   cds_Browse( TEST_BROWSE_DIRECT_CHILDREN, &soap_res );
-   printf( "Response:\n\n%s\n\n", soap_res );
-   free( soap_res );
+   strcpy( soap_req, TEST_BROWSE_DIRECT_CHILDREN );
+   cds_Browse( soap_req, &a, &soap_res );
+   printf( "Response:\n\n%s\n\n", soap_res.body );
+   arena_reset( &a );
 
    printf( "\n\n------------------ X_GetObjectIDfromIndex ----------------------- \n\n" );
 
@@ -1466,32 +4835,33 @@ void cds_test()
    "</s:Envelope>"
 
    printf( "Request:\n\n%s\n\n", TEST_X_GET_OBJ_FROM_IDX );
-   cds_X_GetObjectIDfromIndex( TEST_X_GET_OBJ_FROM_IDX, &soap_res );
+   strcpy( soap_req, TEST_X_GET_OBJ_FROM_IDX );
+   cds_X_GetObjectIDfromIndex( soap_req, &a, &soap_res );
    /*
-   printf( "Response:\n\n%s\n\n", soap_res );
-   free( soap_res );
+   printf( "Response:\n\n%s\n\n", soap_res.body );
    */
+   arena_reset( &a );
 
    printf( "\n\n------------------ GetSearchCapabilities ----------------------- \n\n" );
 
    printf( "Request:\n\n(null)\n\n" );
-   cds_GetSearchCapabilities( &soap_res );
-   printf( "Response:\n\n%s\n\n", soap_res );
-   free( soap_res );
+   cds_GetSearchCapabilities( NULL, &a, &soap_res );
+   printf( "Response:\n\n%s\n\n", soap_res.body );
+   arena_reset( &a );
 
    printf( "\n\n------------------ GetSortCapabilities ----------------------- \n\n" );
 
    printf( "Request:\n\n(null)\n\n" );
-   cds_GetSortCapabilities( &soap_res );
-   printf( "Response:\n\n%s\n\n", soap_res );
-   free( soap_res );
+   cds_GetSortCapabilities( NULL, &a, &soap_res );
+   printf( "Response:\n\n%s\n\n", soap_res.body );
+   arena_reset( &a );
 
    printf( "\n\n------------------ GetSystemUpdateID ----------------------- \n\n" );
 
    printf( "Request:\n\n(null)\n\n" );
-   cds_GetSystemUpdateID( &soap_res );
-   printf( "Response:\n\n%s\n\n", soap_res );
-   free( soap_res );
+   cds_GetSystemUpdateID( NULL, &a, &soap_res );
+   printf( "Response:\n\n%s\n\n", soap_res.body );
+   arena_destroy( &a );
 
    item_freeinfo( ii1 );
    item_freeinfo( ii2 );
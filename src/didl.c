@@ -0,0 +1,724 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* Under Win32, define inline to include ffmpeg headers */
+#ifdef WIN32
+#  define inline _inline
+#endif
+
+/*
+ * SSE2 is used to skip over the bytes that need no escaping
+ * 16 at a time. It is always there on x64, and on x86 when
+ * the compiler is allowed to use it.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  define DIDL_SSE2
+#  include <emmintrin.h>
+#  ifdef _MSC_VER
+#     include <intrin.h>
+#  endif
+#endif
+
+#include "item.h"
+#include "musicTrack.h"
+#include "profiles.h"
+#include "httpd.h"
+#include "_internals.h"
+
+#include "didl.h"
+
+
+/* Smallest buffer a writer starts with. */
+#define DIDL_MIN_SIZE 256
+
+/* Longest double escape sequence, "&amp;quot;". */
+#define DIDL_MAX_ESCAPE 10
+
+/*
+ * Resource flags, the same the HTTP server
+ * sends in contentFeatures.dlna.org.
+ */
+#define DIDL_RES_FLAGS \
+   (DLNA_FLAG_STREAMING_TRANSFER_MODE | \
+    DLNA_FLAG_INTERACTIVE_TRANSFER_MODE | \
+    DLNA_FLAG_BACKGROUND_TRANSFER_MODE | \
+    DLNA_FLAG_DLNA_V15)
+
+
+/*---------------------------------------------------------------------------
+ *
+ * Output buffer
+ *
+ *--------------------------------------------------------------------------*/
+
+int didl_writer_init( didl_writer *w, arena *a, long size_hint )
+{
+   w->a = a;
+   w->length = 0;
+   w->size = (size_hint > DIDL_MIN_SIZE) ? size_hint : DIDL_MIN_SIZE;
+   w->filter = DIDL_PROP_ALL;
+   w->error = 0;
+
+   w->buf = (char *)arena_alloc( a, w->size );
+   if( w->buf == NULL )
+   {
+      w->size = 0;
+      w->error = 1;
+      return DIDL_ERROR;
+   }
+
+   return DIDL_SUCCESS;
+} /* didl_writer_init */
+
+/*
+ * Make room for len more bytes. The buffer doubles, the
+ * old one is left to the arena.
+ */
+static
+int didl_grow( didl_writer *w, long len )
+{
+   long size;
+   char *buf;
+
+   if( w->error )
+   {
+      return DIDL_ERROR;
+   }
+
+   size = (w->size > 0) ? w->size : DIDL_MIN_SIZE;
+   while( size - w->length < len )
+   {
+      size *= 2;
+   }
+
+   buf = (char *)arena_alloc( w->a, size );
+   if( buf == NULL )
+   {
+      w->error = 1;
+      return DIDL_ERROR;
+   }
+   memcpy( buf, w->buf, w->length );
+   w->buf = buf;
+   w->size = size;
+
+   return DIDL_SUCCESS;
+} /* didl_grow */
+
+#define didl_reserve( w, len ) \
+   ((((w)->size - (w)->length) >= (len)) ? DIDL_SUCCESS : didl_grow( (w), (len) ))
+
+void didl_write( didl_writer *w, const char *s, long len )
+{
+   if( didl_reserve( w, len ) == DIDL_SUCCESS )
+   {
+      memcpy( w->buf + w->length, s, len );
+      w->length += len;
+   }
+} /* didl_write */
+
+void didl_write_int( didl_writer *w, int64_t n )
+{
+   char digits[24];
+   char *p = digits + sizeof(digits);
+   uint64_t u = (n < 0) ? -(uint64_t)n : (uint64_t)n;
+
+   do
+   {
+      *--p = (char)('0' + (u % 10));
+      u /= 10;
+   } while( u != 0 );
+   if( n < 0 ) *--p = '-';
+
+   didl_write( w, p, (long)(digits + sizeof(digits) - p) );
+} /* didl_write_int */
+
+
+/*---------------------------------------------------------------------------
+ *
+ * Escaping
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Tells whether a byte cannot be copied as it is.
+ * Bytes from 0x80 up are UTF-8 sequences, and are fine.
+ */
+#define didl_is_special( c ) \
+   (((c) < 0x20) || ((c) == '&') || ((c) == '<') || ((c) == '>') || ((c) == '"') || ((c) == '\''))
+
+/*
+ * Append the escaped form of a special byte. There must be
+ * room for DIDL_MAX_ESCAPE bytes.
+ */
+static
+void didl_escape_char( didl_writer *w, unsigned char c )
+{
+   const char *escape;
+   long len;
+
+   switch( c )
+   {
+      case '&':  escape = "&amp;amp;";  len = 9;  break;
+      case '<':  escape = "&amp;lt;";   len = 8;  break;
+      case '>':  escape = "&amp;gt;";   len = 8;  break;
+      case '"':  escape = "&amp;quot;"; len = 10; break;
+      case '\'': escape = "&amp;apos;"; len = 10; break;
+
+      case '\t':
+      case '\n':
+      case '\r':
+         w->buf[w->length++] = (char)c;
+         return;
+
+      default:
+         /* Not allowed in XML 1.0 documents at all. */
+         return;
+   }
+
+   memcpy( w->buf + w->length, escape, len );
+   w->length += len;
+} /* didl_escape_char */
+
+#ifdef DIDL_SSE2
+/*
+ * Index of the lowest bit set in a non zero mask.
+ */
+static
+int didl_first_bit( unsigned int mask )
+{
+#ifdef _MSC_VER
+   unsigned long idx;
+   _BitScanForward( &idx, mask );
+   return (int)idx;
+#else
+   return __builtin_ctz( mask );
+#endif
+} /* didl_first_bit */
+#endif
+
+/*
+ * The bulk of every value is plain text: it is copied in runs,
+ * and escaping only happens at the few bytes that need it.
+ * The buffer always has room for what is left of the value,
+ * it only grows when an escape sequence is written.
+ */
+void didl_write_escaped( didl_writer *w, const char *s, long len )
+{
+   const unsigned char *p = (const unsigned char *)s;
+   const unsigned char *end = p + len;
+   const unsigned char *run;
+
+   if( didl_reserve( w, len ) != DIDL_SUCCESS )
+   {
+      return;
+   }
+
+#ifdef DIDL_SSE2
+   {
+      const __m128i amp = _mm_set1_epi8( '&' );
+      const __m128i lt = _mm_set1_epi8( '<' );
+      const __m128i gt = _mm_set1_epi8( '>' );
+      const __m128i quot = _mm_set1_epi8( '"' );
+      const __m128i apos = _mm_set1_epi8( '\'' );
+      const __m128i ctrl = _mm_set1_epi8( 0x1f );
+
+      while( end - p >= 16 )
+      {
+         __m128i v = _mm_loadu_si128( (const __m128i *)p );
+         __m128i special;
+         unsigned int mask;
+         int n;
+
+         special = _mm_or_si128( _mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt) );
+         special = _mm_or_si128( special, _mm_cmpeq_epi8(v, gt) );
+         special = _mm_or_si128( special, _mm_cmpeq_epi8(v, quot) );
+         special = _mm_or_si128( special, _mm_cmpeq_epi8(v, apos) );
+         /* Unsigned v <= 0x1f */
+         special = _mm_or_si128( special, _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v) );
+
+         mask = (unsigned int)_mm_movemask_epi8( special );
+         if( mask == 0 )
+         {
+            _mm_storeu_si128( (__m128i *)(w->buf + w->length), v );
+            w->length += 16;
+            p += 16;
+            continue;
+         }
+
+         n = didl_first_bit( mask );
+         memcpy( w->buf + w->length, p, n );
+         w->length += n;
+         p += n;
+
+         if( didl_reserve( w, (long)(end - p) + DIDL_MAX_ESCAPE ) != DIDL_SUCCESS )
+         {
+            return;
+         }
+         didl_escape_char( w, *p++ );
+      }
+   }
+#endif
+
+   while( p < end )
+   {
+      run = p;
+      while( (p < end) && !didl_is_special(*p) )
+      {
+         p++;
+      }
+      memcpy( w->buf + w->length, run, p - run );
+      w->length += (long)(p - run);
+
+      if( p < end )
+      {
+         if( didl_reserve( w, (long)(end - p) + DIDL_MAX_ESCAPE ) != DIDL_SUCCESS )
+         {
+            return;
+         }
+         didl_escape_char( w, *p++ );
+      }
+   }
+} /* didl_write_escaped */
+
+void didl_write_text( didl_writer *w, const char *s )
+{
+   didl_write_escaped( w, s, (long)strlen(s) );
+} /* didl_write_text */
+
+
+/*---------------------------------------------------------------------------
+ *
+ * Filter
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Property names a filter can list. Asking for
+ * an attribute of res brings in res as well.
+ */
+static const struct
+{
+   const char *name;
+   unsigned int props;
+} didl_filter_names[] =
+{
+   { "@childCount",              DIDL_PROP_CHILD_COUNT },
+   { "container@childCount",     DIDL_PROP_CHILD_COUNT },
+   { "@searchable",              DIDL_PROP_SEARCHABLE },
+   { "container@searchable",     DIDL_PROP_SEARCHABLE },
+   { "upnp:artist",              DIDL_PROP_ARTIST },
+   { "dc:creator",               DIDL_PROP_CREATOR },
+   { "upnp:album",               DIDL_PROP_ALBUM },
+   { "upnp:genre",               DIDL_PROP_GENRE },
+   { "dc:description",           DIDL_PROP_DESCRIPTION },
+   { "upnp:originalTrackNumber", DIDL_PROP_TRACK_NUMBER },
+   { "dc:date",                  DIDL_PROP_DATE },
+   { "res",                      DIDL_PROP_RES },
+   { "res@protocolInfo",         DIDL_PROP_RES },
+   { "res@size",                 DIDL_PROP_RES | DIDL_PROP_RES_SIZE },
+   { "res@duration",             DIDL_PROP_RES | DIDL_PROP_RES_DURATION },
+   { "res@bitrate",              DIDL_PROP_RES | DIDL_PROP_RES_BITRATE },
+   { "res@sampleFrequency",      DIDL_PROP_RES | DIDL_PROP_RES_SAMPLE_FREQ },
+   { "res@nrAudioChannels",      DIDL_PROP_RES | DIDL_PROP_RES_CHANNELS },
+   { "res@resolution",           DIDL_PROP_RES | DIDL_PROP_RES_RESOLUTION },
+   { NULL, 0 }
+};
+
+unsigned int didl_parse_filter( const char *filter )
+{
+   unsigned int props = 0;
+   const char *name;
+   size_t len;
+   int i;
+
+   while( *filter != 0 )
+   {
+      while( (*filter == ',') || (*filter == ' ') )
+      {
+         filter++;
+      }
+
+      name = filter;
+      while( (*filter != 0) && (*filter != ',') )
+      {
+         filter++;
+      }
+      len = filter - name;
+      while( (len > 0) && (name[len-1] == ' ') )
+      {
+         len--;
+      }
+
+      if( (len == 1) && (name[0] == '*') )
+      {
+         return DIDL_PROP_ALL;
+      }
+
+      for( i = 0; didl_filter_names[i].name != NULL; i++ )
+      {
+         if( (strncmp(didl_filter_names[i].name, name, len) == 0) && 
+             (didl_filter_names[i].name[len] == 0) )
+         {
+            props |= didl_filter_names[i].props;
+            break;
+         }
+      }
+   }
+
+   return props;
+} /* didl_parse_filter */
+
+
+/*---------------------------------------------------------------------------
+ *
+ * DIDL-Lite objects
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Append a property element if it passes the filter 
+ * and the value is there.
+ */
+static
+void didl_write_property( didl_writer *w, unsigned int prop, const char *open, long open_len,
+                          const char *close, long close_len, const char *value )
+{
+   if( (w->filter & prop) && (value != NULL) && (value[0] != 0) )
+   {
+      didl_write( w, open, open_len );
+      didl_write_text( w, value );
+      didl_write( w, close, close_len );
+   }
+} /* didl_write_property */
+
+#define didl_write_element( w, prop, name, value ) \
+   didl_write_property( (w), (prop), "&lt;" name "&gt;", (long)sizeof("&lt;" name "&gt;")-1, \
+                        "&lt;/" name "&gt;", (long)sizeof("&lt;/" name "&gt;")-1, (value) )
+
+const char *didl_item_title( item_info *item, long *len )
+{
+   const char *name;
+   const char *ext;
+   const char *p;
+
+   if( (item->type == ITEM_AUDIO) && (item->specific_info != NULL) )
+   {
+      musicTrack_info *track = (musicTrack_info *)item->specific_info;
+      if( (track->title != NULL) && (track->title[0] != 0) )
+      {
+         *len = (long)strlen( track->title );
+         return track->title;
+      }
+   }
+
+   name = item->filename;
+   for( p = item->filename; *p != 0; p++ )
+   {
+      if( (*p == '/') || (*p == '\\') ) name = p+1;
+   }
+   ext = strrchr( name, '.' );
+   if( (ext == NULL) || (ext == name) ) ext = p;
+
+   *len = (long)(ext - name);
+   return name;
+} /* didl_item_title */
+
+long didl_format_date( time_t date, char *buf )
+{
+   /* Days since 1970-01-01 to a civil date. */
+   long days = (long)(date / 86400) - ((date % 86400) < 0);
+   long era, doe, yoe, doy, mp;
+   long year, month, day;
+
+   days += 719468;
+   era = (days >= 0 ? days : days - 146096) / 146097;
+   doe = days - era * 146097;
+   yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+   doy = doe - (365*yoe + yoe/4 - yoe/100);
+   mp = (5*doy + 2) / 153;
+   day = doy - (153*mp + 2)/5 + 1;
+   month = (mp < 10) ? mp + 3 : mp - 9;
+   year = yoe + era * 400 + (month <= 2);
+
+   return sprintf( buf, "%04ld-%02ld-%02ld", year, month, day );
+} /* didl_format_date */
+
+/*
+ * Append the date of an item, as an ISO 8601 date in UTC.
+ */
+static
+void didl_write_date( didl_writer *w, time_t date )
+{
+   char buf[DIDL_DATE_SIZE];
+
+   didl_write_literal( w, "&lt;dc:date&gt;" );
+   didl_write( w, buf, didl_format_date(date, buf) );
+   didl_write_literal( w, "&lt;/dc:date&gt;" );
+} /* didl_write_date */
+
+/*
+ * Append a duration in the H+:MM:SS.F+ format.
+ *
+ * @param duration The duration, in AV_TIME_BASE units.
+ */
+static
+void didl_write_duration( didl_writer *w, int64_t duration )
+{
+   char buf[32];
+   int64_t ms = duration / (AV_TIME_BASE / 1000);
+
+   sprintf( buf, "%d:%02d:%02d.%03d",
+            (int)(ms / 3600000), (int)((ms / 60000) % 60),
+            (int)((ms / 1000) % 60), (int)(ms % 1000) );
+   didl_write( w, buf, (long)strlen(buf) );
+} /* didl_write_duration */
+
+/*
+ * Append the URL of an item: the file path under the
+ * document root of the HTTP server, percent encoded.
+ * Items outside of the document root have no URL.
+ *
+ * @return DIDL_SUCCESS, or DIDL_ERROR if there is no URL.
+ */
+static
+int didl_write_url( didl_writer *w, item_info *item )
+{
+   static const char hex[] = "0123456789ABCDEF";
+   const char *doc_root = httpd_get_doc_root();
+   const unsigned char *p;
+   size_t root_len;
+   char *out;
+
+   if( (doc_root == NULL) || (item->filename == NULL) )
+   {
+      return DIDL_ERROR;
+   }
+   root_len = strlen( doc_root );
+   if( strncmp(item->filename, doc_root, root_len) != 0 )
+   {
+      return DIDL_ERROR;
+   }
+
+   didl_write_literal( w, "http://" );
+   didl_write_text( w, httpd_get_ip_address() );
+   didl_write_literal( w, ":" );
+   didl_write_int( w, httpd_get_port() );
+   didl_write_literal( w, "/" );
+
+   p = (const unsigned char *)item->filename + root_len;
+   if( didl_reserve( w, 3 * (long)strlen((const char *)p) ) != DIDL_SUCCESS )
+   {
+      return DIDL_SUCCESS;
+   }
+   out = w->buf + w->length;
+   for( ; *p != 0; p++ )
+   {
+      if( ((*p >= 'a') && (*p <= 'z')) || ((*p >= 'A') && (*p <= 'Z')) ||
+          ((*p >= '0') && (*p <= '9')) ||
+          (*p == '-') || (*p == '_') || (*p == '.') || (*p == '~') || (*p == '/') )
+      {
+         *out++ = (char)*p;
+      }
+      else
+      if( *p == '\\' )
+      {
+         *out++ = '/';
+      }
+      else
+      {
+         *out++ = '%';
+         *out++ = hex[*p >> 4];
+         *out++ = hex[*p & 0x0f];
+      }
+   }
+   w->length = (long)(out - w->buf);
+
+   return DIDL_SUCCESS;
+} /* didl_write_url */
+
+long didl_item_protocol_info( item_info *item, char *buf )
+{
+   char *pn;
+   int op = DLNA_OPERATION_RANGE;
+   long len;
+
+   /* Same as the HTTP server: no time seek on photos. */
+   if( (item->duration > 0) && !item_is_photo(item) )
+   {
+      op |= DLNA_OPERATION_TIMESEEK;
+   }
+
+   len = sprintf( buf, "http-get:*:%.64s:", httpd_guess_mime_type(item->filename) );
+   pn = profile_tostring( item->profile );
+   if( pn != NULL )
+   {
+      len += sprintf( buf + len, "DLNA.ORG_PN=%.64s;", pn );
+   }
+   len += sprintf( buf + len, "DLNA.ORG_OP=%02x;DLNA.ORG_CI=%d;DLNA.ORG_FLAGS=%08x000000000000000000000000",
+                   op, DLNA_CONVERSION_NONE, (unsigned int)DIDL_RES_FLAGS );
+
+   return len;
+} /* didl_item_protocol_info */
+
+/*
+ * Append the res element of an item.
+ */
+static
+void didl_write_res( didl_writer *w, item_info *item )
+{
+   char protocol_info[DIDL_PROTOCOL_INFO_SIZE];
+   long mark = w->length;
+
+   didl_write_literal( w, "&lt;res protocolInfo=&quot;" );
+   didl_write_escaped( w, protocol_info, didl_item_protocol_info(item, protocol_info) );
+   didl_write_literal( w, "&quot;" );
+
+   if( (w->filter & DIDL_PROP_RES_SIZE) && (item->size > 0) )
+   {
+      didl_write_literal( w, " size=&quot;" );
+      didl_write_int( w, item->size );
+      didl_write_literal( w, "&quot;" );
+   }
+   if( (w->filter & DIDL_PROP_RES_DURATION) && (item->duration > 0) )
+   {
+      didl_write_literal( w, " duration=&quot;" );
+      didl_write_duration( w, item->duration );
+      didl_write_literal( w, "&quot;" );
+   }
+   if( (w->filter & DIDL_PROP_RES_BITRATE) && (item->bitrate > 0) )
+   {
+      /* Bytes per second in DIDL-Lite. */
+      didl_write_literal( w, " bitrate=&quot;" );
+      didl_write_int( w, item->bitrate / 8 );
+      didl_write_literal( w, "&quot;" );
+   }
+   if( (w->filter & DIDL_PROP_RES_SAMPLE_FREQ) && (item->sampleFrequency > 0) )
+   {
+      didl_write_literal( w, " sampleFrequency=&quot;" );
+      didl_write_int( w, item->sampleFrequency );
+      didl_write_literal( w, "&quot;" );
+   }
+   if( (w->filter & DIDL_PROP_RES_CHANNELS) && (item->nrAudioChannels > 0) )
+   {
+      didl_write_literal( w, " nrAudioChannels=&quot;" );
+      didl_write_int( w, item->nrAudioChannels );
+      didl_write_literal( w, "&quot;" );
+   }
+   if( (w->filter & DIDL_PROP_RES_RESOLUTION) && (item->width > 0) && (item->height > 0) )
+   {
+      didl_write_literal( w, " resolution=&quot;" );
+      didl_write_int( w, item->width );
+      didl_write_literal( w, "x" );
+      didl_write_int( w, item->height );
+      didl_write_literal( w, "&quot;" );
+   }
+   didl_write_literal( w, "&gt;" );
+
+   if( didl_write_url( w, item ) != DIDL_SUCCESS )
+   {
+      /* Cannot be streamed, leave the resource out. */
+      w->length = mark;
+      return;
+   }
+
+   didl_write_literal( w, "&lt;/res&gt;" );
+} /* didl_write_res */
+
+void didl_write_container( didl_writer *w, const char *id, const char *parent_id,
+                           int child_count, const char *title )
+{
+   didl_write_literal( w, "&lt;container id=&quot;" );
+   didl_write_text( w, id );
+   didl_write_literal( w, "&quot; parentID=&quot;" );
+   didl_write_text( w, parent_id );
+   if( w->filter & DIDL_PROP_CHILD_COUNT )
+   {
+      didl_write_literal( w, "&quot; childCount=&quot;" );
+      didl_write_int( w, child_count );
+   }
+   didl_write_literal( w, "&quot; restricted=&quot;1" );
+   if( w->filter & DIDL_PROP_SEARCHABLE )
+   {
+      /* Any container can be the ContainerID of a Search. */
+      didl_write_literal( w, "&quot; searchable=&quot;1" );
+   }
+   didl_write_literal( w, "&quot;&gt;" );
+
+   didl_write_literal( w, "&lt;dc:title&gt;" );
+   didl_write_text( w, title );
+   didl_write_literal( w, "&lt;/dc:title&gt;" );
+   didl_write_literal( w, "&lt;upnp:class&gt;" DIDL_OBJECT_CONTAINER "&lt;/upnp:class&gt;" );
+
+   didl_write_literal( w, "&lt;/container&gt;" );
+} /* didl_write_container */
+
+void didl_write_item( didl_writer *w, item_info *item, const char *parent_id )
+{
+   const char *title;
+   long title_len;
+
+   didl_write_literal( w, "&lt;item id=&quot;" );
+   didl_write_text( w, item->id );
+   didl_write_literal( w, "&quot; parentID=&quot;" );
+   didl_write_text( w, parent_id );
+   didl_write_literal( w, "&quot; restricted=&quot;1&quot;&gt;" );
+
+   title = didl_item_title( item, &title_len );
+   didl_write_literal( w, "&lt;dc:title&gt;" );
+   didl_write_escaped( w, title, title_len );
+   didl_write_literal( w, "&lt;/dc:title&gt;" );
+
+   didl_write_literal( w, "&lt;upnp:class&gt;" );
+   didl_write_text( w, (item->class != NULL) ? item->class : DIDL_OBJECT_ITEM );
+   didl_write_literal( w, "&lt;/upnp:class&gt;" );
+
+   if( (w->filter & DIDL_PROP_DATE) && (item->date != 0) )
+   {
+      didl_write_date( w, item->date );
+   }
+
+   if( (item->type == ITEM_AUDIO) && (item->specific_info != NULL) )
+   {
+      musicTrack_info *track = (musicTrack_info *)item->specific_info;
+
+      didl_write_element( w, DIDL_PROP_ARTIST, "upnp:artist", track->artist );
+      didl_write_element( w, DIDL_PROP_CREATOR, "dc:creator", track->artist );
+      didl_write_element( w, DIDL_PROP_ALBUM, "upnp:album", track->album );
+      didl_write_element( w, DIDL_PROP_GENRE, "upnp:genre", track->genre );
+      didl_write_element( w, DIDL_PROP_DESCRIPTION, "dc:description", track->description );
+      if( (w->filter & DIDL_PROP_TRACK_NUMBER) && (track->originalTrackNumber > 0) )
+      {
+         didl_write_literal( w, "&lt;upnp:originalTrackNumber&gt;" );
+         didl_write_int( w, track->originalTrackNumber );
+         didl_write_literal( w, "&lt;/upnp:originalTrackNumber&gt;" );
+      }
+   }
+
+   if( w->filter & DIDL_PROP_RES )
+   {
+      didl_write_res( w, item );
+   }
+
+   didl_write_literal( w, "&lt;/item&gt;" );
+} /* didl_write_item */
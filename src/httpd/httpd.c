@@ -38,6 +38,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
 #ifdef WIN32
 #  define WIN32_LEAN_AND_MEAN
 #  include <windows.h>
@@ -45,18 +47,50 @@
 #  include <ws2tcpip.h>
 #  define socket_t SOCKET
 #  define millisleep(x) SleepEx(x, TRUE)
+#  define socket_errno() WSAGetLastError()
+#  define socket_would_block(err) ((err) == WSAEWOULDBLOCK)
+#  define HTTPD_SEND_FLAGS 0
+#  define HTTPD_INT64_FMT "%I64d"
+   typedef WSABUF httpd_iovec;
+#  define httpd_iovec_set(v, p, l) ((v).buf = (char *)(p), (v).len = (ULONG)(l))
+#  define httpd_iovec_base(v) ((v).buf)
+#  define httpd_iovec_len(v) ((long)(v).len)
 #else
 #  include <sys/socket.h>
 #  include <netinet/in.h>
 #  include <arpa/inet.h>
 #  include <netdb.h>
 #  include <unistd.h>
+#  include <errno.h>
+#  include <poll.h>
+#  include <sys/uio.h>
+#  include <inttypes.h>
 #  define socket_t int
 #  define millisleep(x) usleep((x)*1000)
+#  define closesocket(s) close(s)
+#  define SD_BOTH SHUT_RDWR
+#  define INVALID_SOCKET (-1)
+#  define socket_errno() errno
+#  define socket_would_block(err) (((err) == EAGAIN) || ((err) == EWOULDBLOCK) || ((err) == EINTR))
+   /* Do not get killed by SIGPIPE when a renderer goes away. */
+#  define HTTPD_SEND_FLAGS MSG_NOSIGNAL
+#  define HTTPD_INT64_FMT "%" PRId64
+   typedef struct iovec httpd_iovec;
+#  define httpd_iovec_set(v, p, l) ((v).iov_base = (void *)(p), (v).iov_len = (size_t)(l))
+#  define httpd_iovec_base(v) ((char *)(v).iov_base)
+#  define httpd_iovec_len(v) ((long)(v).iov_len)
 #endif
 
 #include "pthread.h"
 
+#include "reactor.h"
+#include "atomic.h"
+#include "mpscq.h"
+#include "threadpool.h"
+#include "transfer.h"
+#include "httpparser.h"
+#include "arena.h"
+
 #include "logger.h"
 
 #include "libxml/parser.h"
@@ -68,9 +102,12 @@
 #endif
 
 #include "seekrange.h"
+#include "mime.h"
+#include "_internals.h"
 
 #include "httpd.h"
 
+#include "item.h"
 #include "cds.h"
 #include "cms.h"
 
@@ -115,8 +152,19 @@ typedef enum
    TM_BACKGROUND
 } TRANSFER_MODE;
 
+/*
+ * Connection header value.
+ */
+typedef enum
+{
+   CONN_DEFAULT,     /* Not sent, depends on HTTP version */
+   CONN_CLOSE,
+   CONN_KEEP_ALIVE
+} CONNECTION_MODE;
+
 /**
- * The HTTP header
+ * The HTTP header. Strings point into the
+ * connection buffer the request was read into.
  */
 typedef struct http_headers
 {
@@ -128,6 +176,7 @@ typedef struct http_headers
    long content_length;
    int chunked;
    char *soap_action;
+   CONNECTION_MODE connection;
 
    /* 
     * DLNA headers allowed in the standard. 
@@ -156,6 +205,77 @@ typedef struct http_message
    http_message_body *body;
 } http_message;
 
+/**
+ * The context of a single request: the parsed message and
+ * the DLNA flags found while parsing it. Every connection
+ * has its own, so many requests can be in flight at once.
+ */
+typedef struct httpd_request
+{
+   /* The client socket to use to send responses back. */
+   socket_t sock;
+
+   /* The HTTP message from the client. */
+   http_message *message;
+
+   /* 
+    * The file to stream once the response headers are 
+    * ready. The transfer is driven by the server thread.
+    */
+   transfer *transfer;
+
+   /* Error message to return. */
+   int error_code;
+
+   /* 
+    * Whether the connection stays open after the 
+    * response, and whether a response was sent at all.
+    */
+   int keep_alive;
+   int responded;
+
+   /* DLNA standard headers */
+   int content_features; /* getcontentFeatures.dlna.org */
+   int timeseek_range;  /* TimeSeekRange.dlna.org */
+   int bytes_range; /* Range */
+   int transfer_mode; /* transferMode.dlna.org */
+
+   /* 
+    * Samsung specific headers 
+    * (not in the standard).
+    */
+   int sec_getmediainfo;
+   int sec_getcaptioninfo;
+
+   /* 
+    * Scratch memory for the request processing, 
+    * released at once when the response is complete.
+    */
+   arena arena;
+} httpd_request;
+
+/**
+ * Most segments a response is made of.
+ */
+#define HTTPD_RESPONSE_MAX_SEGMENTS 8
+
+/**
+ * A response being put together: status line, headers 
+ * and body are pointed to, not copied, and sent with
+ * a single gathering write.
+ */
+typedef struct httpd_response
+{
+   httpd_iovec segments[HTTPD_RESPONSE_MAX_SEGMENTS];
+   int num_segments;
+} httpd_response;
+
+/**
+ * Length of the Date header value, e.g.
+ * "Sun, 06 Nov 1994 08:49:37 GMT", zero included.
+ */
+#define HTTPD_DATE_SIZE 30
+
 /**
  * The buffer size used when reading from
  * sockets. A 2KB buffer should work OK 
@@ -164,15 +284,111 @@ typedef struct http_message
 #define HTTP_SOCKET_BUFFER_SIZE 2048
 
 /**
- * DLNA Requirement [7.4.47.1]: HTTP Client and 
- * Server Endpoints must use a total HTTP 
- * header size that is less than or equal to 
- * 8192 bytes (8 KB) when sending an HTTP 
- * request or HTTP response.
+ * Block size of the per request arena. A SOAP
+ * request and its response fit in a few of them.
  */
-#define HTTP_HEADERS_MAX_SIZE 8192
+#define HTTPD_ARENA_BLOCK_SIZE 8192
 
-/** 
+/**
+ * Length of the listen queue. Renderers open
+ * many connections in bursts, so be generous.
+ */
+#define HTTPD_LISTEN_BACKLOG SOMAXCONN
+
+/**
+ * Maximum number of events handled for
+ * each round of the event loop.
+ */
+#define HTTPD_MAX_EVENTS 64
+
+/**
+ * Event loop timeout in milliseconds. This is
+ * how often the server thread checks whether it
+ * has been asked to stop.
+ */
+#define HTTPD_LOOP_TIMEOUT 1000
+
+/**
+ * How long, in milliseconds, we wait for a client
+ * to make room in its receive window before giving
+ * up sending a response.
+ */
+#define HTTPD_SEND_TIMEOUT 10000
+
+/**
+ * Seconds an idle persistent connection, or one
+ * with an incomplete request, is kept open.
+ */
+#define HTTPD_KEEP_ALIVE_TIMEOUT 15
+
+/**
+ * Seconds a streaming connection can go without the
+ * client reading anything. Renderers in pause simply
+ * stop reading, so be patient.
+ */
+#define HTTPD_STREAM_TIMEOUT 300
+
+/**
+ * Worker pool defaults, used when the configuration
+ * does not say otherwise.
+ */
+#define HTTPD_DEFAULT_WORKERS 4
+#define HTTPD_DEFAULT_QUEUE_DEPTH 128
+
+/**
+ * A client connection.
+ * Requests are read in non-blocking mode into the
+ * connection buffer, and parsed as data arrives until
+ * a complete message (headers and body) is available.
+ */
+typedef struct httpd_connection httpd_connection;
+struct httpd_connection
+{
+   /* 
+    * Queue link, used by the workers to hand the 
+    * connection back to the server thread. 
+    */
+   mpsc_node node; /* Must be first */
+
+   /* 
+    * The job running the request. There is one request per 
+    * connection in flight at most, so one job is enough.
+    */
+   threadpool_job job;
+
+   socket_t sock;
+   struct sockaddr_in addr;
+
+   /* Receive buffer, always zero terminated. */
+   unsigned char *buf;
+   long buf_size;
+   long buf_len;
+
+   /* Parser state for the request at the beginning of the buffer. */
+   http_parser parser;
+
+   /* 
+    * The request being parsed or run by a worker. Its message 
+    * lives here and refers to the connection buffer.
+    */
+   httpd_request request;
+   http_message message;
+   http_headers headers;
+   http_message_body body;
+
+   /* 
+    * Set while a worker owns the connection, 
+    * which is then not watched by the reactor.
+    */
+   int busy;
+   time_t last_activity;
+
+   /* Connection list */
+   httpd_connection *next;
+   httpd_connection *previous;
+};
+
+/**
  * The web server context.
  */
 typedef struct httpd_context
@@ -191,21 +407,27 @@ typedef struct httpd_context
    int httpd_run; /* This will be set to 0 to stop the discover thread */
    pthread_mutex_t httpd_mutex;
 
-   /* Error message to return. */
-   int error_code;
+   /* Event loop and the connections it is watching. */
+   reactor *reactor;
+   socket_t httpd_sock;
+   httpd_connection *connections;
 
-   /* DLNA standard headers */
-   int content_features; /* getcontentFeatures.dlna.org */
-   int timeseek_range;  /* TimeSeekRange.dlna.org */
-   int bytes_range; /* Range */
-   int transfer_mode; /* transferMode.dlna.org */
+   /* 
+    * Worker pool running the requests, and the queue
+    * through which workers give connections back.
+    */
+   threadpool *pool;
+   int num_workers;
+   int queue_depth;
+   mpsc_queue completed;
 
    /* 
-    * Samsung specific headers 
-    * (not in the standard).
+    * The Date header value, refreshed every second by the
+    * server thread. date_seq is odd while it is being
+    * written, so that workers never copy a torn string.
     */
-   int sec_getmediainfo;
-   int sec_getcaptioninfo;
+   volatile long date_seq;
+   char date[HTTPD_DATE_SIZE];
 } httpd_context;
 
 /** 
@@ -214,21 +436,28 @@ typedef struct httpd_context
 static httpd_context g_context = { 0 };
 
 /**
- * Reset working context.
- * Do not reset httpd_initialized though,
- * we assume that is still valid.
+ * Reset a request context before parsing a new request.
+ * The client socket is left untouched, and the message
+ * must have been freed already.
+ *
+ * @param request The request context.
  */
 static
-void httpd_reset_context()
+void httpd_reset_request( httpd_request *request )
 {
-   g_context.error_code = 0;
-   g_context.content_features = 0;
-   g_context.timeseek_range = 0;
-   g_context.bytes_range = 0;
+   request->message = NULL;
+   request->transfer = NULL;
+   request->error_code = 0;
+   request->keep_alive = 0;
+   request->responded = 0;
+   request->content_features = 0;
+   request->timeseek_range = 0;
+   request->bytes_range = 0;
+   request->transfer_mode = 0;
 
-   g_context.sec_getmediainfo = 0;
-   g_context.sec_getcaptioninfo = 0;
-} /* httpd_reset_context */
+   request->sec_getmediainfo = 0;
+   request->sec_getcaptioninfo = 0;
+} /* httpd_reset_request */
 
 
 /*----------------------------------------------------------------------------
@@ -241,70 +470,155 @@ void httpd_reset_context()
  *
  *--------------------------------------------------------------------------*/
 
-#define HTTP_200_MSG_HEADERS \
-   "HTTP/1.1 200 OK\r\n"\
-   "Connection: close\r\n" \
-   "Content-Length: %d\r\n"\
+#define HTTPD_STRINGIFY(x) #x
+#define HTTPD_XSTRINGIFY(x) HTTPD_STRINGIFY(x)
+
+/*
+ * Connection headers, replacing the %s in the streaming 
+ * response headers below, or sent as a segment of their own.
+ */
+#define HTTP_CLOSE_HEADER \
+   "Connection: close\r\n"
+#define HTTP_KEEP_ALIVE_HEADER \
+   "Connection: keep-alive\r\n" \
+   "Keep-Alive: timeout=" HTTPD_XSTRINGIFY(HTTPD_KEEP_ALIVE_TIMEOUT) "\r\n"
+
+/*
+ * XML responses, sent as segments: the Connection header,
+ * the Content-Length and Date values and the body go
+ * in between these.
+ */
+#define HTTP_200_MSG_STATUS \
+   "HTTP/1.1 200 OK\r\n"
+#define HTTP_200_MSG_LENGTH \
+   "Content-Length: "
+#define HTTP_200_MSG_DATE \
+   "\r\n"\
    "Content-Type: text/xml; charset=\"utf-8\"\r\n"\
+   "Date: "
+#define HTTP_200_MSG_END \
+   "\r\n"\
+   "EXT: \r\n"\
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
+   "\r\n"
+
+/*
+ * Streaming responses. The second %s is replaced 
+ * by the DLNA headers, if any.
+ */
+#define HTTP_200_STREAM_MSG_HEADERS \
+   "HTTP/1.1 200 OK\r\n"\
+   "%s" \
+   "%s" \
+   "Accept-Ranges: bytes\r\n"\
+   "Content-Length: " HTTPD_INT64_FMT "\r\n"\
+   "Content-Type: %s\r\n"\
+   "Date: %s\r\n"\
+   "EXT: \r\n"\
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
+   "\r\n"
+
+#define HTTP_206_STREAM_MSG_HEADERS \
+   "HTTP/1.1 206 Partial Content\r\n"\
+   "%s" \
+   "%s" \
+   "Accept-Ranges: bytes\r\n"\
+   "Content-Length: " HTTPD_INT64_FMT "\r\n"\
+   "Content-Range: bytes " HTTPD_INT64_FMT "-" HTTPD_INT64_FMT "/" HTTPD_INT64_FMT "\r\n"\
+   "Content-Type: %s\r\n"\
    "Date: %s\r\n"\
    "EXT: \r\n"\
    "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
    "\r\n"
 
+/* 
+ * DLNA.ORG_OP=01: the resource can be seeked with 
+ * the Range header, 11 if TimeSeekRange.dlna.org 
+ * works as well. Flags are streaming, interactive
+ * and background transfer modes, DLNA 1.5.
+ */
+#define HTTP_CONTENT_FEATURES_HEADER \
+   "contentFeatures.dlna.org: DLNA.ORG_OP=%02x;DLNA.ORG_CI=%d;DLNA.ORG_FLAGS=%08x000000000000000000000000\r\n"
+
+#define HTTP_TIMESEEK_RANGE_HEADER \
+   "TimeSeekRange.dlna.org: npt=%s-%s/%s bytes=" HTTPD_INT64_FMT "-" HTTPD_INT64_FMT "/" HTTPD_INT64_FMT "\r\n"
+
+/*
+ * Error responses. The Connection header and the empty
+ * line ending the headers are added when sending.
+ */
 #define HTTP_400_MSG_HEADERS \
    "HTTP/1.1 400 BAD REQUEST\r\n" \
-   "Connection: close\r\n" \
    "Content-Length: 0\r\n" \
-   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
-   "\r\n"
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
 #define HTTP_400_MSG_BODY \
    ""
 
 #define HTTP_401_MSG_HEADERS \
    "HTTP/1.1 401 UNAUTHORIZED\r\n" \
-   "Connection: close\r\n" \
    "Content-Length: 0\r\n" \
-   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
-   "\r\n"
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
 #define HTTP_401_MSG_BODY \
    ""
 
 #define HTTP_402_MSG_HEADERS \
    "HTTP/1.1 402 Invalid Arguments\r\n" \
-   "Connection: close\r\n" \
    "Content-Length: 0\r\n" \
-   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
-   "\r\n"
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
 #define HTTP_402_MSG_BODY \
    ""
 
 #define HTTP_404_MSG_HEADERS \
    "HTTP/1.1 404 NOT FOUND\r\n" \
-   "Connection: close\r\n" \
    "Content-Length: 0\r\n" \
-   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
-   "\r\n"
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
 #define HTTP_404_MSG_BODY \
    ""
 
 #define HTTP_416_MSG_HEADERS \
    "HTTP/1.1 416 Requested Range Not Satisfiable\r\n" \
-   "Connection: close\r\n" \
    "Content-Length: 0\r\n" \
-   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
-   "\r\n"
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
 #define HTTP_416_MSG_BODY \
    ""
 
-#define HTTP_500_MSG_HEADERS \
-   "HTTP/1.1 500 INTERNAL SERVER ERROR\r\n" \
-   "Connection: close\r\n" \
+#define HTTP_406_MSG_HEADERS \
+   "HTTP/1.1 406 Not Acceptable\r\n" \
+   "Content-Length: 0\r\n" \
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
+#define HTTP_406_MSG_BODY \
+   ""
+
+/* RFC 2616 14.16: tell the client how long the resource is. */
+#define HTTP_416_RANGE_MSG_HEADERS \
+   "HTTP/1.1 416 Requested Range Not Satisfiable\r\n" \
+   "%s" \
    "Content-Length: 0\r\n" \
+   "Content-Range: bytes */" HTTPD_INT64_FMT "\r\n" \
    "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n" \
    "\r\n"
+
+#define HTTP_500_MSG_HEADERS \
+   "HTTP/1.1 500 INTERNAL SERVER ERROR\r\n" \
+   "Content-Length: 0\r\n" \
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
 #define HTTP_500_MSG_BODY \
    ""
 
+#define HTTP_501_MSG_HEADERS \
+   "HTTP/1.1 501 Not Implemented\r\n" \
+   "Content-Length: 0\r\n" \
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
+#define HTTP_501_MSG_BODY \
+   ""
+
+#define HTTP_503_MSG_HEADERS \
+   "HTTP/1.1 503 Service Unavailable\r\n" \
+   "Content-Length: 0\r\n" \
+   "Server: " HTTPD_SERVER_NAME "/" HTTPD_SERVER_VERSION "\r\n"
+#define HTTP_503_MSG_BODY \
+   ""
+
 /*----------------------------------------------------------------------------
  *
  * Private socket functions
@@ -354,7 +668,8 @@ socket_t httpd_new_server_socket()
 {
    socket_t httpd_socket = 0;
    struct sockaddr_in serv_addr;
-   int addr_len = sizeof(serv_addr);
+   socklen_t addr_len = sizeof(serv_addr);
+   int reuse = 1;
 
    /* Create the socket */
    httpd_socket = socket( AF_INET, SOCK_STREAM, 0 );
@@ -364,6 +679,9 @@ socket_t httpd_new_server_socket()
       return httpd_socket;
    }
 
+   /* Allow a quick restart while old connections are in TIME_WAIT. */
+   setsockopt( httpd_socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse) );
+
    /* Bind it to the specified port. */
    memset( &serv_addr, 0, sizeof(serv_addr) );
    serv_addr.sin_family = AF_INET;
@@ -378,7 +696,7 @@ socket_t httpd_new_server_socket()
    }
 
    /* Set the queue length. */
-   if( listen(httpd_socket, 5) < 0 )
+   if( listen(httpd_socket, HTTPD_LISTEN_BACKLOG) < 0 )
    {
       logger_log( LOG_ERROR, LOG_MSG("error during listen") );
       shutdown( httpd_socket, SD_BOTH );
@@ -431,6 +749,126 @@ char *httpd_get_local_ip()
 } /* httpd_get_local_ip */
 
 
+/**
+ * Waits for a socket to become writable.
+ *
+ * @param sock The socket.
+ * @param timeout_ms The maximum time to wait, in milliseconds.
+ * @return A positive value if the socket is writable, 0 on
+ *    timeout or a negative value on error.
+ */
+static
+int httpd_wait_writable( socket_t sock, int timeout_ms )
+{
+#ifdef WIN32
+   fd_set write_set;
+   struct timeval tv;
+
+   FD_ZERO( &write_set );
+   FD_SET( sock, &write_set );
+   tv.tv_sec = timeout_ms / 1000;
+   tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+   return select( 0, NULL, &write_set, NULL, &tv );
+#else
+   struct pollfd pfd;
+
+   pfd.fd = sock;
+   pfd.events = POLLOUT;
+   pfd.revents = 0;
+
+   return poll( &pfd, 1, timeout_ms );
+#endif
+} /* httpd_wait_writable */
+
+/**
+ * Most buffers handed to a single gathering write.
+ */
+#define HTTPD_MAX_IOV 512
+
+/**
+ * Sends a set of buffers to a non-blocking socket, usually
+ * with a single system call. If the client is slow at reading,
+ * wait for the socket to become writable again rather than 
+ * failing.
+ *
+ * @param sock The client socket.
+ * @param iov The buffers. They are updated as data is sent.
+ * @param count The number of buffers.
+ * @param timeout_ms How long to wait for a slow client, 
+ *    0 to give up as soon as the socket would block.
+ * @return The number of bytes sent, or -1 on error.
+ */
+static
+long httpd_send_iovec( socket_t sock, httpd_iovec *iov, int count, int timeout_ms )
+{
+   long sent = 0;
+   long res;
+#ifdef WIN32
+   DWORD n;
+#else
+   struct msghdr msg;
+#endif
+   int batch;
+
+   for( ; ; )
+   {
+      /* Drop what has been sent already. */
+      while( (count > 0) && (httpd_iovec_len(iov[0]) == 0) )
+      {
+         iov++;
+         count--;
+      }
+      if( count == 0 )
+      {
+         return sent;
+      }
+
+      /* Stay within the system limit on buffers per call. */
+      batch = (count < HTTPD_MAX_IOV) ? count : HTTPD_MAX_IOV;
+
+#ifdef WIN32
+      res = (WSASend( sock, iov, batch, &n, 0, NULL, NULL ) == 0) ? (long)n : -1;
+#else
+      memset( &msg, 0, sizeof(msg) );
+      msg.msg_iov = iov;
+      msg.msg_iovlen = batch;
+
+      /* sendmsg rather than writev, to avoid SIGPIPE. */
+      res = (long)sendmsg( sock, &msg, HTTPD_SEND_FLAGS );
+#endif
+      if( res > 0 )
+      {
+         sent += res;
+         while( res > 0 )
+         {
+            long len = httpd_iovec_len( iov[0] );
+            if( res < len )
+            {
+               httpd_iovec_set( iov[0], httpd_iovec_base(iov[0])+res, len-res );
+               break;
+            }
+            res -= len;
+            iov++;
+            count--;
+         }
+         continue;
+      }
+
+      if( (res < 0) && socket_would_block(socket_errno()) )
+      {
+         if( (timeout_ms > 0) && (httpd_wait_writable(sock, timeout_ms) > 0) ) continue;
+         logger_log( LOG_ERROR, LOG_MSG("timeout sending message to client") );
+      }
+      else
+      {
+         logger_log( LOG_ERROR, LOG_MSG("could not send message to client, error code: %d"), socket_errno() );
+      }
+      return -1;
+   }
+} /* httpd_send_iovec */
+
+
 /*----------------------------------------------------------------------------
  *
  * Private header/body management and parsing functions
@@ -453,50 +891,32 @@ static char test_post[] =
 "SOAPACTION: \"urn:schemas-upnp-org:service:ContentDirectory:1#Browse\"\r\n\r\n"
 "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body><u:Browse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\"><ObjectID>V_F</ObjectID><BrowseFlag>BrowseDirectChildren</BrowseFlag><Filter>*</Filter><StartingIndex>0</StartingIndex><RequestedCount>0</RequestedCount><SortCriteria></SortCriteria></u:Browse></s:Body></s:Envelope>\r\n";
 
-/** 
- * Gets the next token from a buffer. A token is 
- * surrounded by whitespace or adjacent to a \r
- * character. Note that \r\n is not a token
- * per se, but this function will correctly
- * stop at the character pointing the \r and will return
- * a length of 2.
- *
- * A typical use of this function is as follows:
- *
- * len = 0;
- * token = buf;
- * token = httpd_next_header_token( token+len, &len );
- * while( len > ) {
- *    token = httpd_next_header_token( token+len, &len );
- *    ....
- * }
+/**
+ * Checks whether a comma separated header value,
+ * such as the Connection header one, contains a token.
  *
- * @param buf The buffer where the tokens are parsed from.
- * @param len A pointer to an int that will be set as the token length.
- * @return The pointer to the first character of the token.
+ * @param value The header value.
+ * @param token The token to look for.
+ * @return 1 if found, 0 otherwise.
  */
 static
-char *httpd_next_header_token( unsigned char *buf, int *len )
+int httpd_header_has_token( const char *value, const char *token )
 {
-   char *token;
-   int idx = 0;
-
-   token = buf;
+   size_t len = strlen( token );
 
-   while( (token[idx] != 0) && isspace(token[idx]) && (token[idx] != '\r') ) idx++;
-   token += idx;
-   while( (token[idx] != 0) && !isspace(token[idx]) && (token[idx] != '\n') ) idx++;
-
-   /* If idx == 0, we may have found a \r\n couple. */
-   if( (idx == 0) && (token[0] == '\r') && (token[1] == '\n') )
+   while( *value )
    {
-      /* Length is actually 2. */
-      idx = 2;
+      while( (*value == ' ') || (*value == '\t') || (*value == ',') ) value++;
+      if( (strncasecmp(value, token, len) == 0) && 
+          ((value[len] == 0) || (value[len] == ',') || (value[len] == ' ') || (value[len] == '\t')) )
+      {
+         return 1;
+      }
+      while( *value && (*value != ',') ) value++;
    }
 
-   *len = idx;
-   return token;
-} /* httpd_next_header_token */
+   return 0;
+} /* httpd_header_has_token */
 
 /**
  * Further header verification.
@@ -504,15 +924,16 @@ char *httpd_next_header_token( unsigned char *buf, int *len )
  * combinations were not sent by the client endpoint (e.g. 
  * sending realTimeInfo header when requesting an interactive 
  * transfer, etc.
- * In case of an error, the function sets the context error_code 
+ * In case of an error, the function sets the request error_code 
  * variable to the appropriate value.
  *
  * @param headers The HTTP headers structure
+ * @param request The request context.
  * @return HTTPD_SUCCESS if successful, HTTP_XXX_ERROR
  *    otherwise, being XXX an HTTP error code.
  */
 static 
-int httpd_validate_headers( http_headers *headers )
+int httpd_validate_headers( http_headers *headers, httpd_request *request )
 {
    /*
     * DLNA Requirement [7.4.75.2]: An HTTP Server Endpoint 
@@ -532,13 +953,13 @@ int httpd_validate_headers( http_headers *headers )
        realTimeInfo.dlna.org
     *
     */
-   if( g_context.transfer_mode && 
+   if( request->transfer_mode && 
       ( (headers->transfer_mode == TM_INTERACTIVE) || (headers->transfer_mode == TM_BACKGROUND) ) )
    {
       /* TimeSeekRange.dlna.org is the only one currently implemented. */
-      if( g_context.timeseek_range )
+      if( request->timeseek_range )
       {
-         g_context.error_code = 400;
+         request->error_code = 400;
          return HTTPD_400_ERROR;
       }
    }
@@ -547,713 +968,1485 @@ int httpd_validate_headers( http_headers *headers )
 } /* httpd_validate_headers */
 
 /**
- * Parse headers from a buffer containing an entire HTTP request. 
- * Allocates memory for the header structure and its content. 
- * Memory must be released using http_free_headers function.
+ * Interprets the headers of a request the parser is done with.
+ * No memory is allocated: strings in the headers structure 
+ * point into the connection buffer, where the parser 
+ * zero terminated them.
  *
- * @param buf The HTTP request
- * @param headers Header structure that will be allocated. 
- *    It must be freed with http_free_headers.
- * @return The offset in the buffer where the headers section ends - i.e.
- *    the index after the final \r\n\r\n string.
+ * @param buf The connection buffer.
+ * @param parser The parser that went through the request.
+ * @param headers The headers structure to fill in.
+ * @param request The request context, where DLNA flags
+ *    and errors are recorded.
+ * @return HTTPD_SUCCESS if successful, HTTP_XXX_ERROR
+ *    otherwise, being XXX an HTTP error code.
  */
 static
-int httpd_parse_headers( unsigned char *buf, http_headers **headers )
+int httpd_parse_headers( unsigned char *buf, http_parser *parser, http_headers *headers, httpd_request *request )
 {
-   char *token;
-   int len = 0;
-   int done = 0;
+   http_slice *value;
+   char *method;
 
-   *headers = calloc( 1, sizeof(http_headers) );
-   (*headers)->content_length = -1;
-
-   token = buf;
-   token = httpd_next_header_token( buf, &len );
-   while( (done == 0) )
-   {
+   memset( headers, 0, sizeof(http_headers) );
 
-      logger_log( LOG_TRACE, LOG_MSG("Received header: %s"), token );
+   method = http_slice_ptr( buf, parser->method );
+   if( strcmp(method, "GET") == 0 ) headers->method = HTTP_METHOD_GET;
+   else if( strcmp(method, "POST") == 0 ) headers->method = HTTP_METHOD_POST;
+   else if( strcmp(method, "HEAD") == 0 ) headers->method = HTTP_METHOD_HEAD;
+   else headers->method = HTTP_METHOD_UNKNOWN;
 
-      /*---------------------------------------------------------------------
-       *
-       * DLNA STANDARD HEADERS
-       *
-       *--------------------------------------------------------------------*/
+   headers->method_uri = http_slice_ptr( buf, parser->uri );
 
-      /* We strncmp "GET " instead of "GET" to distinguish a GET message 
-         from a getXXX DLNA header in the message. */
-      if( (strncasecmp(token, "GET ", 4) == 0) || (strncasecmp(token, "POST", 4) == 0) )
-      {
-         if( (token[0] == 'G') || (token[0] == 'g') ) (*headers)->method = HTTP_METHOD_GET;
-         else (*headers)->method = HTTP_METHOD_POST;
+   /* The parser made sure the version is HTTP/1.x */
+   if( buf[parser->version.offset+7] == '0' ) headers->version = HTTP_VERSION_10;
+   else headers->version = HTTP_VERSION_11;
 
-         /* Parse URI. */
-         token = httpd_next_header_token( token+len, &len );
-         (*headers)->method_uri = calloc( len+1, sizeof(char) );
-         memcpy((*headers)->method_uri, token, len );
+   logger_log( LOG_TRACE, LOG_MSG("Received request: %s %s"), method, headers->method_uri );
 
-         token = httpd_next_header_token( token+len, &len );
-         if( token[7] == '0' ) (*headers)->version = HTTP_VERSION_10;
-         else (*headers)->version = HTTP_VERSION_11;
+   /* Body framing, as worked out by the parser. */
+   headers->chunked = parser->chunked;
+   if( parser->chunked || http_slice_empty(parser->headers[HTTP_HEADER_CONTENT_LENGTH]) )
+   {
+      headers->content_length = -1;
+   }
+   else
+   {
+      headers->content_length = parser->content_length;
+   }
 
-         /* Eat \r\n */
-         token = httpd_next_header_token( token+len, &len );
+   value = &parser->headers[HTTP_HEADER_CONNECTION];
+   if( !http_slice_empty(*value) )
+   {
+      if( httpd_header_has_token(http_slice_ptr(buf, *value), "close") )
+      {
+         headers->connection = CONN_CLOSE;
       }
       else
-      if( (strncasecmp(token, "HEAD", 4) == 0) )
+      if( httpd_header_has_token(http_slice_ptr(buf, *value), "keep-alive") )
       {
-         (*headers)->method = HTTP_METHOD_POST;
+         headers->connection = CONN_KEEP_ALIVE;
+      }
+   }
 
-         /* Parse URI. */
-         token = httpd_next_header_token( token+len, &len );
-         (*headers)->method_uri = calloc( len+1, sizeof(char) );
-         memcpy((*headers)->method_uri, token, len );
+   value = &parser->headers[HTTP_HEADER_USER_AGENT];
+   if( !http_slice_empty(*value) ) headers->user_agent = http_slice_ptr( buf, *value );
 
-         /* Eat \r\n */
-         token = httpd_next_header_token( token+len, &len );
-      }
-      else
-      if( (strncasecmp(token, "User-Agent", 10) == 0) )
-      {
-         token = httpd_next_header_token( token+len, &len );
-         (*headers)->user_agent = calloc( len+1, sizeof(char) );
-         memcpy((*headers)->user_agent, token, len );
+   value = &parser->headers[HTTP_HEADER_SOAPACTION];
+   if( !http_slice_empty(*value) ) headers->soap_action = http_slice_ptr( buf, *value );
 
-         /* Eat \r\n */
-         token = httpd_next_header_token( token+len, &len );
-      }
-      else
-      if( (strncasecmp(token, "Content-Length", 14) == 0) )
+   /*---------------------------------------------------------------------
+    *
+    * DLNA STANDARD HEADERS
+    *
+    *--------------------------------------------------------------------*/
+
+   value = &parser->headers[HTTP_HEADER_GETCONTENTFEATURES];
+   if( !http_slice_empty(*value) )
+   {
+      if( atoi(http_slice_ptr(buf, *value)) != 1 )
       {
-         token = httpd_next_header_token( token+len, &len );
-         (*headers)->content_length = atol( token );
+         logger_log( LOG_ERROR, LOG_MSG("getcontentFeatures header error, setting error to 400") );
 
-         /* Eat \r\n */
-         token = httpd_next_header_token( token+len, &len );
+         /* DLNA Requirement [7.4.26.5]: If an HTTP Server Endpoint 
+          * receives any value except "1" in the 
+          * getcontentFeatures.dlna.org header it must return an 
+          * error code response of 400 (Bad Request).
+          */
+         request->error_code = 400;
+         return HTTPD_400_ERROR;
       }
-      else
-      if( (strncasecmp(token, "Transfer-Encoding", 17) == 0) )
+      request->content_features = 1;
+   }
+
+   value = &parser->headers[HTTP_HEADER_TIMESEEKRANGE];
+   if( !http_slice_empty(*value) )
+   {
+      if( timeseek_parse(http_slice_ptr(buf, *value), &headers->tsr) == 0 )
       {
-         /* If both Transfer-Encoding and Content-Length 
-          * are received, the latter MUST be ignored as
-          * per the HTTP specs.
+         logger_log( LOG_ERROR, LOG_MSG("TimeSeekRange header error, setting error to 416") );
+
+         /* DLNA guidelines do not specify what to do in case of
+          * a malformed header. We decided to comply with 
+          * DLNA Requirement [7.4.40.8]: If an HTTP Server Endpoint 
+          * supports the TimeSeekRange.dlna.org header and the 
+          * requested time range is not valid for the resource 
+          * with URI specified in the HTTP GET request, then the 
+          * HTTP streaming server must respond with the HTTP 
+          * response error code of: 416 (Requested Range Not Satisfiable).
           */
-         (*headers)->chunked = 1;
-         if( (*headers)->content_length != -1 ) (*headers)->content_length = -1;
+         request->error_code = 416;
+         return HTTPD_416_ERROR;
       }
-      else
-      if( (strncasecmp(token, "SOAPACTION", 10) == 0) )
+      request->timeseek_range = 1;
+   }
+
+   value = &parser->headers[HTTP_HEADER_RANGE];
+   if( !http_slice_empty(*value) )
+   {
+      if( bytesrange_parse(http_slice_ptr(buf, *value), &headers->br) == 0 )
       {
-         token = httpd_next_header_token( token+len, &len );
-         (*headers)->soap_action = calloc( len+1, sizeof(char) );
-         memcpy((*headers)->soap_action, token, len );
+         logger_log( LOG_ERROR, LOG_MSG("Range header error, setting error to 416") );
 
-         /* Eat \r\n */
-         token = httpd_next_header_token( token+len, &len );
+         /* Same as per the TimeSeekRange.dlna.org header. */
+         request->error_code = 416;
+         return HTTPD_416_ERROR;
       }
-      else
-      if( (strncasecmp(token, "getcontentFeatures.dlna.org", 27) == 0) )
-      {
-         int val = atoi( httpd_next_header_token( token+len, &len ) );
-         if( val != 1 )
-         {
-            logger_log( LOG_ERROR, LOG_MSG("getcontentFeatures header error, setting error to 400") );
+      request->bytes_range = 1;
+   }
 
-            /* DLNA Requirement [7.4.26.5]: If an HTTP Server Endpoint 
-             * receives any value except "1" in the 
-             * getcontentFeatures.dlna.org header it must return an 
-             * error code response of 400 (Bad Request).
-             */
-            g_context.error_code = 400;
+   value = &parser->headers[HTTP_HEADER_FRIENDLYNAME];
+   if( !http_slice_empty(*value) ) headers->friendly_name = http_slice_ptr( buf, *value );
 
-            /* We can break here as request is malformed. */
-            break;
-         }
-         else
-         {
-            g_context.content_features = 1;
-         }
+   value = &parser->headers[HTTP_HEADER_TRANSFERMODE];
+   if( !http_slice_empty(*value) )
+   {
+      char *mode = http_slice_ptr( buf, *value );
 
-         /* Eat \r\n */
-         token = httpd_next_header_token( token+len, &len );
+      if( strcmp( mode, "Streaming" ) == 0 )
+      {
+         headers->transfer_mode = TM_STREAMING;
       }
       else
-      if( (strncasecmp(token, "TimeSeekRange.dlna.org", 22) == 0) )
+      if( strcmp( mode, "Interactive" ) == 0 )
       {
-         token = httpd_next_header_token( token+len, &len );
-         if ( timeseek_parse(token, &(*headers)->tsr) == 0 )
-         {
-            logger_log( LOG_ERROR, LOG_MSG("TimeSeekRange header error, setting error to 416") );
-
-            /* DLNA guidelines do not specify what to do in case of
-             * a malformed header. We decided to comply with 
-             * DLNA Requirement [7.4.40.8]: If an HTTP Server Endpoint 
-             * supports the TimeSeekRange.dlna.org header and the 
-             * requested time range is not valid for the resource 
-             * with URI specified in the HTTP GET request, then the 
-             * HTTP streaming server must respond with the HTTP 
-             * response error code of: 416 (Requested Range Not Satisfiable).
-             */
-            g_context.error_code = 416;
-
-            /* We can break here as request is malformed. */
-            break;
-         }
-         else
-         {
-            g_context.timeseek_range = 1;
-         }
+         headers->transfer_mode = TM_INTERACTIVE;
       }
       else
-      if( (strncasecmp(token, "Range", 5) == 0) )
+      if( strcmp( mode, "Background" ) == 0 )
       {
-         token = httpd_next_header_token( token+len, &len );
-         if ( bytesrange_parse(token, &(*headers)->br) == 0 )
-         {
-            logger_log( LOG_ERROR, LOG_MSG("Range header error, setting error to 416") );
-               
-            /* Same as per the TimeSeekRange.dlna.org header. */
-            g_context.error_code = 416;
+         headers->transfer_mode = TM_BACKGROUND;
+      }
+      else
+      {
+         logger_log( LOG_ERROR, LOG_MSG("Unsupported transferMode value, setting error to 400") );
 
-            /* We can break here as request is malformed. */
-            break;
-         }
-         else
-         {
-            g_context.bytes_range = 1;
-         }
+         /* DLNA guidelines do not specify how to cope with
+          * a misspecified transferMode header, so the most
+          * natural thing we can do is to respond with error 
+          * code 400 (Bad Request).
+          */
+         request->error_code = 400;
+         return HTTPD_400_ERROR;
+      }
+      request->transfer_mode = 1;
+   }
+
+   /*---------------------------------------------------------------------
+    *
+    * SAMSUNG SPECIFIC HEADERS
+    *
+    *--------------------------------------------------------------------*/
+
+   request->sec_getmediainfo = !http_slice_empty( parser->headers[HTTP_HEADER_GETMEDIAINFO_SEC] );
+   request->sec_getcaptioninfo = !http_slice_empty( parser->headers[HTTP_HEADER_GETCAPTIONINFO_SEC] );
+
+   /* 
+    * Any other header is ignored, as per DLNA Requirement 
+    * [7.4.21.1]: "HTTP Client and Server Endpoints must be 
+    * tolerant of unknown HTTP headers".
+    */
+
+   /* Final verification of not allowed headers combinations. */
+   return httpd_validate_headers( headers, request );
+} /* http_parse_headers */
+
+/**
+ * Fills in the request message once the connection parser
+ * is done with it. Headers and body stay in the connection 
+ * buffer, and are valid until the request is consumed.
+ *
+ * @param conn The connection the request was received on.
+ * @return HTTPD_SUCCESS if successful, HTTP_XXX_ERROR
+ *    otherwise, being XXX an HTTP error code.
+ */
+static
+int httpd_parse_http_message( httpd_connection *conn )
+{
+   httpd_request *request = &conn->request;
+
+   conn->message.headers = &conn->headers;
+   conn->message.body = &conn->body;
+   request->message = &conn->message;
+
+   conn->body.content_length = conn->parser.body.len;
+   conn->body.message = (conn->parser.body.len > 0) ? (unsigned char *)http_slice_ptr( conn->buf, conn->parser.body ) : NULL;
+
+   return httpd_parse_headers( conn->buf, &conn->parser, &conn->headers, request );
+} /* httpd_parse_http_message */
+
+
+/*----------------------------------------------------------------------------
+ *
+ * Private file management functions
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Refreshes the Date header value. Only called by 
+ * the server thread, once per second.
+ */
+static
+void httpd_update_date()
+{
+   static char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+   static char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+   time_t curr_time = time( NULL );
+   struct tm *gm_time = gmtime( &curr_time );
+
+   atomic_inc( &g_context.date_seq );
+   sprintf ( g_context.date, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             days[gm_time->tm_wday],
+             gm_time->tm_mday,
+             months [gm_time->tm_mon],
+             1900 + gm_time->tm_year,
+             gm_time->tm_hour,
+             gm_time->tm_min,
+             gm_time->tm_sec );
+   atomic_inc( &g_context.date_seq );
+} /* httpd_update_date */
+
+/**
+ * Gets the Date header value. Can be called by any thread.
+ *
+ * @param buf The buffer receiving the date,
+ *    at least HTTPD_DATE_SIZE bytes long.
+ * @return buf.
+ */
+static
+char *httpd_get_date( char *buf )
+{
+   long seq;
+
+   do
+   {
+      seq = atomic_read( &g_context.date_seq );
+      memcpy( buf, g_context.date, HTTPD_DATE_SIZE );
+   } while( (seq & 1) || (atomic_read(&g_context.date_seq) != seq) );
+
+   return buf;
+} /* httpd_get_date */
+
+/**
+ * @return The Connection header matching the
+ *    request keep-alive state.
+ */
+static
+char *httpd_connection_header( httpd_request *request )
+{
+   return request->keep_alive ? HTTP_KEEP_ALIVE_HEADER : HTTP_CLOSE_HEADER;
+} /* httpd_connection_header */
+
+/**
+ * Appends a segment to a response. The data is not copied,
+ * and must stay around until the response is sent.
+ *
+ * @param response The response.
+ * @param data The segment data.
+ * @param len The segment length.
+ */
+static
+void httpd_response_add( httpd_response *response, const char *data, long len )
+{
+   httpd_iovec_set( response->segments[response->num_segments], data, len );
+   response->num_segments++;
+} /* httpd_response_add */
+
+/* Appends a string literal to a response. */
+#define httpd_response_add_literal( response, s ) \
+   httpd_response_add( (response), (s), sizeof(s)-1 )
+
+/**
+ * Sends a response back to the client with a single gathering
+ * write. If sending fails the connection will not be kept alive.
+ *
+ * @param request The request context.
+ * @param segments The response segments.
+ * @param num_segments The number of segments.
+ * @return A negative value on error.
+ */
+static
+int httpd_send_segments( httpd_request *request, httpd_iovec *segments, int num_segments )
+{
+   request->responded = 1;
+
+   if( httpd_send_iovec(request->sock, segments, num_segments, HTTPD_SEND_TIMEOUT) < 0 )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("failed sending message to client") );
+      request->keep_alive = 0;
+      return -1;
+   }
+
+   return 0;
+} /* httpd_send_segments */
+
+/**
+ * Sends a response back to the client. If sending fails
+ * the connection will not be kept alive.
+ *
+ * @param request The request context.
+ * @param headers The complete response headers.
+ * @param body The message body.
+ * @return A negative value on error.
+ */
+static
+int httpd_send_response( httpd_request *request, char *headers, char *body )
+{
+   httpd_response response;
+
+   response.num_segments = 0;
+   httpd_response_add( &response, headers, (long)strlen(headers) );
+   httpd_response_add( &response, body, (long)strlen(body) );
+
+   return httpd_send_segments( request, response.segments, response.num_segments );
+} /* httpd_send_response */
+
+/**
+ * Sends one of the HTTP_XXX_MSG_HEADERS responses.
+ *
+ * @param request The request context.
+ * @param headers The response headers, without the 
+ *    Connection header and the final empty line.
+ * @param body The message body.
+ * @return A negative value on error.
+ */
+static
+int httpd_send_header_and_body( httpd_request *request, char *headers, char *body )
+{
+   httpd_response response;
+   char *connection = httpd_connection_header( request );
+
+   response.num_segments = 0;
+   httpd_response_add( &response, headers, (long)strlen(headers) );
+   httpd_response_add( &response, connection, (long)strlen(connection) );
+   httpd_response_add_literal( &response, "\r\n" );
+   httpd_response_add( &response, body, (long)strlen(body) );
+
+   return httpd_send_segments( request, response.segments, response.num_segments );
+} /* httpd_send_header_and_body */
+
+/**
+ * Sends an HTTP 200 OK message back to the client, with a body
+ * made of parts sent in order.
+ *
+ * @param request The request context.
+ * @param parts The message body parts. They are sent as they are,
+ *    not copied.
+ * @param num_parts The number of parts.
+ * @param body_len The message body length.
+ * @return HTTP_SUCCESS if successful, or another value otherwise.
+ */
+static
+int httpd_send_200_OK_parts( httpd_request *request, const cds_response_part *parts, int num_parts, long body_len )
+{
+   httpd_response response;
+   httpd_iovec *segments;
+   char *connection = httpd_connection_header( request );
+   char date[HTTPD_DATE_SIZE];
+   char length[16];
+   int i;
+
+   response.num_segments = 0;
+   httpd_response_add_literal( &response, HTTP_200_MSG_STATUS );
+   httpd_response_add( &response, connection, (long)strlen(connection) );
+   httpd_response_add_literal( &response, HTTP_200_MSG_LENGTH );
+   httpd_response_add( &response, length, sprintf(length, "%ld", body_len) );
+   httpd_response_add_literal( &response, HTTP_200_MSG_DATE );
+   httpd_response_add( &response, httpd_get_date(date), HTTPD_DATE_SIZE-1 );
+   httpd_response_add_literal( &response, HTTP_200_MSG_END );
+
+   if( response.num_segments + num_parts <= HTTPD_RESPONSE_MAX_SEGMENTS )
+   {
+      for( i = 0; i < num_parts; i++ )
+      {
+         httpd_response_add( &response, parts[i].data, parts[i].length );
+      }
+      return httpd_send_segments( request, response.segments, response.num_segments );
+   }
+
+   /* Too many parts for the response, gather them in the arena. */
+   segments = (httpd_iovec *)arena_alloc( &request->arena, (response.num_segments + num_parts) * sizeof(httpd_iovec) );
+   if( segments == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("Out of memory sending the response") );
+      return httpd_send_header_and_body( request, HTTP_500_MSG_HEADERS, HTTP_500_MSG_BODY );
+   }
+   memcpy( segments, response.segments, response.num_segments * sizeof(httpd_iovec) );
+   for( i = 0; i < num_parts; i++ )
+   {
+      httpd_iovec_set( segments[response.num_segments+i], parts[i].data, parts[i].length );
+   }
+
+   return httpd_send_segments( request, segments, response.num_segments + num_parts );
+} /* httpd_send_200_OK_parts */
+
+/**
+ * Sends an HTTP 200 OK message back to the client.
+ *
+ * @param request The request context.
+ * @param body The message body. It is sent as is, not copied.
+ * @param body_len The message body length.
+ * @return HTTP_SUCCESS if successful, or another value otherwise.
+ */
+static
+int httpd_send_200_OK( httpd_request *request, const char *body, long body_len )
+{
+   cds_response_part part;
+
+   part.data = body;
+   part.length = body_len;
+   part.owner = NULL;
+
+   return httpd_send_200_OK_parts( request, &part, 1, body_len );
+} /* httpd_send_200_OK */
+
+/**
+ * Guesses the MIME type of a file from its extension.
+ *
+ * @param filename The file name.
+ * @return The MIME type string.
+ */
+char *httpd_guess_mime_type( const char *filename )
+{
+   static struct
+   {
+      char *ext;
+      char **mime;
+   } mime_types[] = 
+   {
+      { ".mpg",  &MIME_VIDEO_MPEG },
+      { ".mpeg", &MIME_VIDEO_MPEG },
+      { ".mpe",  &MIME_VIDEO_MPEG },
+      { ".vob",  &MIME_VIDEO_MPEG },
+      { ".ts",   &MIME_VIDEO_MPEG_TS },
+      { ".tts",  &MIME_VIDEO_MPEG_TS },
+      { ".m2ts", &MIME_VIDEO_MPEG_TS },
+      { ".mp4",  &MIME_VIDEO_MPEG_4 },
+      { ".3gp",  &MIME_VIDEO_3GP },
+      { ".asf",  &MIME_VIDEO_ASF },
+      { ".wmv",  &MIME_VIDEO_WMV },
+      { ".mp3",  &MIME_AUDIO_MPEG },
+      { ".m4a",  &MIME_AUDIO_MPEG_4 },
+      { ".wma",  &MIME_AUDIO_WMA },
+      { ".lpcm", &MIME_AUDIO_LPCM },
+      { ".jpg",  &MIME_IMAGE_JPEG },
+      { ".jpeg", &MIME_IMAGE_JPEG },
+      { ".png",  &MIME_IMAGE_PNG },
+      { NULL, NULL }
+   };
+   const char *ext = strrchr( filename, '.' );
+   int i;
+
+   if( ext != NULL )
+   {
+      if( strncasecmp(ext, ".xml", 5) == 0 ) return "text/xml; charset=\"utf-8\"";
+
+      for( i = 0; mime_types[i].ext != NULL; i++ )
+      {
+         if( strncasecmp(ext, mime_types[i].ext, strlen(mime_types[i].ext)+1) == 0 ) return *mime_types[i].mime;
+      }
+   }
+
+   return "application/octet-stream";
+} /* httpd_guess_mime_type */
+
+/**
+ * Decodes %XX escapes in place, and strips the query string.
+ *
+ * @param uri The URI to decode.
+ */
+static
+void httpd_decode_uri( char *uri )
+{
+   char *src = uri;
+   char *dst = uri;
+
+   while( (*src != 0) && (*src != '?') )
+   {
+      if( (src[0] == '%') && isxdigit((unsigned char)src[1]) && isxdigit((unsigned char)src[2]) )
+      {
+         char hex[3];
+         hex[0] = src[1];
+         hex[1] = src[2];
+         hex[2] = 0;
+         *dst++ = (char)strtol( hex, NULL, 16 );
+         src += 3;
       }
       else
-      if( (strncasecmp(token, "friendlyName.dlna.org", 21) == 0) )
       {
-         token = httpd_next_header_token( token+len, &len );
-         (*headers)->friendly_name = calloc( len+1, sizeof(char) );
-         memcpy((*headers)->friendly_name, token, len );
+         *dst++ = *src++;
+      }
+   }
+   *dst = 0;
+} /* httpd_decode_uri */
+
+/**
+ * Maps a request URI onto a file under the document root.
+ *
+ * @param a The arena to allocate the file name from.
+ * @param uri The request URI.
+ * @return The file name, or NULL if the URI points
+ *    outside of the document root.
+ */
+static
+char *httpd_resource_filename( arena *a, const char *uri )
+{
+   char *path;
+   char *filename;
+
+   path = arena_strdup( a, uri );
+   if( path == NULL ) return NULL;
+   httpd_decode_uri( path );
+
+   /* Do not let clients walk out of the document root. */
+   if( (path[0] != '/') || strstr(path, "..") || strchr(path, '\\') )
+   {
+      return NULL;
+   }
+
+   /* Root path is already terminated with a '/'. */
+   filename = (char *)arena_alloc( a, strlen(g_context.doc_root_path) + strlen(path) );
+   if( filename != NULL )
+   {
+      sprintf( filename, "%s%s", g_context.doc_root_path, path+1 );
+   }
+
+   return filename;
+} /* httpd_resource_filename */
+
+/**
+ * Tells whether TimeSeekRange.dlna.org can be used on an item.
+ *
+ * @param stream The item streaming information, or NULL if 
+ *    the resource is not shared.
+ * @return 1 if the item can be seeked by time, 0 otherwise.
+ */
+static
+int httpd_timeseek_supported( cds_stream_info *stream )
+{
+   return (stream != NULL) && (stream->duration > 0);
+} /* httpd_timeseek_supported */
+
+/**
+ * Builds the DLNA headers of a streaming response.
+ *
+ * @param request The request context.
+ * @param stream The streaming information of the item, or 
+ *    NULL if the resource is not shared.
+ * @param buf The buffer that will receive the headers.
+ * @return buf, set to an empty string if the client
+ *    did not ask for any DLNA header.
+ */
+static
+char *httpd_dlna_headers( httpd_request *request, cds_stream_info *stream, char *buf )
+{
+   int op = DLNA_OPERATION_RANGE;
+
+   buf[0] = 0;
+
+   if( httpd_timeseek_supported(stream) )
+   {
+      op |= DLNA_OPERATION_TIMESEEK;
+   }
+
+   /*
+    * DLNA Requirement [7.4.26.1]: contentFeatures.dlna.org
+    * is returned when the client sent getcontentFeatures.dlna.org.
+    */
+   if( request->content_features )
+   {
+      sprintf( buf, HTTP_CONTENT_FEATURES_HEADER,
+               op,
+               DLNA_CONVERSION_NONE,
+               (unsigned int)(DLNA_FLAG_STREAMING_TRANSFER_MODE | 
+                              DLNA_FLAG_INTERACTIVE_TRANSFER_MODE |
+                              DLNA_FLAG_BACKGROUND_TRANSFER_MODE |
+                              DLNA_FLAG_DLNA_V15) );
+   }
+
+   return buf;
+} /* httpd_dlna_headers */
+
+/**
+ * Works out the part of a resource a Range header asks for.
+ *
+ * @param br The parsed Range header.
+ * @param size The resource size.
+ * @param first Will receive the first byte to send.
+ * @param last Will receive the last byte to send.
+ * @return 1 if the range can be satisfied, 0 otherwise.
+ */
+static
+int httpd_resolve_range( const bytes_range *br, int64_t size, int64_t *first, int64_t *last )
+{
+   /* 
+    * RFC 2616 14.35.1: a range starting past the end of the
+    * resource is not satisfiable, one ending past it is
+    * truncated to the resource size.
+    */
+   if( (br->type == BR_INVALID) || (br->first >= size) )
+   {
+      return 0;
+   }
+
+   *first = br->first;
+   if( (br->type == BR_OPEN) || (br->last >= size) )
+   {
+      *last = size-1;
+   }
+   else
+   {
+      *last = br->last;
+   }
+
+   return 1;
+} /* httpd_resolve_range */
+
+/**
+ * Formats a time as an npt-sec string, e.g. "335.110".
+ *
+ * @param msec The time, in milliseconds.
+ * @param buf The buffer that will receive the string.
+ * @return buf.
+ */
+static
+char *httpd_format_npt( int64_t msec, char *buf )
+{
+   sprintf( buf, HTTPD_INT64_FMT ".%03d", msec/1000, (int)(msec%1000) );
+   return buf;
+} /* httpd_format_npt */
+
+/**
+ * Works out the part of an item a TimeSeekRange.dlna.org
+ * header asks for. Times are mapped onto byte offsets with 
+ * the item time index, or interpolated from the bitrate
+ * when the item has not been indexed.
+ *
+ * @param request The request context.
+ * @param stream The streaming information of the item, or NULL.
+ * @param size The resource size.
+ * @param first Will receive the first byte to send.
+ * @param last Will receive the last byte to send.
+ * @param header Will receive the TimeSeekRange.dlna.org 
+ *    response header.
+ * @return HTTPD_SUCCESS, HTTPD_406_ERROR if the item cannot
+ *    be seeked by time, or HTTPD_416_ERROR if the range is
+ *    not valid for the item.
+ */
+static
+int httpd_resolve_timeseek( httpd_request *request, cds_stream_info *stream, int64_t size,
+                            int64_t *first, int64_t *last, char *header )
+{
+   timeseek_range *tsr = &request->message->headers->tsr;
+   timeindex_entry start;
+   timeindex_entry end;
+   int64_t duration;
+   int64_t start_time;
+   int64_t end_time;
+   char npt_start[32];
+   char npt_end[32];
+   char npt_duration[32];
+
+   /*
+    * DLNA Requirement [7.4.40.7]: servers that do not support
+    * the header for a resource must respond with 406.
+    */
+   if( !httpd_timeseek_supported(stream) )
+   {
+      return HTTPD_406_ERROR;
+   }
+
+   /* FFMpeg durations are in AV_TIME_BASE units. */
+   duration = stream->duration / (AV_TIME_BASE/1000);
+
+   if( !npt_to_msec(&tsr->npt_start, &start_time) || 
+       !timeindex_seek(stream->time_index, start_time, duration, size, stream->bitrate, 0, &start) )
+   {
+      return HTTPD_416_ERROR;
+   }
+
+   *first = start.offset;
+   *last = size-1;
+   end_time = duration;
+
+   if( npt_to_msec(&tsr->npt_end, &end_time) )
+   {
+      if( end_time <= start_time )
+      {
+         return HTTPD_416_ERROR;
+      }
+
+      /* Stop at the entry point following the end time. */
+      if( (end_time < duration) &&
+          timeindex_seek(stream->time_index, end_time, duration, size, stream->bitrate, 1, &end) &&
+          (end.offset > *first) )
+      {
+         *last = ((end.offset < size) ? end.offset : size)-1;
       }
       else
-      if( (strncasecmp(token, "transferMode.dlna.org", 21) == 0) )
       {
-         token = httpd_next_header_token( token+len, &len );
-         if( strncmp( token, "Streaming", 9 ) == 0 )
-         {
-            (*headers)->transfer_mode = TM_STREAMING;
-         }
-         else
-         if( strncmp( token, "Interactive", 11 ) == 0 )
+         end_time = duration;
+      }
+   }
+
+   sprintf( header, HTTP_TIMESEEK_RANGE_HEADER,
+            httpd_format_npt(start.time, npt_start),
+            httpd_format_npt(end_time, npt_end),
+            httpd_format_npt(duration, npt_duration),
+            *first, *last, size );
+
+   return HTTPD_SUCCESS;
+} /* httpd_resolve_timeseek */
+
+/**
+ * Opens the resource a GET or HEAD request refers to, and
+ * builds the response headers. For GET the file is handed
+ * over to the server thread, which streams it to the client.
+ * A Range header gets a 206 Partial Content response, a 
+ * TimeSeekRange.dlna.org header a 200 OK with the actual
+ * range in the TimeSeekRange.dlna.org response header.
+ *
+ * @param request The request context.
+ * @param send_body 1 for GET, 0 for HEAD.
+ * @return HTTP_SUCCESS if successful, or HTTP_XXX_ERROR otherwise.
+ */
+static
+int httpd_serve_resource( httpd_request *request, int send_body )
+{
+   char msg_header[1024];
+   char dlna_headers[512];
+   char date[HTTPD_DATE_SIZE];
+   char *filename;
+   transfer *t = NULL;
+   cds_stream_info info;
+   cds_stream_info *stream = NULL;
+   int64_t size;
+   int64_t first;
+   int64_t last;
+   int res = HTTPD_SUCCESS;
+
+   filename = httpd_resource_filename( &request->arena, request->message->headers->method_uri );
+   if( filename != NULL )
+   {
+      t = transfer_open( filename, &size );
+   }
+
+   if( t == NULL )
+   {
+      logger_log( LOG_TRACE, LOG_MSG("resource %s not found"), request->message->headers->method_uri );
+      httpd_send_header_and_body( request, HTTP_404_MSG_HEADERS, HTTP_404_MSG_BODY );
+      return HTTPD_404_ERROR;
+   }
+
+   if( (request->timeseek_range || request->content_features) &&
+       (cds_get_stream_info(filename, &info) == CDS_SUCCESS) )
+   {
+      stream = &info;
+   }
+   httpd_dlna_headers( request, stream, dlna_headers );
+
+   /* A Range header takes precedence. */
+   if( request->timeseek_range && !request->bytes_range )
+   {
+      res = httpd_resolve_timeseek( request, stream, size, &first, &last, dlna_headers+strlen(dlna_headers) );
+   }
+
+   if( stream != NULL )
+   {
+      cds_release_stream_info( stream );
+   }
+
+   if( request->bytes_range )
+   {
+      if( !httpd_resolve_range( &request->message->headers->br, size, &first, &last ) )
+      {
+         logger_log( LOG_TRACE, LOG_MSG("range not satisfiable for %s"), request->message->headers->method_uri );
+         transfer_free( t );
+         sprintf( msg_header, HTTP_416_RANGE_MSG_HEADERS, httpd_connection_header(request), size );
+         httpd_send_response( request, msg_header, HTTP_416_MSG_BODY );
+         return HTTPD_416_ERROR;
+      }
+
+      transfer_set_range( t, first, last-first+1 );
+      sprintf( msg_header, HTTP_206_STREAM_MSG_HEADERS, 
+               httpd_connection_header(request), 
+               dlna_headers,
+               last-first+1,
+               first, last, size,
+               httpd_guess_mime_type(filename), 
+               httpd_get_date(date) );
+   }
+   else
+   if( request->timeseek_range )
+   {
+      if( res != HTTPD_SUCCESS )
+      {
+         logger_log( LOG_TRACE, LOG_MSG("time seek not possible for %s"), request->message->headers->method_uri );
+         transfer_free( t );
+         if( res == HTTPD_406_ERROR )
          {
-            (*headers)->transfer_mode = TM_INTERACTIVE;
+            httpd_send_header_and_body( request, HTTP_406_MSG_HEADERS, HTTP_406_MSG_BODY );
          }
          else
-         if( strncmp( token, "Background", 10 ) == 0 )
          {
-            (*headers)->transfer_mode = TM_BACKGROUND;
+            httpd_send_header_and_body( request, HTTP_416_MSG_HEADERS, HTTP_416_MSG_BODY );
          }
-         else
-         {
-            logger_log( LOG_ERROR, LOG_MSG("Unsupported transferMode value, setting error to 400") );
+         return res;
+      }
 
-            /* DLNA guidelines do not specify how to cope with
-             * a misspecified transferMode header, so the most
-             * natural thing we can do is to respond with error 
-             * code 400 (Bad Request).
-             */
-             g_context.error_code = 400;
+      transfer_set_range( t, first, last-first+1 );
+      sprintf( msg_header, HTTP_200_STREAM_MSG_HEADERS, 
+               httpd_connection_header(request), 
+               dlna_headers,
+               last-first+1,
+               httpd_guess_mime_type(filename), 
+               httpd_get_date(date) );
+   }
+   else
+   {
+      sprintf( msg_header, HTTP_200_STREAM_MSG_HEADERS, 
+               httpd_connection_header(request), 
+               dlna_headers,
+               size,
+               httpd_guess_mime_type(filename), 
+               httpd_get_date(date) );
+   }
 
-            /* We can break here as request is malformed. */
-            break;
-         }
-         g_context.transfer_mode = 1;
-      }
+   if( !send_body )
+   {
+      transfer_free( t );
+      httpd_send_response( request, msg_header, "" );
+      return HTTPD_SUCCESS;
+   }
 
-      /*---------------------------------------------------------------------
-       *
-       * SAMSUNG SPECIFIC HEADERS
-       *
-       *--------------------------------------------------------------------*/
+   if( transfer_set_head(t, msg_header) != TRANSFER_DONE )
+   {
+      transfer_free( t );
+      httpd_send_header_and_body( request, HTTP_500_MSG_HEADERS, HTTP_500_MSG_BODY );
+      return HTTPD_500_ERROR;
+   }
 
-      else
-      if( (strncasecmp(token, "getMediaInfo.sec", 16) == 0) )
+   request->transfer = t;
+   request->responded = 1;
+
+   return HTTPD_SUCCESS;
+} /* httpd_serve_resource */
+
+
+/*----------------------------------------------------------------------------
+ *
+ * HEAD, GET and POST processors
+ *
+ *--------------------------------------------------------------------------*/
+
+
+/**
+ * HEAD message processor.
+ *
+ * @param request The request context.
+ * @return HTTP_SUCCESS if successful, or HTTP_XXX_ERROR otherwise, being
+ *    XXX an HTTP error code.
+ */
+static
+int httpd_process_head( httpd_request *request )
+{
+   return httpd_serve_resource( request, 0 );
+}
+
+/**
+ * GET message processor.
+ *
+ * @param request The request context.
+ * @return HTTP_SUCCESS if successful, or HTTP_XXX_ERROR otherwise, being
+ *    XXX an HTTP error code.
+ */
+static
+int httpd_process_get( httpd_request *request )
+{
+   http_message *message = request->message;
+
+   if( strstr(message->headers->method_uri, CDS_SCPD) )
+   {
+      /* Return the CDS description XML. */
+      char *scpd = cds_get_scpd();
+      httpd_send_200_OK( request, scpd, (long)strlen(scpd) );
+   }
+   else
+   if( strstr(message->headers->method_uri, CMS_SCPD) )
+   {
+      /* Return the CDS description XML. */
+      //httpd_send_200_OK( request, cms_get_scpd(), (long)strlen(cms_get_scpd()) );
+   }
+   else
+   {
+      /* Need to stream a resource. */
+      return httpd_serve_resource( request, 1 );
+   }
+   return HTTPD_SUCCESS;
+}
+
+/**
+ * POST message processor.
+ *
+ * @param request The request context.
+ * @return HTTP_SUCCESS if successful, or HTTP_XXX_ERROR otherwise, being
+ *    XXX an HTTP error code.
+ */
+static
+int httpd_process_post( httpd_request *request )
+{
+   http_message *message = request->message;
+
+   if( strcmp(message->headers->method_uri, CDS_CONTROL_URL) == 0 )
+   {
+      /* 
+       * SOAP Action must be CDS action.
+       */
+      int res;
+      cds_response response;
+      
+      /* 
+       * The response is static, lives in the request arena or
+       * in CDS cache buffers: nothing to copy, and the buffers
+       * are given back once sent.
+       */
+      res = cds_dispatch_action( message->headers->soap_action, (char *)message->body->message, &request->arena, &response );
+      if( (res == CDS_SUCCESS) && (response.parts != NULL) )
       {
-         g_context.sec_getmediainfo = 1;
+         httpd_send_200_OK_parts( request, response.parts, response.num_parts, response.length );
+      }
+      else if( (res == CDS_SUCCESS) && (response.body != NULL) )
+      {
+         httpd_send_200_OK( request, response.body, response.length );
       }
       else
-      if( (strncasecmp(token, "getCaptionInfo.sec", 18) == 0) )
       {
-         g_context.sec_getcaptioninfo = 1;
+         httpd_send_header_and_body( request, HTTP_500_MSG_HEADERS, HTTP_500_MSG_BODY );
+      }
+      cds_release_response( &response );
+   }
+   else
+   {
+      httpd_send_header_and_body( request, HTTP_404_MSG_HEADERS, HTTP_404_MSG_BODY );
+      return HTTPD_404_ERROR;
+   }
+   return 0;
+}
+
+
+/*----------------------------------------------------------------------------
+ *
+ * HTTP Thread
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Maximum size of a connection receive buffer.
+ */
+#define HTTPD_CONNECTION_MAX_BUFFER (HTTP_HEADERS_MAX_SIZE + HTTP_BODY_MAX_SIZE)
+
+/**
+ * Creates a new connection for an accepted client socket
+ * and adds it to the connection list.
+ *
+ * @param sock The client socket.
+ * @param addr The client address.
+ * @return The new connection, or NULL if out of memory.
+ */
+static
+httpd_connection *httpd_new_connection( socket_t sock, struct sockaddr_in *addr )
+{
+   httpd_connection *conn;
+
+   conn = (httpd_connection *)calloc( 1, sizeof(httpd_connection) );
+   if( conn == NULL )
+   {
+      return NULL;
+   }
+
+   conn->buf = (unsigned char *)malloc( HTTP_SOCKET_BUFFER_SIZE );
+   if( conn->buf == NULL )
+   {
+      free( conn );
+      return NULL;
+   }
+   conn->buf[0] = 0;
+   conn->buf_size = HTTP_SOCKET_BUFFER_SIZE;
+   conn->sock = sock;
+   conn->addr = *addr;
+   conn->last_activity = time( NULL );
+   conn->request.sock = sock;
+   arena_init( &conn->request.arena, HTTPD_ARENA_BLOCK_SIZE );
+   http_parser_init( &conn->parser );
+
+   conn->next = g_context.connections;
+   if( g_context.connections != NULL ) g_context.connections->previous = conn;
+   g_context.connections = conn;
+
+   return conn;
+} /* httpd_new_connection */
+
+/**
+ * Closes a client connection and frees it up.
+ *
+ * @param conn The connection to close.
+ */
+static
+void httpd_close_connection( httpd_connection *conn )
+{
+   reactor_remove( g_context.reactor, conn->sock );
+   shutdown( conn->sock, SD_BOTH );
+   closesocket( conn->sock );
+
+   if( conn->previous != NULL ) conn->previous->next = conn->next;
+   else g_context.connections = conn->next;
+   if( conn->next != NULL ) conn->next->previous = conn->previous;
+
+   transfer_free( conn->request.transfer );
+   arena_destroy( &conn->request.arena );
+   free( conn->buf );
+   free( conn );
+} /* httpd_close_connection */
+
+/**
+ * Sends an error response from the server thread, then closes
+ * the connection. The socket is never waited upon, as a slow 
+ * client would hold up every other connection: whatever does 
+ * not fit in the socket buffer right away is dropped.
+ *
+ * @param conn The connection.
+ * @param headers One of the HTTP_XXX_MSG_HEADERS responses.
+ * @param body The message body.
+ */
+static
+void httpd_reject_connection( httpd_connection *conn, char *headers, char *body )
+{
+   httpd_response response;
+
+   response.num_segments = 0;
+   httpd_response_add( &response, headers, (long)strlen(headers) );
+   httpd_response_add_literal( &response, HTTP_CLOSE_HEADER );
+   httpd_response_add_literal( &response, "\r\n" );
+   httpd_response_add( &response, body, (long)strlen(body) );
+
+   httpd_send_iovec( conn->sock, response.segments, response.num_segments, 0 );
+   httpd_close_connection( conn );
+} /* httpd_reject_connection */
+
+/**
+ * Accepts all pending connections on the listening socket
+ * and starts watching them for incoming requests.
+ *
+ * @param httpd_sock The listening socket.
+ */
+static
+void httpd_accept_connections( socket_t httpd_sock )
+{
+   socket_t client_sock;
+   struct sockaddr_in cli_addr;
+   socklen_t cli_len;
+   httpd_connection *conn;
+
+   for( ; ; )
+   {
+      cli_len = sizeof( cli_addr );
+      client_sock = accept( httpd_sock, (struct sockaddr *)&cli_addr, &cli_len );
+      if( client_sock == INVALID_SOCKET )
+      {
+         int err = socket_errno();
+         if( !socket_would_block(err) )
+         {
+            logger_log( LOG_ERROR, LOG_MSG("could not accept from clients, error code: %d"), err );
+         }
+         return;
       }
-      
 
-      /*---------------------------------------------------------------------
-       *
-       * OTHER HEADERS
-       *
-       *--------------------------------------------------------------------*/
-
-      else
-      {
-         /* 
-          * A header we do not recognize. 
-          * As per DLNA Requirement [7.4.21.1]: "HTTP Client 
-          * and Server Endpoints must be tolerant of 
-          * unknown HTTP headers".
-          * So just swallow it up until the terminating \r\n. 
-          */
+      logger_log( LOG_TRACE, LOG_MSG("http connection from %s:%d"), inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port) );
 
-         logger_log( LOG_TRACE, LOG_MSG("header is unsupported, ignoring it") );
+      /* TBD: Authorize Client. */
 
-         do
-         {
-            token = httpd_next_header_token( token+len, &len );
-         } while( token[0] != '\r' );
+      conn = httpd_new_connection( client_sock, &cli_addr );
+      if( conn == NULL )
+      {
+         logger_log( LOG_ERROR, LOG_MSG("could not allocate connection, dropping client") );
+         shutdown( client_sock, SD_BOTH );
+         closesocket( client_sock );
+         continue;
       }
 
-      token = httpd_next_header_token( token+len, &len );
-      if( strncmp(token, "\r\n", 2) == 0 )
+      if( (reactor_set_nonblocking(client_sock) != REACTOR_SUCCESS) ||
+          (reactor_add(g_context.reactor, client_sock, REACTOR_READ, conn) != REACTOR_SUCCESS) )
       {
-         /* Found headers end, we're done. */
-         token += 2;
-         done = 1;
+         logger_log( LOG_ERROR, LOG_MSG("could not watch client socket, dropping client") );
+         httpd_close_connection( conn );
       }
-   } /* while( done == 0) */
-
-   /* Final verification of not allowed headers combinations. */
-   httpd_validate_headers( *headers );
-
-   return token-buf;
-} /* http_parse_headers */
+   }
+} /* httpd_accept_connections */
 
 /**
- * Parse an HTTP message body from a buffer containing the HTTP
- * message body. 
- * Allocates memory for the body structure and its content. 
- * If Transfer-Encoding is chunked, the function parses each
- * chunk and rebuilds the entire message.
+ * Reads whatever is available on a connection socket
+ * without blocking.
  *
- * @param buf The HTTP message body
- * @param content_length The content length as stated in the
- *    headers, or HTTP_CONTENT_CHUNKED if Transfer-Encoding is 
- *    chunked.
- * @param body Body structure that will be allocated. 
- * @return The length of the message body.
+ * @param conn The connection.
+ * @return 0 if the connection is still open, 1 if the peer
+ *    closed it, or -1 on error.
  */
 static
-long httpd_parse_body( unsigned char *buf, long content_length, http_message_body **body )
+int httpd_read_connection( httpd_connection *conn )
 {
-   unsigned char *full_body = NULL;
-   long body_length = 0;
+   int res;
 
-   if( content_length == -1 )
+   for( ; ; )
    {
-      /* 
-       * Message is a chunked POST. Read every chunk 
-       * and build the entire message.
-       */
-      long next_size = 0;
-      int len = 0;
-      unsigned char *token;
-
-      /* 
-       * Use httpd_next_header_token as we need
-       * to parse the chunk headers giving us
-       * their lengths.
-       */
-      token = buf;
-      token = httpd_next_header_token( buf, &len );
-      for( ; ; )
+      /* Leave room for the terminating zero. */
+      if( conn->buf_len+1 >= conn->buf_size )
       {
-         /* 
-          * What we just read into token is actually a
-          * hex value. Need to convert it into a decimal 
-          * value before using it.
-          */
-         next_size = strtol( token, NULL, 16 );
-         if( next_size == 0 ) break;
+         unsigned char *buf;
+         long new_size = conn->buf_size * 2;
 
-         /* Eat up everything until the terminating \r\n included. */
-         do
+         if( conn->buf_size >= HTTPD_CONNECTION_MAX_BUFFER+1 )
          {
-            token = httpd_next_header_token( token+len, &len );
-         } while( token[0] != '\r' );
-         token = httpd_next_header_token( token+len, &len );
+            /* Buffer is full, let the framing code reject the request. */
+            return 0;
+         }
+         if( new_size > HTTPD_CONNECTION_MAX_BUFFER+1 ) new_size = HTTPD_CONNECTION_MAX_BUFFER+1;
 
-         /* 
-          * Reallocate the body buffer, append the 
-          * current chunk and zero-terminate. 
-          */
-         full_body = (unsigned char *)realloc( full_body, body_length+next_size+1 );
-         memcpy( full_body+body_length, token, next_size );
-         full_body[body_length+next_size] = 0;
+         buf = (unsigned char *)realloc( conn->buf, new_size );
+         if( buf == NULL )
+         {
+            logger_log( LOG_ERROR, LOG_MSG("could not grow connection buffer") );
+            return -1;
+         }
+         conn->buf = buf;
+         conn->buf_size = new_size;
+      }
 
-         /* Eat up everything until the terminating \r\n included. */
-         do
+      res = recv( conn->sock, conn->buf+conn->buf_len, (int)(conn->buf_size-conn->buf_len-1), 0 );
+      if( res > 0 )
+      {
+         conn->buf_len += res;
+         conn->buf[conn->buf_len] = 0;
+      }
+      else
+      if( res == 0 )
+      {
+         return 1;
+      }
+      else
+      {
+         int err = socket_errno();
+         if( socket_would_block(err) )
          {
-            token = httpd_next_header_token( token+next_size, &len );
-         } while( token[0] != '\r' );
-         token = httpd_next_header_token( token+len, &len );
+            return 0;
+         }
 
-         /* 
-          * Go ahead and parse the next chunk length. 
-          * Update the body length read so far. 
-          */
-         body_length += next_size;
+         logger_log( LOG_ERROR, LOG_MSG("could not receive message from socket, error code: %d"), err );
+         return -1;
       }
    }
+} /* httpd_read_connection */
+
+/**
+ * Worker job: acts upon a parsed request, then gives the
+ * connection back to the server thread.
+ *
+ * @param arg The connection the request was received on.
+ */
+static
+void httpd_handle_request( void *arg )
+{
+   httpd_connection *conn = (httpd_connection *)arg;
+   httpd_request *request = &conn->request;
+
+   if( request->error_code == 400 )
+   {
+      httpd_send_header_and_body( request, HTTP_400_MSG_HEADERS, HTTP_400_MSG_BODY );
+   }
    else
-   if( content_length > 0 )
+   if( request->error_code == 416 )
    {
-      /* Non chunked POST. Easy job. */
-      body_length = content_length;
-      full_body = (unsigned char *)calloc( body_length+1, sizeof(unsigned char) );
-      memcpy( full_body, buf, body_length );
+      httpd_send_header_and_body( request, HTTP_416_MSG_HEADERS, HTTP_416_MSG_BODY );
    }
    else
    {
-      /* Must be a GET then. */
-      body_length = 0;
-      full_body = NULL;
+      /* Act upon the received request. */
+      switch( request->message->headers->method )
+      {
+         case HTTP_METHOD_HEAD:
+            httpd_process_head( request );
+            break;
+
+         case HTTP_METHOD_GET:
+            httpd_process_get( request );
+            break;
+
+         case HTTP_METHOD_POST:
+            httpd_process_post( request );
+            break;
+
+         default:
+            /* The request framing is fine, the connection can be kept. */
+            logger_log( LOG_TRACE, LOG_MSG("unsupported method, sending 501") );
+            httpd_send_header_and_body( request, HTTP_501_MSG_HEADERS, HTTP_501_MSG_BODY );
+            break;
+      }
    }
 
-   /* We're done, copy things back into the body structure. */
-   *body = (http_message_body *)calloc( 1, sizeof(http_message_body) );
-   (*body)->content_length = body_length;
-   (*body)->message = full_body;
+   /* 
+    * Without a response the client cannot tell where the next one
+    * begins, so the only option left is closing the connection.
+    */
+   if( !request->responded ) request->keep_alive = 0;
 
-   return body_length;
-} /* httpd_parse_body */
+   request->message = NULL;
+
+   mpsc_queue_push( &g_context.completed, &conn->node );
+   reactor_wakeup( g_context.reactor );
+} /* httpd_handle_request */
 
 /**
- * Parses an HTTP message from a buffer containing the HTTP
- * entire message.
- * Allocates memory for the message structure and its content.
- * Memory must be frees with httpd_free_http_message.
- * Returns the combined header+body length, taking correctly
- * into account if the body is transferred in chunks.
+ * Decides whether the connection should be kept open
+ * after the response, as per HTTP/1.1 rules: persistent
+ * by default, unless the client says otherwise. HTTP/1.0
+ * clients must ask for it explicitly.
  *
- * @param buf The HTTP message.
- * @param message http_message structure that will be allocated. 
- * @return The length of the parsed message.
+ * @param request The parsed request.
+ * @return 1 if the connection should be kept alive, 0 otherwise.
  */
 static
-long httpd_parse_http_message( unsigned char *buf, http_message **message )
+int httpd_keep_alive( httpd_request *request )
 {
-   long length = 0;
+   http_headers *headers = request->message->headers;
 
-   *message = (http_message *)calloc( 1, sizeof(http_message) );
-   length = httpd_parse_headers( buf, &((*message)->headers) );
-   return length + httpd_parse_body( buf+length, (*message)->headers->content_length, &((*message)->body) );
-} /* httpd_parse_http_message */
+   if( request->error_code != 0 ) return 0;
+   if( headers->connection == CONN_CLOSE ) return 0;
+   if( headers->connection == CONN_KEEP_ALIVE ) return 1;
 
-/**
- * Frees up the headers structure allocated 
- * by http_parse_headers
- *
- * @param headers Header structure that will be freed
- */
-static
-void httpd_free_headers( http_headers *headers )
-{
-   if( headers == NULL ) return;
-   if( headers->method_uri ) free( headers->method_uri );
-   if( headers->user_agent ) free( headers->user_agent );
-   if( headers->soap_action ) free( headers->soap_action );
-   if( headers->friendly_name ) free( headers->friendly_name );
-   free( headers );
-} /* http_free_headers */
+   return (headers->version == HTTP_VERSION_11);
+} /* httpd_keep_alive */
 
 /**
- * Frees up the body structure allocated 
- * by http_parse_body
+ * Looks for a complete request in the connection buffer,
+ * parses it and hands it over to a worker.
  *
- * @param body Body structure that will be freed
+ * @param conn The connection.
+ * @return 1 if a request was handed over, 0 if more data is
+ *    needed, -1 if the connection has been closed.
  */
 static
-void httpd_free_body( http_message_body *body )
+int httpd_dispatch_request( httpd_connection *conn )
 {
-   if( body == NULL ) return;
-   if( body->message != NULL )  free( body->message );
-   free( body );
-} /* httpd_free_body */
+   int res;
 
-/**
- * Frees up the http message structure allocated 
- * by the various parsing functions
- *
- * @param message Message structure that will be freed
- */
-static
-void httpd_free_http_message( http_message *message )
-{
-   if( message == NULL ) return;
-   if( message->headers != NULL ) httpd_free_headers( message->headers );
-   if( message->body != NULL ) free( message->body );
-   free( message );
-} /* httpd_free_http_message */
+   res = http_parser_execute( &conn->parser, conn->buf, conn->buf_len );
+   if( (res == HTTP_PARSER_AGAIN) && (conn->buf_len >= HTTPD_CONNECTION_MAX_BUFFER) )
+   {
+      /* A chunked body with too much chunking overhead. */
+      res = HTTP_PARSER_ERROR;
+   }
 
+   if( res == HTTP_PARSER_ERROR )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("malformed or oversized request, sending 400") );
+      httpd_reject_connection( conn, HTTP_400_MSG_HEADERS, HTTP_400_MSG_BODY );
+      return -1;
+   }
 
-/*----------------------------------------------------------------------------
- *
- * Private file management functions
- *
- *--------------------------------------------------------------------------*/
+   if( res == HTTP_PARSER_AGAIN )
+   {
+      return 0;
+   }
 
-/**
- * Builds the HTTP time string.
- * This function is not reentrant.
- */
-static
-char *httpd_build_http_time()
-{
-   static char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
-   static char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
-	static char http_time[30];
+   /* Reset the request context. */
+   httpd_reset_request( &conn->request );
 
-	time_t curr_time = time( NULL );
-	struct tm *gm_time = gmtime( &curr_time );
-	sprintf ( http_time, "%s, %02d %s %04d %02d:%02d:%02d GMT",
-			    days[gm_time->tm_wday],
-			    gm_time->tm_mday,
-             months [gm_time->tm_mon],
-             1900 + gm_time->tm_year,
-             gm_time->tm_hour,
-             gm_time->tm_min,
-             gm_time->tm_sec );
-			  
-	return http_time;
-} /* httpd_build_http_time */
+   /* 
+    * Requests are parsed here and run by the workers. The 
+    * connection is not watched while a worker owns it, so 
+    * pipelined requests are run one at a time and answered 
+    * in order.
+    */
+   httpd_parse_http_message( conn );
+   conn->request.keep_alive = httpd_keep_alive( &conn->request );
+   reactor_remove( g_context.reactor, conn->sock );
+   conn->busy = 1;
 
-static
-int httpd_send_header_and_body( socket_t client_sock, char *headers, char *body )
-{
-   int res = 0;
+   switch( threadpool_submit(g_context.pool, &conn->job, httpd_handle_request, conn) )
+   {
+      case THREADPOOL_SUCCESS:
+         return 1;
 
-   res = send( client_sock, headers, strlen(headers), 0 );
-   if( res > 0 )
-      res *= send( client_sock, body, strlen(body), 0 );
+      case THREADPOOL_QUEUE_FULL:
+         logger_log( LOG_ERROR, LOG_MSG("too many requests pending, sending 503") );
+         httpd_reject_connection( conn, HTTP_503_MSG_HEADERS, HTTP_503_MSG_BODY );
+         return -1;
 
-   if( res < 0 )
-   {
-      logger_log( LOG_ERROR, LOG_MSG("failed sending message to client") );
+      default:
+         httpd_reject_connection( conn, HTTP_500_MSG_HEADERS, HTTP_500_MSG_BODY );
+         return -1;
    }
-
-   return res;
-} /* httpd_send_header_and_body */
+} /* httpd_dispatch_request */
 
 /**
- * Sends an HTTP 200 OK message back to the client.
+ * Called once the whole response has been sent: either
+ * closes the connection or gets ready for the next request.
  *
- * @param client_sock The client socket to use to send 
- *    the response back.
- * @param body The message body
- * @return HTTP_SUCCESS if successful, or another value otherwise.
+ * @param conn The connection.
  */
 static
-int httpd_send_200_OK( socket_t client_sock, unsigned char *body )
+void httpd_response_complete( httpd_connection *conn )
 {
-   char msg_header[512];
-
-   sprintf( msg_header, HTTP_200_MSG_HEADERS, strlen( body ), httpd_build_http_time() );
-
-   return httpd_send_header_and_body( client_sock, msg_header, body );
-} /* httpd_send_200_OK */
+   /*
+    * Persistent connections are supported, but as per DLNA 
+    * Requirement [7.2.8.5] a connection the client (or we) 
+    * asked to close is closed right after the response, 
+    * ignoring any other request pipelined on it.
+    */
+   if( !conn->request.keep_alive )
+   {
+      httpd_close_connection( conn );
+      return;
+   }
 
+   /* Drop the request just served, keep whatever follows it. */
+   arena_reset( &conn->request.arena );
+   http_parser_consume( &conn->parser, conn->buf, &conn->buf_len );
+   conn->last_activity = time( NULL );
 
-/*----------------------------------------------------------------------------
- *
- * HEAD, GET and POST processors
- *
- *--------------------------------------------------------------------------*/
+   if( reactor_add(g_context.reactor, conn->sock, REACTOR_READ, conn) != REACTOR_SUCCESS )
+   {
+      httpd_close_connection( conn );
+      return;
+   }
 
+   /* A pipelined request may be waiting already. */
+   httpd_dispatch_request( conn );
+} /* httpd_response_complete */
 
 /**
- * HEAD message processor.
+ * Called by the event loop when a streaming connection
+ * can take more data.
  *
- * @param client_sock The client socket to use to send responses back.
- * @param message The HTTP message from the client.
- * @return HTTP_SUCCESS if successful, or HTTP_XXX_ERROR otherwise, being
- *    XXX an HTTP error code.
+ * @param conn The connection.
  */
 static
-int httpd_process_head( socket_t client_sock, http_message *message )
+void httpd_connection_writable( httpd_connection *conn )
 {
-   return 0;
-}
+   switch( transfer_send(conn->request.transfer, conn->sock) )
+   {
+      case TRANSFER_AGAIN:
+         conn->last_activity = time( NULL );
+         break;
+
+      case TRANSFER_DONE:
+         transfer_free( conn->request.transfer );
+         conn->request.transfer = NULL;
+         reactor_remove( g_context.reactor, conn->sock );
+         httpd_response_complete( conn );
+         break;
+
+      default:
+         httpd_close_connection( conn );
+         break;
+   }
+} /* httpd_connection_writable */
 
 /**
- * GET message processor.
+ * Called by the server thread for each connection
+ * a worker is done with.
  *
- * @param client_sock The client socket to use to send responses back.
- * @param message The HTTP message from the client.
- * @return HTTP_SUCCESS if successful, or HTTP_XXX_ERROR otherwise, being
- *    XXX an HTTP error code.
+ * @param conn The connection.
  */
 static
-int httpd_process_get( socket_t client_sock, http_message *message )
+void httpd_request_done( httpd_connection *conn )
 {
-   if( strstr(message->headers->method_uri, CDS_SCPD) )
-   {
-      /* Return the CDS description XML. */
-      httpd_send_200_OK( client_sock, cds_get_scpd() );
-   }
-   else
-   if( strstr(message->headers->method_uri, CMS_SCPD) )
-   {
-      /* Return the CDS description XML. */
-      //httpd_send_200_OK( client_sock, cms_get_scpd() );
-   }
-   else
-   {
-      /* Need to stream a resource. */
-      FILE *resource;
-      int len = strlen(g_context.doc_root_path) + strlen(message->headers->method_uri) + 1;
-      char *filename = (char *)calloc( len, sizeof(char) );
+   conn->busy = 0;
 
-      /* 
-       * Build the file name and try to open it. 
-       * Root path is already terminated with a '/'. 
-       */
-      sprintf( filename, "%s%s", g_context.doc_root_path, message->headers->method_uri );
-      resource = fopen( filename, "r" );
-      if( resource == NULL )
+   if( conn->request.transfer != NULL )
+   {
+      /* The worker opened a file, stream it as the client reads. */
+      conn->last_activity = time( NULL );
+      if( reactor_add(g_context.reactor, conn->sock, REACTOR_WRITE, conn) != REACTOR_SUCCESS )
       {
-         httpd_send_header_and_body( client_sock, 
-                                     HTTP_404_MSG_HEADERS, 
-                                     HTTP_404_MSG_BODY );
-         return HTTPD_404_ERROR;
+         httpd_close_connection( conn );
       }
-
-      /* OK, file is found. Guess file type. */
+      return;
    }
-   return HTTPD_SUCCESS;
-}
+
+   httpd_response_complete( conn );
+} /* httpd_request_done */
 
 /**
- * POST message processor.
- *
- * @param client_sock The client socket to use to send responses back.
- * @param message The HTTP message from the client.
- * @return HTTP_SUCCESS if successful, or HTTP_XXX_ERROR otherwise, being
- *    XXX an HTTP error code.
+ * Closes the connections that have been idle, or have been
+ * sending an incomplete request, for too long. Streaming 
+ * connections get a longer timeout, and connections owned 
+ * by a worker are left alone.
  */
 static
-int httpd_process_post( socket_t client_sock, http_message *message )
+void httpd_close_idle_connections()
 {
-   if( strcmp(message->headers->method_uri, CDS_CONTROL_URL) == 0 )
+   httpd_connection *conn = g_context.connections;
+   time_t now = time( NULL );
+
+   while( conn != NULL )
    {
-      /* 
-       * SOAP Action must be CDS action.
-       */
-      int res;
-      char *cds_response;
-      
-      res = cds_dispatch_action( message->headers->soap_action, message->body->message, &cds_response );
-      if( res == CDS_SUCCESS )
-      {
-         httpd_send_200_OK( client_sock, cds_response );
-      }
-      else
+      httpd_connection *next = conn->next;
+
+      int timeout = (conn->request.transfer != NULL) ? HTTPD_STREAM_TIMEOUT : HTTPD_KEEP_ALIVE_TIMEOUT;
+
+      if( !conn->busy && (now - conn->last_activity >= timeout) )
       {
-         httpd_send_header_and_body( client_sock, HTTP_500_MSG_HEADERS, HTTP_500_MSG_BODY );
+         logger_log( LOG_TRACE, LOG_MSG("closing idle connection from %s:%d"), inet_ntoa(conn->addr.sin_addr), ntohs(conn->addr.sin_port) );
+         httpd_close_connection( conn );
       }
+      conn = next;
    }
-   return 0;
-}
+} /* httpd_close_idle_connections */
 
+/**
+ * Gives back all the connections the workers are done with.
+ */
+static
+void httpd_drain_completed()
+{
+   mpsc_node *node;
 
-/*----------------------------------------------------------------------------
- *
- * HTTP Thread
- *
- *--------------------------------------------------------------------------*/
+   while( (node = mpsc_queue_pop(&g_context.completed)) != NULL )
+   {
+      httpd_request_done( (httpd_connection *)node );
+   }
+} /* httpd_drain_completed */
 
 /**
- * Reads an HTTP message from a socket, and builds the header and
- * body structure.
+ * Called by the event loop when a connection has data to read.
  *
- * @param client_sock The client socket to read the message from.
- * @param message A pointer to the HTTP message structure. The structure
- *    will be allocated and it must be freed with http_free_message.
- * @return HTTPD_SUCCESS is successful, any other value otherwise.
+ * @param conn The connection.
  */
 static
-int httpd_read_http_message( socket_t client_sock, http_message **message )
+void httpd_connection_readable( httpd_connection *conn )
 {
-   int done = 0;
-   int recvd = 0;
-   int curr_recvd = 0;
-   int recv_error = 0;
-   unsigned char tmpbuf[HTTP_SOCKET_BUFFER_SIZE];
-   unsigned char *fullmsg = NULL;
-   int body_offset = 0;
+   int status;
 
-   while( done == 0 )
+   status = httpd_read_connection( conn );
+   if( status < 0 )
    {
-      curr_recvd = recv( client_sock, tmpbuf, HTTP_SOCKET_BUFFER_SIZE, 0 );
-#ifdef WIN32
-      if( curr_recvd == SOCKET_ERROR )
-      {
-         int err =  WSAGetLastError();
-         if( (err != WSAEMSGSIZE) && (err != WSAEWOULDBLOCK) ) 
-#else
-      if( curr_recvd < 0 )
-      {
-         int err = errno;
-         if( (err != EAGAIN) && (err != EWOULDBLOCK) ) 
-#endif
-         {
-            /* Critical error, we're done. */
-            logger_log( LOG_ERROR, LOG_MSG("could not receive message from socket, error code: %d"), err );
-            recv_error = 1;
-         }
-         else 
-         {
-            /* A non critical error has occurred, 
-             * let's sleep for a little while and 
-             * try again... 
-             */
-           millisleep( 10 );
-           continue;
-         }
-      } /* if( curr_recvd... */
-
-      if( recv_error == 1 )
-      {
-         return -1;
-      }
-
-      if( curr_recvd == 0 )
-      {
-         done = 1;
-      }
-      else
-      {
-         /* Append buffer we just read. */
-         fullmsg = (unsigned char *)realloc( fullmsg, (recvd+curr_recvd+1) * sizeof(char) );
-         memcpy( fullmsg+recvd, tmpbuf, curr_recvd * sizeof(char) );
-         fullmsg[recvd+curr_recvd] = 0;
-
-         recvd += curr_recvd;
-         curr_recvd = 0;
-      }
-      
-   } /* while( done == 0 ) */
-
-   /* 
-    * We received the entire HTTP message. Time to 
-    * parse it. This will generate header and body structure.
-    */
-   httpd_parse_http_message( fullmsg, message );
-
-   /* 
-    * Message is parsed, so get rid of the 
-    * allocated buffer.
-    */
-   free( fullmsg );
+      httpd_close_connection( conn );
+      return;
+   }
+   conn->last_activity = time( NULL );
 
-   return HTTPD_SUCCESS;
-} /* read_http_message */
+   if( (httpd_dispatch_request(conn) == 0) && (status == 1) )
+   {
+      /* Incomplete request, and the peer went away. */
+      httpd_close_connection( conn );
+   }
+} /* httpd_connection_readable */
 
 /*
  * HTTP thread procedure.
+ * Runs the event loop: the listening socket and all the client
+ * connections are non-blocking and watched by the reactor, so
+ * a slow client does not hold up the others.
  *
  * @param arg Unused.
  * @return The arg parameter.
@@ -1261,94 +2454,107 @@ int httpd_read_http_message( socket_t client_sock, http_message **message )
 static
 void *httpd_thread_proc( void *arg )
 {
-#if 0
-   long l;
-   http_message *message;
+   reactor_event events[HTTPD_MAX_EVENTS];
+   int num_events;
+   int i;
+   time_t last_sweep = 0;
 
-   l = httpd_parse_http_message( test_get, &message );
-   httpd_free_http_message( message );
-
-   l = httpd_parse_http_message( test_post, &message );
-   httpd_free_http_message( message );
+   g_context.reactor = reactor_create();
+   if( g_context.reactor == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("could not create HTTP event loop, exiting thread") );
+      return NULL;
+   }
 
-   l = httpd_parse_http_message( test_post_chunked, &message );
-   httpd_free_http_message( message );
-#endif
+   mpsc_queue_init( &g_context.completed );
+   g_context.pool = threadpool_create( g_context.num_workers, g_context.queue_depth );
+   if( g_context.pool == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("could not create HTTP worker pool, exiting thread") );
+      reactor_destroy( g_context.reactor );
+      return NULL;
+   }
 
-   socket_t httpd_sock;
-   socket_t client_sock;
-   struct sockaddr_in cli_addr;
-   int cli_len = sizeof( cli_addr );
-   http_message *message;
-   
-   httpd_sock = httpd_new_server_socket();
-   if( httpd_sock < 0 )
+   g_context.httpd_sock = httpd_new_server_socket();
+   if( g_context.httpd_sock < 0 )
    {
       logger_log( LOG_ERROR, LOG_MSG("could not create HTTP socket, exiting thread") );
+      threadpool_destroy( g_context.pool );
+      reactor_destroy( g_context.reactor );
+      return NULL;
+   }
+
+   /* The listening socket is the only one registered with a NULL connection. */
+   if( (reactor_set_nonblocking(g_context.httpd_sock) != REACTOR_SUCCESS) ||
+       (reactor_add(g_context.reactor, g_context.httpd_sock, REACTOR_READ, NULL) != REACTOR_SUCCESS) )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("could not watch HTTP socket, exiting thread") );
+      closesocket( g_context.httpd_sock );
+      threadpool_destroy( g_context.pool );
+      reactor_destroy( g_context.reactor );
       return NULL;
    }
-   
+
    logger_log( LOG_INFO, LOG_MSG("HTTP server running on %s:%d"), g_context.ip_address, g_context.port );
 
+   httpd_update_date();
+
    pthread_mutex_lock( &g_context.httpd_mutex );
    g_context.httpd_initialized = 1;
    pthread_mutex_unlock( &g_context.httpd_mutex );
 
    while( g_context.httpd_run )
    {
-      pthread_mutex_lock( &g_context.httpd_mutex );
+      num_events = reactor_wait( g_context.reactor, events, HTTPD_MAX_EVENTS, HTTPD_LOOP_TIMEOUT );
+      if( num_events < 0 )
+      {
+         logger_log( LOG_ERROR, LOG_MSG("error waiting for HTTP events") );
+         millisleep( 10 );
+         continue;
+      }
 
-      client_sock = accept( httpd_sock, (struct sockaddr *)&cli_addr, &cli_len );
-      if( client_sock > 0 )
+      for( i = 0; i < num_events; i++ )
       {
-         logger_log( LOG_TRACE, LOG_MSG("http connection from %s:%d"), inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port) );
-         
-         /* TBD: Authorize Client. */
-
-         /* Reset working context. */
-         httpd_reset_context();
-         
-         /* Read and parse the message. */
-         httpd_read_http_message( httpd_sock, &message );
-
-         /* Act upon the received request. */
-         switch( message->headers->method )
+         if( events[i].data == NULL )
          {
-            case HTTP_METHOD_HEAD:
-               httpd_process_head( client_sock, message );
-               break;
-
-            case HTTP_METHOD_GET:
-               httpd_process_get( client_sock, message );
-               break;
-
-            case HTTP_METHOD_POST:
-               httpd_process_post( client_sock, message );
-               break;
+            httpd_accept_connections( g_context.httpd_sock );
+         }
+         else
+         if( ((httpd_connection *)events[i].data)->request.transfer != NULL )
+         {
+            httpd_connection_writable( (httpd_connection *)events[i].data );
+         }
+         else
+         if( events[i].events & (REACTOR_READ | REACTOR_HANGUP) )
+         {
+            httpd_connection_readable( (httpd_connection *)events[i].data );
          }
-
-         /* Free up memory. */
-         httpd_free_http_message( message );
-      }
-      else
-      {
-         logger_log( LOG_ERROR, LOG_MSG("could not accept from clients") );
       }
 
-      /* 
-       * This streaming server implementation does not support
-       * persistent connections so as per DLNA Requirement [7.2.8.5]: 
-       * "The HTTP servers of UPnP endpoints (devices and control points) 
-       * that do not support persistent connections must answer 
-       * the first HTTP request from the requesting UPnP control point 
-       * and close the TCP connection to correctly ignore other requests."
-       */
-      shutdown( client_sock, SD_BOTH );
-      closesocket( client_sock );
+      httpd_drain_completed();
 
-      pthread_mutex_unlock( &g_context.httpd_mutex );
+      if( time(NULL) != last_sweep )
+      {
+         last_sweep = time( NULL );
+         httpd_update_date();
+         httpd_close_idle_connections();
+      }
    } /* while( g_context.httpd_run ) */
 
+   /* Let the workers finish, then drop any connection still open. */
+   threadpool_destroy( g_context.pool );
+   g_context.pool = NULL;
+   httpd_drain_completed();
+   while( g_context.connections != NULL )
+   {
+      httpd_close_connection( g_context.connections );
+   }
+   reactor_remove( g_context.reactor, g_context.httpd_sock );
+   shutdown( g_context.httpd_sock, SD_BOTH );
+   closesocket( g_context.httpd_sock );
+   reactor_destroy( g_context.reactor );
+   g_context.reactor = NULL;
+
    logger_log( LOG_INFO, LOG_MSG("httpd server now stopped") );
 
    return arg;
@@ -1388,8 +2594,11 @@ int httpd_server_start( httpd_init_param *init_param )
    }
    g_context.port = init_param->port;
    g_context.doc_root_path = init_param->doc_root;
+   g_context.num_workers = (init_param->num_workers > 0) ? init_param->num_workers : HTTPD_DEFAULT_WORKERS;
+   g_context.queue_depth = (init_param->queue_depth > 0) ? init_param->queue_depth : HTTPD_DEFAULT_QUEUE_DEPTH;
 
    pthread_mutex_init( &g_context.httpd_mutex, NULL );
+   g_context.httpd_run = 1;
    if( pthread_create(&g_context.httpd_thread, NULL, httpd_thread_proc, NULL) != 0 ) 
    {
       logger_log( LOG_ERROR, LOG_MSG("could not start HTTP thread") );
@@ -1422,7 +2631,9 @@ void httpd_server_stop()
       g_context.httpd_initialized = 0;
 
       pthread_mutex_unlock( &g_context.httpd_mutex );
-      pthread_cancel( g_context.httpd_thread );
+
+      /* The event loop wakes up at least once per HTTPD_LOOP_TIMEOUT. */
+      pthread_join( g_context.httpd_thread, NULL );
       pthread_mutex_destroy( &g_context.httpd_mutex );
 
       httpd_socket_cleanup();
@@ -1470,3 +2681,11 @@ char *httpd_get_root_name()
 {
    return HTTPD_WEB_ROOT;
 } /* httpd_get_root_name */
+
+/**
+ * @return The path of the "/" location, terminated with a '/'.
+ */
+char *httpd_get_doc_root()
+{
+   return g_context.doc_root_path;
+} /* httpd_get_doc_root */
@@ -0,0 +1,681 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+/*
+ * Incremental HTTP request parser.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#  include "strncasecmp.h"
+#else
+#  include <strings.h>
+#endif
+
+#include "httpparser.h"
+
+/*
+ * Lines are scanned 32 or 16 bytes at a time when AVX2 or
+ * SSE2 are available, looking for ':' and '\n' at once.
+ */
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define HTTP_SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define HTTP_SCAN_SSE2
+#endif
+
+#if defined(HTTP_SCAN_AVX2) || defined(HTTP_SCAN_SSE2)
+#  ifdef _MSC_VER
+#     include <intrin.h>
+static __inline int http_ctz( unsigned int mask ) { unsigned long i; _BitScanForward( &i, mask ); return (int)i; }
+#  else
+#     define http_ctz( mask ) __builtin_ctz( mask )
+#  endif
+#endif
+
+/**
+ * Longest chunk size line (size and extensions) accepted, 
+ * and longest trailer line.
+ */
+#define HTTP_CHUNK_LINE_MAX 1024
+
+/* Parser states */
+enum
+{
+   HTTP_STATE_REQUEST_LINE,
+   HTTP_STATE_HEADER,
+   HTTP_STATE_BODY,
+   HTTP_STATE_CHUNK_SIZE,
+   HTTP_STATE_CHUNK_DATA,
+   HTTP_STATE_CHUNK_END,
+   HTTP_STATE_TRAILER,
+   HTTP_STATE_DONE
+};
+
+/**
+ * Names of the headers the parser keeps track of,
+ * in HTTP_HEADER order.
+ */
+static const struct
+{
+   const char *name;
+   long len;
+} http_header_names[HTTP_HEADER_MAX] =
+{
+   { "Connection", 10 },
+   { "Content-Length", 14 },
+   { "Transfer-Encoding", 17 },
+   { "User-Agent", 10 },
+   { "SOAPACTION", 10 },
+   { "Range", 5 },
+   { "getcontentFeatures.dlna.org", 27 },
+   { "TimeSeekRange.dlna.org", 22 },
+   { "friendlyName.dlna.org", 21 },
+   { "transferMode.dlna.org", 21 },
+   { "getMediaInfo.sec", 16 },
+   { "getCaptionInfo.sec", 18 }
+};
+
+/* 
+ * Perfect hash over the header names above, case insensitive: 
+ * ASCII letters are folded to lower case by setting bit 5, which 
+ * leaves '-' and '.' untouched. The multiplier was searched for 
+ * so that no two names collide; adding a header means checking 
+ * that again, and updating http_header_hash_table.
+ */
+#define HTTP_HEADER_HASH_SIZE 32
+#define http_fold( c ) ((c) | 0x20)
+#define http_header_hash( name, len ) \
+   ((3*http_fold((name)[0]) + http_fold((name)[(len)-1]) + (len)) & (HTTP_HEADER_HASH_SIZE-1))
+
+/* Hash value to header, HTTP_HEADER_MAX for unused slots. */
+static const unsigned char http_header_hash_table[HTTP_HEADER_HASH_SIZE] =
+{
+   HTTP_HEADER_RANGE,                  /* 0 */
+   HTTP_HEADER_CONNECTION,             /* 1 */
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_GETMEDIAINFO_SEC,       /* 8 */
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_GETCAPTIONINFO_SEC,     /* 10 */
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_FRIENDLYNAME,           /* 14 */
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_SOAPACTION,             /* 17 */
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_TRANSFER_ENCODING,      /* 20 */
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_GETCONTENTFEATURES,     /* 23 */
+   HTTP_HEADER_TRANSFERMODE,           /* 24 */
+   HTTP_HEADER_TIMESEEKRANGE,          /* 25 */
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_USER_AGENT,             /* 29 */
+   HTTP_HEADER_MAX,
+   HTTP_HEADER_CONTENT_LENGTH          /* 31 */
+};
+
+#define http_is_blank( c ) (((c) == ' ') || ((c) == '\t'))
+
+
+/*----------------------------------------------------------------------------
+ *
+ * Private functions
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Scans a buffer for the first '\n', also recording
+ * where the first ':' before it is.
+ *
+ * @param buf The buffer.
+ * @param i Where to start from.
+ * @param len The number of bytes in the buffer.
+ * @param colon Will receive the offset of the first ':', if it 
+ *    is still negative and there is one before the '\n'.
+ * @return The offset of the '\n', or -1 if not found.
+ */
+static
+long http_scan_line( const unsigned char *buf, long i, long len, long *colon )
+{
+#if defined(HTTP_SCAN_AVX2)
+   const __m256i nl_v = _mm256_set1_epi8( '\n' );
+   const __m256i colon_v = _mm256_set1_epi8( ':' );
+
+   for( ; i+32 <= len; i += 32 )
+   {
+      __m256i v = _mm256_loadu_si256( (const __m256i *)(buf+i) );
+      unsigned int nl = (unsigned int)_mm256_movemask_epi8( _mm256_cmpeq_epi8(v, nl_v) );
+
+      if( *colon < 0 )
+      {
+         unsigned int c = (unsigned int)_mm256_movemask_epi8( _mm256_cmpeq_epi8(v, colon_v) );
+
+         /* Only colons before the newline count. */
+         if( nl ) c &= (nl & (0u-nl)) - 1;
+         if( c ) *colon = i + http_ctz( c );
+      }
+      if( nl )
+      {
+         return i + http_ctz( nl );
+      }
+   }
+#elif defined(HTTP_SCAN_SSE2)
+   const __m128i nl_v = _mm_set1_epi8( '\n' );
+   const __m128i colon_v = _mm_set1_epi8( ':' );
+
+   for( ; i+16 <= len; i += 16 )
+   {
+      __m128i v = _mm_loadu_si128( (const __m128i *)(buf+i) );
+      unsigned int nl = (unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8(v, nl_v) );
+
+      if( *colon < 0 )
+      {
+         unsigned int c = (unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8(v, colon_v) );
+
+         /* Only colons before the newline count. */
+         if( nl ) c &= (nl & (0u-nl)) - 1;
+         if( c ) *colon = i + http_ctz( c );
+      }
+      if( nl )
+      {
+         return i + http_ctz( nl );
+      }
+   }
+#endif
+
+   for( ; i < len; i++ )
+   {
+      if( buf[i] == '\n' )
+      {
+         return i;
+      }
+      if( (buf[i] == ':') && (*colon < 0) )
+      {
+         *colon = i;
+      }
+   }
+
+   return -1;
+} /* http_scan_line */
+
+/**
+ * Looks for the end of the current line, starting from where
+ * the previous call stopped. Both \r\n and a bare \n end a line.
+ *
+ * @param p The parser.
+ * @param buf The buffer.
+ * @param len The number of bytes in the buffer.
+ * @param line Will receive the line, without its terminator.
+ * @param colon Will receive the offset of the first ':' 
+ *    in the line, -1 if there is none.
+ * @return 1 if a whole line is available, 0 otherwise.
+ */
+static
+int http_parser_next_line( http_parser *p, unsigned char *buf, long len, http_slice *line, long *colon )
+{
+   long nl;
+
+   nl = http_scan_line( buf, p->scan, len, &p->colon );
+   if( nl < 0 )
+   {
+      p->scan = len;
+      return 0;
+   }
+
+   line->offset = p->pos;
+   line->len = nl - p->pos;
+   if( (line->len > 0) && (buf[line->offset+line->len-1] == '\r') )
+   {
+      line->len--;
+   }
+   *colon = p->colon;
+
+   p->pos = nl + 1;
+   p->scan = p->pos;
+   p->colon = -1;
+
+   return 1;
+} /* http_parser_next_line */
+
+/**
+ * Parses the request line: method, URI and version.
+ *
+ * @return HTTP_PARSER_AGAIN or HTTP_PARSER_ERROR.
+ */
+static
+int http_parser_request_line( http_parser *p, unsigned char *buf, http_slice *line )
+{
+   long end = line->offset + line->len;
+   long i = line->offset;
+
+   p->method.offset = i;
+   while( (i < end) && (buf[i] != ' ') ) i++;
+   p->method.len = i - p->method.offset;
+   if( (p->method.len == 0) || (i == end) ) return HTTP_PARSER_ERROR;
+
+   p->uri.offset = ++i;
+   while( (i < end) && (buf[i] != ' ') ) i++;
+   p->uri.len = i - p->uri.offset;
+   if( (p->uri.len == 0) || (i == end) ) return HTTP_PARSER_ERROR;
+
+   p->version.offset = ++i;
+   p->version.len = end - i;
+   if( (p->version.len != 8) || (strncmp((char *)buf+i, "HTTP/1.", 7) != 0) )
+   {
+      return HTTP_PARSER_ERROR;
+   }
+
+   p->state = HTTP_STATE_HEADER;
+   return HTTP_PARSER_AGAIN;
+} /* http_parser_request_line */
+
+/**
+ * Parses a header line, keeping track of the
+ * value if the header is a known one.
+ *
+ * @return HTTP_PARSER_AGAIN or HTTP_PARSER_ERROR.
+ */
+static
+int http_parser_header_line( http_parser *p, unsigned char *buf, http_slice *line, long colon )
+{
+   unsigned char *start = buf + line->offset;
+   long name_len;
+   long value_start;
+   long value_end;
+   int id;
+
+   /* Obsolete line folding is not supported. */
+   if( http_is_blank(start[0]) )
+   {
+      return HTTP_PARSER_ERROR;
+   }
+
+   if( colon < 0 )
+   {
+      return HTTP_PARSER_ERROR;
+   }
+
+   name_len = colon - line->offset;
+   while( (name_len > 0) && http_is_blank(start[name_len-1]) ) name_len--;
+   if( name_len == 0 )
+   {
+      return HTTP_PARSER_ERROR;
+   }
+
+   /* One hash lookup, then a single compare to rule out unknown headers. */
+   id = http_header_hash_table[http_header_hash( start, name_len )];
+   if( (id == HTTP_HEADER_MAX) || (http_header_names[id].len != name_len) ||
+       (strncasecmp((char *)start, http_header_names[id].name, name_len) != 0) )
+   {
+      return HTTP_PARSER_AGAIN;
+   }
+
+   value_start = colon - line->offset + 1;
+   value_end = line->len;
+   while( (value_start < value_end) && http_is_blank(start[value_start]) ) value_start++;
+   while( (value_end > value_start) && http_is_blank(start[value_end-1]) ) value_end--;
+
+   p->headers[id].offset = line->offset + value_start;
+   p->headers[id].len = value_end - value_start;
+
+   return HTTP_PARSER_AGAIN;
+} /* http_parser_header_line */
+
+/**
+ * Called at the end of the headers, works out 
+ * how the body is delimited.
+ *
+ * @return HTTP_PARSER_AGAIN or HTTP_PARSER_ERROR.
+ */
+static
+int http_parser_headers_done( http_parser *p, unsigned char *buf )
+{
+   http_slice *value;
+
+   p->body.offset = p->pos;
+   p->body.len = 0;
+
+   value = &p->headers[HTTP_HEADER_TRANSFER_ENCODING];
+   if( !http_slice_empty(*value) )
+   {
+      /* 
+       * Content-Length must be ignored in this case. Chunked 
+       * is the only transfer coding we can decode, and it 
+       * must come last.
+       */
+      if( (value->len < 7) || 
+          (strncasecmp(http_slice_ptr(buf, *value)+value->len-7, "chunked", 7) != 0) ||
+          ((value->len > 7) && (strchr(", \t", buf[value->offset+value->len-8]) == NULL)) )
+      {
+         return HTTP_PARSER_ERROR;
+      }
+      p->chunked = 1;
+      p->state = HTTP_STATE_CHUNK_SIZE;
+      return HTTP_PARSER_AGAIN;
+   }
+
+   value = &p->headers[HTTP_HEADER_CONTENT_LENGTH];
+   if( !http_slice_empty(*value) )
+   {
+      long i;
+
+      if( value->len == 0 )
+      {
+         return HTTP_PARSER_ERROR;
+      }
+
+      p->content_length = 0;
+      for( i = 0; i < value->len; i++ )
+      {
+         unsigned char c = buf[value->offset+i];
+         if( (c < '0') || (c > '9') ) return HTTP_PARSER_ERROR;
+         p->content_length = p->content_length*10 + (c-'0');
+         if( p->content_length > HTTP_BODY_MAX_SIZE ) return HTTP_PARSER_ERROR;
+      }
+   }
+
+   p->state = HTTP_STATE_BODY;
+   return HTTP_PARSER_AGAIN;
+} /* http_parser_headers_done */
+
+/**
+ * Parses a chunk size line.
+ *
+ * @return HTTP_PARSER_AGAIN or HTTP_PARSER_ERROR.
+ */
+static
+int http_parser_chunk_size( http_parser *p, unsigned char *buf, http_slice *line )
+{
+   long size = 0;
+   long i;
+
+   for( i = 0; i < line->len; i++ )
+   {
+      unsigned char c = buf[line->offset+i];
+      int digit;
+
+      if( (c >= '0') && (c <= '9') ) digit = c-'0';
+      else if( (c >= 'a') && (c <= 'f') ) digit = c-'a'+10;
+      else if( (c >= 'A') && (c <= 'F') ) digit = c-'A'+10;
+      else break;
+
+      size = size*16 + digit;
+      if( size > HTTP_BODY_MAX_SIZE - p->body.len ) return HTTP_PARSER_ERROR;
+   }
+
+   /* At least a digit, then nothing but chunk extensions. */
+   if( i == 0 )
+   {
+      return HTTP_PARSER_ERROR;
+   }
+   while( (i < line->len) && http_is_blank(buf[line->offset+i]) ) i++;
+   if( (i < line->len) && (buf[line->offset+i] != ';') )
+   {
+      return HTTP_PARSER_ERROR;
+   }
+
+   p->chunk_left = size;
+   p->state = (size == 0) ? HTTP_STATE_TRAILER : HTTP_STATE_CHUNK_DATA;
+   return HTTP_PARSER_AGAIN;
+} /* http_parser_chunk_size */
+
+/**
+ * Moves chunk data next to the body decoded so far.
+ *
+ * @return HTTP_PARSER_AGAIN.
+ */
+static
+int http_parser_chunk_data( http_parser *p, unsigned char *buf, long len )
+{
+   long n = len - p->pos;
+
+   if( n > p->chunk_left ) n = p->chunk_left;
+
+   if( p->body.offset + p->body.len != p->pos )
+   {
+      memmove( buf + p->body.offset + p->body.len, buf + p->pos, n );
+   }
+   p->body.len += n;
+   p->pos += n;
+   p->scan = p->pos;
+   p->chunk_left -= n;
+
+   if( p->chunk_left == 0 )
+   {
+      p->state = HTTP_STATE_CHUNK_END;
+   }
+   return HTTP_PARSER_AGAIN;
+} /* http_parser_chunk_data */
+
+/**
+ * Called once the whole request has been received:
+ * zero terminates all the slices in the buffer.
+ */
+static
+void http_parser_done( http_parser *p, unsigned char *buf )
+{
+   int i;
+
+   buf[p->method.offset + p->method.len] = 0;
+   buf[p->uri.offset + p->uri.len] = 0;
+   buf[p->version.offset + p->version.len] = 0;
+
+   for( i = 0; i < HTTP_HEADER_MAX; i++ )
+   {
+      if( !http_slice_empty(p->headers[i]) )
+      {
+         buf[p->headers[i].offset + p->headers[i].len] = 0;
+      }
+   }
+
+   /* 
+    * The byte after the body may well be the beginning 
+    * of the next request: keep it aside.
+    */
+   p->saved = buf[p->body.offset + p->body.len];
+   buf[p->body.offset + p->body.len] = 0;
+
+   p->state = HTTP_STATE_DONE;
+} /* http_parser_done */
+
+
+/*----------------------------------------------------------------------------
+ *
+ * Public functions
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Gets a parser ready for a new request.
+ *
+ * @param p The parser.
+ */
+void http_parser_init( http_parser *p )
+{
+   int i;
+
+   p->state = HTTP_STATE_REQUEST_LINE;
+   p->pos = 0;
+   p->scan = 0;
+   p->colon = -1;
+
+   p->method.offset = -1;
+   p->uri.offset = -1;
+   p->version.offset = -1;
+   for( i = 0; i < HTTP_HEADER_MAX; i++ )
+   {
+      p->headers[i].offset = -1;
+      p->headers[i].len = 0;
+   }
+
+   p->chunked = 0;
+   p->content_length = 0;
+   p->chunk_left = 0;
+   p->body.offset = -1;
+   p->body.len = 0;
+   p->saved = 0;
+} /* http_parser_init */
+
+/**
+ * Parses the bytes added to the buffer since the last call.
+ * Once the request is complete, the request line, headers 
+ * and body slices are zero terminated in the buffer, so
+ * buf[len] must be writable.
+ *
+ * @param p The parser.
+ * @param buf The buffer, with the request at its beginning.
+ * @param len The number of bytes in the buffer.
+ * @return HTTP_PARSER_DONE if the request is complete,
+ *    HTTP_PARSER_AGAIN if more data is needed, or 
+ *    HTTP_PARSER_ERROR if the request is malformed or
+ *    too large.
+ */
+int http_parser_execute( http_parser *p, unsigned char *buf, long len )
+{
+   http_slice line;
+   long colon;
+   int res = HTTP_PARSER_AGAIN;
+
+   while( res == HTTP_PARSER_AGAIN )
+   {
+      switch( p->state )
+      {
+         case HTTP_STATE_REQUEST_LINE:
+         case HTTP_STATE_HEADER:
+            if( !http_parser_next_line(p, buf, len, &line, &colon) )
+            {
+               return (len > HTTP_HEADERS_MAX_SIZE) ? HTTP_PARSER_ERROR : HTTP_PARSER_AGAIN;
+            }
+            if( p->pos > HTTP_HEADERS_MAX_SIZE )
+            {
+               return HTTP_PARSER_ERROR;
+            }
+
+            if( p->state == HTTP_STATE_REQUEST_LINE )
+            {
+               /* Empty lines before the request line are ignored. */
+               if( line.len > 0 ) res = http_parser_request_line( p, buf, &line );
+            }
+            else
+            if( line.len == 0 )
+            {
+               res = http_parser_headers_done( p, buf );
+            }
+            else
+            {
+               res = http_parser_header_line( p, buf, &line, colon );
+            }
+            break;
+
+         case HTTP_STATE_BODY:
+            if( len - p->body.offset < p->content_length )
+            {
+               return HTTP_PARSER_AGAIN;
+            }
+            p->body.len = p->content_length;
+            p->pos = p->body.offset + p->content_length;
+            http_parser_done( p, buf );
+            break;
+
+         case HTTP_STATE_CHUNK_SIZE:
+         case HTTP_STATE_CHUNK_END:
+         case HTTP_STATE_TRAILER:
+            if( !http_parser_next_line(p, buf, len, &line, &colon) )
+            {
+               return (len - p->pos > HTTP_CHUNK_LINE_MAX) ? HTTP_PARSER_ERROR : HTTP_PARSER_AGAIN;
+            }
+            if( line.len > HTTP_CHUNK_LINE_MAX )
+            {
+               return HTTP_PARSER_ERROR;
+            }
+
+            if( p->state == HTTP_STATE_CHUNK_SIZE )
+            {
+               res = http_parser_chunk_size( p, buf, &line );
+            }
+            else
+            if( p->state == HTTP_STATE_CHUNK_END )
+            {
+               /* Chunk data must be followed by \r\n. */
+               if( line.len != 0 ) return HTTP_PARSER_ERROR;
+               p->state = HTTP_STATE_CHUNK_SIZE;
+            }
+            else
+            if( line.len == 0 )
+            {
+               /* Trailer headers, if any, are skipped. */
+               http_parser_done( p, buf );
+            }
+            break;
+
+         case HTTP_STATE_CHUNK_DATA:
+            if( p->pos == len )
+            {
+               return HTTP_PARSER_AGAIN;
+            }
+            res = http_parser_chunk_data( p, buf, len );
+            break;
+
+         case HTTP_STATE_DONE:
+            return HTTP_PARSER_DONE;
+      }
+   }
+
+   return res;
+} /* http_parser_execute */
+
+/**
+ * Removes a complete request from the beginning of the buffer
+ * and gets the parser ready for the next one.
+ *
+ * @param p The parser.
+ * @param buf The buffer.
+ * @param len The number of bytes in the buffer, updated
+ *    to what is left after the request.
+ */
+void http_parser_consume( http_parser *p, unsigned char *buf, long *len )
+{
+   if( p->state == HTTP_STATE_DONE )
+   {
+      buf[p->body.offset + p->body.len] = p->saved;
+      *len -= p->pos;
+      memmove( buf, buf + p->pos, *len );
+      buf[*len] = 0;
+   }
+
+   http_parser_init( p );
+} /* http_parser_consume */
@@ -0,0 +1,455 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * A minimal non-blocking I/O reactor used by the HTTP server.
+ *
+ * Under Linux descriptors are multiplexed with epoll, which scales
+ * to thousands of connections. Everywhere else (i.e. Windows) we
+ * fall back to select(), which is good enough for a home network.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+   /* Must be set before winsock2.h gets included. */
+#  define FD_SETSIZE 1024
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#  include <winsock2.h>
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <errno.h>
+#  include <sys/types.h>
+#  include <sys/socket.h>
+#  include <sys/select.h>
+#endif
+
+#if defined(__linux__)
+#  define REACTOR_USE_EPOLL
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#  include <stdint.h>
+#endif
+
+#include "pthread.h"
+
+#include "logger.h"
+
+#include "reactor.h"
+
+#ifdef REACTOR_USE_EPOLL
+
+/*
+ * Size hint for epoll_create. Ignored by recent kernels
+ * but must be greater than zero.
+ */
+#define REACTOR_EPOLL_SIZE_HINT 1024
+
+/* Maximum number of events fetched by a single epoll_wait. */
+#define REACTOR_EPOLL_MAX_EVENTS 64
+
+struct reactor
+{
+   int epfd;
+
+   /*
+    * Written to by reactor_wakeup. It is registered with
+    * the reactor itself as data, and never reported.
+    */
+   int wakeup_fd;
+};
+
+#else
+
+/*
+ * Upper limit to the time spent in select(). Other threads
+ * may change the watched set while we are waiting, and those
+ * changes will only be picked up on the next round.
+ */
+#define REACTOR_SELECT_MAX_WAIT 20
+
+typedef struct reactor_entry
+{
+   reactor_fd fd;
+   int events;
+   void *data;
+} reactor_entry;
+
+struct reactor
+{
+   pthread_mutex_t mutex;
+   int num_entries;
+   reactor_entry entries[FD_SETSIZE];
+};
+
+#endif
+
+
+#ifdef REACTOR_USE_EPOLL
+
+/*----------------------------------------------------------------------------
+ *
+ * epoll implementation
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Converts REACTOR_XXX flags into epoll flags.
+ */
+static
+unsigned int reactor_to_epoll( int events )
+{
+   unsigned int ev = 0;
+
+   if( events & REACTOR_READ ) ev |= EPOLLIN | EPOLLRDHUP;
+   if( events & REACTOR_WRITE ) ev |= EPOLLOUT;
+
+   return ev;
+} /* reactor_to_epoll */
+
+reactor *reactor_create()
+{
+   reactor *r = (reactor *)calloc( 1, sizeof(reactor) );
+   if( r == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("could not allocate reactor") );
+      return NULL;
+   }
+
+   r->epfd = epoll_create( REACTOR_EPOLL_SIZE_HINT );
+   if( r->epfd < 0 )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("epoll_create failed, error code: %d"), errno );
+      free( r );
+      return NULL;
+   }
+
+   r->wakeup_fd = eventfd( 0, EFD_NONBLOCK );
+   if( (r->wakeup_fd < 0) || (reactor_add(r, r->wakeup_fd, REACTOR_READ, r) != REACTOR_SUCCESS) )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("could not create reactor wakeup descriptor, error code: %d"), errno );
+      if( r->wakeup_fd >= 0 ) close( r->wakeup_fd );
+      close( r->epfd );
+      free( r );
+      return NULL;
+   }
+
+   return r;
+} /* reactor_create */
+
+void reactor_destroy( reactor *r )
+{
+   if( r == NULL ) return;
+   close( r->wakeup_fd );
+   close( r->epfd );
+   free( r );
+} /* reactor_destroy */
+
+int reactor_add( reactor *r, reactor_fd fd, int events, void *data )
+{
+   struct epoll_event ev;
+
+   memset( &ev, 0, sizeof(ev) );
+   ev.events = reactor_to_epoll( events );
+   ev.data.ptr = data;
+   if( epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0 )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("epoll_ctl(ADD) failed, error code: %d"), errno );
+      return REACTOR_ERROR;
+   }
+
+   return REACTOR_SUCCESS;
+} /* reactor_add */
+
+int reactor_modify( reactor *r, reactor_fd fd, int events, void *data )
+{
+   struct epoll_event ev;
+
+   memset( &ev, 0, sizeof(ev) );
+   ev.events = reactor_to_epoll( events );
+   ev.data.ptr = data;
+   if( epoll_ctl(r->epfd, EPOLL_CTL_MOD, fd, &ev) < 0 )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("epoll_ctl(MOD) failed, error code: %d"), errno );
+      return REACTOR_ERROR;
+   }
+
+   return REACTOR_SUCCESS;
+} /* reactor_modify */
+
+int reactor_remove( reactor *r, reactor_fd fd )
+{
+   /* Kernels before 2.6.9 require a non-NULL event. */
+   struct epoll_event ev;
+
+   memset( &ev, 0, sizeof(ev) );
+   if( epoll_ctl(r->epfd, EPOLL_CTL_DEL, fd, &ev) < 0 )
+   {
+      return REACTOR_ERROR;
+   }
+
+   return REACTOR_SUCCESS;
+} /* reactor_remove */
+
+int reactor_wait( reactor *r, reactor_event *events, int max_events, int timeout_ms )
+{
+   struct epoll_event ev[REACTOR_EPOLL_MAX_EVENTS];
+   int n, i, count;
+
+   if( max_events > REACTOR_EPOLL_MAX_EVENTS ) max_events = REACTOR_EPOLL_MAX_EVENTS;
+
+   n = epoll_wait( r->epfd, ev, max_events, timeout_ms );
+   if( n < 0 )
+   {
+      /* A signal is not an error. */
+      return (errno == EINTR) ? 0 : REACTOR_ERROR;
+   }
+
+   for( i = 0, count = 0; i < n; i++ )
+   {
+      if( ev[i].data.ptr == r )
+      {
+         /* Just a wakeup, reset the counter. */
+         uint64_t value;
+         read( r->wakeup_fd, &value, sizeof(value) );
+         continue;
+      }
+
+      events[count].data = ev[i].data.ptr;
+      events[count].events = 0;
+
+      if( ev[i].events & (EPOLLIN | EPOLLRDHUP) ) events[count].events |= REACTOR_READ;
+      if( ev[i].events & EPOLLOUT ) events[count].events |= REACTOR_WRITE;
+      if( ev[i].events & (EPOLLERR | EPOLLHUP) ) events[count].events |= REACTOR_HANGUP;
+      count++;
+   }
+
+   return count;
+} /* reactor_wait */
+
+int reactor_wakeup( reactor *r )
+{
+   uint64_t one = 1;
+
+   /* EAGAIN means the counter is already set, which is fine. */
+   if( (write(r->wakeup_fd, &one, sizeof(one)) < 0) && (errno != EAGAIN) )
+   {
+      return REACTOR_ERROR;
+   }
+
+   return REACTOR_SUCCESS;
+} /* reactor_wakeup */
+
+#else
+
+/*----------------------------------------------------------------------------
+ *
+ * select() implementation
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Finds the entry for a descriptor.
+ * Must be called with the reactor mutex held.
+ *
+ * @return The entry index or -1 if not found.
+ */
+static
+int reactor_find( reactor *r, reactor_fd fd )
+{
+   int i;
+
+   for( i = 0; i < r->num_entries; i++ )
+   {
+      if( r->entries[i].fd == fd ) return i;
+   }
+
+   return -1;
+} /* reactor_find */
+
+reactor *reactor_create()
+{
+   reactor *r = (reactor *)calloc( 1, sizeof(reactor) );
+   if( r == NULL )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("could not allocate reactor") );
+      return NULL;
+   }
+
+   pthread_mutex_init( &r->mutex, NULL );
+
+   return r;
+} /* reactor_create */
+
+void reactor_destroy( reactor *r )
+{
+   if( r == NULL ) return;
+   pthread_mutex_destroy( &r->mutex );
+   free( r );
+} /* reactor_destroy */
+
+int reactor_add( reactor *r, reactor_fd fd, int events, void *data )
+{
+   int res = REACTOR_SUCCESS;
+
+   pthread_mutex_lock( &r->mutex );
+   if( r->num_entries < FD_SETSIZE )
+   {
+      r->entries[r->num_entries].fd = fd;
+      r->entries[r->num_entries].events = events;
+      r->entries[r->num_entries].data = data;
+      r->num_entries++;
+   }
+   else
+   {
+      logger_log( LOG_ERROR, LOG_MSG("too many descriptors, FD_SETSIZE is %d"), FD_SETSIZE );
+      res = REACTOR_ERROR;
+   }
+   pthread_mutex_unlock( &r->mutex );
+
+   return res;
+} /* reactor_add */
+
+int reactor_modify( reactor *r, reactor_fd fd, int events, void *data )
+{
+   int idx;
+
+   pthread_mutex_lock( &r->mutex );
+   idx = reactor_find( r, fd );
+   if( idx >= 0 )
+   {
+      r->entries[idx].events = events;
+      r->entries[idx].data = data;
+   }
+   pthread_mutex_unlock( &r->mutex );
+
+   return (idx >= 0) ? REACTOR_SUCCESS : REACTOR_ERROR;
+} /* reactor_modify */
+
+int reactor_remove( reactor *r, reactor_fd fd )
+{
+   int idx;
+
+   pthread_mutex_lock( &r->mutex );
+   idx = reactor_find( r, fd );
+   if( idx >= 0 )
+   {
+      /* Order does not matter, move the last entry here. */
+      r->entries[idx] = r->entries[r->num_entries-1];
+      r->num_entries--;
+   }
+   pthread_mutex_unlock( &r->mutex );
+
+   return (idx >= 0) ? REACTOR_SUCCESS : REACTOR_ERROR;
+} /* reactor_remove */
+
+int reactor_wait( reactor *r, reactor_event *events, int max_events, int timeout_ms )
+{
+   fd_set read_set, write_set, except_set;
+   struct timeval tv;
+   reactor_fd max_fd = 0;
+   int i, n, count = 0;
+
+   FD_ZERO( &read_set );
+   FD_ZERO( &write_set );
+   FD_ZERO( &except_set );
+
+   pthread_mutex_lock( &r->mutex );
+   for( i = 0; i < r->num_entries; i++ )
+   {
+      reactor_entry *e = &r->entries[i];
+
+      if( e->events == 0 ) continue;
+      if( e->events & REACTOR_READ ) FD_SET( e->fd, &read_set );
+      if( e->events & REACTOR_WRITE ) FD_SET( e->fd, &write_set );
+      FD_SET( e->fd, &except_set );
+      if( e->fd > max_fd ) max_fd = e->fd;
+   }
+   pthread_mutex_unlock( &r->mutex );
+
+   if( (timeout_ms < 0) || (timeout_ms > REACTOR_SELECT_MAX_WAIT) )
+   {
+      timeout_ms = REACTOR_SELECT_MAX_WAIT;
+   }
+   tv.tv_sec = timeout_ms / 1000;
+   tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+   n = select( (int)max_fd+1, &read_set, &write_set, &except_set, &tv );
+   if( n <= 0 )
+   {
+      return n;
+   }
+
+   pthread_mutex_lock( &r->mutex );
+   for( i = 0; (i < r->num_entries) && (count < max_events); i++ )
+   {
+      reactor_entry *e = &r->entries[i];
+      int ev = 0;
+
+      if( e->events == 0 ) continue;
+      if( FD_ISSET(e->fd, &read_set) ) ev |= REACTOR_READ;
+      if( FD_ISSET(e->fd, &write_set) ) ev |= REACTOR_WRITE;
+      if( FD_ISSET(e->fd, &except_set) ) ev |= REACTOR_HANGUP;
+
+      if( ev != 0 )
+      {
+         events[count].events = ev;
+         events[count].data = e->data;
+         count++;
+      }
+   }
+   pthread_mutex_unlock( &r->mutex );
+
+   return count;
+} /* reactor_wait */
+
+int reactor_wakeup( reactor *r )
+{
+   /*
+    * Nothing to do: select() never waits longer than
+    * REACTOR_SELECT_MAX_WAIT anyway.
+    */
+   return REACTOR_SUCCESS;
+} /* reactor_wakeup */
+
+#endif
+
+
+/**
+ * Puts a socket in non-blocking mode.
+ *
+ * @param fd The socket.
+ * @return REACTOR_SUCCESS or REACTOR_ERROR.
+ */
+int reactor_set_nonblocking( reactor_fd fd )
+{
+#ifdef WIN32
+   u_long yes = 1;
+   return (ioctlsocket(fd, FIONBIO, &yes) == 0) ? REACTOR_SUCCESS : REACTOR_ERROR;
+#else
+   int flags = fcntl( fd, F_GETFL, 0 );
+   if( flags < 0 ) return REACTOR_ERROR;
+   return (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0) ? REACTOR_SUCCESS : REACTOR_ERROR;
+#endif
+} /* reactor_set_nonblocking */
@@ -0,0 +1,328 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Response bodies streamed from files.
+ */
+
+#ifndef WIN32
+   /* Files larger than 4GB on 32 bit systems too. */
+#  define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#  include <winsock2.h>
+#  include <io.h>
+#  define socket_errno() WSAGetLastError()
+#  define socket_would_block(err) ((err) == WSAEWOULDBLOCK)
+#else
+#  include <unistd.h>
+#  include <errno.h>
+#  include <sys/socket.h>
+#  include <sys/uio.h>
+#  define socket_errno() errno
+#  define socket_would_block(err) (((err) == EAGAIN) || ((err) == EWOULDBLOCK) || ((err) == EINTR))
+#endif
+
+#if defined(__linux__)
+#  define TRANSFER_USE_SENDFILE
+#  include <sys/sendfile.h>
+#endif
+
+#include "logger.h"
+
+#include "transfer.h"
+
+/**
+ * Size of the bounce buffer used when sendfile
+ * is not available.
+ */
+#define TRANSFER_BUFFER_SIZE 65536
+
+/**
+ * Maximum number of bytes sent by a single call to
+ * transfer_send, so that a fast client does not keep
+ * the event loop away from the other connections.
+ */
+#define TRANSFER_MAX_BURST (1024*1024)
+
+
+/*----------------------------------------------------------------------------
+ *
+ * Platform helpers
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Reads from a file at a given offset.
+ *
+ * @return The number of bytes read, or -1 on error.
+ */
+static
+long transfer_pread( int fd, char *buf, long len, int64_t offset )
+{
+#ifdef WIN32
+   if( _lseeki64( fd, offset, SEEK_SET ) < 0 ) return -1;
+   return _read( fd, buf, len );
+#else
+   return (long)pread( fd, buf, len, (off_t)offset );
+#endif
+} /* transfer_pread */
+
+/**
+ * Sends up to two buffers with a single system call.
+ *
+ * @return The number of bytes sent, or -1 on error.
+ */
+static
+long transfer_writev( transfer_socket sock, char *b1, long l1, char *b2, long l2 )
+{
+#ifdef WIN32
+   WSABUF bufs[2];
+   DWORD sent = 0;
+   int n = 0;
+
+   if( l1 > 0 ) { bufs[n].buf = b1; bufs[n].len = l1; n++; }
+   if( l2 > 0 ) { bufs[n].buf = b2; bufs[n].len = l2; n++; }
+   if( WSASend( sock, bufs, n, &sent, 0, NULL, NULL ) != 0 ) return -1;
+
+   return (long)sent;
+#else
+   struct iovec iov[2];
+   struct msghdr msg;
+   int n = 0;
+
+   if( l1 > 0 ) { iov[n].iov_base = b1; iov[n].iov_len = l1; n++; }
+   if( l2 > 0 ) { iov[n].iov_base = b2; iov[n].iov_len = l2; n++; }
+
+   memset( &msg, 0, sizeof(msg) );
+   msg.msg_iov = iov;
+   msg.msg_iovlen = n;
+
+   /* sendmsg rather than writev, to avoid SIGPIPE. */
+   return (long)sendmsg( sock, &msg, MSG_NOSIGNAL );
+#endif
+} /* transfer_writev */
+
+
+/*----------------------------------------------------------------------------
+ *
+ * Public functions
+ *
+ *--------------------------------------------------------------------------*/
+
+transfer *transfer_open( const char *filename, int64_t *size )
+{
+   transfer *t;
+   int fd;
+#ifdef WIN32
+   struct _stati64 st;
+
+   fd = _open( filename, _O_RDONLY | _O_BINARY );
+   if( fd < 0 ) return NULL;
+   if( (_fstati64(fd, &st) != 0) || !(st.st_mode & _S_IFREG) )
+   {
+      _close( fd );
+      return NULL;
+   }
+#else
+   struct stat st;
+
+   fd = open( filename, O_RDONLY );
+   if( fd < 0 ) return NULL;
+   if( (fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) )
+   {
+      close( fd );
+      return NULL;
+   }
+#endif
+
+   t = (transfer *)calloc( 1, sizeof(transfer) );
+   if( t == NULL )
+   {
+#ifdef WIN32
+      _close( fd );
+#else
+      close( fd );
+#endif
+      return NULL;
+   }
+
+   t->fd = fd;
+   t->offset = 0;
+   t->remaining = (int64_t)st.st_size;
+#ifdef TRANSFER_USE_SENDFILE
+   t->use_sendfile = 1;
+#endif
+
+   *size = (int64_t)st.st_size;
+
+   return t;
+} /* transfer_open */
+
+void transfer_set_range( transfer *t, int64_t offset, int64_t length )
+{
+   t->offset = offset;
+   t->remaining = length;
+} /* transfer_set_range */
+
+int transfer_set_head( transfer *t, const char *head )
+{
+   free( t->head );
+
+   t->head_len = (long)strlen( head );
+   t->head_sent = 0;
+   t->head = (char *)malloc( t->head_len+1 );
+   if( t->head == NULL )
+   {
+      t->head_len = 0;
+      return TRANSFER_ERROR;
+   }
+   memcpy( t->head, head, t->head_len+1 );
+
+   return TRANSFER_DONE;
+} /* transfer_set_head */
+
+int transfer_send( transfer *t, transfer_socket sock )
+{
+   long burst = 0;
+   long res;
+
+   while( (t->head_sent < t->head_len) || (t->remaining > 0) || (t->buf_sent < t->buf_len) )
+   {
+      if( burst >= TRANSFER_MAX_BURST )
+      {
+         /* Give the other connections a chance. */
+         return TRANSFER_AGAIN;
+      }
+
+#ifdef TRANSFER_USE_SENDFILE
+      if( t->use_sendfile )
+      {
+         if( t->head_sent < t->head_len )
+         {
+            /* Tell the kernel more data follows, so headers and data share packets. */
+            res = send( sock, t->head+t->head_sent, t->head_len-t->head_sent, MSG_NOSIGNAL | ((t->remaining > 0) ? MSG_MORE : 0) );
+            if( res < 0 ) goto _send_error;
+            t->head_sent += res;
+            burst += res;
+         }
+         else
+         {
+            off_t offset = (off_t)t->offset;
+            size_t count = (t->remaining > TRANSFER_MAX_BURST) ? TRANSFER_MAX_BURST : (size_t)t->remaining;
+
+            res = (long)sendfile( sock, t->fd, &offset, count );
+            if( res < 0 )
+            {
+               if( (errno == EINVAL) || (errno == ENOSYS) )
+               {
+                  /* Not supported for this file, go the slow way. */
+                  t->use_sendfile = 0;
+                  continue;
+               }
+               goto _send_error;
+            }
+            if( res == 0 )
+            {
+               logger_log( LOG_ERROR, LOG_MSG("file ended before the expected length") );
+               return TRANSFER_ERROR;
+            }
+            t->offset += res;
+            t->remaining -= res;
+            burst += res;
+         }
+         continue;
+      }
+#endif
+
+      /* Refill the bounce buffer. */
+      if( (t->buf_sent >= t->buf_len) && (t->remaining > 0) )
+      {
+         long len = (t->remaining > TRANSFER_BUFFER_SIZE) ? TRANSFER_BUFFER_SIZE : (long)t->remaining;
+
+         if( t->buf == NULL )
+         {
+            t->buf = (char *)malloc( TRANSFER_BUFFER_SIZE );
+            if( t->buf == NULL ) return TRANSFER_ERROR;
+         }
+
+         res = transfer_pread( t->fd, t->buf, len, t->offset );
+         if( res <= 0 )
+         {
+            logger_log( LOG_ERROR, LOG_MSG("could not read file at offset %ld"), (long)t->offset );
+            return TRANSFER_ERROR;
+         }
+         t->buf_len = res;
+         t->buf_sent = 0;
+         t->offset += res;
+         t->remaining -= res;
+      }
+
+      /* Pending headers and file data leave together. */
+      res = transfer_writev( sock,
+                             t->head+t->head_sent, t->head_len-t->head_sent,
+                             t->buf+t->buf_sent, t->buf_len-t->buf_sent );
+      if( res < 0 ) goto _send_error;
+      burst += res;
+
+      if( t->head_sent < t->head_len )
+      {
+         long head_part = t->head_len-t->head_sent;
+         if( res < head_part ) head_part = res;
+         t->head_sent += head_part;
+         res -= head_part;
+      }
+      t->buf_sent += res;
+   }
+
+   return TRANSFER_DONE;
+
+_send_error:
+   if( socket_would_block(socket_errno()) )
+   {
+      return TRANSFER_AGAIN;
+   }
+   logger_log( LOG_TRACE, LOG_MSG("transfer interrupted, error code: %d"), socket_errno() );
+   return TRANSFER_ERROR;
+} /* transfer_send */
+
+void transfer_free( transfer *t )
+{
+   if( t == NULL ) return;
+
+#ifdef WIN32
+   _close( t->fd );
+#else
+   close( t->fd );
+#endif
+   free( t->head );
+   free( t->buf );
+   free( t );
+} /* transfer_free */
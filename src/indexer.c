@@ -0,0 +1,804 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+/*
+ * Background keyframe indexer for MPEG-1/2 program and 
+ * transport streams.
+ *
+ * Items are scanned once, sequentially, on a thread of their own:
+ * the PTS of every video PES is tracked, and a sequence header or
+ * GOP header in the elementary stream marks a keyframe, i.e. a
+ * point where playback can start from. Entries go straight into
+ * the item time index, which can be used while it fills up, and 
+ * the complete index is saved in the metadata directory so that
+ * items are only scanned once.
+ */
+
+#ifndef WIN32
+   /* Files larger than 4GB on 32 bit systems too. */
+#  define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pthread.h"
+
+#include "logger.h"
+#include "atomic.h"
+
+#include "item.h"
+#include "timeindex.h"
+#include "indexer.h"
+
+#ifdef WIN32
+#  define INDEXER_PATH_SEPARATOR "\\"
+#else
+#  define INDEXER_PATH_SEPARATOR "/"
+#endif
+
+/* Index file extension. */
+#define INDEXER_FILE_EXTENSION ".idx"
+
+/* Read size. Items are read sequentially, once. */
+#define INDEXER_BUFFER_SIZE (256*1024)
+
+/* 
+ * Bytes kept at the end of each read in program streams, 
+ * so that a PES header is never split: 6 bytes of header,
+ * up to 16 stuffing bytes, 2 STD buffer bytes and the PTS.
+ */
+#define INDEXER_LOOKAHEAD 32
+
+#define TS_SYNC_BYTE 0x47
+#define TS_PACKET_SIZE 188
+
+/* Presentation time stamps are 33 bit wide, 90kHz. */
+#define PTS_WRAP ((int64_t)1 << 33)
+#define PTS_TICKS_PER_MSEC 90
+
+/* Start codes */
+#define START_CODE_SEQUENCE_HEADER 0xB3
+#define START_CODE_GOP 0xB8
+#define START_CODE_PACK 0xBA
+#define START_CODE_SYSTEM_HEADER 0xBB
+#define START_CODE_VIDEO_FIRST 0xE0
+#define START_CODE_VIDEO_LAST 0xEF
+
+/**
+ * An item waiting to be indexed.
+ */
+typedef struct indexer_job
+{
+   struct indexer_job *next;
+
+   char *filename;
+   ITEM_ID id;
+
+   /* A reference to the item index. */
+   timeindex *index;
+} indexer_job;
+
+/**
+ * The state of a stream scan.
+ */
+typedef struct indexer_scan
+{
+   timeindex *index;
+
+   /* Last four bytes seen, to spot start codes. */
+   unsigned int window;
+
+   /* Program streams: whether the current PES carries video. */
+   int in_video;
+   int64_t pack_offset;
+
+   /* Transport streams: the video PID, -1 until found. */
+   int video_pid;
+
+   /* PTS unwrapping. */
+   int64_t first_pts;
+   int64_t last_pts;
+   int64_t pts_base;
+
+   /* 
+    * The current video PES: its time, where a reader should
+    * start from to get it, and whether it already produced
+    * an index entry.
+    */
+   int64_t pes_time;
+   int64_t pes_offset;
+   int pes_indexed;
+} indexer_scan;
+
+/**
+ * The indexer context.
+ */
+static struct
+{
+   char *metadata_path;
+
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   volatile long run;
+
+   /* Jobs, first in first out. */
+   indexer_job *first;
+   indexer_job *last;
+} g_indexer;
+
+
+/*----------------------------------------------------------------------------
+ *
+ * Stream parsing
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Decodes a 33 bit PTS from the five bytes carrying it.
+ */
+static
+int64_t indexer_read_pts( const unsigned char *p )
+{
+   return ((int64_t)(p[0] & 0x0E) << 29) |
+          ((int64_t)p[1] << 22) |
+          ((int64_t)(p[2] & 0xFE) << 14) |
+          ((int64_t)p[3] << 7) |
+          ((int64_t)p[4] >> 1);
+} /* indexer_read_pts */
+
+/**
+ * Reads the PTS from a PES header.
+ *
+ * @param p Points to the stream_id, right after the 00 00 01 prefix.
+ * @param len The bytes available from p.
+ * @param pts Will receive the PTS.
+ * @return 1 if the header carries a PTS, 0 otherwise.
+ */
+static
+int indexer_pes_pts( const unsigned char *p, int len, int64_t *pts )
+{
+   int i = 3;
+
+   if( len < 11 )
+   {
+      return 0;
+   }
+
+   /* MPEG-2 PES header. */
+   if( (p[3] & 0xC0) == 0x80 )
+   {
+      if( (p[4] & 0x80) == 0 )
+      {
+         return 0;
+      }
+      *pts = indexer_read_pts( p+6 );
+      return 1;
+   }
+
+   /* MPEG-1 packet header: stuffing, STD buffer, then the PTS. */
+   while( (i < len) && (p[i] == 0xFF) ) i++;
+   if( (i < len) && ((p[i] & 0xC0) == 0x40) ) i += 2;
+   if( (i+5 <= len) && ((p[i] & 0xE0) == 0x20) )
+   {
+      *pts = indexer_read_pts( p+i );
+      return 1;
+   }
+
+   return 0;
+} /* indexer_pes_pts */
+
+/**
+ * Starts a new video PES.
+ *
+ * @param s The scan state.
+ * @param pts The PES time stamp.
+ * @param offset Where a reader should start from to get this PES.
+ */
+static
+void indexer_new_pes( indexer_scan *s, int64_t pts, int64_t offset )
+{
+   /* Unwrap the time stamp: it wraps every 26 hours or so. */
+   if( (s->last_pts >= 0) && (pts < s->last_pts - PTS_WRAP/2) )
+   {
+      s->pts_base += PTS_WRAP;
+   }
+   else
+   if( (s->last_pts >= 0) && (pts > s->last_pts + PTS_WRAP/2) )
+   {
+      /* A late packet from before the wrap. */
+      pts -= PTS_WRAP;
+   }
+   s->last_pts = pts & (PTS_WRAP-1);
+   pts += s->pts_base;
+
+   if( s->first_pts < 0 )
+   {
+      s->first_pts = pts;
+   }
+
+   s->pes_time = (pts > s->first_pts) ? (pts - s->first_pts) / PTS_TICKS_PER_MSEC : 0;
+   s->pes_offset = offset;
+   s->pes_indexed = 0;
+} /* indexer_new_pes */
+
+/**
+ * Records a keyframe found in the current video PES.
+ *
+ * @param s The scan state.
+ */
+static
+void indexer_keyframe( indexer_scan *s )
+{
+   /* A sequence header is often followed by a GOP header. */
+   if( (s->pes_time >= 0) && !s->pes_indexed )
+   {
+      timeindex_add( s->index, s->pes_time, s->pes_offset );
+      s->pes_indexed = 1;
+   }
+} /* indexer_keyframe */
+
+/**
+ * Scans video elementary stream data for keyframes.
+ *
+ * @param s The scan state.
+ * @param p The data.
+ * @param len The data length.
+ */
+static
+void indexer_scan_video( indexer_scan *s, const unsigned char *p, int len )
+{
+   unsigned int window = s->window;
+   int i;
+
+   for( i = 0; i < len; i++ )
+   {
+      window = (window << 8) | p[i];
+      if( ((window & 0xFFFFFF00) == 0x00000100) && 
+          ((p[i] == START_CODE_SEQUENCE_HEADER) || (p[i] == START_CODE_GOP)) )
+      {
+         indexer_keyframe( s );
+      }
+   }
+
+   s->window = window;
+} /* indexer_scan_video */
+
+/**
+ * Scans a chunk of a program stream.
+ *
+ * @param s The scan state.
+ * @param buf The data.
+ * @param len The data length.
+ * @param limit Where to stop: the bytes after it are kept 
+ *    for the next call, unless it is the end of the file.
+ * @param base The file offset of buf.
+ */
+static
+void indexer_scan_ps( indexer_scan *s, const unsigned char *buf, int len, int limit, int64_t base )
+{
+   unsigned int window = s->window;
+   int64_t pts;
+   int i;
+
+   for( i = 0; i < limit; i++ )
+   {
+      unsigned char code = buf[i];
+
+      window = (window << 8) | code;
+      if( (window & 0xFFFFFF00) != 0x00000100 )
+      {
+         continue;
+      }
+
+      if( code == START_CODE_PACK )
+      {
+         s->pack_offset = base + i - 3;
+      }
+      else
+      if( (code >= START_CODE_VIDEO_FIRST) && (code <= START_CODE_VIDEO_LAST) )
+      {
+         s->in_video = 1;
+         if( indexer_pes_pts(buf+i, len-i, &pts) )
+         {
+            indexer_new_pes( s, pts, s->pack_offset );
+         }
+      }
+      else
+      if( code >= START_CODE_SYSTEM_HEADER )
+      {
+         /* Audio, private or padding stream. */
+         s->in_video = 0;
+      }
+      else
+      if( s->in_video && ((code == START_CODE_SEQUENCE_HEADER) || (code == START_CODE_GOP)) )
+      {
+         indexer_keyframe( s );
+      }
+   }
+
+   s->window = window;
+} /* indexer_scan_ps */
+
+/**
+ * Scans a transport stream packet.
+ *
+ * @param s The scan state.
+ * @param p The packet, starting with the sync byte.
+ * @param offset Where a reader should start from to get 
+ *    the packet.
+ */
+static
+void indexer_scan_ts_packet( indexer_scan *s, const unsigned char *p, int64_t offset )
+{
+   int pid = ((p[1] & 0x1F) << 8) | p[2];
+   int pusi = p[1] & 0x40;
+   int afc = (p[3] >> 4) & 0x03;
+   int start = 4;
+   const unsigned char *payload;
+   int len;
+   int64_t pts;
+
+   /* No payload. */
+   if( (afc & 0x01) == 0 )
+   {
+      return;
+   }
+   if( afc & 0x02 )
+   {
+      start += 1 + p[4];
+   }
+   if( start >= TS_PACKET_SIZE )
+   {
+      return;
+   }
+   payload = p + start;
+   len = TS_PACKET_SIZE - start;
+
+   if( pusi && (len >= 9) && (payload[0] == 0) && (payload[1] == 0) && (payload[2] == 1) )
+   {
+      /* The first video PES found tells which PID carries video. */
+      if( (s->video_pid < 0) && 
+          (payload[3] >= START_CODE_VIDEO_FIRST) && (payload[3] <= START_CODE_VIDEO_LAST) )
+      {
+         s->video_pid = pid;
+      }
+
+      if( pid == s->video_pid )
+      {
+         int header = ((payload[6] & 0xC0) == 0x80) ? 9 + payload[8] : 6;
+
+         if( indexer_pes_pts(payload+3, len-3, &pts) )
+         {
+            indexer_new_pes( s, pts, offset );
+         }
+
+         s->window = 0xFFFFFFFF;
+         if( header < len )
+         {
+            indexer_scan_video( s, payload + header, len - header );
+         }
+      }
+   }
+   else
+   if( pid == s->video_pid )
+   {
+      indexer_scan_video( s, payload, len );
+   }
+} /* indexer_scan_ts_packet */
+
+/**
+ * Works out the transport stream packet size.
+ *
+ * @param buf The beginning of the file.
+ * @param len The bytes available.
+ * @param prefix Will receive the bytes preceding the sync byte
+ *    in each packet (4 for M2TS time coded packets).
+ * @return The packet size, or 0 if this is not a transport stream.
+ */
+static
+int indexer_ts_packet_size( const unsigned char *buf, int len, int *prefix )
+{
+   static const int sizes[] = { TS_PACKET_SIZE, TS_PACKET_SIZE+4 };
+   int i;
+
+   for( i = 0; i < 2; i++ )
+   {
+      int size = sizes[i];
+      int pre = size - TS_PACKET_SIZE;
+
+      if( (len >= 3*size) && 
+          (buf[pre] == TS_SYNC_BYTE) && (buf[pre+size] == TS_SYNC_BYTE) && (buf[pre+2*size] == TS_SYNC_BYTE) )
+      {
+         *prefix = pre;
+         return size;
+      }
+   }
+
+   return 0;
+} /* indexer_ts_packet_size */
+
+/**
+ * Scans a whole file, filling up the index.
+ *
+ * @param job The item to scan.
+ * @return INDEXER_SUCCESS if the whole file has been scanned, 
+ *    INDEXER_ERROR otherwise.
+ */
+static
+int indexer_scan_file( indexer_job *job )
+{
+   indexer_scan s;
+   unsigned char *buf;
+   FILE *f;
+   int64_t base = 0;
+   int len = 0;
+   int packet_size = 0;
+   int prefix = 0;
+   int is_ps = -1;
+   int eof = 0;
+   int res = INDEXER_SUCCESS;
+
+   f = fopen( job->filename, "rb" );
+   if( f == NULL )
+   {
+      return INDEXER_ERROR;
+   }
+
+   buf = (unsigned char *)malloc( INDEXER_BUFFER_SIZE );
+   if( buf == NULL )
+   {
+      fclose( f );
+      return INDEXER_ERROR;
+   }
+
+   memset( &s, 0, sizeof(s) );
+   s.index = job->index;
+   s.window = 0xFFFFFFFF;
+   s.video_pid = -1;
+   s.first_pts = -1;
+   s.last_pts = -1;
+   s.pes_time = -1;
+
+   while( !eof )
+   {
+      int used;
+
+      /* 
+       * Give up if the indexer is stopping, or if we hold the
+       * last reference: the item has been freed meanwhile.
+       */
+      if( !g_indexer.run || (atomic_read(&job->index->refs) == 1) )
+      {
+         res = INDEXER_ERROR;
+         break;
+      }
+
+      len += (int)fread( buf+len, 1, INDEXER_BUFFER_SIZE-len, f );
+      eof = feof( f ) || ferror( f );
+
+      if( is_ps < 0 )
+      {
+         packet_size = indexer_ts_packet_size( buf, len, &prefix );
+         is_ps = (packet_size == 0);
+         if( is_ps && ((len < 4) || (buf[0] != 0) || (buf[1] != 0) || (buf[2] != 1) || (buf[3] != START_CODE_PACK)) )
+         {
+            /* Neither a program nor a transport stream. */
+            logger_log( LOG_TRACE, LOG_MSG("%s is not an MPEG program or transport stream"), job->filename );
+            break;
+         }
+      }
+
+      if( is_ps )
+      {
+         int limit = eof ? len : len - INDEXER_LOOKAHEAD;
+
+         if( limit < 0 ) limit = 0;
+         indexer_scan_ps( &s, buf, len, limit, base );
+         used = limit;
+      }
+      else
+      {
+         used = 0;
+         while( used + packet_size <= len )
+         {
+            if( buf[used+prefix] != TS_SYNC_BYTE )
+            {
+               /* Lost sync, look for the next sync byte. */
+               used++;
+               continue;
+            }
+            indexer_scan_ts_packet( &s, buf+used+prefix, base+used );
+            used += packet_size;
+         }
+      }
+
+      memmove( buf, buf+used, len-used );
+      len -= used;
+      base += used;
+   }
+
+   free( buf );
+   fclose( f );
+
+   return res;
+} /* indexer_scan_file */
+
+
+/*----------------------------------------------------------------------------
+ *
+ * Indexer thread
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Returns the size of a file.
+ *
+ * @param filename The file name.
+ * @return The file size, or -1 if the file cannot be accessed.
+ */
+static
+int64_t indexer_file_size( const char *filename )
+{
+#ifdef WIN32
+   struct _stati64 st;
+   if( _stati64(filename, &st) != 0 ) return -1;
+#else
+   struct stat st;
+   if( stat(filename, &st) != 0 ) return -1;
+#endif
+   return (int64_t)st.st_size;
+} /* indexer_file_size */
+
+/**
+ * Indexes an item: loads its index file if there is an 
+ * up to date one, scans the item and saves the index otherwise.
+ *
+ * @param job The item to index.
+ */
+static
+void indexer_run_job( indexer_job *job )
+{
+   char *index_filename;
+   int64_t size;
+
+   size = indexer_file_size( job->filename );
+   if( size < 0 )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("cannot access %s"), job->filename );
+      return;
+   }
+
+   index_filename = (char *)malloc( strlen(g_indexer.metadata_path) + 1 + sizeof(ITEM_ID) + strlen(INDEXER_FILE_EXTENSION) + 1 );
+   if( index_filename == NULL )
+   {
+      return;
+   }
+   sprintf( index_filename, "%s" INDEXER_PATH_SEPARATOR "%s" INDEXER_FILE_EXTENSION, g_indexer.metadata_path, job->id );
+
+   if( timeindex_load(job->index, index_filename, size) == TIMEINDEX_SUCCESS )
+   {
+      logger_log( LOG_TRACE, LOG_MSG("time index for %s loaded from %s"), job->filename, index_filename );
+   }
+   else
+   if( indexer_scan_file(job) == INDEXER_SUCCESS )
+   {
+      timeindex_set_complete( job->index );
+      logger_log( LOG_TRACE, LOG_MSG("%s indexed, %d entries"), job->filename, job->index->num_entries );
+
+      if( timeindex_save(job->index, index_filename, size) != TIMEINDEX_SUCCESS )
+      {
+         logger_log( LOG_ERROR, LOG_MSG("cannot save time index %s"), index_filename );
+      }
+   }
+
+   free( index_filename );
+} /* indexer_run_job */
+
+/**
+ * Frees up a job.
+ */
+static
+void indexer_free_job( indexer_job *job )
+{
+   timeindex_free( job->index );
+   free( job->filename );
+   free( job );
+} /* indexer_free_job */
+
+/**
+ * The indexer thread: indexes queued items one at a time.
+ */
+static
+void *indexer_thread_proc( void *arg )
+{
+   indexer_job *job;
+
+   (void)arg;
+
+   for( ; ; )
+   {
+      pthread_mutex_lock( &g_indexer.mutex );
+      while( g_indexer.run && (g_indexer.first == NULL) )
+      {
+         pthread_cond_wait( &g_indexer.cond, &g_indexer.mutex );
+      }
+      if( !g_indexer.run )
+      {
+         pthread_mutex_unlock( &g_indexer.mutex );
+         break;
+      }
+      job = g_indexer.first;
+      g_indexer.first = job->next;
+      if( g_indexer.first == NULL )
+      {
+         g_indexer.last = NULL;
+      }
+      pthread_mutex_unlock( &g_indexer.mutex );
+
+      indexer_run_job( job );
+      indexer_free_job( job );
+   }
+
+   return NULL;
+} /* indexer_thread_proc */
+
+
+/*----------------------------------------------------------------------------
+ *
+ * Public functions
+ *
+ *--------------------------------------------------------------------------*/
+
+/**
+ * Starts the background indexer. The indexer scans MPEG-1/2
+ * program and transport streams for their keyframes, and builds
+ * the time index used to answer TimeSeekRange.dlna.org requests.
+ *
+ * @param metadata_path The directory where index files are kept.
+ * @return INDEXER_SUCCESS or INDEXER_ERROR.
+ */
+int indexer_start( const char *metadata_path )
+{
+   if( g_indexer.run )
+   {
+      return INDEXER_SUCCESS;
+   }
+
+   g_indexer.metadata_path = strdup( metadata_path );
+   g_indexer.first = NULL;
+   g_indexer.last = NULL;
+   pthread_mutex_init( &g_indexer.mutex, NULL );
+   pthread_cond_init( &g_indexer.cond, NULL );
+
+   g_indexer.run = 1;
+   if( pthread_create(&g_indexer.thread, NULL, indexer_thread_proc, NULL) != 0 )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("cannot start the indexer thread") );
+      g_indexer.run = 0;
+      pthread_cond_destroy( &g_indexer.cond );
+      pthread_mutex_destroy( &g_indexer.mutex );
+      free( g_indexer.metadata_path );
+      return INDEXER_ERROR;
+   }
+
+   logger_log( LOG_TRACE, LOG_MSG("indexer started, index files in %s"), metadata_path );
+
+   return INDEXER_SUCCESS;
+} /* indexer_start */
+
+/**
+ * Stops the background indexer. Items being indexed are left
+ * with a partial index, and will be scanned again next time.
+ */
+void indexer_stop()
+{
+   indexer_job *job;
+
+   if( !g_indexer.run )
+   {
+      return;
+   }
+
+   pthread_mutex_lock( &g_indexer.mutex );
+   g_indexer.run = 0;
+   pthread_cond_signal( &g_indexer.cond );
+   pthread_mutex_unlock( &g_indexer.mutex );
+
+   pthread_join( g_indexer.thread, NULL );
+
+   while( g_indexer.first != NULL )
+   {
+      job = g_indexer.first;
+      g_indexer.first = job->next;
+      indexer_free_job( job );
+   }
+   g_indexer.last = NULL;
+
+   pthread_cond_destroy( &g_indexer.cond );
+   pthread_mutex_destroy( &g_indexer.mutex );
+   free( g_indexer.metadata_path );
+   g_indexer.metadata_path = NULL;
+} /* indexer_stop */
+
+/**
+ * Queues an item for indexing. This never blocks: the item gets
+ * an empty time index right away, which fills up while the item
+ * is scanned, or is loaded from the metadata directory if the
+ * item was indexed before. Items that already have a time index,
+ * and items that are not video, are ignored.
+ *
+ * @param item The item to index.
+ * @return INDEXER_SUCCESS, or INDEXER_ERROR if the indexer
+ *    is not running or out of memory.
+ */
+int indexer_submit( item_info *item )
+{
+   indexer_job *job;
+
+   if( !g_indexer.run )
+   {
+      return INDEXER_ERROR;
+   }
+
+   if( (item->time_index != NULL) || (item->filename == NULL) ||
+       !(item->type & (ITEM_VIDEO | ITEM_AUDIOVIDEO)) )
+   {
+      return INDEXER_SUCCESS;
+   }
+
+   job = (indexer_job *)calloc( 1, sizeof(indexer_job) );
+   if( job == NULL )
+   {
+      return INDEXER_ERROR;
+   }
+   job->filename = strdup( item->filename );
+   strcpy( job->id, item->id );
+
+   item->time_index = timeindex_create();
+   if( (job->filename == NULL) || (item->time_index == NULL) )
+   {
+      free( job->filename );
+      free( job );
+      return INDEXER_ERROR;
+   }
+   job->index = timeindex_retain( item->time_index );
+
+   pthread_mutex_lock( &g_indexer.mutex );
+   if( g_indexer.last != NULL )
+   {
+      g_indexer.last->next = job;
+   }
+   else
+   {
+      g_indexer.first = job;
+   }
+   g_indexer.last = job;
+   pthread_cond_signal( &g_indexer.cond );
+   pthread_mutex_unlock( &g_indexer.mutex );
+
+   return INDEXER_SUCCESS;
+} /* indexer_submit */
@@ -22,6 +22,8 @@
 
 #include <malloc.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 /* Under Win32, define inline to include ffmpeg headers */
 #ifdef WIN32
@@ -64,6 +66,7 @@ int item_getinfo( char *filename, item_info **item )
    unsigned int idx;
    item_info *ii = NULL;
    AVFormatContext *avcontext;
+   struct stat file_stat;
 
    logger_log( LOG_TRACE, LOG_MSG("file name: %s"), filename );
 
@@ -203,6 +206,10 @@ int item_getinfo( char *filename, item_info **item )
    ii->filename = strdup( filename );
    ii->size = avcontext->file_size;
    ii->bitrate = avcontext->bit_rate;
+   if( stat(filename, &file_stat) == 0 )
+   {
+      ii->date = file_stat.st_mtime;
+   }
 
    *item = ii;
 
@@ -220,6 +227,7 @@ void item_freeinfo( item_info *item )
    if( item != NULL )
    {
       av_close_input_stream( item->format_context );
+      timeindex_free( item->time_index );
       free( item->filename );
       free( item );
    }
@@ -0,0 +1,327 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "searchcriteria.h"
+
+#ifdef WIN32
+#  include "strncasecmp.h"
+#else
+#  include <strings.h>
+#endif
+
+#define search_is_space(c) (((c) == ' ') || ((c) == '\t') || ((c) == '\r') || ((c) == '\n'))
+
+/*
+ * Parser state: the position in the criteria and the arena.
+ */
+typedef struct search_parser
+{
+   char *p;
+   arena *a;
+} search_parser;
+
+static
+search_expr *search_parse_or( search_parser *parser );
+
+static
+void search_skip_spaces( search_parser *parser )
+{
+   while( search_is_space(*parser->p) )
+   {
+      parser->p++;
+   }
+} /* search_skip_spaces */
+
+/*
+ * Check for a keyword at the current position, followed by a
+ * space, a quote or a parenthesis, and skip it if found.
+ */
+static
+int search_keyword( search_parser *parser, const char *keyword )
+{
+   size_t len = strlen( keyword );
+   char next;
+
+   if( strncasecmp(parser->p, keyword, len) != 0 )
+   {
+      return 0;
+   }
+
+   next = parser->p[len];
+   if( (next != 0) && !search_is_space(next) && (next != '(') && (next != ')') && (next != '"') )
+   {
+      return 0;
+   }
+
+   parser->p += len;
+   return 1;
+} /* search_keyword */
+
+static
+search_expr *search_new_expr( search_parser *parser, SEARCH_OP op )
+{
+   search_expr *expr;
+
+   expr = (search_expr *)arena_alloc( parser->a, sizeof(search_expr) );
+   if( expr != NULL )
+   {
+      memset( expr, 0, sizeof(search_expr) );
+      expr->op = op;
+   }
+   return expr;
+} /* search_new_expr */
+
+/*
+ * Parse a quoted value, unescaping it in place.
+ *
+ * @return The value, or NULL if it is not properly quoted.
+ */
+static
+char *search_parse_value( search_parser *parser )
+{
+   char *value;
+   char *w;
+
+   if( *parser->p != '"' )
+   {
+      return NULL;
+   }
+
+   value = w = ++parser->p;
+   for( ; ; )
+   {
+      if( *parser->p == 0 )
+      {
+         return NULL;
+      }
+      if( *parser->p == '"' )
+      {
+         parser->p++;
+         break;
+      }
+      if( (*parser->p == '\\') && (parser->p[1] != 0) )
+      {
+         parser->p++;
+      }
+      *w++ = *parser->p++;
+   }
+   *w = 0;
+
+   return value;
+} /* search_parse_value */
+
+/*
+ * Parse a relExp.
+ */
+static
+search_expr *search_parse_relation( search_parser *parser )
+{
+   static const struct
+   {
+      const char *name;
+      SEARCH_OP op;
+      int keyword;
+   } ops[] =
+   {
+      /* Longest first. */
+      { "!=", SEARCH_NOT_EQUAL, 0 },
+      { "<=", SEARCH_LESS_EQUAL, 0 },
+      { ">=", SEARCH_GREATER_EQUAL, 0 },
+      { "=", SEARCH_EQUAL, 0 },
+      { "<", SEARCH_LESS, 0 },
+      { ">", SEARCH_GREATER, 0 },
+      { "contains", SEARCH_CONTAINS, 1 },
+      { "doesNotContain", SEARCH_DOES_NOT_CONTAIN, 1 },
+      { "derivedfrom", SEARCH_DERIVED_FROM, 1 },
+      { "exists", SEARCH_EXISTS, 1 },
+      { NULL, 0, 0 }
+   };
+   search_expr *expr;
+   char *property;
+   char *property_end;
+   int i;
+
+   property = parser->p;
+   while( (*parser->p != 0) && !search_is_space(*parser->p) && (strchr("=!<>()\"", *parser->p) == NULL) )
+   {
+      parser->p++;
+   }
+   if( parser->p == property )
+   {
+      return NULL;
+   }
+   property_end = parser->p;
+   search_skip_spaces( parser );
+
+   for( i = 0; ops[i].name != NULL; i++ )
+   {
+      if( ops[i].keyword ? search_keyword(parser, ops[i].name) :
+          (strncmp(parser->p, ops[i].name, strlen(ops[i].name)) == 0) )
+      {
+         break;
+      }
+   }
+   if( ops[i].name == NULL )
+   {
+      return NULL;
+   }
+   if( !ops[i].keyword )
+   {
+      parser->p += strlen( ops[i].name );
+   }
+
+   /* The operator has been read, the property can be terminated. */
+   *property_end = 0;
+
+   expr = search_new_expr( parser, ops[i].op );
+   if( expr == NULL )
+   {
+      return NULL;
+   }
+   expr->property = property;
+
+   search_skip_spaces( parser );
+   if( expr->op == SEARCH_EXISTS )
+   {
+      if( search_keyword(parser, "true") )
+      {
+         expr->value = "true";
+      }
+      else if( search_keyword(parser, "false") )
+      {
+         expr->value = "false";
+      }
+   }
+   else
+   {
+      expr->value = search_parse_value( parser );
+   }
+
+   return (expr->value != NULL) ? expr : NULL;
+} /* search_parse_relation */
+
+/*
+ * Parse a parenthesized searchExp or a relExp.
+ */
+static
+search_expr *search_parse_primary( search_parser *parser )
+{
+   search_expr *expr;
+
+   search_skip_spaces( parser );
+   if( *parser->p != '(' )
+   {
+      return search_parse_relation( parser );
+   }
+
+   parser->p++;
+   expr = search_parse_or( parser );
+   search_skip_spaces( parser );
+   if( (expr == NULL) || (*parser->p != ')') )
+   {
+      return NULL;
+   }
+   parser->p++;
+
+   return expr;
+} /* search_parse_primary */
+
+/*
+ * Parse a sequence of searchExp joined by a logOp.
+ */
+static
+search_expr *search_parse_logical( search_parser *parser, const char *keyword, SEARCH_OP op,
+                                   search_expr *(*parse_operand)(search_parser *) )
+{
+   search_expr *left;
+   search_expr *expr;
+
+   left = parse_operand( parser );
+   while( left != NULL )
+   {
+      search_skip_spaces( parser );
+      if( !search_keyword(parser, keyword) )
+      {
+         break;
+      }
+
+      expr = search_new_expr( parser, op );
+      if( expr == NULL )
+      {
+         return NULL;
+      }
+      expr->left = left;
+      expr->right = parse_operand( parser );
+      if( expr->right == NULL )
+      {
+         return NULL;
+      }
+      left = expr;
+   }
+
+   return left;
+} /* search_parse_logical */
+
+static
+search_expr *search_parse_and( search_parser *parser )
+{
+   return search_parse_logical( parser, "and", SEARCH_AND, search_parse_primary );
+} /* search_parse_and */
+
+static
+search_expr *search_parse_or( search_parser *parser )
+{
+   return search_parse_logical( parser, "or", SEARCH_OR, search_parse_and );
+} /* search_parse_or */
+
+int search_parse( char *criteria, arena *a, search_expr **expr )
+{
+   search_parser parser;
+
+   parser.p = criteria;
+   parser.a = a;
+
+   search_skip_spaces( &parser );
+   if( (*parser.p == 0) || (*parser.p == '*') )
+   {
+      if( *parser.p == '*' )
+      {
+         parser.p++;
+      }
+      *expr = search_new_expr( &parser, SEARCH_ALL );
+   }
+   else
+   {
+      *expr = search_parse_or( &parser );
+   }
+
+   search_skip_spaces( &parser );
+   if( (*expr == NULL) || (*parser.p != 0) )
+   {
+      return SEARCH_ERROR;
+   }
+
+   return SEARCH_SUCCESS;
+} /* search_parse */
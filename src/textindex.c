@@ -0,0 +1,982 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "textindex.h"
+
+/* Initial number of hash buckets, a power of two. */
+#define TEXTINDEX_INITIAL_BUCKETS 1024
+
+/* 
+ * Longest word kept, longer ones are cut. Cut query words 
+ * can still be looked up whole. Trigrams are taken from
+ * the whole words.
+ */
+#define TEXTINDEX_MAX_WORD 64
+
+/* Trigrams per text. */
+#define TEXTINDEX_GRAM_LEN 3
+
+/* Default limits, see textindex_set_limits(). */
+#define TEXTINDEX_DEFAULT_MIN_SUBSTRING TEXTINDEX_GRAM_LEN
+#define TEXTINDEX_DEFAULT_MAX_POSTINGS (4L * 1024 * 1024)
+
+typedef struct textindex_word textindex_word;
+struct textindex_word
+{
+   uint32_t hash;
+   textindex_word *chain;
+   int pos;             /* In the words array */
+
+   /* The ids of the texts holding the word, sorted. */
+   uint32_t *ids;
+   int count;
+   int max;
+
+   char word[1];        /* Folded, zero terminated */
+};
+
+/*
+ * Three bytes in a row of a word, folded. Trigrams that are too
+ * common to be worth their memory are shed: they lose their ids
+ * and are taken to be in every text from then on.
+ */
+typedef struct textindex_gram textindex_gram;
+struct textindex_gram
+{
+   uint32_t key;        /* The bytes, first one highest */
+   textindex_gram *chain;
+   int pos;             /* In the grams array */
+   int shed;
+
+   /* The ids of the texts holding the trigram, sorted. */
+   uint32_t *ids;
+   int count;
+   int max;
+};
+
+struct textindex
+{
+   textindex_word **buckets;
+   int num_buckets;
+
+   /* All of the words. */
+   textindex_word **words;
+   int num_words;
+   int max_words;
+
+   /* The trigrams, hashed the same way. */
+   textindex_gram **gram_buckets;
+   int num_gram_buckets;
+   textindex_gram **grams;
+   int num_grams;
+   int max_grams;
+
+   /* Ids in the trigram lists, and how many can be kept. */
+   long num_postings;
+   long max_postings;
+
+   /* Shorter substrings do not narrow lookups down. */
+   int min_substring;
+};
+
+#define textindex_is_word_char(c) \
+   ((((c) >= 'a') && ((c) <= 'z')) || (((c) >= 'A') && ((c) <= 'Z')) || \
+    (((c) >= '0') && ((c) <= '9')) || ((unsigned char)(c) >= 0x80))
+
+#define textindex_fold(c) \
+   ((((c) >= 'A') && ((c) <= 'Z')) ? (char)((c) - 'A' + 'a') : (c))
+
+/*
+ * Get the next word of a text, case folded.
+ *
+ * @param p Where to start from.
+ * @param end The end of the text.
+ * @param word Receives the word, at least TEXTINDEX_MAX_WORD+1
+ *    bytes long. It is zero terminated.
+ * @param len Receives the word length, TEXTINDEX_MAX_WORD if 
+ *    the word was cut.
+ * @param start Receives where the word starts in the text.
+ * @return Where the word ends, or NULL if there are no more words.
+ */
+static
+const char *textindex_next_word( const char *p, const char *end, char *word, int *len, const char **start )
+{
+   int n = 0;
+
+   while( (p < end) && !textindex_is_word_char(*p) )
+   {
+      p++;
+   }
+   if( p == end )
+   {
+      return NULL;
+   }
+
+   *start = p;
+   for( ; (p < end) && textindex_is_word_char(*p); p++ )
+   {
+      if( n < TEXTINDEX_MAX_WORD )
+      {
+         word[n++] = textindex_fold( *p );
+      }
+   }
+   word[n] = 0;
+   *len = n;
+
+   return p;
+} /* textindex_next_word */
+
+/* FNV-1a hash of a word. */
+static
+uint32_t textindex_hash( const char *word, int len )
+{
+   uint32_t hash = 2166136261u;
+   int i;
+
+   for( i = 0; i < len; i++ )
+   {
+      hash = (hash ^ (unsigned char)word[i]) * 16777619u;
+   }
+   return hash;
+} /* textindex_hash */
+
+/* Hash of a trigram, mixing the high bits down to the bucket bits. */
+static
+uint32_t textindex_gram_hash( uint32_t key )
+{
+   key *= 2654435761u;
+   return key ^ (key >> 15);
+} /* textindex_gram_hash */
+
+/* Find a word, NULL if no text holds it. */
+static
+textindex_word *textindex_lookup( textindex *index, const char *word, int len, uint32_t hash )
+{
+   textindex_word *w;
+
+   for( w = index->buckets[hash & (index->num_buckets-1)]; w != NULL; w = w->chain )
+   {
+      if( (w->hash == hash) && (memcmp(w->word, word, len+1) == 0) )
+      {
+         return w;
+      }
+   }
+   return NULL;
+} /* textindex_lookup */
+
+/* Find a trigram, NULL if no text holds it. */
+static
+textindex_gram *textindex_lookup_gram( textindex *index, uint32_t key )
+{
+   textindex_gram *g;
+
+   for( g = index->gram_buckets[textindex_gram_hash(key) & (index->num_gram_buckets-1)]; g != NULL; g = g->chain )
+   {
+      if( g->key == key )
+      {
+         return g;
+      }
+   }
+   return NULL;
+} /* textindex_lookup_gram */
+
+/*
+ * Double the hash buckets, once there are more words than buckets.
+ */
+static
+int textindex_grow_buckets( textindex *index )
+{
+   textindex_word **buckets;
+   textindex_word *w;
+   int num_buckets = index->num_buckets * 2;
+   int i;
+
+   buckets = (textindex_word **)calloc( num_buckets, sizeof(textindex_word *) );
+   if( buckets == NULL )
+   {
+      return TEXTINDEX_ERROR;
+   }
+
+   for( i = 0; i < index->num_words; i++ )
+   {
+      w = index->words[i];
+      w->chain = buckets[w->hash & (num_buckets-1)];
+      buckets[w->hash & (num_buckets-1)] = w;
+   }
+
+   free( index->buckets );
+   index->buckets = buckets;
+   index->num_buckets = num_buckets;
+
+   return TEXTINDEX_SUCCESS;
+} /* textindex_grow_buckets */
+
+/*
+ * Double the trigram hash buckets, as for the words.
+ */
+static
+int textindex_grow_gram_buckets( textindex *index )
+{
+   textindex_gram **buckets;
+   textindex_gram *g;
+   int num_buckets = index->num_gram_buckets * 2;
+   uint32_t hash;
+   int i;
+
+   buckets = (textindex_gram **)calloc( num_buckets, sizeof(textindex_gram *) );
+   if( buckets == NULL )
+   {
+      return TEXTINDEX_ERROR;
+   }
+
+   for( i = 0; i < index->num_grams; i++ )
+   {
+      g = index->grams[i];
+      hash = textindex_gram_hash( g->key );
+      g->chain = buckets[hash & (num_buckets-1)];
+      buckets[hash & (num_buckets-1)] = g;
+   }
+
+   free( index->gram_buckets );
+   index->gram_buckets = buckets;
+   index->num_gram_buckets = num_buckets;
+
+   return TEXTINDEX_SUCCESS;
+} /* textindex_grow_gram_buckets */
+
+/*
+ * Add a new word, with no ids yet.
+ *
+ * @return The word, or NULL if out of memory.
+ */
+static
+textindex_word *textindex_new_word( textindex *index, const char *word, int len, uint32_t hash )
+{
+   textindex_word *w;
+
+   if( index->num_words == index->max_words )
+   {
+      int max_words = (index->max_words == 0) ? 256 : index->max_words * 2;
+      textindex_word **words;
+
+      words = (textindex_word **)realloc( index->words, max_words * sizeof(textindex_word *) );
+      if( words == NULL )
+      {
+         return NULL;
+      }
+      index->words = words;
+      index->max_words = max_words;
+   }
+   if( (index->num_words >= index->num_buckets) && (textindex_grow_buckets(index) != TEXTINDEX_SUCCESS) )
+   {
+      return NULL;
+   }
+
+   w = (textindex_word *)malloc( sizeof(textindex_word) + len );
+   if( w == NULL )
+   {
+      return NULL;
+   }
+   w->hash = hash;
+   w->ids = NULL;
+   w->count = 0;
+   w->max = 0;
+   memcpy( w->word, word, len+1 );
+
+   w->chain = index->buckets[hash & (index->num_buckets-1)];
+   index->buckets[hash & (index->num_buckets-1)] = w;
+   w->pos = index->num_words;
+   index->words[index->num_words++] = w;
+
+   return w;
+} /* textindex_new_word */
+
+/*
+ * Add a new trigram, with no ids yet.
+ *
+ * @return The trigram, or NULL if out of memory.
+ */
+static
+textindex_gram *textindex_new_gram( textindex *index, uint32_t key )
+{
+   textindex_gram *g;
+   uint32_t hash;
+
+   if( index->num_grams == index->max_grams )
+   {
+      int max_grams = (index->max_grams == 0) ? 256 : index->max_grams * 2;
+      textindex_gram **grams;
+
+      grams = (textindex_gram **)realloc( index->grams, max_grams * sizeof(textindex_gram *) );
+      if( grams == NULL )
+      {
+         return NULL;
+      }
+      index->grams = grams;
+      index->max_grams = max_grams;
+   }
+   if( (index->num_grams >= index->num_gram_buckets) && (textindex_grow_gram_buckets(index) != TEXTINDEX_SUCCESS) )
+   {
+      return NULL;
+   }
+
+   g = (textindex_gram *)calloc( 1, sizeof(textindex_gram) );
+   if( g == NULL )
+   {
+      return NULL;
+   }
+   g->key = key;
+
+   hash = textindex_gram_hash( key );
+   g->chain = index->gram_buckets[hash & (index->num_gram_buckets-1)];
+   index->gram_buckets[hash & (index->num_gram_buckets-1)] = g;
+   g->pos = index->num_grams;
+   index->grams[index->num_grams++] = g;
+
+   return g;
+} /* textindex_new_gram */
+
+/*
+ * Drop a word once no text holds it any more.
+ */
+static
+void textindex_del_word( textindex *index, textindex_word *w )
+{
+   textindex_word **link;
+
+   link = &index->buckets[w->hash & (index->num_buckets-1)];
+   while( *link != w )
+   {
+      link = &(*link)->chain;
+   }
+   *link = w->chain;
+
+   index->words[w->pos] = index->words[--index->num_words];
+   index->words[w->pos]->pos = w->pos;
+
+   free( w->ids );
+   free( w );
+} /* textindex_del_word */
+
+/*
+ * Drop a trigram once no text holds it any more.
+ */
+static
+void textindex_del_gram( textindex *index, textindex_gram *g )
+{
+   textindex_gram **link;
+
+   link = &index->gram_buckets[textindex_gram_hash(g->key) & (index->num_gram_buckets-1)];
+   while( *link != g )
+   {
+      link = &(*link)->chain;
+   }
+   *link = g->chain;
+
+   index->grams[g->pos] = index->grams[--index->num_grams];
+   index->grams[g->pos]->pos = g->pos;
+
+   free( g->ids );
+   free( g );
+} /* textindex_del_gram */
+
+/*
+ * Find the position of the first id not lower than id.
+ */
+static
+int textindex_search( const uint32_t *ids, int count, uint32_t id )
+{
+   int low = 0;
+   int high = count;
+   int mid;
+
+   while( low < high )
+   {
+      mid = low + (high - low) / 2;
+      if( ids[mid] < id ) low = mid + 1;
+      else high = mid;
+   }
+   return low;
+} /* textindex_search */
+
+/*
+ * Insert an id into a sorted id list.
+ *
+ * @return 1 if inserted, 0 if the list had it already, or 
+ *    TEXTINDEX_ERROR if out of memory.
+ */
+static
+int textindex_insert( uint32_t **ids, int *count, int *max, uint32_t id )
+{
+   int pos;
+
+   /* Ids usually come in increasing order, and go last. */
+   pos = *count;
+   if( (*count > 0) && ((*ids)[*count-1] >= id) )
+   {
+      pos = textindex_search( *ids, *count, id );
+      if( (*ids)[pos] == id )
+      {
+         return 0;
+      }
+   }
+
+   if( *count == *max )
+   {
+      int new_max = (*max == 0) ? 4 : *max * 2;
+      uint32_t *new_ids;
+
+      new_ids = (uint32_t *)realloc( *ids, new_max * sizeof(uint32_t) );
+      if( new_ids == NULL )
+      {
+         return TEXTINDEX_ERROR;
+      }
+      *ids = new_ids;
+      *max = new_max;
+   }
+
+   memmove( *ids + pos + 1, *ids + pos, (*count - pos) * sizeof(uint32_t) );
+   (*ids)[pos] = id;
+   (*count)++;
+
+   return 1;
+} /* textindex_insert */
+
+/*
+ * Delete an id from a sorted id list.
+ *
+ * @return 1 if deleted, 0 if the list did not have it.
+ */
+static
+int textindex_delete( uint32_t *ids, int *count, uint32_t id )
+{
+   int pos;
+
+   pos = textindex_search( ids, *count, id );
+   if( (pos == *count) || (ids[pos] != id) )
+   {
+      return 0;
+   }
+
+   memmove( ids + pos, ids + pos + 1, (*count - pos - 1) * sizeof(uint32_t) );
+   (*count)--;
+
+   return 1;
+} /* textindex_delete */
+
+/*
+ * Shed the largest trigram lists, until the postings are well
+ * within bounds again. The largest lists are of the commonest 
+ * trigrams, which narrow lookups down the least.
+ */
+static
+void textindex_shed( textindex *index )
+{
+   textindex_gram *largest;
+   int i;
+
+   while( index->num_postings > index->max_postings - index->max_postings / 8 )
+   {
+      largest = NULL;
+      for( i = 0; i < index->num_grams; i++ )
+      {
+         if( (largest == NULL) || (index->grams[i]->count > largest->count) )
+         {
+            largest = index->grams[i];
+         }
+      }
+      if( (largest == NULL) || (largest->count == 0) )
+      {
+         break;
+      }
+
+      index->num_postings -= largest->count;
+      free( largest->ids );
+      largest->ids = NULL;
+      largest->count = 0;
+      largest->max = 0;
+      largest->shed = 1;
+   }
+} /* textindex_shed */
+
+/*
+ * Add a text to the list of a trigram.
+ */
+static
+int textindex_add_gram( textindex *index, uint32_t key, uint32_t id )
+{
+   textindex_gram *g;
+   int res;
+
+   g = textindex_lookup_gram( index, key );
+   if( g == NULL )
+   {
+      g = textindex_new_gram( index, key );
+      if( g == NULL )
+      {
+         return TEXTINDEX_ERROR;
+      }
+   }
+   if( g->shed )
+   {
+      return TEXTINDEX_SUCCESS;
+   }
+
+   res = textindex_insert( &g->ids, &g->count, &g->max, id );
+   if( res == TEXTINDEX_ERROR )
+   {
+      if( g->count == 0 )
+      {
+         textindex_del_gram( index, g );
+      }
+      return TEXTINDEX_ERROR;
+   }
+
+   index->num_postings += res;
+   if( index->num_postings > index->max_postings )
+   {
+      textindex_shed( index );
+   }
+
+   return TEXTINDEX_SUCCESS;
+} /* textindex_add_gram */
+
+textindex *textindex_create()
+{
+   textindex *index;
+
+   index = (textindex *)calloc( 1, sizeof(textindex) );
+   if( index == NULL )
+   {
+      return NULL;
+   }
+
+   index->buckets = (textindex_word **)calloc( TEXTINDEX_INITIAL_BUCKETS, sizeof(textindex_word *) );
+   index->gram_buckets = (textindex_gram **)calloc( TEXTINDEX_INITIAL_BUCKETS, sizeof(textindex_gram *) );
+   if( (index->buckets == NULL) || (index->gram_buckets == NULL) )
+   {
+      free( index->buckets );
+      free( index->gram_buckets );
+      free( index );
+      return NULL;
+   }
+   index->num_buckets = TEXTINDEX_INITIAL_BUCKETS;
+   index->num_gram_buckets = TEXTINDEX_INITIAL_BUCKETS;
+
+   index->min_substring = TEXTINDEX_DEFAULT_MIN_SUBSTRING;
+   index->max_postings = TEXTINDEX_DEFAULT_MAX_POSTINGS;
+
+   return index;
+} /* textindex_create */
+
+void textindex_free( textindex *index )
+{
+   int i;
+
+   if( index != NULL )
+   {
+      for( i = 0; i < index->num_words; i++ )
+      {
+         free( index->words[i]->ids );
+         free( index->words[i] );
+      }
+      for( i = 0; i < index->num_grams; i++ )
+      {
+         free( index->grams[i]->ids );
+         free( index->grams[i] );
+      }
+      free( index->words );
+      free( index->buckets );
+      free( index->grams );
+      free( index->gram_buckets );
+      free( index );
+   }
+} /* textindex_free */
+
+void textindex_set_limits( textindex *index, int min_substring, long max_postings )
+{
+   index->min_substring = (min_substring > TEXTINDEX_GRAM_LEN) ? min_substring : TEXTINDEX_GRAM_LEN;
+   if( max_postings > 0 )
+   {
+      index->max_postings = max_postings;
+      if( index->num_postings > index->max_postings )
+      {
+         textindex_shed( index );
+      }
+   }
+} /* textindex_set_limits */
+
+int textindex_add( textindex *index, const char *text, long len, uint32_t id )
+{
+   const char *p = text;
+   const char *end = text + len;
+   const char *start;
+   char word[TEXTINDEX_MAX_WORD+1];
+   int word_len;
+   uint32_t hash;
+   uint32_t key;
+   textindex_word *w;
+
+   while( (p = textindex_next_word(p, end, word, &word_len, &start)) != NULL )
+   {
+      hash = textindex_hash( word, word_len );
+      w = textindex_lookup( index, word, word_len, hash );
+      if( w == NULL )
+      {
+         w = textindex_new_word( index, word, word_len, hash );
+         if( w == NULL )
+         {
+            return TEXTINDEX_ERROR;
+         }
+      }
+
+      if( textindex_insert( &w->ids, &w->count, &w->max, id ) == TEXTINDEX_ERROR )
+      {
+         if( w->count == 0 )
+         {
+            textindex_del_word( index, w );
+         }
+         return TEXTINDEX_ERROR;
+      }
+
+      /* The trigrams of the whole word, even if cut. */
+      for( key = 0, word_len = 0; start < p; start++ )
+      {
+         key = ((key << 8) | (unsigned char)textindex_fold(*start)) & 0xFFFFFF;
+         if( (++word_len >= TEXTINDEX_GRAM_LEN) && 
+             (textindex_add_gram( index, key, id ) != TEXTINDEX_SUCCESS) )
+         {
+            return TEXTINDEX_ERROR;
+         }
+      }
+   }
+
+   return TEXTINDEX_SUCCESS;
+} /* textindex_add */
+
+void textindex_remove( textindex *index, const char *text, long len, uint32_t id )
+{
+   const char *p = text;
+   const char *end = text + len;
+   const char *start;
+   char word[TEXTINDEX_MAX_WORD+1];
+   int word_len;
+   uint32_t key;
+   textindex_word *w;
+   textindex_gram *g;
+
+   while( (p = textindex_next_word(p, end, word, &word_len, &start)) != NULL )
+   {
+      w = textindex_lookup( index, word, word_len, textindex_hash(word, word_len) );
+      if( (w != NULL) && textindex_delete( w->ids, &w->count, id ) && (w->count == 0) )
+      {
+         textindex_del_word( index, w );
+      }
+
+      for( key = 0, word_len = 0; start < p; start++ )
+      {
+         key = ((key << 8) | (unsigned char)textindex_fold(*start)) & 0xFFFFFF;
+         if( ++word_len < TEXTINDEX_GRAM_LEN )
+         {
+            continue;
+         }
+
+         /* Shed trigrams stay, they still stand for every text. */
+         g = textindex_lookup_gram( index, key );
+         if( (g != NULL) && !g->shed && textindex_delete( g->ids, &g->count, id ) )
+         {
+            index->num_postings--;
+            if( g->count == 0 )
+            {
+               textindex_del_gram( index, g );
+            }
+         }
+      }
+   }
+} /* textindex_remove */
+
+/*
+ * Copy an id list into an arena set.
+ */
+static
+int textindex_copy( const uint32_t *ids, int count, arena *a, textindex_set *set )
+{
+   set->ids = (uint32_t *)arena_alloc( a, (count + 1) * sizeof(uint32_t) );
+   if( set->ids == NULL )
+   {
+      return TEXTINDEX_ERROR;
+   }
+   memcpy( set->ids, ids, count * sizeof(uint32_t) );
+   set->count = count;
+
+   return TEXTINDEX_SUCCESS;
+} /* textindex_copy */
+
+/*
+ * Find the texts holding a word with a certain part: those in
+ * the lists of all of the trigrams of the part. The shortest
+ * lists are intersected first.
+ *
+ * @param index The index.
+ * @param part The part, not folded.
+ * @param len The part length, at least TEXTINDEX_GRAM_LEN.
+ * @param a The arena the set is allocated from.
+ * @param set Receives the ids of the candidate texts.
+ * @return TEXTINDEX_SUCCESS, TEXTINDEX_NO_WORDS if all of the 
+ *    trigrams were shed, or TEXTINDEX_ERROR if out of memory.
+ */
+static
+int textindex_find_part( textindex *index, const char *part, int len, arena *a, textindex_set *set )
+{
+   textindex_gram **grams;
+   textindex_gram *g;
+   textindex_set gram_set;
+   uint32_t key = 0;
+   int num_grams = 0;
+   int i, j;
+
+   grams = (textindex_gram **)arena_alloc( a, len * sizeof(textindex_gram *) );
+   if( grams == NULL )
+   {
+      return TEXTINDEX_ERROR;
+   }
+
+   for( i = 0; i < len; i++ )
+   {
+      key = ((key << 8) | (unsigned char)textindex_fold(part[i])) & 0xFFFFFF;
+      if( i < TEXTINDEX_GRAM_LEN - 1 )
+      {
+         continue;
+      }
+
+      g = textindex_lookup_gram( index, key );
+      if( g == NULL )
+      {
+         /* No text has it. */
+         set->ids = NULL;
+         set->count = 0;
+         return TEXTINDEX_SUCCESS;
+      }
+      if( g->shed )
+      {
+         continue;
+      }
+
+      /* Sorted by list length, once each. */
+      for( j = num_grams; (j > 0) && (grams[j-1]->count >= g->count); j-- )
+      {
+         if( grams[j-1] == g )
+         {
+            break;
+         }
+      }
+      if( (j > 0) && (grams[j-1] == g) )
+      {
+         continue;
+      }
+      memmove( grams + j + 1, grams + j, (num_grams - j) * sizeof(textindex_gram *) );
+      grams[j] = g;
+      num_grams++;
+   }
+
+   if( num_grams == 0 )
+   {
+      return TEXTINDEX_NO_WORDS;
+   }
+
+   if( textindex_copy( grams[0]->ids, grams[0]->count, a, set ) != TEXTINDEX_SUCCESS )
+   {
+      return TEXTINDEX_ERROR;
+   }
+   for( i = 1; (i < num_grams) && (set->count > 0); i++ )
+   {
+      gram_set.ids = grams[i]->ids;
+      gram_set.count = grams[i]->count;
+      if( textindex_and( set, &gram_set, a, set ) != TEXTINDEX_SUCCESS )
+      {
+         return TEXTINDEX_ERROR;
+      }
+   }
+
+   return TEXTINDEX_SUCCESS;
+} /* textindex_find_part */
+
+int textindex_find( textindex *index, const char *query, int mode, arena *a, textindex_set *set )
+{
+   const char *p = query;
+   const char *end = query + strlen( query );
+   const char *start;
+   char word[TEXTINDEX_MAX_WORD+1];
+   int word_len;
+   textindex_set word_set;
+   textindex_word *w;
+   int found = 0;
+   int too_short = 0;
+   int shed = 0;
+   int res;
+
+   while( (p = textindex_next_word(p, end, word, &word_len, &start)) != NULL )
+   {
+      if( mode == TEXTINDEX_SUBSTRING )
+      {
+         if( p - start < index->min_substring )
+         {
+            /* Too short to narrow anything down. */
+            too_short = 1;
+            continue;
+         }
+         res = textindex_find_part( index, start, (int)(p - start), a, &word_set );
+         if( res == TEXTINDEX_NO_WORDS )
+         {
+            shed = 1;
+            continue;
+         }
+         if( res != TEXTINDEX_SUCCESS )
+         {
+            return TEXTINDEX_ERROR;
+         }
+      }
+      else
+      {
+         w = textindex_lookup( index, word, word_len, textindex_hash(word, word_len) );
+         word_set.ids = NULL;
+         word_set.count = 0;
+         if( (w != NULL) && (textindex_copy(w->ids, w->count, a, &word_set) != TEXTINDEX_SUCCESS) )
+         {
+            return TEXTINDEX_ERROR;
+         }
+      }
+
+      if( !found )
+      {
+         *set = word_set;
+         found = 1;
+      }
+      else if( textindex_and(set, &word_set, a, set) != TEXTINDEX_SUCCESS )
+      {
+         return TEXTINDEX_ERROR;
+      }
+
+      if( set->count == 0 )
+      {
+         break;
+      }
+   }
+
+   if( found )
+   {
+      return TEXTINDEX_SUCCESS;
+   }
+
+   /* 
+    * Checking every text for short words would make the minimum 
+    * substring length pointless. Shed trigrams are different: 
+    * their texts can only be found that way.
+    */
+   return (too_short && !shed) ? TEXTINDEX_TOO_SHORT : TEXTINDEX_NO_WORDS;
+} /* textindex_find */
+
+int textindex_and( const textindex_set *x, const textindex_set *y, arena *a, textindex_set *result )
+{
+   const textindex_set *small = (x->count <= y->count) ? x : y;
+   const textindex_set *large = (x->count <= y->count) ? y : x;
+   uint32_t *ids;
+   int count = 0;
+   int i = 0, j = 0;
+
+   ids = (uint32_t *)arena_alloc( a, (small->count + 1) * sizeof(uint32_t) );
+   if( ids == NULL )
+   {
+      return TEXTINDEX_ERROR;
+   }
+
+   if( (long)small->count * 16 < (long)large->count )
+   {
+      /* Far apart in size: look the few ids up in the long list. */
+      for( i = 0; (i < small->count) && (j < large->count); i++ )
+      {
+         j += textindex_search( large->ids + j, large->count - j, small->ids[i] );
+         if( (j < large->count) && (large->ids[j] == small->ids[i]) )
+         {
+            ids[count++] = small->ids[i];
+         }
+      }
+   }
+   else
+   {
+      while( (i < small->count) && (j < large->count) )
+      {
+         if( small->ids[i] < large->ids[j] ) i++;
+         else if( small->ids[i] > large->ids[j] ) j++;
+         else
+         {
+            ids[count++] = small->ids[i];
+            i++;
+            j++;
+         }
+      }
+   }
+
+   result->ids = ids;
+   result->count = count;
+
+   return TEXTINDEX_SUCCESS;
+} /* textindex_and */
+
+int textindex_or( const textindex_set *x, const textindex_set *y, arena *a, textindex_set *result )
+{
+   uint32_t *ids;
+   int count = 0;
+   int i = 0, j = 0;
+
+   ids = (uint32_t *)arena_alloc( a, (x->count + y->count + 1) * sizeof(uint32_t) );
+   if( ids == NULL )
+   {
+      return TEXTINDEX_ERROR;
+   }
+
+   while( (i < x->count) || (j < y->count) )
+   {
+      if( (j == y->count) || ((i < x->count) && (x->ids[i] < y->ids[j])) )
+      {
+         ids[count++] = x->ids[i++];
+      }
+      else if( (i == x->count) || (y->ids[j] < x->ids[i]) )
+      {
+         ids[count++] = y->ids[j++];
+      }
+      else
+      {
+         ids[count++] = x->ids[i];
+         i++;
+         j++;
+      }
+   }
+
+   result->ids = ids;
+   result->count = count;
+
+   return TEXTINDEX_SUCCESS;
+} /* textindex_or */
@@ -0,0 +1,409 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atomic.h"
+
+#include "timeindex.h"
+
+/* Initial number of entries, one every GOP for a few minutes. */
+#define TIMEINDEX_INITIAL_SIZE 1024
+
+/* Index files: a header followed by the entries. */
+#define TIMEINDEX_FILE_MAGIC "YIDX"
+#define TIMEINDEX_FILE_VERSION 1
+
+typedef struct timeindex_file_header
+{
+   char magic[4];
+   int32_t version;
+   int32_t num_entries;
+   int32_t reserved;
+   int64_t size;
+} timeindex_file_header;
+
+/**
+ * Creates a new, empty, time index with a reference count of 1.
+ *
+ * @return The new index, or NULL if out of memory.
+ */
+timeindex *timeindex_create()
+{
+   timeindex *idx;
+
+   idx = (timeindex *)calloc( 1, sizeof(timeindex) );
+   if( idx != NULL )
+   {
+      pthread_mutex_init( &idx->lock, NULL );
+      idx->refs = 1;
+   }
+
+   return idx;
+} /* timeindex_create */
+
+/**
+ * Takes a reference to a time index.
+ *
+ * @param idx The index.
+ * @return idx.
+ */
+timeindex *timeindex_retain( timeindex *idx )
+{
+   atomic_inc( &idx->refs );
+   return idx;
+} /* timeindex_retain */
+
+/**
+ * Drops a reference to a time index, and frees 
+ * it up when that was the last one.
+ *
+ * @param idx The index to free. Can be NULL.
+ */
+void timeindex_free( timeindex *idx )
+{
+   if( (idx != NULL) && (atomic_dec(&idx->refs) == 0) )
+   {
+      pthread_mutex_destroy( &idx->lock );
+      free( idx->entries );
+      free( idx );
+   }
+} /* timeindex_free */
+
+/**
+ * Appends an entry to the index. Entries must be added in 
+ * increasing time order, the others are silently dropped.
+ *
+ * @param idx The index.
+ * @param time The entry time, in milliseconds.
+ * @param offset The entry byte offset.
+ * @return TIMEINDEX_SUCCESS, or TIMEINDEX_ERROR if out of memory.
+ */
+int timeindex_add( timeindex *idx, int64_t time, int64_t offset )
+{
+   int res = TIMEINDEX_SUCCESS;
+
+   pthread_mutex_lock( &idx->lock );
+
+   if( idx->num_entries > 0 )
+   {
+      timeindex_entry *last = &idx->entries[idx->num_entries-1];
+
+      /* 
+       * Timestamps may wrap or jump back in broken
+       * recordings: keep the index monotonic.
+       */
+      if( (time <= last->time) || (offset < last->offset) )
+      {
+         pthread_mutex_unlock( &idx->lock );
+         return TIMEINDEX_SUCCESS;
+      }
+   }
+
+   if( idx->num_entries == idx->max_entries )
+   {
+      int new_size = (idx->max_entries == 0) ? TIMEINDEX_INITIAL_SIZE : idx->max_entries*2;
+      timeindex_entry *entries;
+
+      entries = (timeindex_entry *)realloc( idx->entries, new_size*sizeof(timeindex_entry) );
+      if( entries == NULL )
+      {
+         res = TIMEINDEX_ERROR;
+      }
+      else
+      {
+         idx->entries = entries;
+         idx->max_entries = new_size;
+      }
+   }
+
+   if( res == TIMEINDEX_SUCCESS )
+   {
+      idx->entries[idx->num_entries].time = time;
+      idx->entries[idx->num_entries].offset = offset;
+      idx->num_entries++;
+   }
+
+   pthread_mutex_unlock( &idx->lock );
+
+   return res;
+} /* timeindex_add */
+
+/**
+ * Marks the index as complete: from now on entries
+ * are trusted up to the end of the item.
+ *
+ * @param idx The index.
+ */
+void timeindex_set_complete( timeindex *idx )
+{
+   pthread_mutex_lock( &idx->lock );
+   idx->complete = 1;
+   pthread_mutex_unlock( &idx->lock );
+} /* timeindex_set_complete */
+
+/**
+ * Binary search for the last entry at or before a certain
+ * time. Must be called with the index lock held.
+ *
+ * @param idx The index.
+ * @param time The time to look for, in milliseconds.
+ * @return The entry position, or -1 if there is none.
+ */
+static
+int timeindex_find( const timeindex *idx, int64_t time )
+{
+   int lo = 0;
+   int hi;
+
+   if( (idx->num_entries == 0) || (time < idx->entries[0].time) )
+   {
+      return -1;
+   }
+
+   hi = idx->num_entries-1;
+   while( lo < hi )
+   {
+      int mid = lo + (hi-lo+1)/2;
+      if( idx->entries[mid].time <= time )
+      {
+         lo = mid;
+      }
+      else
+      {
+         hi = mid-1;
+      }
+   }
+
+   return lo;
+} /* timeindex_find */
+
+/**
+ * Finds the last entry at or before a certain time.
+ *
+ * @param idx The index.
+ * @param time The time to look for, in milliseconds.
+ * @param entry Will receive the entry found.
+ * @return 1 if an entry was found, 0 otherwise.
+ */
+int timeindex_lookup( timeindex *idx, int64_t time, timeindex_entry *entry )
+{
+   int pos;
+
+   pthread_mutex_lock( &idx->lock );
+   pos = timeindex_find( idx, time );
+   if( pos >= 0 )
+   {
+      *entry = idx->entries[pos];
+   }
+   pthread_mutex_unlock( &idx->lock );
+
+   return (pos >= 0);
+} /* timeindex_lookup */
+
+/**
+ * Maps a time onto a byte offset. The index is used when 
+ * there is one, otherwise the offset is interpolated from 
+ * the bitrate, or from the size and duration of the item.
+ *
+ * @param idx The item index. Can be NULL.
+ * @param time The time to seek to, in milliseconds.
+ * @param duration The item duration, in milliseconds.
+ * @param size The item size, in bytes.
+ * @param bitrate The item bitrate, in bits per second. Can be 0.
+ * @param end 0 to find where playback starts from, which may be 
+ *    slightly before time. 1 to find where it stops, which may be
+ *    slightly after time.
+ * @param entry Will receive the position found. The offset is the
+ *    item size when an end position falls after the last entry.
+ * @return 1 if successful, 0 if time is past the end of the
+ *    item or nothing is known about its duration.
+ */
+int timeindex_seek( timeindex *idx, int64_t time, 
+                    int64_t duration, int64_t size, int bitrate,
+                    int end, timeindex_entry *entry )
+{
+   if( (duration <= 0) || (size <= 0) || (time < 0) || (time >= duration) )
+   {
+      return 0;
+   }
+
+   if( idx != NULL )
+   {
+      int found = 0;
+      int pos;
+
+      pthread_mutex_lock( &idx->lock );
+
+      /* 
+       * While the index is being built, the last entry may not
+       * be the closest one: a keyframe further on may simply
+       * not have been reached yet.
+       */
+      pos = timeindex_find( idx, time );
+      if( (pos >= 0) && (idx->complete || (pos < idx->num_entries-1)) )
+      {
+         found = 1;
+         if( !end || (idx->entries[pos].time == time) )
+         {
+            *entry = idx->entries[pos];
+         }
+         else
+         if( pos+1 < idx->num_entries )
+         {
+            *entry = idx->entries[pos+1];
+         }
+         else
+         {
+            entry->time = duration;
+            entry->offset = size;
+         }
+      }
+
+      pthread_mutex_unlock( &idx->lock );
+
+      if( found )
+      {
+         return 1;
+      }
+   }
+
+   entry->time = time;
+   if( bitrate > 0 )
+   {
+      entry->offset = time * (bitrate/8) / 1000;
+   }
+   else
+   {
+      /* Go through a double, size*time easily overflows. */
+      entry->offset = (int64_t)((double)size * (double)time / (double)duration);
+   }
+
+   if( entry->offset >= size )
+   {
+      entry->offset = size-1;
+   }
+
+   return 1;
+} /* timeindex_seek */
+
+/**
+ * Saves a complete index to a file.
+ *
+ * @param idx The index.
+ * @param filename The index file.
+ * @param size The size of the indexed item, stored
+ *    to detect stale index files.
+ * @return TIMEINDEX_SUCCESS or TIMEINDEX_ERROR.
+ */
+int timeindex_save( timeindex *idx, const char *filename, int64_t size )
+{
+   timeindex_file_header header;
+   FILE *f;
+   int res = TIMEINDEX_SUCCESS;
+
+   f = fopen( filename, "wb" );
+   if( f == NULL )
+   {
+      return TIMEINDEX_ERROR;
+   }
+
+   memset( &header, 0, sizeof(header) );
+   memcpy( header.magic, TIMEINDEX_FILE_MAGIC, 4 );
+   header.version = TIMEINDEX_FILE_VERSION;
+   header.size = size;
+
+   pthread_mutex_lock( &idx->lock );
+   header.num_entries = idx->num_entries;
+   if( (fwrite(&header, sizeof(header), 1, f) != 1) ||
+       (fwrite(idx->entries, sizeof(timeindex_entry), idx->num_entries, f) != (size_t)idx->num_entries) )
+   {
+      res = TIMEINDEX_ERROR;
+   }
+   pthread_mutex_unlock( &idx->lock );
+
+   if( fclose(f) != 0 )
+   {
+      res = TIMEINDEX_ERROR;
+   }
+   if( res != TIMEINDEX_SUCCESS )
+   {
+      remove( filename );
+   }
+
+   return res;
+} /* timeindex_save */
+
+/**
+ * Loads an index saved with timeindex_save into an empty 
+ * index, and marks it as complete.
+ *
+ * @param idx The index.
+ * @param filename The index file.
+ * @param size The current size of the item. Files saved 
+ *    for a different size are ignored.
+ * @return TIMEINDEX_SUCCESS, or TIMEINDEX_ERROR if the file is
+ *    missing, stale or corrupted.
+ */
+int timeindex_load( timeindex *idx, const char *filename, int64_t size )
+{
+   timeindex_file_header header;
+   timeindex_entry *entries;
+   FILE *f;
+
+   f = fopen( filename, "rb" );
+   if( f == NULL )
+   {
+      return TIMEINDEX_ERROR;
+   }
+
+   if( (fread(&header, sizeof(header), 1, f) != 1) ||
+       (memcmp(header.magic, TIMEINDEX_FILE_MAGIC, 4) != 0) ||
+       (header.version != TIMEINDEX_FILE_VERSION) ||
+       (header.size != size) || (header.num_entries < 0) )
+   {
+      fclose( f );
+      return TIMEINDEX_ERROR;
+   }
+
+   entries = (timeindex_entry *)malloc( (header.num_entries+1)*sizeof(timeindex_entry) );
+   if( (entries == NULL) ||
+       (fread(entries, sizeof(timeindex_entry), header.num_entries, f) != (size_t)header.num_entries) )
+   {
+      free( entries );
+      fclose( f );
+      return TIMEINDEX_ERROR;
+   }
+   fclose( f );
+
+   pthread_mutex_lock( &idx->lock );
+   free( idx->entries );
+   idx->entries = entries;
+   idx->num_entries = header.num_entries;
+   idx->max_entries = header.num_entries+1;
+   idx->complete = 1;
+   pthread_mutex_unlock( &idx->lock );
+
+   return TIMEINDEX_SUCCESS;
+} /* timeindex_load */
@@ -0,0 +1,179 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ * Every allocation is rounded up to this, which is
+ * enough for any type the server deals with.
+ */
+#define ARENA_ALIGNMENT 16
+#define ARENA_ALIGN(n) (((n) + (ARENA_ALIGNMENT-1)) & ~(size_t)(ARENA_ALIGNMENT-1))
+
+/*
+ * Block header. Data follows it, starting at the
+ * next aligned address.
+ */
+struct arena_block
+{
+   arena_block *next;
+   size_t size;
+   size_t used;
+};
+
+#define ARENA_BLOCK_HEADER ARENA_ALIGN(sizeof(arena_block))
+#define ARENA_BLOCK_DATA(b) ((char *)(b) + ARENA_BLOCK_HEADER)
+
+static
+arena_block *arena_new_block( size_t size )
+{
+   arena_block *block;
+
+   block = (arena_block *)malloc( ARENA_BLOCK_HEADER + size );
+   if( block == NULL )
+   {
+      return NULL;
+   }
+   block->next = NULL;
+   block->size = size;
+   block->used = 0;
+
+   return block;
+} /* arena_new_block */
+
+static
+void arena_free_blocks( arena_block *block )
+{
+   arena_block *next;
+
+   while( block != NULL )
+   {
+      next = block->next;
+      free( block );
+      block = next;
+   }
+} /* arena_free_blocks */
+
+void arena_init( arena *a, size_t block_size )
+{
+   a->first = NULL;
+   a->current = NULL;
+   a->large = NULL;
+   a->block_size = ARENA_ALIGN( block_size );
+} /* arena_init */
+
+void *arena_alloc( arena *a, size_t size )
+{
+   arena_block *block;
+   void *p;
+
+   size = ARENA_ALIGN( size ? size : 1 );
+
+   /*
+    * Allocations bigger than a quarter of a block would
+    * waste too much of it: they get a block of their own.
+    */
+   if( size > a->block_size / 4 )
+   {
+      block = arena_new_block( size );
+      if( block == NULL )
+      {
+         return NULL;
+      }
+      block->used = size;
+      block->next = a->large;
+      a->large = block;
+      return ARENA_BLOCK_DATA( block );
+   }
+
+   block = a->current;
+   if( (block == NULL) || (block->size - block->used < size) )
+   {
+      /* Move on to the next block, reusing those kept by a reset. */
+      if( (block != NULL) && (block->next != NULL) )
+      {
+         block = block->next;
+      }
+      else
+      {
+         arena_block *new_block = arena_new_block( a->block_size );
+         if( new_block == NULL )
+         {
+            return NULL;
+         }
+         if( block == NULL ) a->first = new_block;
+         else block->next = new_block;
+         block = new_block;
+      }
+      block->used = 0;
+      a->current = block;
+   }
+
+   p = ARENA_BLOCK_DATA( block ) + block->used;
+   block->used += size;
+
+   return p;
+} /* arena_alloc */
+
+char *arena_strdup( arena *a, const char *s )
+{
+   return arena_strndup( a, s, strlen(s) );
+} /* arena_strdup */
+
+char *arena_strndup( arena *a, const char *s, size_t len )
+{
+   const char *end;
+   char *copy;
+
+   end = (const char *)memchr( s, 0, len );
+   if( end != NULL ) len = end - s;
+
+   copy = (char *)arena_alloc( a, len+1 );
+   if( copy != NULL )
+   {
+      memcpy( copy, s, len );
+      copy[len] = 0;
+   }
+
+   return copy;
+} /* arena_strndup */
+
+void arena_reset( arena *a )
+{
+   arena_free_blocks( a->large );
+   a->large = NULL;
+
+   a->current = a->first;
+   if( a->current != NULL ) a->current->used = 0;
+} /* arena_reset */
+
+void arena_destroy( arena *a )
+{
+   arena_free_blocks( a->large );
+   arena_free_blocks( a->first );
+   a->first = NULL;
+   a->current = NULL;
+   a->large = NULL;
+} /* arena_destroy */
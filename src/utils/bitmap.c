@@ -0,0 +1,852 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+/* SSE2 combines bit sets 128 bits at a time where available. */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define BITMAP_SSE2
+#endif
+
+#include "bitmap.h"
+
+/* Size of the bit set of a chunk, in 64 bit words. */
+#define BITMAP_WORDS 1024
+
+/* Most members of a sorted array chunk: a bit set is smaller beyond. */
+#define BITMAP_ARRAY_MAX 4096
+
+struct bitmap_container
+{
+   uint16_t key;        /* High 16 bits of the members */
+   uint32_t count;
+
+   /* Low 16 bits of the members, sorted, or NULL for a bit set. */
+   uint16_t *array;
+   uint32_t max;        /* Entries allocated, heap bitmaps only */
+
+   /* BITMAP_WORDS words, or NULL for an array. */
+   uint64_t *bits;
+};
+
+enum
+{
+   BITMAP_OP_AND,
+   BITMAP_OP_OR,
+   BITMAP_OP_ANDNOT
+};
+
+#define bitmap_bit(low) ((uint64_t)1 << ((low) & 63))
+
+/*
+ * Count the bits set in a word.
+ */
+static
+uint32_t bitmap_popcount( uint64_t w )
+{
+#if defined(__GNUC__)
+   return (uint32_t)__builtin_popcountll( w );
+#else
+   w = w - ((w >> 1) & 0x5555555555555555ULL);
+   w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+   w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+   return (uint32_t)((w * 0x0101010101010101ULL) >> 56);
+#endif
+} /* bitmap_popcount */
+
+/* Position of the lowest bit set in a word, which must not be 0. */
+#define bitmap_lowest_bit(w) bitmap_popcount( ((w) & (0 - (w))) - 1 )
+
+/*
+ * Count the bits set in a bit set.
+ */
+static
+uint32_t bitmap_count_bits( const uint64_t *bits )
+{
+   uint32_t count = 0;
+   int i;
+
+   for( i = 0; i < BITMAP_WORDS; i++ )
+   {
+      count += bitmap_popcount( bits[i] );
+   }
+   return count;
+} /* bitmap_count_bits */
+
+#ifdef BITMAP_SSE2
+#  define bitmap_mm_andnot(x, y) _mm_andnot_si128( (y), (x) )
+#  define BITMAP_WORDS_LOOP(mm_op, op) \
+   for( i = 0; i < BITMAP_WORDS; i += 2 ) \
+   { \
+      _mm_storeu_si128( (__m128i *)(out + i), \
+                        mm_op( _mm_loadu_si128( (const __m128i *)(x + i) ), \
+                               _mm_loadu_si128( (const __m128i *)(y + i) ) ) ); \
+   }
+#else
+#  define BITMAP_WORDS_LOOP(mm_op, op) \
+   for( i = 0; i < BITMAP_WORDS; i++ ) \
+   { \
+      out[i] = x[i] op y[i]; \
+   }
+#endif
+
+/*
+ * Combine two bit sets word by word. out may be x or y.
+ */
+static
+void bitmap_combine_bits( int op, const uint64_t *x, const uint64_t *y, uint64_t *out )
+{
+   int i;
+
+   switch( op )
+   {
+      case BITMAP_OP_AND:
+         BITMAP_WORDS_LOOP( _mm_and_si128, & )
+         break;
+
+      case BITMAP_OP_OR:
+         BITMAP_WORDS_LOOP( _mm_or_si128, | )
+         break;
+
+      case BITMAP_OP_ANDNOT:
+         BITMAP_WORDS_LOOP( bitmap_mm_andnot, & ~ )
+         break;
+   }
+} /* bitmap_combine_bits */
+
+/*
+ * Find a key among the containers of a bitmap. Keys are most 
+ * often added in increasing order, so the last one is tried first.
+ *
+ * @return The container position, or -(insertion position)-1 if 
+ *    there is no container for the key.
+ */
+static
+int bitmap_find_container( const bitmap *b, uint16_t key )
+{
+   int low = 0;
+   int high = b->num_containers - 1;
+   int mid;
+
+   if( (high < 0) || (b->containers[high].key < key) )
+   {
+      return -b->num_containers - 1;
+   }
+
+   while( low <= high )
+   {
+      mid = (low + high) / 2;
+      if( b->containers[mid].key < key ) low = mid + 1;
+      else if( b->containers[mid].key > key ) high = mid - 1;
+      else return mid;
+   }
+   return -low - 1;
+} /* bitmap_find_container */
+
+/*
+ * Find a value in a sorted array, as bitmap_find_container.
+ */
+static
+int bitmap_find_value( const uint16_t *array, uint32_t count, uint16_t value )
+{
+   int low = 0;
+   int high = (int)count - 1;
+   int mid;
+
+   if( (high < 0) || (array[high] < value) )
+   {
+      return -(int)count - 1;
+   }
+
+   while( low <= high )
+   {
+      mid = (low + high) / 2;
+      if( array[mid] < value ) low = mid + 1;
+      else if( array[mid] > value ) high = mid - 1;
+      else return mid;
+   }
+   return -low - 1;
+} /* bitmap_find_value */
+
+/*
+ * Take a container out of a heap bitmap, freeing it.
+ */
+static
+void bitmap_delete_container( bitmap *b, int pos )
+{
+   free( b->containers[pos].array );
+   free( b->containers[pos].bits );
+   memmove( b->containers + pos, b->containers + pos + 1, 
+            (b->num_containers - pos - 1) * sizeof(bitmap_container) );
+   b->num_containers -= 1;
+} /* bitmap_delete_container */
+
+void bitmap_init( bitmap *b )
+{
+   b->containers = NULL;
+   b->num_containers = 0;
+   b->max_containers = 0;
+} /* bitmap_init */
+
+void bitmap_free( bitmap *b )
+{
+   while( b->num_containers > 0 )
+   {
+      bitmap_delete_container( b, b->num_containers - 1 );
+   }
+   free( b->containers );
+   bitmap_init( b );
+} /* bitmap_free */
+
+int bitmap_add( bitmap *b, uint32_t x )
+{
+   uint16_t key = (uint16_t)(x >> 16);
+   uint16_t low = (uint16_t)(x & 0xFFFF);
+   bitmap_container *c;
+   int pos;
+   int i;
+
+   pos = bitmap_find_container( b, key );
+   if( pos < 0 )
+   {
+      pos = -pos - 1;
+      if( b->num_containers == b->max_containers )
+      {
+         int max = (b->max_containers == 0) ? 4 : b->max_containers * 2;
+
+         c = (bitmap_container *)realloc( b->containers, max * sizeof(bitmap_container) );
+         if( c == NULL )
+         {
+            return BITMAP_ERROR;
+         }
+         b->containers = c;
+         b->max_containers = max;
+      }
+
+      memmove( b->containers + pos + 1, b->containers + pos, 
+               (b->num_containers - pos) * sizeof(bitmap_container) );
+      b->num_containers += 1;
+      memset( b->containers + pos, 0, sizeof(bitmap_container) );
+      b->containers[pos].key = key;
+   }
+   c = &b->containers[pos];
+
+   if( c->bits != NULL )
+   {
+      if( (c->bits[low >> 6] & bitmap_bit(low)) == 0 )
+      {
+         c->bits[low >> 6] |= bitmap_bit( low );
+         c->count += 1;
+      }
+      return BITMAP_SUCCESS;
+   }
+
+   i = bitmap_find_value( c->array, c->count, low );
+   if( i >= 0 )
+   {
+      return BITMAP_SUCCESS;
+   }
+   i = -i - 1;
+
+   if( c->count == BITMAP_ARRAY_MAX )
+   {
+      /* Too many for an array. */
+      uint64_t *bits = (uint64_t *)calloc( BITMAP_WORDS, sizeof(uint64_t) );
+      uint32_t k;
+
+      if( bits == NULL )
+      {
+         return BITMAP_ERROR;
+      }
+      for( k = 0; k < c->count; k++ )
+      {
+         bits[c->array[k] >> 6] |= bitmap_bit( c->array[k] );
+      }
+      bits[low >> 6] |= bitmap_bit( low );
+      free( c->array );
+      c->array = NULL;
+      c->max = 0;
+      c->bits = bits;
+      c->count += 1;
+      return BITMAP_SUCCESS;
+   }
+
+   if( c->count == c->max )
+   {
+      uint32_t max = (c->max == 0) ? 4 : c->max * 2;
+      uint16_t *array;
+
+      if( max > BITMAP_ARRAY_MAX ) max = BITMAP_ARRAY_MAX;
+      array = (uint16_t *)realloc( c->array, max * sizeof(uint16_t) );
+      if( array == NULL )
+      {
+         if( c->count == 0 )
+         {
+            bitmap_delete_container( b, pos );
+         }
+         return BITMAP_ERROR;
+      }
+      c->array = array;
+      c->max = max;
+   }
+
+   memmove( c->array + i + 1, c->array + i, (c->count - i) * sizeof(uint16_t) );
+   c->array[i] = low;
+   c->count += 1;
+
+   return BITMAP_SUCCESS;
+} /* bitmap_add */
+
+void bitmap_remove( bitmap *b, uint32_t x )
+{
+   uint16_t key = (uint16_t)(x >> 16);
+   uint16_t low = (uint16_t)(x & 0xFFFF);
+   bitmap_container *c;
+   int pos;
+   int i;
+
+   pos = bitmap_find_container( b, key );
+   if( pos < 0 )
+   {
+      return;
+   }
+   c = &b->containers[pos];
+
+   if( c->bits != NULL )
+   {
+      if( (c->bits[low >> 6] & bitmap_bit(low)) == 0 )
+      {
+         return;
+      }
+      c->bits[low >> 6] &= ~bitmap_bit( low );
+      c->count -= 1;
+
+      /* Back to an array, well below the limit not to flip back and forth. */
+      if( (c->count > 0) && (c->count <= BITMAP_ARRAY_MAX / 2) )
+      {
+         uint16_t *array = (uint16_t *)malloc( c->count * sizeof(uint16_t) );
+         uint64_t w;
+
+         if( array != NULL )
+         {
+            c->max = 0;
+            for( i = 0; i < BITMAP_WORDS; i++ )
+            {
+               for( w = c->bits[i]; w != 0; w &= w - 1 )
+               {
+                  array[c->max++] = (uint16_t)(i * 64 + bitmap_lowest_bit(w));
+               }
+            }
+            free( c->bits );
+            c->bits = NULL;
+            c->array = array;
+         }
+      }
+   }
+   else
+   {
+      i = bitmap_find_value( c->array, c->count, low );
+      if( i < 0 )
+      {
+         return;
+      }
+      memmove( c->array + i, c->array + i + 1, (c->count - i - 1) * sizeof(uint16_t) );
+      c->count -= 1;
+   }
+
+   if( c->count == 0 )
+   {
+      bitmap_delete_container( b, pos );
+   }
+} /* bitmap_remove */
+
+uint32_t bitmap_count( const bitmap *b )
+{
+   uint32_t count = 0;
+   int i;
+
+   for( i = 0; i < b->num_containers; i++ )
+   {
+      count += b->containers[i].count;
+   }
+   return count;
+} /* bitmap_count */
+
+/*
+ * Turn a result container holding a bit set of count members
+ * into an array if it is small enough.
+ *
+ * @return BITMAP_SUCCESS, or BITMAP_ERROR if out of memory.
+ */
+static
+int bitmap_shrink_bits( bitmap_container *c, arena *a )
+{
+   uint16_t *array;
+   uint64_t w;
+   int n = 0;
+   int i;
+
+   if( (c->count == 0) || (c->count > BITMAP_ARRAY_MAX) )
+   {
+      return BITMAP_SUCCESS;
+   }
+
+   array = (uint16_t *)arena_alloc( a, c->count * sizeof(uint16_t) );
+   if( array == NULL )
+   {
+      return BITMAP_ERROR;
+   }
+   for( i = 0; i < BITMAP_WORDS; i++ )
+   {
+      for( w = c->bits[i]; w != 0; w &= w - 1 )
+      {
+         array[n++] = (uint16_t)(i * 64 + bitmap_lowest_bit(w));
+      }
+   }
+   c->array = array;
+   c->bits = NULL;
+
+   return BITMAP_SUCCESS;
+} /* bitmap_shrink_bits */
+
+/*
+ * Combine two arrays of sorted values.
+ *
+ * @return The number of values in the result.
+ */
+static
+uint32_t bitmap_combine_arrays( int op, const uint16_t *x, uint32_t nx, 
+                                const uint16_t *y, uint32_t ny, uint16_t *out )
+{
+   uint32_t i = 0, j = 0, n = 0;
+
+   while( (i < nx) && (j < ny) )
+   {
+      if( x[i] < y[j] )
+      {
+         if( op != BITMAP_OP_AND ) out[n++] = x[i];
+         i++;
+      }
+      else if( x[i] > y[j] )
+      {
+         if( op == BITMAP_OP_OR ) out[n++] = y[j];
+         j++;
+      }
+      else
+      {
+         if( op != BITMAP_OP_ANDNOT ) out[n++] = x[i];
+         i++;
+         j++;
+      }
+   }
+
+   if( op != BITMAP_OP_AND )
+   {
+      while( i < nx ) out[n++] = x[i++];
+   }
+   if( op == BITMAP_OP_OR )
+   {
+      while( j < ny ) out[n++] = y[j++];
+   }
+
+   return n;
+} /* bitmap_combine_arrays */
+
+/*
+ * Combine two containers with the same key. The result may
+ * be empty.
+ *
+ * @return BITMAP_SUCCESS, or BITMAP_ERROR if out of memory.
+ */
+static
+int bitmap_combine( int op, const bitmap_container *x, const bitmap_container *y, 
+                    arena *a, bitmap_container *out )
+{
+   const bitmap_container *t;
+   uint32_t k;
+
+   memset( out, 0, sizeof(bitmap_container) );
+   out->key = x->key;
+
+   /* And and or are symmetric: keep a bit set second. */
+   if( (op != BITMAP_OP_ANDNOT) && (x->bits != NULL) && (y->bits == NULL) )
+   {
+      t = x;
+      x = y;
+      y = t;
+   }
+
+   if( (x->bits == NULL) && ((y->bits == NULL) || (op != BITMAP_OP_OR)) &&
+       ((op != BITMAP_OP_OR) || (x->count + y->count <= BITMAP_ARRAY_MAX)) )
+   {
+      /* The result is an array at most as large as x, or x and y. */
+      out->array = (uint16_t *)arena_alloc( a, (x->count + y->count + 1) * sizeof(uint16_t) );
+      if( out->array == NULL )
+      {
+         return BITMAP_ERROR;
+      }
+
+      if( y->bits == NULL )
+      {
+         out->count = bitmap_combine_arrays( op, x->array, x->count, y->array, y->count, out->array );
+      }
+      else
+      {
+         for( k = 0; k < x->count; k++ )
+         {
+            if( ((y->bits[x->array[k] >> 6] & bitmap_bit(x->array[k])) != 0) == (op == BITMAP_OP_AND) )
+            {
+               out->array[out->count++] = x->array[k];
+            }
+         }
+      }
+      return BITMAP_SUCCESS;
+   }
+
+   /* The result is a bit set, made an array if small enough. */
+   out->bits = (uint64_t *)arena_alloc( a, BITMAP_WORDS * sizeof(uint64_t) );
+   if( out->bits == NULL )
+   {
+      return BITMAP_ERROR;
+   }
+
+   if( (x->bits != NULL) && (y->bits != NULL) )
+   {
+      bitmap_combine_bits( op, x->bits, y->bits, out->bits );
+      out->count = bitmap_count_bits( out->bits );
+   }
+   else if( x->bits != NULL )
+   {
+      /* Andnot with an array. */
+      memcpy( out->bits, x->bits, BITMAP_WORDS * sizeof(uint64_t) );
+      out->count = x->count;
+      for( k = 0; k < y->count; k++ )
+      {
+         if( out->bits[y->array[k] >> 6] & bitmap_bit(y->array[k]) )
+         {
+            out->bits[y->array[k] >> 6] &= ~bitmap_bit( y->array[k] );
+            out->count -= 1;
+         }
+      }
+   }
+   else
+   {
+      /* Or of an array, with an array or a bit set. */
+      if( y->bits != NULL )
+      {
+         memcpy( out->bits, y->bits, BITMAP_WORDS * sizeof(uint64_t) );
+      }
+      else
+      {
+         memset( out->bits, 0, BITMAP_WORDS * sizeof(uint64_t) );
+         for( k = 0; k < y->count; k++ )
+         {
+            out->bits[y->array[k] >> 6] |= bitmap_bit( y->array[k] );
+         }
+      }
+      for( k = 0; k < x->count; k++ )
+      {
+         out->bits[x->array[k] >> 6] |= bitmap_bit( x->array[k] );
+      }
+      out->count = bitmap_count_bits( out->bits );
+   }
+
+   return bitmap_shrink_bits( out, a );
+} /* bitmap_combine */
+
+/*
+ * Combine two bitmaps chunk by chunk. Chunks only one of the 
+ * bitmaps has are shared with the result when they are part of it.
+ */
+static
+int bitmap_op( int op, const bitmap *x, const bitmap *y, arena *a, bitmap *result )
+{
+   bitmap_container *out;
+   int max;
+   int i = 0;
+   int j = 0;
+
+   bitmap_init( result );
+
+   max = x->num_containers + ((op == BITMAP_OP_OR) ? y->num_containers : 0);
+   out = (bitmap_container *)arena_alloc( a, (max + 1) * sizeof(bitmap_container) );
+   if( out == NULL )
+   {
+      return BITMAP_ERROR;
+   }
+   result->containers = out;
+
+   while( (i < x->num_containers) || (j < y->num_containers) )
+   {
+      if( (j == y->num_containers) || 
+          ((i < x->num_containers) && (x->containers[i].key < y->containers[j].key)) )
+      {
+         if( op != BITMAP_OP_AND )
+         {
+            out[result->num_containers++] = x->containers[i];
+         }
+         i++;
+      }
+      else if( (i == x->num_containers) || (y->containers[j].key < x->containers[i].key) )
+      {
+         if( op == BITMAP_OP_OR )
+         {
+            out[result->num_containers++] = y->containers[j];
+         }
+         j++;
+      }
+      else
+      {
+         if( bitmap_combine( op, &x->containers[i], &y->containers[j], a, 
+                             &out[result->num_containers] ) != BITMAP_SUCCESS )
+         {
+            return BITMAP_ERROR;
+         }
+         if( out[result->num_containers].count > 0 )
+         {
+            result->num_containers++;
+         }
+         i++;
+         j++;
+      }
+   }
+
+   return BITMAP_SUCCESS;
+} /* bitmap_op */
+
+int bitmap_and( const bitmap *x, const bitmap *y, arena *a, bitmap *result )
+{
+   return bitmap_op( BITMAP_OP_AND, x, y, a, result );
+} /* bitmap_and */
+
+int bitmap_or( const bitmap *x, const bitmap *y, arena *a, bitmap *result )
+{
+   return bitmap_op( BITMAP_OP_OR, x, y, a, result );
+} /* bitmap_or */
+
+int bitmap_andnot( const bitmap *x, const bitmap *y, arena *a, bitmap *result )
+{
+   return bitmap_op( BITMAP_OP_ANDNOT, x, y, a, result );
+} /* bitmap_andnot */
+
+int bitmap_or_many( const bitmap **maps, int count, arena *a, bitmap *result )
+{
+   uint64_t **sets;
+   const bitmap_container *c;
+   bitmap_container *out;
+   int num_keys = 0;
+   int key;
+   uint32_t k;
+   int i, j;
+
+   bitmap_init( result );
+   if( count == 1 )
+   {
+      *result = *maps[0];
+      return BITMAP_SUCCESS;
+   }
+
+   for( i = 0; i < count; i++ )
+   {
+      if( (maps[i]->num_containers > 0) && 
+          (maps[i]->containers[maps[i]->num_containers-1].key >= num_keys) )
+      {
+         num_keys = maps[i]->containers[maps[i]->num_containers-1].key + 1;
+      }
+   }
+   if( num_keys == 0 )
+   {
+      return BITMAP_SUCCESS;
+   }
+
+   /* A bit set per chunk, where every bitmap is added. */
+   sets = (uint64_t **)arena_alloc( a, num_keys * sizeof(uint64_t *) );
+   out = (bitmap_container *)arena_alloc( a, num_keys * sizeof(bitmap_container) );
+   if( (sets == NULL) || (out == NULL) )
+   {
+      return BITMAP_ERROR;
+   }
+   memset( sets, 0, num_keys * sizeof(uint64_t *) );
+
+   for( i = 0; i < count; i++ )
+   {
+      for( j = 0; j < maps[i]->num_containers; j++ )
+      {
+         c = &maps[i]->containers[j];
+         if( sets[c->key] == NULL )
+         {
+            sets[c->key] = (uint64_t *)arena_alloc( a, BITMAP_WORDS * sizeof(uint64_t) );
+            if( sets[c->key] == NULL )
+            {
+               return BITMAP_ERROR;
+            }
+            memset( sets[c->key], 0, BITMAP_WORDS * sizeof(uint64_t) );
+         }
+
+         if( c->bits != NULL )
+         {
+            bitmap_combine_bits( BITMAP_OP_OR, sets[c->key], c->bits, sets[c->key] );
+         }
+         else
+         {
+            for( k = 0; k < c->count; k++ )
+            {
+               sets[c->key][c->array[k] >> 6] |= bitmap_bit( c->array[k] );
+            }
+         }
+      }
+   }
+
+   result->containers = out;
+   for( key = 0; key < num_keys; key++ )
+   {
+      if( sets[key] != NULL )
+      {
+         memset( out, 0, sizeof(bitmap_container) );
+         out->key = (uint16_t)key;
+         out->bits = sets[key];
+         out->count = bitmap_count_bits( out->bits );
+         if( bitmap_shrink_bits( out, a ) != BITMAP_SUCCESS )
+         {
+            return BITMAP_ERROR;
+         }
+         out++;
+         result->num_containers++;
+      }
+   }
+
+   return BITMAP_SUCCESS;
+} /* bitmap_or_many */
+
+int bitmap_from_array( const uint32_t *ids, int count, arena *a, bitmap *result )
+{
+   bitmap_container *out;
+   int num_keys = 0;
+   int i, j;
+
+   bitmap_init( result );
+
+   for( i = 0; i < count; i++ )
+   {
+      if( (i == 0) || ((ids[i] >> 16) != (ids[i-1] >> 16)) ) num_keys++;
+   }
+
+   out = (bitmap_container *)arena_alloc( a, (num_keys + 1) * sizeof(bitmap_container) );
+   if( out == NULL )
+   {
+      return BITMAP_ERROR;
+   }
+   result->containers = out;
+
+   for( i = 0; i < count; i = j )
+   {
+      for( j = i + 1; (j < count) && ((ids[j] >> 16) == (ids[i] >> 16)); j++ );
+
+      memset( out, 0, sizeof(bitmap_container) );
+      out->key = (uint16_t)(ids[i] >> 16);
+      out->count = j - i;
+      if( out->count <= BITMAP_ARRAY_MAX )
+      {
+         out->array = (uint16_t *)arena_alloc( a, out->count * sizeof(uint16_t) );
+         if( out->array == NULL )
+         {
+            return BITMAP_ERROR;
+         }
+         for( ; i < j; i++ )
+         {
+            out->array[i - (j - out->count)] = (uint16_t)(ids[i] & 0xFFFF);
+         }
+      }
+      else
+      {
+         out->bits = (uint64_t *)arena_alloc( a, BITMAP_WORDS * sizeof(uint64_t) );
+         if( out->bits == NULL )
+         {
+            return BITMAP_ERROR;
+         }
+         memset( out->bits, 0, BITMAP_WORDS * sizeof(uint64_t) );
+         for( ; i < j; i++ )
+         {
+            out->bits[(ids[i] & 0xFFFF) >> 6] |= bitmap_bit( ids[i] );
+         }
+      }
+      out++;
+      result->num_containers++;
+   }
+
+   return BITMAP_SUCCESS;
+} /* bitmap_from_array */
+
+uint32_t bitmap_select( const bitmap *b, uint32_t start, uint32_t count, uint32_t *ids )
+{
+   const bitmap_container *c;
+   uint32_t n = 0;
+   uint32_t high;
+   uint64_t w;
+   int i, k;
+
+   for( i = 0; (i < b->num_containers) && (n < count); i++ )
+   {
+      c = &b->containers[i];
+      if( start >= c->count )
+      {
+         /* Whole chunks are skipped by their count. */
+         start -= c->count;
+         continue;
+      }
+
+      high = (uint32_t)c->key << 16;
+      if( c->bits == NULL )
+      {
+         for( ; (start < c->count) && (n < count); start++ )
+         {
+            ids[n++] = high | c->array[start];
+         }
+      }
+      else
+      {
+         for( k = 0; (k < BITMAP_WORDS) && (n < count); k++ )
+         {
+            w = c->bits[k];
+            if( start >= bitmap_popcount(w) )
+            {
+               start -= bitmap_popcount( w );
+               continue;
+            }
+            for( ; (w != 0) && (n < count); w &= w - 1 )
+            {
+               if( start > 0 )
+               {
+                  start--;
+                  continue;
+               }
+               ids[n++] = high | (uint32_t)(k * 64 + bitmap_lowest_bit(w));
+            }
+         }
+      }
+      start = 0;
+   }
+
+   return n;
+} /* bitmap_select */
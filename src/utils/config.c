@@ -52,6 +52,8 @@ typedef struct config_param
    int httpd_port;
    char *httpd_doc_root_path;
    int httpd_scms_flag;
+   int httpd_workers;
+   int httpd_queue_depth;
 
    /* UPnP configuration parameters. */
    int upnp_check_ip;
@@ -59,6 +61,8 @@ typedef struct config_param
 
    /* CDS parameters. */
    char *cds_service_doc;
+   char *cds_metadata_path;
+   int cds_search_min_length;
    
 } config_param;
 
@@ -188,6 +192,32 @@ _usecwd:
       logger_log( LOG_TRACE, LOG_MSG("doc_root_path = \"%s\""), g_param.httpd_doc_root_path );
    }
 
+   /* 
+    * Worker pool settings. Zero means the
+    * HTTP server will use its own defaults.
+    */
+   node = xml_first_node_by_name( httpd_node, "workers" );
+   if( node )
+   {
+      g_param.httpd_workers = atoi( xmlNodeGetContent( node ) );
+      logger_log( LOG_TRACE, LOG_MSG("workers = %d"), g_param.httpd_workers );
+   }
+   else
+   {
+      g_param.httpd_workers = 0;
+   }
+
+   node = xml_first_node_by_name( httpd_node, "queue_depth" );
+   if( node )
+   {
+      g_param.httpd_queue_depth = atoi( xmlNodeGetContent( node ) );
+      logger_log( LOG_TRACE, LOG_MSG("queue_depth = %d"), g_param.httpd_queue_depth );
+   }
+   else
+   {
+      g_param.httpd_queue_depth = 0;
+   }
+
    return 0;
 } /* config_parse_httpd_settings */
 
@@ -243,6 +273,39 @@ int config_parse_upnp_settings( xmlNode *upnp_node )
 static
 int config_parse_cds_settings( xmlNode *cds_node )
 {
+   xmlNode *node;
+
+   /* 
+    * Where the library metadata (time indexes) is kept.
+    * Defaults to the document root, see config_get_metadata_path().
+    */
+   node = xml_first_node_by_name( cds_node, "metadata_path" );
+   if( node )
+   {
+      g_param.cds_metadata_path = xmlNodeGetContent( node );
+      if( !g_param.cds_metadata_path[0] )
+      {
+         xmlFree( g_param.cds_metadata_path );
+         g_param.cds_metadata_path = NULL;
+      }
+      else
+      {
+         logger_log( LOG_TRACE, LOG_MSG("metadata_path = \"%s\""), g_param.cds_metadata_path );
+      }
+   }
+
+   /* Shortest word part Search looks up in its trigram index. */
+   node = xml_first_node_by_name( cds_node, "search_min_length" );
+   if( node )
+   {
+      g_param.cds_search_min_length = atoi( xmlNodeGetContent( node ) );
+      logger_log( LOG_TRACE, LOG_MSG("search_min_length = %d"), g_param.cds_search_min_length );
+   }
+   else
+   {
+      g_param.cds_search_min_length = 0;
+   }
+
       /* FIXME: to be completed. */
    return 0;
 } /* config_parse_cds_settings */
@@ -434,8 +497,29 @@ char *config_get_doc_root_path()
    return g_param.httpd_doc_root_path;
 }
 
+int config_get_workers()
+{
+   return g_param.httpd_workers;
+}
+
+int config_get_queue_depth()
+{
+   return g_param.httpd_queue_depth;
+}
+
 /* UPnP configuration parameters. */
 char **config_get_allowed_ips()
 {
    return g_param.upnp_allowed_ips;
 }
+
+/* CDS configuration parameters. */
+char *config_get_metadata_path()
+{
+   return g_param.cds_metadata_path ? g_param.cds_metadata_path : g_param.httpd_doc_root_path;
+}
+
+int config_get_search_min_length()
+{
+   return g_param.cds_search_min_length;
+}
@@ -0,0 +1,87 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stddef.h>
+
+#include "atomic.h"
+
+#include "mpscq.h"
+
+void mpsc_queue_init( mpsc_queue *q )
+{
+   q->stub.next = NULL;
+   q->head = &q->stub;
+   q->tail = &q->stub;
+} /* mpsc_queue_init */
+
+void mpsc_queue_push( mpsc_queue *q, mpsc_node *node )
+{
+   mpsc_node *prev;
+
+   node->next = NULL;
+   prev = (mpsc_node *)atomic_xchg_ptr( &q->head, node );
+
+   /*
+    * The queue is briefly disconnected here: the consumer
+    * will not see the node until the link below is set.
+    */
+   prev->next = node;
+   atomic_barrier();
+} /* mpsc_queue_push */
+
+mpsc_node *mpsc_queue_pop( mpsc_queue *q )
+{
+   mpsc_node *tail = q->tail;
+   mpsc_node *next = tail->next;
+
+   if( tail == &q->stub )
+   {
+      /* Skip the stub. */
+      if( next == NULL ) return NULL;
+      q->tail = next;
+      tail = next;
+      next = next->next;
+   }
+
+   if( next != NULL )
+   {
+      q->tail = next;
+      return tail;
+   }
+
+   if( tail != q->head )
+   {
+      /* A producer has not linked its node yet. */
+      return NULL;
+   }
+
+   /* Last node, put the stub back behind it so it can be popped. */
+   mpsc_queue_push( q, &q->stub );
+
+   next = tail->next;
+   if( next != NULL )
+   {
+      q->tail = next;
+      return tail;
+   }
+
+   return NULL;
+} /* mpsc_queue_pop */
@@ -26,6 +26,13 @@
 
 #include "seekrange.h"
 
+#ifdef WIN32
+#  define SEEKRANGE_INT64_FMT "%I64d"
+#else
+#  include <inttypes.h>
+#  define SEEKRANGE_INT64_FMT "%" PRId64
+#endif
+
 
 
 /*----------------------------------------------------------------------------
@@ -34,6 +41,33 @@
  *
  *--------------------------------------------------------------------------*/
 
+/**
+ * Turns the "." 1*3DIGIT fraction of an npt-time into 
+ * milliseconds, so that ".5" and ".500" are the same.
+ *
+ * @param dot A pointer to the '.' character.
+ * @param msec Will receive the milliseconds.
+ * @return 1 if successful, 0 if the fraction is malformed.
+ */
+static
+int npt_parse_fraction( const char *dot, unsigned int *msec )
+{
+   int digits = 0;
+   unsigned int val = 0;
+
+   for( dot++; isdigit((unsigned char)*dot); dot++ )
+   {
+      if( ++digits > 3 ) return 0;
+      val = val*10 + (*dot - '0');
+   }
+
+   if( digits == 0 ) return 0;
+   while( digits++ < 3 ) val *= 10;
+
+   *msec = val;
+   return 1;
+} /* npt_parse_fraction */
+
 
 /**
  * Parse a string into a npt_time structure.
@@ -51,12 +85,20 @@
 int npt_parse( const char *npt_string, npt_time *npt )
 {
    int res;
+   unsigned int hh, mm, ss;
+   const char *dot;
 
    if( npt_string == NULL || npt == NULL )
    {
       return 0;
    }
 
+   /* 
+    * The string may go on past the time, an end time is followed 
+    * by the instance duration: only look at the time itself.
+    */
+   for( dot = npt_string; isdigit((unsigned char)*dot); dot++ );
+
    if( npt_string[0] == '*' )
    {
       npt->type = NPT_UNKNOWN;
@@ -67,18 +109,18 @@ int npt_parse( const char *npt_string, npt_time *npt )
       npt->type = NPT_NOW;
    }
    else
-   if( strchr( npt_string, (int)':' ) == NULL )
+   if( *dot != ':' )
    {
       /* This is an npt sec time representation. */
-      if( strchr( npt_string, (int)'.' ) != NULL )
+      res = ( sscanf( npt_string, "%lu", &npt->secs.sec_hi ) < 1 ) ? 0 : 1;
+      if( *dot == '.' )
       {
          npt->type = NPT_SEC_FULL;
-         res = ( sscanf( npt_string, "%u.%u", &npt->secs.sec_hi, &npt->secs.sec_lo ) < 2 ) ? 0 : 1;
+         res = res && npt_parse_fraction( dot, &npt->secs.sec_lo );
       }
       else
       {
          npt->type = NPT_SEC;
-         res = ( sscanf( npt_string, "%u", &npt->secs.sec_hi ) < 1 ) ? 0 : 1;
       }
 
       /* Sanity check. */
@@ -91,15 +133,16 @@ int npt_parse( const char *npt_string, npt_time *npt )
    else
    {
       /* This is an npt hhmmss time representation. */
-      if( strchr( npt_string, (int)'.' ) != NULL )
+      res = ( sscanf( npt_string, "%u:%u:%u", &hh, &mm, &ss ) < 3 ) ? 0 : 1;
+      for( ; isdigit((unsigned char)*dot) || (*dot == ':'); dot++ );
+      if( (*dot == '.') && isdigit((unsigned char)dot[1]) )
       {
          npt->type = NPT_HHMMSS_FULL;
-         res = ( sscanf( npt_string, "%u:%u:%u.%u", &npt->hhmmss.hh, &npt->hhmmss.mm, &npt->hhmmss.ss, &npt->hhmmss.low ) < 4 ) ? 0 : 1;
+         res = res && npt_parse_fraction( dot, &npt->hhmmss.low );
       }
       else
       {
          npt->type = NPT_HHMMSS;
-         res = ( sscanf( npt_string, "%u:%u:%u", &npt->hhmmss.hh, &npt->hhmmss.mm, &npt->hhmmss.ss ) < 3 ) ? 0 : 1;
       }
 
       /* Sanity check. */
@@ -110,11 +153,15 @@ int npt_parse( const char *npt_string, npt_time *npt )
       }
 
       /* Further sanity check. */
-      if( npt->hhmmss.mm > 59 || npt->hhmmss.ss > 59 )
+      if( mm > 59 || ss > 59 )
       {
          npt->type = NPT_INVALID;
          return 0;
       }
+
+      npt->hhmmss.hh = hh;
+      npt->hhmmss.mm = (unsigned char)mm;
+      npt->hhmmss.ss = (unsigned char)ss;
    }
 
    return 1;
@@ -164,19 +211,19 @@ char *npt_tostring( const npt_time *npt, char *buf, unsigned int buf_len )
          break;
 
       case NPT_SEC:
-         sprintf( nptstring, "%u", npt->secs.sec_hi );
+         sprintf( nptstring, "%lu", npt->secs.sec_hi );
          break;
 
       case NPT_SEC_FULL:
-         sprintf( nptstring, "%u.%u", npt->secs.sec_hi, npt->secs.sec_lo );
+         sprintf( nptstring, "%lu.%03u", npt->secs.sec_hi, npt->secs.sec_lo );
          break;
 
       case NPT_HHMMSS:
-         sprintf( nptstring, "%u.%02u.%02u", npt->hhmmss.hh, npt->hhmmss.mm, npt->hhmmss.ss );
+         sprintf( nptstring, "%lu:%02u:%02u", npt->hhmmss.hh, npt->hhmmss.mm, npt->hhmmss.ss );
          break;
 
       case NPT_HHMMSS_FULL:
-         sprintf( nptstring, "%u.%02u.%02u.%u", npt->hhmmss.hh, npt->hhmmss.mm, npt->hhmmss.ss, npt->hhmmss.low );
+         sprintf( nptstring, "%lu:%02u:%02u.%03u", npt->hhmmss.hh, npt->hhmmss.mm, npt->hhmmss.ss, npt->hhmmss.low );
          break;
 
       default:
@@ -198,6 +245,44 @@ char *npt_tostring( const npt_time *npt, char *buf, unsigned int buf_len )
    return buf;
 } /* npt_tostring */
 
+/**
+ * Converts an npt-time into milliseconds.
+ *
+ * @param npt The npt time structure to convert.
+ * @param msec Will receive the time in milliseconds.
+ * @return 1 if successful, 0 if npt is not an actual
+ *    time (NPT_INVALID, NPT_NOW or NPT_UNKNOWN).
+ */
+int npt_to_msec( const npt_time *npt, int64_t *msec )
+{
+   if( npt == NULL )
+   {
+      return 0;
+   }
+
+   switch( npt->type )
+   {
+      case NPT_SEC:
+         *msec = (int64_t)npt->secs.sec_hi * 1000;
+         return 1;
+
+      case NPT_SEC_FULL:
+         *msec = (int64_t)npt->secs.sec_hi * 1000 + npt->secs.sec_lo;
+         return 1;
+
+      case NPT_HHMMSS:
+         *msec = ((int64_t)npt->hhmmss.hh * 3600 + npt->hhmmss.mm * 60 + npt->hhmmss.ss) * 1000;
+         return 1;
+
+      case NPT_HHMMSS_FULL:
+         *msec = ((int64_t)npt->hhmmss.hh * 3600 + npt->hhmmss.mm * 60 + npt->hhmmss.ss) * 1000 + npt->hhmmss.low;
+         return 1;
+
+      default:
+         return 0;
+   }
+} /* npt_to_msec */
+
 
 /*----------------------------------------------------------------------------
  *
@@ -205,6 +290,41 @@ char *npt_tostring( const npt_time *npt, char *buf, unsigned int buf_len )
  *
  *--------------------------------------------------------------------------*/
 
+/**
+ * Reads a byte position (1*DIGIT). sscanf cannot be used
+ * here, as there is no portable conversion for 64 bit values.
+ *
+ * @param s The string to read from.
+ * @param pos Will receive the byte position.
+ * @return A pointer to the first character after the digits,
+ *    or NULL if there are no digits or the value overflows.
+ */
+static
+const char *bytepos_parse( const char *s, int64_t *pos )
+{
+   int64_t val = 0;
+   const char *start = s;
+
+   while( isdigit((unsigned char)*s) )
+   {
+      int digit = *s - '0';
+      if( val > (INT64_MAX - digit) / 10 )
+      {
+         return NULL;
+      }
+      val = val*10 + digit;
+      s++;
+   }
+
+   if( s == start )
+   {
+      return NULL;
+   }
+
+   *pos = val;
+   return s;
+} /* bytepos_parse */
+
 /**
  * Parse a string into a bytes_range structure.
  *
@@ -216,6 +336,8 @@ char *npt_tostring( const npt_time *npt, char *buf, unsigned int buf_len )
  */
 int bytesrange_parse( const char *bytesrange_string, bytes_range *br )
 {
+   const char *s;
+
    /* Look for the "bytes=" string. Be case sensitive. */
    if( strncmp(bytesrange_string, "bytes=", 6) != 0 )
    {
@@ -224,27 +346,38 @@ int bytesrange_parse( const char *bytesrange_string, bytes_range *br )
    }
 
    /* 
-    * Read the byte range specifiers and make sure the dash
+    * Read the first byte pos and make sure the dash
     * is in the string.
     */
-   if( sscanf( bytesrange_string+6, "%u-%u", &br->first, &br->last ) < 2 )
+   s = bytepos_parse( bytesrange_string+6, &br->first );
+   if( (s == NULL) || (*s != '-') )
    {
-      char dash;
+      br->type = BR_INVALID;
+      return 0;
+   }
+   s++;
 
-      /* That did not work, is maybe a BR_OPEN type? */
-      if( (sscanf( bytesrange_string+6, "%u%c", &br->first, &dash ) < 2) || (dash != '-') )
+   if( isdigit((unsigned char)*s) )
+   {
+      s = bytepos_parse( s, &br->last );
+      if( (s == NULL) || (br->last < br->first) )
       {
          br->type = BR_INVALID;
          return 0;
       }
-      else
-      {
-         br->type = BR_OPEN;
-      }
+      br->type = BR_CLOSED;
    }
    else
    {
-      br->type = BR_CLOSED;
+      br->type = BR_OPEN;
+   }
+
+   /* Only trailing LWS is allowed. */
+   while( (*s == ' ') || (*s == '\t') ) s++;
+   if( (*s != 0) && (*s != '\r') && (*s != '\n') )
+   {
+      br->type = BR_INVALID;
+      return 0;
    }
 
    return 1;
@@ -281,11 +414,11 @@ char *bytesrange_tostring( const bytes_range *br, char *buf, unsigned int buf_le
          return NULL;
 
       case BR_OPEN:
-         sprintf( brstring, "bytes=%u-", br->first );
+         sprintf( brstring, "bytes=" SEEKRANGE_INT64_FMT "-", br->first );
          break;
 
       case BR_CLOSED:
-         sprintf( brstring, "bytes=%u-%u", br->last );
+         sprintf( brstring, "bytes=" SEEKRANGE_INT64_FMT "-" SEEKRANGE_INT64_FMT, br->first, br->last );
          break;
    }
 
@@ -455,11 +588,11 @@ int timeseek_parse( const char *timeseek_string, timeseek_range *tsr )
             }
          }
          else
-         if( (*npt != '\r') && (*npt != '\n') )
+         if( (*npt != 0) && (*npt != ' ') && (*npt != '\r') && (*npt != '\n') )
          {
             /* 
-             * If it is not LWS then there's 
-             * garbage at the end of the npt-range. 
+             * If it is not the end of the value or LWS then 
+             * there's garbage at the end of the npt-range. 
              * Abort parsing and return an error.
              */
             tsr->type = TSR_INVALID;
@@ -523,33 +656,42 @@ int timeseek_parse( const char *timeseek_string, timeseek_range *tsr )
     */
    if( bytes != NULL )
    {
-      unsigned long ul;
+      const char *s;
+      int64_t length;
 
-      /* Try with the 1234-5678/1234 format first. */
-      if( sscanf( bytes, "bytes=%u-%u/%u", &tsr->range_start, &tsr->range_end, &ul ) < 3 )
+      s = bytepos_parse( bytes+6, &tsr->range_start );
+      if( (s != NULL) && (*s == '-') )
       {
-         char star;
-
-         /* That did not work. Try the 1234-5678/* then. */
-         if( (sscanf( bytes, "bytes=%u-%u/%c", &tsr->range_start, &tsr->range_end, &star ) < 3) || (star != '*') )
-         {
-            /* 
-             * That did not work either, it 
-             * must be a mispelled bytes-range then. 
-             */
-            tsr->type = TSR_INVALID;
-            return 0;
-         }
-         else
-         {
-            tsr->instance_length.type = NPT_UNKNOWN;
-         }
+         s = bytepos_parse( s+1, &tsr->range_end );
       }
       else
+      {
+         s = NULL;
+      }
+
+      if( (s == NULL) || (*s != '/') )
+      {
+         /* It must be a mispelled bytes-range then. */
+         tsr->type = TSR_INVALID;
+         return 0;
+      }
+
+      /* Try with the 1234-5678/1234 format first. */
+      if( bytepos_parse( s+1, &length ) != NULL )
       {
          /* There is only left to assign the instance-length. */
          tsr->instance_length.type = NPT_SEC;
-         tsr->instance_length.secs.sec_hi = ul;
+         tsr->instance_length.secs.sec_hi = (unsigned long)length;
+      }
+      else
+      if( s[1] == '*' )
+      {
+         tsr->instance_length.type = NPT_UNKNOWN;
+      }
+      else
+      {
+         tsr->type = TSR_INVALID;
+         return 0;
       }
    }
    return 1;
@@ -626,7 +768,7 @@ char *timeseek_tostring( const timeseek_range *tsr, char *buf, unsigned int buf_
       case TSR_NPT_BYTES:       /* npt=xxxx- bytes=wwww-zzzz/llll */
          nptstart = npt_tostring( &tsr->npt_start, NULL, 0 );
          nptlength = npt_tostring( &tsr->instance_length, NULL, 0 );
-         sprintf( tsrstring, "npt=%s- bytes=%u-%u/%s", nptstart, tsr->range_start, tsr->range_end, nptlength );
+         sprintf( tsrstring, "npt=%s- bytes=" SEEKRANGE_INT64_FMT "-" SEEKRANGE_INT64_FMT "/%s", nptstart, tsr->range_start, tsr->range_end, nptlength );
          free( nptstart );
          free( nptlength );
          break;
@@ -635,7 +777,7 @@ char *timeseek_tostring( const timeseek_range *tsr, char *buf, unsigned int buf_
          nptstart = npt_tostring( &tsr->npt_start, NULL, 0 );
          nptduration = npt_tostring( &tsr->instance_duration, NULL, 0 );
          nptlength = npt_tostring( &tsr->instance_length, NULL, 0 );
-         sprintf( tsrstring, "npt=%s-/%s bytes=%u-%u/%s", nptstart, nptduration, tsr->range_start, tsr->range_end, nptlength );
+         sprintf( tsrstring, "npt=%s-/%s bytes=" SEEKRANGE_INT64_FMT "-" SEEKRANGE_INT64_FMT "/%s", nptstart, nptduration, tsr->range_start, tsr->range_end, nptlength );
          free( nptstart );
          free( nptduration );
          free( nptlength );
@@ -645,7 +787,7 @@ char *timeseek_tostring( const timeseek_range *tsr, char *buf, unsigned int buf_
          nptstart = npt_tostring( &tsr->npt_start, NULL, 0 );
          nptend = npt_tostring( &tsr->npt_end, NULL, 0 );
          nptlength = npt_tostring( &tsr->instance_length, NULL, 0 );
-         sprintf( tsrstring, "npt=%s-%s bytes=%u-%u/%s", nptstart, nptend, tsr->range_start, tsr->range_end, nptlength );
+         sprintf( tsrstring, "npt=%s-%s bytes=" SEEKRANGE_INT64_FMT "-" SEEKRANGE_INT64_FMT "/%s", nptstart, nptend, tsr->range_start, tsr->range_end, nptlength );
          free( nptstart );
          free( nptend );
          free( nptlength );
@@ -656,7 +798,7 @@ char *timeseek_tostring( const timeseek_range *tsr, char *buf, unsigned int buf_
          nptend = npt_tostring( &tsr->npt_end, NULL, 0 );
          nptduration = npt_tostring( &tsr->instance_duration, NULL, 0 );
          nptlength = npt_tostring( &tsr->instance_length, NULL, 0 );
-         sprintf( tsrstring, "npt=%s-%s/%s bytes=%u-%u/%s", nptstart, nptend, nptduration, tsr->range_start, tsr->range_end, nptlength );
+         sprintf( tsrstring, "npt=%s-%s/%s bytes=" SEEKRANGE_INT64_FMT "-" SEEKRANGE_INT64_FMT "/%s", nptstart, nptend, nptduration, tsr->range_start, tsr->range_end, nptlength );
          free( nptstart );
          free( nptend );
          free( nptduration );
@@ -0,0 +1,533 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "soapparser.h"
+
+/* Kinds of markup returned by soap_next_tag. */
+enum
+{
+   SOAP_TAG_START,   /* <name ...> */
+   SOAP_TAG_END,     /* </name> */
+   SOAP_TAG_EMPTY    /* <name .../> */
+};
+
+typedef struct soap_parser
+{
+   char *p;
+   char *end;
+} soap_parser;
+
+typedef struct soap_tag
+{
+   int type;
+   char *name;       /* Local name, prefix stripped */
+   long name_len;
+   char *name_end;   /* Where the name can be zero terminated */
+} soap_tag;
+
+#define soap_is_space(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+/*
+ * Finds a string between p and end.
+ * Returns where it starts, or NULL.
+ */
+static
+char *soap_find( char *p, char *end, const char *s )
+{
+   size_t len = strlen( s );
+
+   while( (end - p) >= (long)len )
+   {
+      p = (char *)memchr( p, s[0], (end - p) - len + 1 );
+      if( p == NULL ) return NULL;
+      if( memcmp(p, s, len) == 0 ) return p;
+      p++;
+   }
+   return NULL;
+} /* soap_find */
+
+/*
+ * Skips a processing instruction, a comment, a CDATA
+ * section or a declaration, the parser being on its '<'.
+ */
+static
+int soap_skip_markup( soap_parser *ps )
+{
+   const char *terminator;
+   char *q;
+
+   if( ps->p[1] == '?' ) terminator = "?>";
+   else if( (ps->end - ps->p >= 4) && (memcmp(ps->p, "<!--", 4) == 0) ) terminator = "-->";
+   else if( (ps->end - ps->p >= 9) && (memcmp(ps->p, "<![CDATA[", 9) == 0) ) terminator = "]]>";
+   else terminator = ">";
+
+   q = soap_find( ps->p + 2, ps->end, terminator );
+   if( q == NULL )
+   {
+      return SOAP_ERROR;
+   }
+   ps->p = q + strlen( terminator );
+
+   return SOAP_SUCCESS;
+} /* soap_skip_markup */
+
+/*
+ * Reads the element tag the parser is on, up to 
+ * and including its closing '>'.
+ */
+static
+int soap_read_tag( soap_parser *ps, soap_tag *tag )
+{
+   char *p = ps->p + 1;
+   char *end = ps->end;
+   char *colon = NULL;
+   char quote;
+
+   tag->type = SOAP_TAG_START;
+   if( (p < end) && (*p == '/') )
+   {
+      tag->type = SOAP_TAG_END;
+      p++;
+   }
+
+   tag->name = p;
+   while( (p < end) && !soap_is_space(*p) && (*p != '>') && (*p != '/') )
+   {
+      if( *p == ':' ) colon = p;
+      p++;
+   }
+   if( (p == end) || (p == tag->name) )
+   {
+      return SOAP_ERROR;
+   }
+   tag->name_end = p;
+   if( colon != NULL ) tag->name = colon + 1;
+   tag->name_len = (long)(tag->name_end - tag->name);
+
+   /* Attributes are skipped, namespaces do not matter here. */
+   for( ;; )
+   {
+      while( (p < end) && soap_is_space(*p) ) p++;
+      if( p == end )
+      {
+         return SOAP_ERROR;
+      }
+
+      if( *p == '>' )
+      {
+         p++;
+         break;
+      }
+
+      if( *p == '/' )
+      {
+         if( (tag->type == SOAP_TAG_END) || (p+1 == end) || (p[1] != '>') )
+         {
+            return SOAP_ERROR;
+         }
+         tag->type = SOAP_TAG_EMPTY;
+         p += 2;
+         break;
+      }
+
+      if( tag->type == SOAP_TAG_END )
+      {
+         return SOAP_ERROR;
+      }
+
+      /* name="value" or name='value' */
+      while( (p < end) && (*p != '=') && (*p != '>') ) p++;
+      if( (p == end) || (*p != '=') )
+      {
+         return SOAP_ERROR;
+      }
+      p++;
+      while( (p < end) && soap_is_space(*p) ) p++;
+      if( (p == end) || ((*p != '"') && (*p != '\'')) )
+      {
+         return SOAP_ERROR;
+      }
+      quote = *p++;
+      p = (char *)memchr( p, quote, end - p );
+      if( p == NULL )
+      {
+         return SOAP_ERROR;
+      }
+      p++;
+   }
+
+   ps->p = p;
+   return SOAP_SUCCESS;
+} /* soap_read_tag */
+
+/*
+ * Moves to the next element tag, skipping 
+ * text, comments and the like.
+ */
+static
+int soap_next_tag( soap_parser *ps, soap_tag *tag )
+{
+   for( ;; )
+   {
+      ps->p = (char *)memchr( ps->p, '<', ps->end - ps->p );
+      if( (ps->p == NULL) || (ps->p+1 >= ps->end) )
+      {
+         return SOAP_ERROR;
+      }
+
+      if( (ps->p[1] == '?') || (ps->p[1] == '!') )
+      {
+         if( soap_skip_markup(ps) != SOAP_SUCCESS )
+         {
+            return SOAP_ERROR;
+         }
+         continue;
+      }
+
+      return soap_read_tag( ps, tag );
+   }
+} /* soap_next_tag */
+
+/*
+ * Skips the content of an element, up to and
+ * including its end tag.
+ */
+static
+int soap_skip_element( soap_parser *ps )
+{
+   soap_tag tag;
+   int depth = 1;
+
+   while( depth > 0 )
+   {
+      if( soap_next_tag(ps, &tag) != SOAP_SUCCESS )
+      {
+         return SOAP_ERROR;
+      }
+      if( tag.type == SOAP_TAG_START ) depth++;
+      else if( tag.type == SOAP_TAG_END ) depth--;
+   }
+   return SOAP_SUCCESS;
+} /* soap_skip_element */
+
+/*
+ * Writes a code point as UTF-8.
+ * Returns the number of bytes written.
+ */
+static
+int soap_put_utf8( char *w, unsigned long c )
+{
+   if( c < 0x80 )
+   {
+      w[0] = (char)c;
+      return 1;
+   }
+   if( c < 0x800 )
+   {
+      w[0] = (char)(0xC0 | (c >> 6));
+      w[1] = (char)(0x80 | (c & 0x3F));
+      return 2;
+   }
+   if( c < 0x10000 )
+   {
+      w[0] = (char)(0xE0 | (c >> 12));
+      w[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+      w[2] = (char)(0x80 | (c & 0x3F));
+      return 3;
+   }
+   w[0] = (char)(0xF0 | (c >> 18));
+   w[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+   w[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+   w[3] = (char)(0x80 | (c & 0x3F));
+   return 4;
+} /* soap_put_utf8 */
+
+/*
+ * Decodes the entity reference at p (on its '&') into w.
+ * Every reference is longer than what it stands for,
+ * so w can trail p in the same buffer.
+ * Returns the number of bytes written, or -1.
+ */
+static
+int soap_decode_entity( char *p, char *end, char *w, char **next )
+{
+   char *semi;
+   unsigned long c;
+   char *digits_end;
+
+   semi = (char *)memchr( p, ';', (end - p < 12) ? (end - p) : 12 );
+   if( semi == NULL )
+   {
+      return -1;
+   }
+   *next = semi + 1;
+
+   if( p[1] == '#' )
+   {
+      if( (p[2] == 'x') || (p[2] == 'X') ) c = strtoul( p+3, &digits_end, 16 );
+      else c = strtoul( p+2, &digits_end, 10 );
+      if( (digits_end != semi) || (c == 0) || (c > 0x10FFFF) )
+      {
+         return -1;
+      }
+      return soap_put_utf8( w, c );
+   }
+
+   switch( semi - p - 1 )
+   {
+      case 2:
+         if( memcmp(p+1, "lt", 2) == 0 ) { *w = '<'; return 1; }
+         if( memcmp(p+1, "gt", 2) == 0 ) { *w = '>'; return 1; }
+         break;
+      case 3:
+         if( memcmp(p+1, "amp", 3) == 0 ) { *w = '&'; return 1; }
+         break;
+      case 4:
+         if( memcmp(p+1, "quot", 4) == 0 ) { *w = '"'; return 1; }
+         if( memcmp(p+1, "apos", 4) == 0 ) { *w = '\''; return 1; }
+         break;
+   }
+   return -1;
+} /* soap_decode_entity */
+
+/*
+ * Reads the text content of an element, stopping on the
+ * first tag. Returns where the decoded value ends: the
+ * caller zero terminates it once the tag has been read.
+ */
+static
+char *soap_read_text( soap_parser *ps )
+{
+   char *p = ps->p;
+   char *end = ps->end;
+   char *w = NULL;  /* Write position, once decoding started */
+   char *q;
+   int n;
+
+   for( ;; )
+   {
+      q = p;
+      while( (q < end) && (*q != '<') && (*q != '&') ) q++;
+      if( q == end )
+      {
+         return NULL;
+      }
+
+      if( w != NULL )
+      {
+         memmove( w, p, q - p );
+         w += q - p;
+      }
+
+      if( *q == '&' )
+      {
+         if( w == NULL ) w = q;
+         n = soap_decode_entity( q, end, w, &p );
+         if( n < 0 )
+         {
+            return NULL;
+         }
+         w += n;
+         continue;
+      }
+
+      if( (end - q >= 4) && (memcmp(q, "<!--", 4) == 0) )
+      {
+         if( w == NULL ) w = q;
+         ps->p = q;
+         if( soap_skip_markup(ps) != SOAP_SUCCESS ) return NULL;
+         p = ps->p;
+         continue;
+      }
+
+      if( (end - q >= 9) && (memcmp(q, "<![CDATA[", 9) == 0) )
+      {
+         char *cdata_end = soap_find( q+9, end, "]]>" );
+         if( cdata_end == NULL )
+         {
+            return NULL;
+         }
+         if( w == NULL ) w = q;
+         memmove( w, q+9, cdata_end - (q+9) );
+         w += cdata_end - (q+9);
+         p = cdata_end + 3;
+         continue;
+      }
+
+      /* A tag: the text is over. */
+      ps->p = q;
+      return (w != NULL) ? w : q;
+   }
+} /* soap_read_text */
+
+/*
+ * Reads the argument whose start tag has just been read.
+ */
+static
+int soap_read_argument( soap_parser *ps, soap_tag *start, soap_argument *arg )
+{
+   soap_tag tag;
+   char *value_end;
+
+   arg->name = start->name;
+   arg->value = ps->p;
+
+   value_end = soap_read_text( ps );
+   if( value_end == NULL )
+   {
+      return SOAP_ERROR;
+   }
+
+   if( soap_read_tag(ps, &tag) != SOAP_SUCCESS )
+   {
+      return SOAP_ERROR;
+   }
+
+   if( tag.type != SOAP_TAG_END )
+   {
+      /* Structured arguments are not used by any action, skip it. */
+      if( (tag.type == SOAP_TAG_START) && (soap_skip_element(ps) != SOAP_SUCCESS) )
+      {
+         return SOAP_ERROR;
+      }
+      if( soap_skip_element(ps) != SOAP_SUCCESS )
+      {
+         return SOAP_ERROR;
+      }
+      value_end = arg->value;
+   }
+   else
+   if( (tag.name_len != start->name_len) || memcmp(tag.name, start->name, tag.name_len) )
+   {
+      return SOAP_ERROR;
+   }
+
+   *start->name_end = 0;
+   *value_end = 0;
+
+   return SOAP_SUCCESS;
+} /* soap_read_argument */
+
+#define soap_tag_is(tag, s) (((tag)->name_len == sizeof(s)-1) && !memcmp((tag)->name, s, sizeof(s)-1))
+
+int soap_parse_request( char *buf, long len, soap_request *request )
+{
+   soap_parser ps;
+   soap_tag tag;
+   soap_argument arg;
+
+   request->action = NULL;
+   request->num_arguments = 0;
+
+   ps.p = buf;
+   ps.end = buf + len;
+
+   /* The Envelope. */
+   if( (soap_next_tag(&ps, &tag) != SOAP_SUCCESS) || (tag.type != SOAP_TAG_START) || !soap_tag_is(&tag, "Envelope") )
+   {
+      return SOAP_ERROR;
+   }
+
+   /* The Body, possibly after a Header. */
+   for( ;; )
+   {
+      if( (soap_next_tag(&ps, &tag) != SOAP_SUCCESS) || (tag.type == SOAP_TAG_END) )
+      {
+         return SOAP_ERROR;
+      }
+      if( tag.type == SOAP_TAG_EMPTY )
+      {
+         continue;
+      }
+      if( soap_tag_is(&tag, "Body") )
+      {
+         break;
+      }
+      if( soap_skip_element(&ps) != SOAP_SUCCESS )
+      {
+         return SOAP_ERROR;
+      }
+   }
+
+   /* The action. */
+   if( (soap_next_tag(&ps, &tag) != SOAP_SUCCESS) || (tag.type == SOAP_TAG_END) )
+   {
+      return SOAP_ERROR;
+   }
+   request->action = tag.name;
+   *tag.name_end = 0;
+   if( tag.type == SOAP_TAG_EMPTY )
+   {
+      return SOAP_SUCCESS;
+   }
+
+   /* Its arguments, up to the action end tag. */
+   for( ;; )
+   {
+      if( soap_next_tag(&ps, &tag) != SOAP_SUCCESS )
+      {
+         return SOAP_ERROR;
+      }
+
+      if( tag.type == SOAP_TAG_END )
+      {
+         break;
+      }
+
+      if( tag.type == SOAP_TAG_EMPTY )
+      {
+         /* The terminated name doubles as the empty value. */
+         *tag.name_end = 0;
+         arg.name = tag.name;
+         arg.value = tag.name_end;
+      }
+      else
+      if( soap_read_argument(&ps, &tag, &arg) != SOAP_SUCCESS )
+      {
+         return SOAP_ERROR;
+      }
+
+      if( request->num_arguments < SOAP_MAX_ARGUMENTS )
+      {
+         request->arguments[request->num_arguments++] = arg;
+      }
+   }
+
+   return SOAP_SUCCESS;
+} /* soap_parse_request */
+
+char *soap_get_argument( soap_request *request, const char *name )
+{
+   int i;
+
+   for( i = 0; i < request->num_arguments; i++ )
+   {
+      if( strcmp(request->arguments[i].name, name) == 0 )
+      {
+         return request->arguments[i].value;
+      }
+   }
+   return NULL;
+} /* soap_get_argument */
@@ -0,0 +1,270 @@
+/*
+ * YADL - Yet Another DLNA Library
+ * Copyright (C) 2008 Stefano Passiglia <info@stefanopassiglia.com>
+ *
+ * This file is part of YADL.
+ *
+ * YADL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * YADL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dlnacpp; if not, write to the Free Software
+ * Foundation, Inc, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * A fixed size pool of worker threads.
+ *
+ * Every worker consumes jobs from its own lock-free MPSC queue, so
+ * submitting a job costs an atomic exchange and, only when the
+ * worker is asleep, a condition variable signal.
+ */
+
+#include <stdlib.h>
+
+#include "pthread.h"
+
+#include "logger.h"
+#include "atomic.h"
+#include "mpscq.h"
+
+#include "threadpool.h"
+
+/**
+ * A worker thread and its queue.
+ */
+typedef struct threadpool_worker
+{
+   mpsc_queue queue;
+
+   /*
+    * Set by the worker, with its mutex held, right before
+    * checking the queue one last time and going to sleep.
+    */
+   volatile long sleeping;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+
+   pthread_t thread;
+   threadpool *pool;
+} threadpool_worker;
+
+struct threadpool
+{
+   volatile long run;
+
+   /* Jobs queued or running. */
+   volatile long pending;
+   long queue_depth;
+
+   /* Round robin index, used when no worker is idle. */
+   volatile long next_worker;
+
+   int num_workers;
+   threadpool_worker *workers;
+};
+
+
+/**
+ * Runs a job. The job may be gone once its function returns.
+ */
+static
+void threadpool_run_job( threadpool *pool, mpsc_node *node )
+{
+   threadpool_job *job = (threadpool_job *)node;
+
+   job->fn( job->arg );
+
+   atomic_dec( &pool->pending );
+} /* threadpool_run_job */
+
+/**
+ * Worker thread procedure.
+ *
+ * @param arg The worker structure.
+ * @return Always NULL.
+ */
+static
+void *threadpool_worker_proc( void *arg )
+{
+   threadpool_worker *w = (threadpool_worker *)arg;
+   threadpool *pool = w->pool;
+   mpsc_node *node;
+
+   for( ; ; )
+   {
+      node = mpsc_queue_pop( &w->queue );
+      if( node != NULL )
+      {
+         threadpool_run_job( pool, node );
+         continue;
+      }
+
+      if( !atomic_read(&pool->run) )
+      {
+         /* Queue is drained, we are done. */
+         break;
+      }
+
+      /*
+       * Queue looks empty: announce we are going to sleep and check
+       * again. A producer pushing concurrently either sees the flag
+       * and signals us, or we see its job here.
+       */
+      pthread_mutex_lock( &w->mutex );
+      atomic_xchg( &w->sleeping, 1 );
+      node = mpsc_queue_pop( &w->queue );
+      if( (node == NULL) && atomic_read(&pool->run) )
+      {
+         pthread_cond_wait( &w->cond, &w->mutex );
+      }
+      atomic_xchg( &w->sleeping, 0 );
+      pthread_mutex_unlock( &w->mutex );
+
+      if( node != NULL )
+      {
+         threadpool_run_job( pool, node );
+      }
+   }
+
+   return NULL;
+} /* threadpool_worker_proc */
+
+/**
+ * Wakes up a worker if it is sleeping.
+ */
+static
+void threadpool_wake_worker( threadpool_worker *w )
+{
+   if( atomic_read(&w->sleeping) )
+   {
+      pthread_mutex_lock( &w->mutex );
+      pthread_cond_signal( &w->cond );
+      pthread_mutex_unlock( &w->mutex );
+   }
+} /* threadpool_wake_worker */
+
+threadpool *threadpool_create( int num_workers, int queue_depth )
+{
+   threadpool *pool;
+   int i;
+
+   if( (num_workers <= 0) || (queue_depth <= 0) )
+   {
+      logger_log( LOG_ERROR, LOG_MSG("invalid thread pool size %d or queue depth %d"), num_workers, queue_depth );
+      return NULL;
+   }
+
+   pool = (threadpool *)calloc( 1, sizeof(threadpool) );
+   if( pool == NULL )
+   {
+      return NULL;
+   }
+   pool->workers = (threadpool_worker *)calloc( num_workers, sizeof(threadpool_worker) );
+   if( pool->workers == NULL )
+   {
+      free( pool );
+      return NULL;
+   }
+   pool->run = 1;
+   pool->queue_depth = queue_depth;
+
+   for( i = 0; i < num_workers; i++ )
+   {
+      threadpool_worker *w = &pool->workers[i];
+
+      mpsc_queue_init( &w->queue );
+      pthread_mutex_init( &w->mutex, NULL );
+      pthread_cond_init( &w->cond, NULL );
+      w->pool = pool;
+
+      if( pthread_create(&w->thread, NULL, threadpool_worker_proc, w) != 0 )
+      {
+         logger_log( LOG_ERROR, LOG_MSG("could not start worker thread %d"), i );
+         pthread_cond_destroy( &w->cond );
+         pthread_mutex_destroy( &w->mutex );
+         break;
+      }
+      pool->num_workers++;
+   }
+
+   if( pool->num_workers == 0 )
+   {
+      threadpool_destroy( pool );
+      return NULL;
+   }
+
+   logger_log( LOG_INFO, LOG_MSG("thread pool started with %d workers, queue depth is %d"), pool->num_workers, queue_depth );
+
+   return pool;
+} /* threadpool_create */
+
+int threadpool_submit( threadpool *pool, threadpool_job *job, threadpool_job_fn fn, void *arg )
+{
+   threadpool_worker *w;
+   long start;
+   int i;
+
+   if( atomic_inc(&pool->pending) > pool->queue_depth )
+   {
+      atomic_dec( &pool->pending );
+      return THREADPOOL_QUEUE_FULL;
+   }
+
+   job->fn = fn;
+   job->arg = arg;
+
+   /* Prefer a sleeping worker, or just go round robin. */
+   start = atomic_inc( &pool->next_worker );
+   w = &pool->workers[(unsigned long)start % pool->num_workers];
+   for( i = 0; i < pool->num_workers; i++ )
+   {
+      threadpool_worker *candidate = &pool->workers[(unsigned long)(start+i) % pool->num_workers];
+      if( candidate->sleeping )
+      {
+         w = candidate;
+         break;
+      }
+   }
+
+   mpsc_queue_push( &w->queue, &job->node );
+   threadpool_wake_worker( w );
+
+   return THREADPOOL_SUCCESS;
+} /* threadpool_submit */
+
+void threadpool_destroy( threadpool *pool )
+{
+   int i;
+
+   if( pool == NULL ) return;
+
+   atomic_xchg( &pool->run, 0 );
+   for( i = 0; i < pool->num_workers; i++ )
+   {
+      threadpool_worker *w = &pool->workers[i];
+
+      pthread_mutex_lock( &w->mutex );
+      pthread_cond_signal( &w->cond );
+      pthread_mutex_unlock( &w->mutex );
+   }
+
+   for( i = 0; i < pool->num_workers; i++ )
+   {
+      threadpool_worker *w = &pool->workers[i];
+
+      pthread_join( w->thread, NULL );
+      pthread_cond_destroy( &w->cond );
+      pthread_mutex_destroy( &w->mutex );
+   }
+
+   free( pool->workers );
+   free( pool );
+} /* threadpool_destroy */
@@ -58,33 +58,6 @@ unsigned int xml_num_children( xmlNode *root_node )
 } /* xml_num_children */
 
 
-xmlNode *xml_get_soap_body( char *soap_action )
-{
-   xmlDoc *doc;
-   xmlNode *root_node, 
-           *body_node;
-
-   doc = xmlReadMemory( soap_action, strlen(soap_action), "", NULL, 0 );
-   if( doc == NULL )
-   {
-      return NULL;
-   }
-
-   root_node = xmlDocGetRootElement( doc );
-   if( root_node == NULL )
-   {
-      return NULL;
-   }
-
-   /* Get the Body node. */
-   body_node = xml_first_node_by_name( root_node, "Body" );
-   if( body_node == NULL )
-   {
-      return NULL;
-   }
-
-   return body_node;
-} /* cds_get_soap_body */
 
 
 
@@ -46,6 +46,7 @@
 #include "config.h"
 
 #include "cds.h"
+#include "indexer.h"
 #include "cms.h"
 
 #include "yada.h"
@@ -285,11 +286,21 @@ int yada_init( char *config_file )
       return DLNA_INIT_ERROR;
    }
 
+   /* 
+    * Start the time indexer first, so that items added
+    * by the Content Directory get queued right away.
+    */
+   if( indexer_start( config_get_metadata_path() ) != INDEXER_SUCCESS )
+   {
+      return DLNA_INIT_ERROR;
+   }
+
    /* Initialize the Content Directory "Server" */
    if( cds_init() != CDS_SUCCESS )
    {
       return DLNA_INIT_ERROR;
    }
+   cds_set_search_min_length( config_get_search_min_length() );
 
    yada_create_SCPD();
    //cms_create_SCPD();
@@ -305,6 +316,8 @@ int yada_init( char *config_file )
    httpd_param.ip_address = config_get_ip_address();
    httpd_param.port = config_get_port();
    httpd_param.doc_root = config_get_doc_root_path();
+   httpd_param.num_workers = config_get_workers();
+   httpd_param.queue_depth = config_get_queue_depth();
    httpd_server_start( &httpd_param );
 
    /*
@@ -349,5 +362,6 @@ void yada_shutdown()
    config_unload();
    upnp_shutdown();
    httpd_server_stop();
+   indexer_stop();
    yada_socket_cleanup();
 } /* yada_shutdown */